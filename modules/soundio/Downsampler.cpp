@@ -2,12 +2,26 @@
 //
 //  Downsampler implementation
 //
-//  Copyright (c) 2005-2022 Erik Persson
+//  Copyright (c) 2005-2023 Erik Persson
 //
+//  Both kernels are Hann windowed sincs, 8 output periods on each side.
+//
+//  For a rational factor up/down, the filter is designed at up times the
+//  input rate, and split into up phases. Each output uses the phase which
+//  matches its position between two input samples.
+//
+//  Inner products accumulate in 8 independent sums, so that the compiler
+//  may keep them in SIMD registers without reordering float additions.
 //----------------------------------------------------------------------------
 
 #include "Downsampler.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdint.h>
 #include <tgmath.h>
+#include <algorithm>
+#include <numeric>
 
 //----------------------------------------------------------------------------
 
@@ -22,23 +36,123 @@ static __inline double sinc(double x)
 
 //----------------------------------------------------------------------------
 
-Downsampler::Downsampler(int down_factor)
+// Symmetric inner product around x[0], with center coefficient halved
+static __inline float dot_folded(const float *c, int n, const float *x)
 {
-    m_down_factor= down_factor;
-    m_coeff_cnt= down_factor==1? 1 : 8*down_factor;
-    m_coeffs= new float[m_coeff_cnt];
+    const int LANES = 8;
+    float acc[LANES] = {0};
+    int k = 0;
+    for (; k+LANES <= n; k += LANES)
+        for (int l=0; l<LANES; l++)
+            acc[l] += c[k+l]*(x[k+l] + x[-k-l]);
+
+    float s = 0;
+    for (; k<n; k++)
+        s += c[k]*(x[k] + x[-k]);
+    for (int l=0; l<LANES; l++)
+        s += acc[l];
+    return s;
+}
+
+//----------------------------------------------------------------------------
+
+// Plain inner product
+static __inline float dot(const float *c, int n, const float *x)
+{
+    const int LANES = 8;
+    float acc[LANES] = {0};
+    int k = 0;
+    for (; k+LANES <= n; k += LANES)
+        for (int l=0; l<LANES; l++)
+            acc[l] += c[k+l]*x[k+l];
+
+    float s = 0;
+    for (; k<n; k++)
+        s += c[k]*x[k];
+    for (int l=0; l<LANES; l++)
+        s += acc[l];
+    return s;
+}
+
+//----------------------------------------------------------------------------
 
-    // Hann windowed sinc
-    for (int i= 0; i<m_coeff_cnt; i++)
-        m_coeffs[i]= sinc(((double) i)/down_factor)*(1 + cos(M_PI*i/m_coeff_cnt));
+// Copy cnt samples starting at src[from], with zeros outside of src
+static void fetch_padded(float *dst, const float *src, int srclen, int from, int cnt)
+{
+    for (int i=0; i<cnt; i++)
+        dst[i] = (from+i >= 0 && from+i < srclen) ? src[from+i] : 0;
+}
 
-    // Normalize sum to 1.
-    float s= m_coeffs[0]; // count nonzero indices twice.
-    for (int i= 1; i<m_coeff_cnt; i++)
-        s += 2*m_coeffs[i];
+//----------------------------------------------------------------------------
 
-    for (int i= 0; i<m_coeff_cnt; i++)
-        m_coeffs[i] /= s;
+Downsampler::Downsampler(int down_factor) :
+    Downsampler(1, down_factor)
+{
+}
+
+//----------------------------------------------------------------------------
+
+Downsampler::Downsampler(int up_factor, int down_factor)
+{
+    assert(up_factor>=1 && down_factor>=1);
+    int g = std::gcd(up_factor, down_factor);
+    m_up_factor= up_factor/g;
+    m_down_factor= down_factor/g;
+
+    if (m_up_factor==1)
+    {
+        // Integer factor
+        int d = m_down_factor;
+        m_tap_cnt= d==1? 1 : 8*d;
+        m_extra= m_tap_cnt-1;
+        m_coeffs= new float[m_tap_cnt];
+
+        // Hann windowed sinc
+        for (int i= 0; i<m_tap_cnt; i++)
+            m_coeffs[i]= sinc(((double) i)/d)*(1 + cos(M_PI*i/m_tap_cnt));
+
+        // Normalize sum to 1.
+        float s= m_coeffs[0]; // count nonzero indices twice.
+        for (int i= 1; i<m_tap_cnt; i++)
+            s += 2*m_coeffs[i];
+
+        for (int i= 0; i<m_tap_cnt; i++)
+            m_coeffs[i] /= s;
+
+        // The folded sum counts the center tap twice
+        m_coeffs[0] *= 0.5;
+    }
+    else
+    {
+        // Rational factor, polyphase
+        int up = m_up_factor;
+        int f = std::max(up, m_down_factor);
+        int half_len = 8*f; // kernel half length at up-sampled rate
+        m_tap_cnt= 2*((half_len + up-1)/up);
+        m_extra= m_tap_cnt/2;
+        m_coeffs= new float[up*m_tap_cnt];
+
+        for (int ph= 0; ph<up; ph++)
+        {
+            // Tap t applies to input sample base-m_tap_cnt/2+1+t,
+            // at distance ph+(m_tap_cnt/2-1-t)*up on the up-sampled grid
+            float *c = m_coeffs + ph*m_tap_cnt;
+            float s = 0;
+            for (int t= 0; t<m_tap_cnt; t++)
+            {
+                int dist = ph + (m_tap_cnt/2-1-t)*up;
+                c[t] = dist > -half_len && dist < half_len ?
+                    sinc(((double) dist)/f)*(1 + cos(M_PI*dist/half_len)) : 0;
+                s += c[t];
+            }
+
+            // Normalize each phase to unit gain
+            for (int t= 0; t<m_tap_cnt; t++)
+                c[t] /= s;
+        }
+    }
+
+    Reset();
 }
 
 //----------------------------------------------------------------------------
@@ -50,20 +164,48 @@ Downsampler::~Downsampler()
 
 //----------------------------------------------------------------------------
 
-void Downsampler::Downsample(float *buf, int len, const float *src, int srclen, int srcoffs) const
+void Downsampler::Downsample(float *buf, int len,
+                             const float *src, int srclen, int srcoffs,
+                             int phase) const
 {
-    int j= srcoffs;
-    for (int i= 0; i<len; i++)
+    int n = m_tap_cnt;
+    float win[2*m_extra+1]; // padded window for samples near the edges
+
+    if (m_up_factor==1)
+    {
+        assert(phase==0);
+        int j= srcoffs;
+        for (int i= 0; i<len; i++)
+        {
+            if (j-m_extra >= 0 && j+m_extra < srclen)
+                buf[i]= dot_folded(m_coeffs, n, src+j);
+            else
+            {
+                fetch_padded(win, src, srclen, j-m_extra, 2*m_extra+1);
+                buf[i]= dot_folded(m_coeffs, n, win+m_extra);
+            }
+            j += m_down_factor;
+        }
+    }
+    else
     {
-        float s= m_coeffs[0]*((j>=0 && j<srclen)? src[j]:0);
-        for (int k= 1; k<m_coeff_cnt; k++)
-            s += m_coeffs[k]*
-            ( ((j+k>=0 && j+k<srclen)? src[j+k]:0) +
-              ((j-k>=0 && j-k<srclen)? src[j-k]:0)
-            );
-
-        buf[i]= s;
-        j += m_down_factor;
+        assert(phase>=0 && phase<m_up_factor);
+        int64_t pos= phase;
+        for (int i= 0; i<len; i++)
+        {
+            int ph= pos % m_up_factor;
+            int j= srcoffs + (int) (pos/m_up_factor) - n/2 + 1;
+            const float *c= m_coeffs + ph*n;
+
+            if (j >= 0 && j+n <= srclen)
+                buf[i]= dot(c, n, src+j);
+            else
+            {
+                fetch_padded(win, src, srclen, j, n);
+                buf[i]= dot(c, n, win);
+            }
+            pos += m_down_factor;
+        }
     }
 }
 
@@ -72,5 +214,46 @@ void Downsampler::Downsample(float *buf, int len, const float *src, int srclen,
 // Return the no. of extra samples needed before and after the sample points in src
 int Downsampler::GetExtraSamplesNeeded() const
 {
-    return m_coeff_cnt-1;
+    return m_extra;
+}
+
+//----------------------------------------------------------------------------
+
+// Start over in streaming mode
+void Downsampler::Reset()
+{
+    // Silence before the first sample
+    m_hist.assign(m_extra, 0);
+    m_next_pos = ((int64_t) m_extra)*m_up_factor;
+}
+
+//----------------------------------------------------------------------------
+
+// Streaming mode: add input, produce output for which all input is known
+// Return no. of samples written to buf
+int Downsampler::Process(float *buf, int maxlen, const float *src, int srclen)
+{
+    assert(m_hist.size() + srclen <= INT_MAX);
+    m_hist.insert(m_hist.end(), src, src+srclen);
+    int histlen = (int) m_hist.size();
+
+    // Count outputs that have their full support in the history,
+    // that is, outputs at pos with pos/m_up_factor + m_extra < histlen
+    int cnt = 0;
+    int64_t end_pos = ((int64_t) histlen - m_extra)*m_up_factor;
+    if (m_next_pos < end_pos)
+        cnt = (int) std::min<int64_t>(maxlen, (end_pos - 1 - m_next_pos)/m_down_factor + 1);
+    int64_t pos = m_next_pos + ((int64_t) cnt)*m_down_factor;
+
+    // The history is dropped up to the next output, so it starts within it
+    int64_t offs = m_next_pos/m_up_factor;
+    int phase = (int) (m_next_pos%m_up_factor);
+    assert(offs <= histlen + m_down_factor);
+    Downsample(buf, cnt, m_hist.data(), histlen, (int) offs, phase);
+
+    // Drop input which no future output depends on
+    int drop = std::max(0, std::min((int) (pos/m_up_factor) - m_extra, histlen));
+    m_hist.erase(m_hist.begin(), m_hist.begin()+drop);
+    m_next_pos = pos - ((int64_t) drop)*m_up_factor;
+    return cnt;
 }
@@ -2,28 +2,53 @@
 //
 //  Downsampler -- Anti-aliasing downsampler using windowed-sinc filter
 //
-//  Copyright (c) 2005 Erik Persson
+//  * Integer factors use a symmetric kernel, folded around the center
+//  * Rational factors up/down use a polyphase filter bank
+//  * Block mode on padded input, or streaming mode with kept history
+//
+//  Copyright (c) 2005-2023 Erik Persson
 //
 //----------------------------------------------------------------------------
 
 #ifndef DOWNSAMPLER_H
 #define DOWNSAMPLER_H
 
+#include <stdint.h>
+#include <vector>
+
 class Downsampler
 {
+    int m_up_factor;
     int m_down_factor;
-    int m_coeff_cnt;
-    float *m_coeffs; // coeffs for non-negative offsets
+    int m_tap_cnt;   // integer: taps from center outwards, rational: taps per phase
+    int m_extra;     // extra samples needed on each side
+    float *m_coeffs; // integer: center tap halved, rational: [phase][tap]
+
+    // Streaming state
+    std::vector<float> m_hist; // input history, starting m_extra before next output
+    int64_t m_next_pos = 0;    // next output position in m_hist, times m_up_factor
 
 public:
     Downsampler(int down_factor);
+    Downsampler(int up_factor, int down_factor);
+    Downsampler(const Downsampler&) = delete;
     ~Downsampler();
 
+    // Block mode. Output i is centered on src[srcoffs + (phase + i*down)/up].
+    // Samples outside src count as zero, but src should be padded with
+    // GetExtraSamplesNeeded() samples on each side for best speed.
     void Downsample(float *buf, int len,
-                    const float *src, int srclen, int srcoffs) const;
+                    const float *src, int srclen, int srcoffs,
+                    int phase = 0) const;
 
     // Return the no. of extra samples needed before and after the sample points in src
     int GetExtraSamplesNeeded() const;
+
+    // Streaming mode. Feed consecutive blocks of input, and get the output
+    // produced so far. Output 0 is centered on the first input sample, as
+    // if the stream was preceded by silence.
+    void Reset();
+    int Process(float *buf, int maxlen, const float *src, int srclen);
 };
 
 #endif // DOWNSAMPLER_H
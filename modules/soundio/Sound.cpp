@@ -13,11 +13,14 @@
 #include "SoundWriter.h"
 #include "Downsampler.h"
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <tgmath.h>
 #include <assert.h>
+#include <algorithm>
+#include <numeric>
 #include <utility>
 #include <atomic>
 #include <mutex>
@@ -37,6 +40,16 @@ static void average_channels(short *dst, int dstlen, const short *src, int chann
     }
 }
 
+//----------------------------------------------------------------------------
+
+// Take one of multiple (stereo) channels
+static void pick_channel(short *dst, int dstlen, const short *src, int channels,
+                         int channel)
+{
+    for (int i=0; i<dstlen; i++)
+        dst[i] = src[i*channels+channel];
+}
+
 //----------------------------------------------------------------------------
 // SoundBackend
 //----------------------------------------------------------------------------
@@ -75,12 +88,20 @@ public:
     // Callable from any thread
     virtual int64_t GetLength() const { return m_length; };
 
+    // No. of channels in the file the sound was read from
+    virtual int GetFileChannelCnt() const { return 1; }
+
     // Entry points for reading, callable from any thread
     // Floating point variety
     virtual bool Read(int64_t where, float *buf, int samples) const = 0;
 
     // Truncation to shorts
     virtual bool Read(int64_t where, short *buf, int samples) const;
+
+    // Backends that are a plain window into another sound return it here,
+    // with the offset of sample 0. Reads inside the window are then passed
+    // straight to the source, skipping the chain of layers in between.
+    virtual const Sound *GetViewSource(int64_t * /*offset*/) const { return 0; }
 };
 
 //----------------------------------------------------------------------------
@@ -111,7 +132,7 @@ bool SoundBackend::Read(int64_t where, short *buf, int samples) const
 // FileBackend
 //----------------------------------------------------------------------------
 // * Uses a SoundReader
-// * Converts stereo=>mono
+// * Converts stereo=>mono, or selects one channel
 //   uses a one-second buffer for this
 // * Caches one-second blocks that have been read already
 // * Pads with zeros
@@ -125,19 +146,22 @@ protected:
 
     // Block cache
     int m_block_size = 0;
-    int m_block_cnt = 0;
+    int64_t m_block_cnt = 0;
     std::atomic<short *> *m_blocks = 0;
 
     // Buffer for stereo-to-mono conversion
     short *m_stereo_buf = 0;
+    int m_channel = -1; // selected channel, -1 to average
 
 public:
-    FileBackend(SoundReader&& reader);
+    FileBackend(SoundReader&& reader, int channel = -1);
     FileBackend(const FileBackend&) = delete;
     virtual ~FileBackend();
 
+    int GetFileChannelCnt() const override { return m_reader.GetChannelCnt(); }
+
     // Retrieve a pointer to a cached block of audio
-    short *GetBlock(int block_no) const;
+    short *GetBlock(int64_t block_no) const;
 
     // Read via cache, callable from any thread
     bool ReadFromCache(int64_t where, short *buf, int samples) const;
@@ -149,9 +173,12 @@ public:
 
 //----------------------------------------------------------------------------
 
-FileBackend::FileBackend(SoundReader&& reader) : m_reader( std::move(reader) )
+FileBackend::FileBackend(SoundReader&& reader, int channel) :
+    m_reader( std::move(reader) ),
+    m_channel(channel)
 {
     int channels = m_reader.GetChannelCnt();
+    assert(channel < channels);
 
     m_sample_rate = m_reader.GetSampleRate();
     m_length = m_reader.GetLength()/channels; // since we convert to mono
@@ -161,11 +188,11 @@ FileBackend::FileBackend(SoundReader&& reader) : m_reader( std::move(reader) )
     {
         m_block_size = m_sample_rate; // 1 second blocks
         if (m_block_size>m_length)
-            m_block_size = m_length;
+            m_block_size = (int) m_length;
 
         m_block_cnt = (m_length + m_block_size-1)/m_block_size;
         m_blocks= new std::atomic<short *>[m_block_cnt];
-        for (int i=0; i<m_block_cnt; i++)
+        for (int64_t i=0; i<m_block_cnt; i++)
             m_blocks[i] = 0;
 
         // Stereo-to-mono buffer
@@ -182,7 +209,7 @@ FileBackend::FileBackend(SoundReader&& reader) : m_reader( std::move(reader) )
 FileBackend::~FileBackend()
 {
     // Delete block cache
-    for (int i=0; i<m_block_cnt; i++)
+    for (int64_t i=0; i<m_block_cnt; i++)
         delete[] m_blocks[i];
     delete[] m_blocks;
 
@@ -196,7 +223,7 @@ FileBackend::~FileBackend()
 // Retrieve a pointer to a cached block
 // Read from file, stereo-to-mono, and cache.
 // Callable from any thread.
-short *FileBackend::GetBlock(int block_no) const
+short *FileBackend::GetBlock(int64_t block_no) const
 {
     assert( block_no >= 0 && block_no < m_block_cnt);
 
@@ -215,46 +242,46 @@ short *FileBackend::GetBlock(int block_no) const
         return m_blocks[block_no]; // already in cache
     }
 
-    int64_t length = m_reader.GetLength();
+    int64_t length = GetLength(); // in frames
     int channels= m_reader.GetChannelCnt();
 
     // Attempt to seek
     // Some file formats may not support seeking.
     // In that case we read all the blocks from the beginning.
-    (void) m_reader.SetReadPos( ((int64_t) block_no) * m_block_size * channels  );
+    (void) m_reader.SetReadPos(block_no * m_block_size * channels);
     int64_t at_pos = m_reader.GetReadPos()/channels;
-    int at_block_no = at_pos/m_block_size;
-    assert(((int64_t) at_block_no) * m_block_size == at_pos);
+    int64_t at_block_no = at_pos/m_block_size;
+    assert(at_block_no * m_block_size == at_pos);
 
     while (at_block_no <= block_no)
     {
-        if (m_blocks[at_block_no])
-            continue; // already fetched
-
         // Allocate block buffer
         int size = m_block_size;
         if (size > length - at_pos)
-            size = length - at_pos; // last block is smaller
-        m_blocks[at_block_no] = new short[size];
+            size = (int) (length - at_pos); // last block is smaller
+        short *block = new short[size];
 
-        // Read from file
+        // Read from file. A block that is already cached must still be
+        // read past when the reader can't seek.
         bool ok = false;
         if (channels==1)
             // Mono already, no conversion needed
-            ok = m_reader.Read(m_blocks[at_block_no], size);
+            ok = m_reader.Read(block, size);
         else
         {
             // Read first to stereo buffer, then convert to mono
             ok = m_reader.Read(m_stereo_buf, size*channels);
-            if (ok)
-                average_channels(m_blocks[at_block_no], size, m_stereo_buf, channels);
+            if (ok && m_channel >= 0)
+                pick_channel(block, size, m_stereo_buf, channels, m_channel);
+            else if (ok)
+                average_channels(block, size, m_stereo_buf, channels);
         }
 
-        if (!ok)
-        {
-            delete[] m_blocks[at_block_no];
-            m_blocks[at_block_no] = 0;
-        }
+        // Publish only once filled, as lookups don't take the mutex
+        if (ok && !m_blocks[at_block_no])
+            m_blocks[at_block_no] = block;
+        else
+            delete[] block;
         at_block_no++;
         at_pos += m_block_size;
     }
@@ -276,12 +303,11 @@ bool FileBackend::ReadFromCache(int64_t where, short *buf, int cnt) const
         assert(where >= 0 && where < length);
         assert(where+cnt <= length);
 
-        int block_no= where/m_block_size;
-        int64_t block_start = ((int64_t) block_no)*m_block_size;
+        int64_t block_no= where/m_block_size;
+        int64_t block_start = block_no*m_block_size;
         int64_t block_end = block_start + m_block_size;
 
-        int do_cnt = block_end - where;
-        if (do_cnt>cnt) do_cnt = cnt;
+        int do_cnt = (int) std::min(block_end - where, (int64_t) cnt);
 
         short *block = GetBlock(block_no);
         if (!block)
@@ -369,6 +395,7 @@ public:
     float *GetBuffer();
 
     bool Read(int64_t where, float *buf, int samples) const override;
+    bool Write(int64_t where, const float *buf, int samples);
 };
 
 //----------------------------------------------------------------------------
@@ -431,6 +458,27 @@ bool MemBackend::Read(int64_t where, float *buf, int samples) const
     return true;
 }
 
+//----------------------------------------------------------------------------
+
+// Write in place. Only used while the backend is not shared.
+bool MemBackend::Write(int64_t where, const float *buf, int samples)
+{
+    // Ignore writes outside of the sound
+    if (where < 0)
+    {
+        int skip = (int) std::min((int64_t) samples, -where);
+        where += skip;
+        buf += skip;
+        samples -= skip;
+    }
+    if (where + samples > m_length)
+        samples = (int) std::max((int64_t) 0, m_length - where);
+
+    if (samples > 0)
+        memcpy(m_buf + where, buf, samples*sizeof(float));
+    return true;
+}
+
 //----------------------------------------------------------------------------
 // ClipBackend: Cut out a part of a sound
 // Used to implement Sound::Clip()
@@ -443,9 +491,16 @@ class ClipBackend : public SoundBackend
 
 public:
     ClipBackend(const Sound& sound0, double skip_seconds, double max_seconds);
+    ClipBackend(const Sound& sound0, int64_t offset, int64_t length);
     virtual ~ClipBackend() {};
 
     bool Read(int64_t where, float *buf, int samples) const override;
+
+    const Sound *GetViewSource(int64_t *offset) const override
+    {
+        *offset = m_offset;
+        return &m_sound0;
+    }
 };
 
 //----------------------------------------------------------------------------
@@ -467,6 +522,20 @@ ClipBackend::ClipBackend(const Sound& sound0, double skip_seconds, double max_se
 
 //----------------------------------------------------------------------------
 
+// Window given in samples, which must lie within sound0
+ClipBackend::ClipBackend(const Sound& sound0, int64_t offset, int64_t length) :
+    m_sound0(sound0),
+    m_offset(offset)
+{
+    assert(offset >= 0 && length >= 0);
+    assert(offset + length <= sound0.GetLength());
+
+    m_sample_rate = sound0.GetSampleRate();
+    m_length = length;
+}
+
+//----------------------------------------------------------------------------
+
 // Entry point for reading, callable from any thread
 bool ClipBackend::Read(int64_t where, float *buf, int samples) const
 {
@@ -494,50 +563,188 @@ bool ClipBackend::Read(int64_t where, float *buf, int samples) const
 }
 
 //----------------------------------------------------------------------------
-// DownsampleBackend : used to implement Sound::Downsample
+// ComputedBackend - base for backends that compute their samples
+//----------------------------------------------------------------------------
+// * Subclasses compute a range in one pass over their inputs, in Compute
+// * A sound with one consumer is computed directly into the caller's buffer
+// * When several sounds share the backend, computed blocks are kept in a
+//   small cache, so that each consumer does not compute them again
+// * Compute must give the same sample values for any range split
 //----------------------------------------------------------------------------
 
-class DownsampleBackend : public SoundBackend
+class ComputedBackend : public SoundBackend
+{
+    static const int BLOCK_LEN = 4096; // samples per cached block
+    static const int BLOCK_CNT = 32;   // blocks kept
+
+    struct Block
+    {
+        int64_t block_no = INT64_MIN;
+        uint64_t last_use = 0;
+        float data[BLOCK_LEN];
+    };
+
+    mutable std::mutex m_mutex;
+    mutable Block *m_blocks = 0; // allocated on first shared read
+    mutable uint64_t m_use_cnt = 0;
+
+public:
+    ComputedBackend() {}
+    ComputedBackend(const ComputedBackend&) = delete;
+    virtual ~ComputedBackend() { delete[] m_blocks; }
+
+    bool Read(int64_t where, float *buf, int samples) const override;
+
+protected:
+    // Compute a range, callable from any thread
+    virtual bool Compute(int64_t where, float *buf, int samples) const = 0;
+
+private:
+    bool FindBlock(int64_t block_no, float *data) const;
+    void StoreBlock(int64_t block_no, const float *data) const;
+};
+
+//----------------------------------------------------------------------------
+
+// Entry point for reading, callable from any thread
+bool ComputedBackend::Read(int64_t where, float *buf, int samples) const
+{
+    // Every Sound referring to the backend is a consumer
+    if (GetRefCount() <= 1)
+        return Compute(where, buf, samples);
+
+    float block[BLOCK_LEN];
+    while (samples > 0)
+    {
+        int64_t block_no = where >= 0 ? where/BLOCK_LEN : -((BLOCK_LEN-1-where)/BLOCK_LEN);
+        int offs = (int) (where - block_no*BLOCK_LEN);
+        int cnt = std::min(samples, BLOCK_LEN-offs);
+
+        if (!FindBlock(block_no, block))
+        {
+            // Compute outside the lock, so consumers can work in parallel
+            if (!Compute(block_no*BLOCK_LEN, block, BLOCK_LEN))
+                return false;
+            StoreBlock(block_no, block);
+        }
+        memcpy(buf, block + offs, cnt*sizeof(float));
+
+        where += cnt;
+        buf += cnt;
+        samples -= cnt;
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+// Copy a cached block, false if it is not in the cache
+bool ComputedBackend::FindBlock(int64_t block_no, float *data) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_blocks)
+        return false;
+
+    for (int i=0; i<BLOCK_CNT; i++)
+        if (m_blocks[i].block_no == block_no)
+        {
+            m_blocks[i].last_use = ++m_use_cnt;
+            memcpy(data, m_blocks[i].data, sizeof(m_blocks[i].data));
+            return true;
+        }
+    return false;
+}
+
+//----------------------------------------------------------------------------
+
+// Put a block in the cache, replacing the least recently used one
+void ComputedBackend::StoreBlock(int64_t block_no, const float *data) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_blocks)
+        m_blocks = new Block[BLOCK_CNT];
+
+    int lru = 0;
+    for (int i=0; i<BLOCK_CNT; i++)
+    {
+        if (m_blocks[i].block_no == block_no)
+            return; // another consumer got here first
+        if (m_blocks[i].last_use < m_blocks[lru].last_use)
+            lru = i;
+    }
+    m_blocks[lru].block_no = block_no;
+    m_blocks[lru].last_use = ++m_use_cnt;
+    memcpy(m_blocks[lru].data, data, sizeof(m_blocks[lru].data));
+}
+
+//----------------------------------------------------------------------------
+// DownsampleBackend : used to implement Sound::Downsample and Sound::Resample
+//----------------------------------------------------------------------------
+
+class DownsampleBackend : public ComputedBackend
 {
     Sound m_sound0;
     Downsampler m_downsampler;
+    int m_up_factor;
     int m_down_factor;
 
 public:
-    DownsampleBackend(const Sound& sound0, int down_factor);
+    DownsampleBackend(const Sound& sound0, int up_factor, int down_factor);
     virtual ~DownsampleBackend() {}
 
-    bool Read(int64_t where, float *buf, int samples) const override;
+protected:
+    bool Compute(int64_t where, float *buf, int samples) const override;
 };
 
 //----------------------------------------------------------------------------
 
-DownsampleBackend::DownsampleBackend(const Sound& sound0, int down_factor) :
+DownsampleBackend::DownsampleBackend(const Sound& sound0, int up_factor, int down_factor) :
     m_sound0(sound0),
-    m_downsampler(down_factor)
+    m_downsampler(up_factor, down_factor)
 {
-    assert(down_factor>1);
-    m_down_factor = down_factor;
+    assert(up_factor>=1 && down_factor>up_factor);
 
-    m_sample_rate = sound0.GetSampleRate()/down_factor;
-    m_length = sound0.GetLength()/down_factor;
+    // Same reduced factors as the downsampler, which asserts phase < up
+    int g = std::gcd(up_factor, down_factor);
+    m_up_factor = up_factor/g;
+    m_down_factor = down_factor/g;
+
+    m_sample_rate = ((int64_t) sound0.GetSampleRate())*up_factor/down_factor;
+    m_length = sound0.GetLength()*up_factor/down_factor;
 }
 
 //----------------------------------------------------------------------------
 
-// Entry point for reading, callable from any thread
-bool DownsampleBackend::Read(int64_t where, float *buf, int samples) const
+// Filter and decimate, callable from any thread
+bool DownsampleBackend::Compute(int64_t where, float *buf, int samples) const
 {
+    // Convert in chunks, so buffer can be on stack
+    const int chunk_size = 1024;
     int extra_samples= m_downsampler.GetExtraSamplesNeeded();
-    int highlen= m_down_factor * samples + 2*extra_samples;
-    float highbuf[highlen];
+    int max_highlen= (m_down_factor*chunk_size)/m_up_factor + 1 + 2*extra_samples;
+    float highbuf[max_highlen];
 
-    if (m_sound0.Read(m_down_factor*where + extra_samples, highbuf,highlen))
+    while (samples>0)
     {
-        m_downsampler.Downsample(buf,samples,highbuf,highlen,extra_samples);
-        return true;
+        int cnt = samples<chunk_size ? samples : chunk_size;
+
+        // Output sample i is centered on input position (where+i)*down/up
+        // Split start into a whole input sample and a phase, rounding down
+        int64_t pos = where*m_down_factor;
+        int64_t start = pos>=0 ? pos/m_up_factor : -((m_up_factor-1-pos)/m_up_factor);
+        int phase = (int) (pos - start*m_up_factor);
+        int highlen= (phase + ((int64_t) cnt-1)*m_down_factor)/m_up_factor + 1 + 2*extra_samples;
+        assert(highlen <= max_highlen);
+
+        if (!m_sound0.Read(start - extra_samples, highbuf, highlen))
+            return false;
+        m_downsampler.Downsample(buf,cnt,highbuf,highlen,extra_samples,phase);
+
+        where += cnt;
+        buf += cnt;
+        samples -= cnt;
     }
-    return false;
+    return true;
 }
 
 //----------------------------------------------------------------------------
@@ -546,7 +753,7 @@ bool DownsampleBackend::Read(int64_t where, float *buf, int samples) const
 
 // Sound-file like object that mixes two sounds
 // Deletes the two input sounds on destruction.
-class MixBackend : public SoundBackend
+class MixBackend : public ComputedBackend
 {
     Sound m_sound0;
     Sound m_sound1;
@@ -557,7 +764,8 @@ public:
                double proportion); // 0=only sound0, 1=only sound1
     virtual ~MixBackend() {}
 
-    bool Read(int64_t where, float *buf, int samples) const override;
+protected:
+    bool Compute(int64_t where, float *buf, int samples) const override;
 };
 
 //----------------------------------------------------------------------------
@@ -578,22 +786,254 @@ MixBackend::MixBackend(const Sound& sound0, const Sound& sound1,
 
 //----------------------------------------------------------------------------
 
-// Entry point for reading, callable from any thread
-bool MixBackend::Read(int64_t where, float *buf, int samples) const
+// Mix, callable from any thread
+bool MixBackend::Compute(int64_t where, float *buf, int samples) const
 {
-    float tmp[samples];
     if (!m_sound0.Read(where,buf,samples))
         return 0;
 
-    if (!m_sound1.Read(where,tmp,samples))
-        return 0;
+    // Mix in sound1 one chunk at a time, through a fixed size buffer
+    const int chunk_size = 1024;
+    float tmp[chunk_size];
+    while (samples>0)
+    {
+        int cnt = samples<chunk_size ? samples : chunk_size;
+        if (!m_sound1.Read(where,tmp,cnt))
+            return 0;
 
-    for (int i=0; i<samples; i++)
-        buf[i] += m_k*(tmp[i] - buf[i]);
+        for (int i=0; i<cnt; i++)
+            buf[i] += m_k*(tmp[i] - buf[i]);
 
+        where += cnt;
+        buf += cnt;
+        samples -= cnt;
+    }
     return true;
 }
 
+//----------------------------------------------------------------------------
+// PagedBackend - Writable sound, stored in pages allocated on first write
+//----------------------------------------------------------------------------
+// * Unwritten pages read through to a source sound, or are silent
+// * Pages are reference counted, and shared copy-on-write between copies
+// * Can grow at the end, with a page table that doubles as needed
+// * Used to implement Sound::Write and Sound::Append
+//----------------------------------------------------------------------------
+
+class PagedBackend : public SoundBackend
+{
+    static const int PAGE_LEN = 65536; // samples per page
+
+    struct Page
+    {
+        std::atomic<int> ref_cnt = 1;
+        float data[PAGE_LEN];
+    };
+
+    Sound m_source;     // backs unwritten pages, silence if not IsOk()
+    Page **m_pages = 0; // 0 for unwritten pages
+    int64_t m_page_cnt = 0;
+    int64_t m_page_cap = 0; // allocated size of m_pages
+
+public:
+    PagedBackend(const Sound& source);
+    PagedBackend(int64_t len, int sample_rate);
+    PagedBackend(const PagedBackend& other); // shares the pages
+    virtual ~PagedBackend();
+
+    // Modify a section, must not be called while reading from another thread
+    bool Write(int64_t where, const float *buf, int samples);
+
+    // Extend at the end, same restriction as Write
+    bool Append(const float *buf, int samples);
+
+    bool Read(int64_t where, float *buf, int samples) const override;
+
+private:
+    void AllocPageTable();
+    bool MakePageWritable(int64_t page_no);
+};
+
+//----------------------------------------------------------------------------
+
+PagedBackend::PagedBackend(const Sound& source) :
+    m_source(source)
+{
+    m_sample_rate = source.GetSampleRate();
+    m_length = source.GetLength();
+    AllocPageTable();
+}
+
+//----------------------------------------------------------------------------
+
+PagedBackend::PagedBackend(int64_t len, int sample_rate)
+{
+    assert(len >= 0);
+    assert(sample_rate > 0);
+
+    m_sample_rate = sample_rate;
+    m_length = len;
+    AllocPageTable();
+}
+
+//----------------------------------------------------------------------------
+
+PagedBackend::PagedBackend(const PagedBackend& other) :
+    SoundBackend(),
+    m_source(other.m_source)
+{
+    m_sample_rate = other.m_sample_rate;
+    m_length = other.m_length;
+    AllocPageTable();
+
+    for (int64_t k=0; k<m_page_cnt; k++)
+        if ((m_pages[k] = other.m_pages[k]) != 0)
+            m_pages[k]->ref_cnt++;
+}
+
+//----------------------------------------------------------------------------
+
+PagedBackend::~PagedBackend()
+{
+    for (int64_t k=0; k<m_page_cnt; k++)
+        if (m_pages[k] && !(--m_pages[k]->ref_cnt))
+            delete m_pages[k];
+    delete[] m_pages;
+}
+
+//----------------------------------------------------------------------------
+
+void PagedBackend::AllocPageTable()
+{
+    m_page_cnt = (m_length + PAGE_LEN-1)/PAGE_LEN;
+    m_page_cap = m_page_cnt;
+    m_pages = new Page *[m_page_cap];
+    for (int64_t k=0; k<m_page_cnt; k++)
+        m_pages[k] = 0;
+}
+
+//----------------------------------------------------------------------------
+
+// Give the page an exclusive copy, filled from the source if new
+bool PagedBackend::MakePageWritable(int64_t page_no)
+{
+    Page *page = m_pages[page_no];
+    if (page && page->ref_cnt == 1)
+        return true;
+
+    Page *fresh = new Page;
+    bool ok = true;
+    if (page)
+    {
+        memcpy(fresh->data, page->data, sizeof(fresh->data));
+        if (!(--page->ref_cnt))
+            delete page;
+    }
+    else if (m_source.IsOk())
+        ok = m_source.Read(page_no*PAGE_LEN, fresh->data, PAGE_LEN);
+    else
+        memset(fresh->data, 0, sizeof(fresh->data));
+
+    m_pages[page_no] = fresh;
+    return ok;
+}
+
+//----------------------------------------------------------------------------
+
+bool PagedBackend::Write(int64_t where, const float *buf, int samples)
+{
+    // Ignore writes outside of the sound
+    if (where < 0)
+    {
+        int skip = (int) std::min((int64_t) samples, -where);
+        where += skip;
+        buf += skip;
+        samples -= skip;
+    }
+    if (where + samples > m_length)
+        samples = (int) std::max((int64_t) 0, m_length - where);
+
+    bool ok = true;
+    while (samples > 0)
+    {
+        int64_t page_no = where/PAGE_LEN;
+        int offs = (int) (where - page_no*PAGE_LEN);
+        int cnt = std::min(samples, PAGE_LEN-offs);
+
+        ok &= MakePageWritable(page_no);
+        memcpy(m_pages[page_no]->data + offs, buf, cnt*sizeof(float));
+
+        where += cnt;
+        buf += cnt;
+        samples -= cnt;
+    }
+    return ok;
+}
+
+//----------------------------------------------------------------------------
+
+bool PagedBackend::Append(const float *buf, int samples)
+{
+    assert(samples >= 0);
+    int64_t where = m_length;
+    int64_t page_cnt = (m_length + samples + PAGE_LEN-1)/PAGE_LEN;
+
+    if (page_cnt > m_page_cap)
+    {
+        int64_t cap = std::max(page_cnt, 2*m_page_cap);
+        Page **pages = new Page *[cap];
+        for (int64_t k=0; k<m_page_cnt; k++)
+            pages[k] = m_pages[k];
+        delete[] m_pages;
+        m_pages = pages;
+        m_page_cap = cap;
+    }
+    for (int64_t k=m_page_cnt; k<page_cnt; k++)
+        m_pages[k] = 0;
+    m_page_cnt = page_cnt;
+
+    // Pages past the end of the source are filled with silence
+    m_length += samples;
+    return Write(where, buf, samples);
+}
+
+//----------------------------------------------------------------------------
+
+// Entry point for reading
+// Callable from any thread, except when Write is also used.
+bool PagedBackend::Read(int64_t where, float *buf, int samples) const
+{
+    bool ok = true;
+    while (samples > 0)
+    {
+        int cnt;
+        if (where < 0 || where >= m_length)
+        {
+            // Padding
+            cnt = where < 0 ? (int) std::min((int64_t) samples, -where) : samples;
+            memset(buf, 0, cnt*sizeof(float));
+        }
+        else
+        {
+            int64_t page_no = where/PAGE_LEN;
+            int offs = (int) (where - page_no*PAGE_LEN);
+            cnt = std::min(samples, PAGE_LEN-offs);
+
+            if (m_pages[page_no])
+                memcpy(buf, m_pages[page_no]->data + offs, cnt*sizeof(float));
+            else if (m_source.IsOk())
+                ok &= m_source.Read(where, buf, cnt);
+            else
+                memset(buf, 0, cnt*sizeof(float));
+        }
+
+        where += cnt;
+        buf += cnt;
+        samples -= cnt;
+    }
+    return ok;
+}
+
 //----------------------------------------------------------------------------
 // Sound class
 //----------------------------------------------------------------------------
@@ -631,7 +1071,7 @@ Sound::Sound(const float *buf, int64_t len, int sample_rate)
 // MemBackend constructor, initialized with zeros
 Sound::Sound(int64_t len, int sample_rate)
 {
-    SetBackend( new MemBackend(len, sample_rate) );
+    SetBackend( new PagedBackend(len, sample_rate) );
 }
 
 //----------------------------------------------------------------------------
@@ -718,6 +1158,15 @@ double Sound::GetDuration() const
 
 //----------------------------------------------------------------------------
 
+int Sound::GetFileChannelCnt() const
+{
+    if (!m_backend)
+        return 0;
+    return m_backend->GetFileChannelCnt();
+}
+
+//----------------------------------------------------------------------------
+
 bool Sound::IsOk() const
 {
     return m_backend != 0;
@@ -725,11 +1174,29 @@ bool Sound::IsOk() const
 
 //----------------------------------------------------------------------------
 
+const void *Sound::GetId() const
+{
+    return m_backend;
+}
+
+//----------------------------------------------------------------------------
+
 bool Sound::Read(int64_t where, float *buf, int samples) const
 {
     if (!m_backend)
         return false;
-    return m_backend->Read(where, buf, samples);
+
+    // Collapse nested views, as long as the range is inside each window
+    const SoundBackend *backend = m_backend;
+    int64_t offset;
+    while (const Sound *src = backend->GetViewSource(&offset))
+    {
+        if (where < 0 || where + samples > backend->GetLength())
+            break;
+        where += offset;
+        backend = src->m_backend;
+    }
+    return backend->Read(where, buf, samples);
 }
 
 //----------------------------------------------------------------------------
@@ -745,12 +1212,19 @@ bool Sound::Read(int64_t where, short *buf, int samples) const
 
 // Read from file
 // Only header is read during this call, data reads are deferred
-bool Sound::ReadFromFile(const char *path, bool silent)
+bool Sound::ReadFromFile(const char *path, bool silent, int channel)
 {
     SoundReader reader;
     if (reader.Open(path, silent))
     {
-        SetBackend(new FileBackend( std::move(reader) ));
+        if (channel >= reader.GetChannelCnt())
+        {
+            if (!silent)
+                fprintf(stderr, "%s has no channel %d\n", path, channel);
+            SetBackend(0);
+            return false;
+        }
+        SetBackend(new FileBackend( std::move(reader), channel ));
         return true;
     }
     SetBackend(0);
@@ -784,34 +1258,18 @@ bool Sound::WriteToFile(const char *path) const
 
 //----------------------------------------------------------------------------
 
-// Get a writable pointer to the sound's buffer
-// Convert to MemBackend.
-// Make it an exclusive (non-shared) copy.
-float *Sound::GetBuffer()
+// Copy the whole sound to a caller-owned buffer of GetLength() samples
+// The backend is kept, so a paged, file or computed sound stays that way.
+bool Sound::GetBuffer(float *buf) const
 {
     assert(m_backend);
 
-    MemBackend *ms = dynamic_cast<MemBackend *>(m_backend);
-    if (ms == 0 || m_backend->GetRefCount() != 1)
-    {
-        // Either it wasn't a MemBackend or it wasn't exclusive.
-
-        // Create a new MemBackend, with the same length and samplerate
-        int64_t len = GetLength();
-        int samplerate = GetSampleRate();
-        ms = new MemBackend(len, samplerate);
-
-        // Copy data from old to new oblect
-        float *buffer = ms->GetBuffer();
-        Read(0,buffer,len);
-
-        // Install new reference
-        SetBackend(ms);
-    }
-
-    assert(ms);
-    assert(ms->GetRefCount() == 1);
-    return ms->GetBuffer();
+    const int chunk_len = 1 << 20; // Read takes an int count
+    int64_t len = GetLength();
+    bool ok = true;
+    for (int64_t pos = 0; pos < len; pos += chunk_len)
+        ok &= Read(pos, buf + pos, (int) std::min((int64_t) chunk_len, len - pos));
+    return ok;
 }
 
 //----------------------------------------------------------------------------
@@ -824,7 +1282,21 @@ void Sound::Clip(double skip_seconds, double max_seconds)
     double duration = GetDuration();
     if (skip_seconds > 0 || duration>max_seconds)
     {
-        SetBackend( new ClipBackend(*this, skip_seconds, max_seconds) );
+        ClipBackend *clip = new ClipBackend(*this, skip_seconds, max_seconds);
+
+        // Clip of a clip, make it a single window into the source
+        int64_t inner, outer;
+        if (const Sound *src = m_backend->GetViewSource(&inner))
+        {
+            clip->GetViewSource(&outer);
+            // An empty clip may start anywhere, keep it within the source
+            int64_t len = clip->GetLength();
+            int64_t offset = std::min(inner+outer, src->GetLength());
+            ClipBackend *flat = new ClipBackend(*src, offset, len);
+            delete clip;
+            clip = flat;
+        }
+        SetBackend(clip);
     }
 }
 
@@ -836,7 +1308,20 @@ void Sound::Downsample(int down_factor)
     assert(down_factor >= 1);
     if (down_factor>1)
     {
-        SetBackend( new DownsampleBackend(*this, down_factor) );
+        SetBackend( new DownsampleBackend(*this, 1, down_factor) );
+    }
+}
+
+//----------------------------------------------------------------------------
+
+// Lower the sample rate by a rational factor up/down
+void Sound::Resample(int up_factor, int down_factor)
+{
+    assert(up_factor >= 1 && down_factor >= up_factor);
+    assert(((int64_t) GetSampleRate())*up_factor % down_factor == 0);
+    if (down_factor>up_factor)
+    {
+        SetBackend( new DownsampleBackend(*this, up_factor, down_factor) );
     }
 }
 
@@ -852,26 +1337,45 @@ void Sound::Mix(const Sound& sound1, double proportion) // 0=only sound 0(this)
 
 // Write - Modify a section of the sound
 //
-// This interface permits streaming file operation but the current
-// implementation works will the full sound in memory.
+// Converts to a PagedBackend, so only the pages that are written take
+// memory. The rest reads through to the previous contents. A MemBackend
+// that no other sound shares is written in place.
 //
 bool Sound::Write(int64_t where, const float *buf, int samples)
 {
-    float *dst = GetBuffer(); // convert to in-memory sound
-    int64_t len = GetLength();
+    assert(m_backend);
 
-    // Ignore writes to the left of the sound
-    while (where<0 && samples>0)
-    {
-        where++;
-        samples--;
-    }
+    MemBackend *ms = dynamic_cast<MemBackend *>(m_backend);
+    if (ms && m_backend->GetRefCount() == 1)
+        return ms->Write(where, buf, samples);
 
-    // Ignore writes to the right of the sound
-    while (samples>0 && where+samples>len)
-        samples--;
+    PagedBackend *pb = dynamic_cast<PagedBackend *>(m_backend);
+    if (pb == 0)
+        pb = new PagedBackend(*this);
+    else if (m_backend->GetRefCount() != 1)
+        pb = new PagedBackend(*pb); // share pages until written
+    SetBackend(pb);
 
-    for (int i=0; i<samples; i++)
-        dst[where+i] = buf[i];
-    return true;
+    return pb->Write(where, buf, samples);
+}
+
+//----------------------------------------------------------------------------
+
+// Append - Extend the sound at the end
+//
+// Converts to a PagedBackend like Write. Copies made in between share all
+// pages but the last, which is copied on the next Append.
+//
+bool Sound::Append(const float *buf, int samples)
+{
+    assert(m_backend);
+
+    PagedBackend *pb = dynamic_cast<PagedBackend *>(m_backend);
+    if (pb == 0)
+        pb = new PagedBackend(*this);
+    else if (m_backend->GetRefCount() != 1)
+        pb = new PagedBackend(*pb); // share pages until written
+    SetBackend(pb);
+
+    return pb->Append(buf, samples);
 }
@@ -7,8 +7,9 @@
 //  * Simple interface to audio file read/write.
 //  * Reference counted, using atomic operations
 //  * Thread safe interface
-//  * Copy on write
-//  * Stereo-to-mono conversion
+//  * Copy on write, per page when written with Write
+//  * Stereo-to-mono conversion, or selection of one channel
+//  * Computed sounds cache blocks while shared by several consumers
 //
 //  Copyright (c) 2005-2022 Erik Persson
 //
@@ -50,24 +51,36 @@ public:
     int GetSampleRate() const; // Sample rate in Hz
     double GetDuration() const; // Duration in seconds
 
+    // No. of channels in the file that was read, 1 for other sounds
+    int GetFileChannelCnt() const;
+
     // Check if sound is in a usable state
     // This returns false after default construction, and true after
     // successful ReadFromFile
     bool IsOk() const;
 
+    // Identity of the waveform data, shared by copies until one is written
+    // Usable as a cache key while a copy is kept alive
+    const void *GetId() const;
+
     // Data access
     // Read is callable from any thread, except that Write
     // must not be called simultaneously from a different thread.
+    // Write only allocates memory for the pages it touches, or writes in
+    // place if the sound is an unshared in-memory buffer.
     bool Read(int64_t where, float *buf, int samples) const;
     bool Read(int64_t where, short *buf, int samples) const;
     bool Write(int64_t where, const float *buf, int samples);
+    bool Append(const float *buf, int samples);
 
-    // Direct buffer access. Will convert to a MemSound.
-    float *GetBuffer();
+    // Copy all samples to a caller-owned buffer of GetLength() floats
+    // The sound itself is left as it is.
+    bool GetBuffer(float *buf) const;
 
     // Read from file
     // Only header is read during this call, data reads are deferred
-    bool ReadFromFile(const char *path, bool silent = false);
+    // Channels are averaged to mono, unless one channel is selected
+    bool ReadFromFile(const char *path, bool silent = false, int channel = -1);
 
     // Write to file as .wav
     bool WriteToFile(const char *path) const;
@@ -78,6 +91,10 @@ public:
     // Downsample by an integer factor
     void Downsample(int down_factor);
 
+    // Lower the sample rate by a rational factor, e.g. 147/160 for 48 to 44.1 kHz
+    // The resulting rate must be a whole number of Hz
+    void Resample(int up_factor, int down_factor);
+
     // Mix with outher sound
     void Mix(const Sound& sound1, double proportion); // 0=only sound 0(this) 1= only sound 1
 };
@@ -0,0 +1,74 @@
+//----------------------------------------------------------------------------
+//
+//  SoundMemWriter - Audio sink that collects a Sound in memory
+//
+//  Copyright (c) 2023 Erik Persson
+//
+//----------------------------------------------------------------------------
+
+#include "SoundMemWriter.h"
+
+#include <assert.h>
+#include <algorithm>
+
+//----------------------------------------------------------------------------
+
+bool SoundMemWriter::Open(int sample_rate)
+{
+    assert(sample_rate > 0);
+    m_sound = Sound(0, sample_rate);
+    m_sample_rate = sample_rate;
+    m_write_pos = 0;
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+int64_t SoundMemWriter::GetWritePos() const
+{
+    return m_write_pos;
+}
+
+//----------------------------------------------------------------------------
+
+bool SoundMemWriter::Write(const short *buf, int len)
+{
+    // Convert in chunks, with the scale SoundReader uses
+    const int CHUNK_LEN = 1024;
+    float chunk[CHUNK_LEN];
+    bool ok = true;
+    for (int done=0; done<len; done+=CHUNK_LEN)
+    {
+        int cnt = std::min(CHUNK_LEN, len-done);
+        for (int i=0; i<cnt; i++)
+            chunk[i] = buf[done+i]*(1.0f/32768);
+        ok &= Write(chunk, cnt);
+    }
+    return ok;
+}
+
+//----------------------------------------------------------------------------
+
+bool SoundMemWriter::Write(const float *buf, int len)
+{
+    assert(m_sample_rate); // must be open
+    bool ok = m_sound.Append(buf, len);
+    m_write_pos += len;
+    return ok;
+}
+
+//----------------------------------------------------------------------------
+
+// Check how many seconds of audio has been written
+// This may be called from any thread
+double SoundMemWriter::GetWrittenTime() const
+{
+    return m_sample_rate ? ((double) m_write_pos)/m_sample_rate : 0;
+}
+
+//----------------------------------------------------------------------------
+
+double SoundMemWriter::GetElapsedTime() const
+{
+    return GetWrittenTime(); // mimic a player that has finished
+}
@@ -0,0 +1,58 @@
+//----------------------------------------------------------------------------
+//
+//  SoundMemWriter - Audio sink that collects a Sound in memory
+//
+//  * Provides a SoundSink interface, for encoding without a file
+//  * Grows a paged Sound, so appending never moves written samples
+//  * The result is shared with the writer, not copied
+//  * Keeps float samples as written
+//  * Only supports mono
+//
+//  Copyright (c) 2023 Erik Persson
+//
+//----------------------------------------------------------------------------
+
+#ifndef SOUNDMEMWRITER_H
+#define SOUNDMEMWRITER_H
+
+#include "Sound.h"
+#include "SoundSink.h"
+
+#include <atomic>
+#include <stdint.h>
+
+class SoundMemWriter : public SoundSink
+{
+    Sound m_sound;
+    int m_sample_rate = 0;
+    std::atomic<int64_t> m_write_pos = 0; // for inquiries from other threads
+
+public:
+    SoundMemWriter() {}
+    SoundMemWriter(const SoundMemWriter& other) = delete;
+    SoundMemWriter& operator=(const SoundMemWriter& other) = delete;
+    virtual ~SoundMemWriter() {}
+
+    // Start a new, empty sound. Returns true.
+    bool Open(int sample_rate);
+
+    // SoundSink interface
+    // Methods are documented in SoundSink.h
+    // Writing can't fail, except by running out of memory.
+    int64_t GetWritePos() const override;
+    bool Write(const short *buf, int len) override;
+    bool Write(const float *buf, int len) override;
+    void Flush(double) override {}
+    bool IsPlaying() const override { return false; }
+    double GetWrittenTime() const override;
+    double GetElapsedTime() const override;
+    double GetTimeLeft() const override { return 0; }
+    void Close() override {}
+
+    // What has been written so far
+    // Later writes don't affect the returned sound. Only the last,
+    // partly written page is copied when writing continues.
+    Sound GetSound() const { return m_sound; }
+};
+
+#endif // SOUNDMEMWRITER_H
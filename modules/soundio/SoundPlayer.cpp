@@ -17,6 +17,9 @@
 #include <assert.h>
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 
 //----------------------------------------------------------------------------
 // SoundPlayerBackend
@@ -31,6 +34,7 @@ private:
     Sound m_sound;
     int m_sample_rate_hz = 0;
     int m_samples_per_chunk = 0;
+    int m_low_water = 0;        // refill when FIFO holds less than this
 
     // These are made atomic so Write() and GetTimeLeft()
     // can be used from different treads.
@@ -60,6 +64,19 @@ private:
     bool m_refill_pending = false;
     std::thread *m_refill_thread = 0;
 
+    // Wakeup of the refill thread and blocking writers by the callback
+    std::mutex m_wake_mutex;
+    std::condition_variable m_wake_cond;
+    std::atomic<bool> m_wake = false;
+
+    // Statistics, written by the callback
+    std::atomic<bool> m_expect_more = false; // short FIFO counts as underrun
+    std::atomic<int> m_underruns = 0;
+    std::atomic<int64_t> m_underrun_len = 0;
+    std::atomic<int> m_wakeups = 0;
+    std::atomic<int> m_min_fill = 0;
+    std::atomic<double> m_device_latency = 0;
+
     bool m_stopping = false;
 
 protected:
@@ -75,6 +92,7 @@ protected:
 
     void Refill();
     void RefillThread();
+    void WaitForWake(double t_timeout);
 
 public:
     SoundPlayerBackend() {}
@@ -83,7 +101,7 @@ public:
     virtual ~SoundPlayerBackend();
 
     // Initialization before using Write interface
-    bool Open(int sample_rate_hz);
+    bool Open(int sample_rate_hz, double chunk_time, int chunk_cnt);
 
     // SoundSink interface
     // Methods are commented in SoundSink.h
@@ -97,8 +115,10 @@ public:
     double GetTimeLeft() const override;
     void Close() override;
 
-    bool Play(const Sound& sound);
+    bool Play(const Sound& sound, double chunk_time, int chunk_cnt);
     void Stop();
+
+    PlayerStats GetStats() const;
 };
 
 //----------------------------------------------------------------------------
@@ -262,16 +282,38 @@ int SoundPlayerBackend::OnChunk(
 {
     (void) input_buffer;
     sample_t *output = (sample_t *) output_buffer;
-    (void) time_info;
     (void) status_flags;
 
+    if (time_info)
+        m_device_latency = time_info->outputBufferDacTime - time_info->currentTime;
+
     // Transfer from FIFO to PortAudio's output buffer
+    // Lowest fill while more is coming, the end always drains it
+    int fill = m_fifo.GetReadAvail();
+    if (fill < m_min_fill && m_expect_more)
+        m_min_fill = fill;
     int transfered_len = m_fifo.Read(output, frames_per_buffer);
 
+    // Running dry before the end of the sound is an underrun
+    if (transfered_len < (int) frames_per_buffer && m_expect_more)
+    {
+        m_underruns++;
+        m_underrun_len += frames_per_buffer - transfered_len;
+    }
+
     // Pad out with zeros
     while (transfered_len < (int) frames_per_buffer)
         output[transfered_len++] = 0;
 
+    // Wake the refill thread, or a blocked writer, below the low-water mark.
+    // Not taking the mutex keeps the callback from blocking. A missed
+    // wakeup is caught by the timeout in WaitForWake.
+    if (m_fifo.GetReadAvail() < m_low_water && !m_wake)
+    {
+        m_wake = true;
+        m_wake_cond.notify_one();
+    }
+
     // PortAudio v19.7.0 Linux tends to drop end of audio if we return
     // paComplete. So we always return paContinue here.
     return paContinue;
@@ -279,7 +321,7 @@ int SoundPlayerBackend::OnChunk(
 
 //----------------------------------------------------------------------------
 
-// Populate FIFO with data from m_sound
+// Populate FIFO with data from m_sound, as far as there is room
 void SoundPlayerBackend::Refill()
 {
     if (m_stopping)
@@ -287,26 +329,42 @@ void SoundPlayerBackend::Refill()
     if (!m_refill_pending)
         return;
 
-    m_fifo.Write(m_sound, m_samples_per_chunk);
+    m_fifo.Write(m_sound, m_fifo.GetWriteAvail());
 
     m_refill_pending =
         m_fifo.m_write_cnt < m_sound.GetLength() &&
         !m_stopping;
+    m_expect_more = m_refill_pending;
+}
+
+//----------------------------------------------------------------------------
+
+// Sleep until the callback signals a low FIFO, or the timeout passes
+void SoundPlayerBackend::WaitForWake(double t_timeout)
+{
+    std::unique_lock<std::mutex> lock(m_wake_mutex);
+    m_wake_cond.wait_for(lock, std::chrono::duration<double>(t_timeout),
+                         [this]() { return m_wake || m_stopping; });
+    if (m_wake)
+        m_wakeups++;
+    m_wake = false;
 }
 
 //----------------------------------------------------------------------------
 
 // Background thread to refill FIFO
+// Sleeps until the callback finds the FIFO below the low-water mark.
+// Timeouts only check for a missed wakeup, refilling on every one would
+// keep the FIFO topped up by polling.
 void SoundPlayerBackend::RefillThread()
 {
+    double t_chunk = ((double) m_samples_per_chunk)/m_sample_rate_hz;
     while (m_refill_pending)
     {
-        if (m_fifo.GetWriteAvail() > 0)
-            Refill();
-
-        double t_wait = ((double) m_samples_per_chunk)/m_sample_rate_hz;
-        int ms = (int) floor(t_wait*1e3);
-        Pa_Sleep(ms);
+        Refill();
+        while (m_refill_pending && !m_stopping &&
+               m_fifo.GetReadAvail() >= m_low_water)
+            WaitForWake(t_chunk);
     }
 }
 
@@ -335,14 +393,23 @@ void SoundPlayerBackend::FinishStream()
 //----------------------------------------------------------------------------
 
 // Initialization before using Write interface
-bool SoundPlayerBackend::Open(int sample_rate_hz)
+bool SoundPlayerBackend::Open(int sample_rate_hz, double chunk_time, int chunk_cnt)
 {
+    assert(chunk_cnt >= 2);
     m_sample_rate_hz = sample_rate_hz;
-    m_samples_per_chunk = sample_rate_hz/8; // 125 ms chunks
+    m_samples_per_chunk = (int) floor(0.5 + chunk_time*sample_rate_hz);
+    if (m_samples_per_chunk < 1)
+        m_samples_per_chunk = 1;
+
+    // Set up FIFO, and refill when half of it has played
+    m_fifo.Alloc( chunk_cnt * m_samples_per_chunk );
+    m_low_water = m_fifo.m_size/2;
 
-    // Set up FIFO
-    // 3 seconds of buffer, divided in 24 125 ms chunks
-    m_fifo.Alloc( 24 * m_samples_per_chunk );
+    m_underruns = 0;
+    m_underrun_len = 0;
+    m_wakeups = 0;
+    m_min_fill = m_fifo.m_size;
+    m_device_latency = 0;
 
     // 16 bit fixed point mono output
     return OpenStream(true, paInt16, m_sample_rate_hz, m_samples_per_chunk);
@@ -365,21 +432,23 @@ int64_t SoundPlayerBackend::GetWritePos() const
 bool SoundPlayerBackend::Write(const short *buf, int len)
 {
     assert(len >= 0);
-    assert(m_stream); // stream must be open
+    assert(IsStreamOpen()); // stream must be open
 
+    m_expect_more = true;
     while (len>0)
     {
         int free = m_fifo.GetWriteAvail();
 
         // Start stream once FIFO half full
-        if (free <= m_fifo.GetReadAvail() && Pa_IsStreamActive(m_stream) == 0)
+        if (free <= m_fifo.GetReadAvail() && !IsStreamActive())
             (void) StartStream();
 
-        while (free==0 && Pa_IsStreamActive(m_stream) == 1)
+        // When full, sleep until the callback finds the FIFO below the
+        // low-water mark, like the refill thread
+        if (free==0)
         {
-            // Wait 1/4 chunk time
-            int ms = (int) floor(250.0*m_samples_per_chunk/m_sample_rate_hz);
-            Pa_Sleep(ms);
+            while (IsStreamActive() && m_fifo.GetReadAvail() >= m_low_water)
+                WaitForWake(((double) m_samples_per_chunk)/m_sample_rate_hz);
             free = m_fifo.GetWriteAvail();
         }
 
@@ -418,12 +487,12 @@ void SoundPlayerBackend::Close()
 //----------------------------------------------------------------------------
 
 // Play a sound file
-bool SoundPlayerBackend::Play(const Sound& sound)
+bool SoundPlayerBackend::Play(const Sound& sound, double chunk_time, int chunk_cnt)
 {
     // Stop previous stream
     Stop();
 
-    if (Open(sound.GetSampleRate()))
+    if (Open(sound.GetSampleRate(), chunk_time, chunk_cnt))
     {
         m_sound = sound;
 
@@ -458,6 +527,11 @@ bool SoundPlayerBackend::Play(const Sound& sound)
 void SoundPlayerBackend::Stop()
 {
     m_stopping = true; // Tell thread to exit quickly
+    m_expect_more = false;
+    {
+        std::lock_guard<std::mutex> lock(m_wake_mutex);
+        m_wake_cond.notify_all();
+    }
     FinishStream();    // Disable audio directly
     FinishThread();    // Then wait for the refill thread
     m_stopping = false;
@@ -522,8 +596,12 @@ double SoundPlayerBackend::GetTimeLeft() const
 // Wait until playing has finished, or timeout reached
 void SoundPlayerBackend::Flush(double t_timeout /*=1e9*/)
 {
+    // Nothing more is coming through Write, so running dry is the end
+    if (!m_refill_pending)
+        m_expect_more = false;
+
     // Get stream started if blocking write interface wrote below threshold
-    if (m_stream && Pa_IsStreamActive(m_stream) == 0 && m_fifo.GetReadAvail())
+    if (IsStreamOpen() && !IsStreamActive() && m_fifo.GetReadAvail())
         StartStream();
     if (t_timeout <= 0)
         return; // nonblocking in this case
@@ -556,6 +634,20 @@ void SoundPlayerBackend::Flush(double t_timeout /*=1e9*/)
     m_pending_len = 0;
 }
 
+//----------------------------------------------------------------------------
+
+PlayerStats SoundPlayerBackend::GetStats() const
+{
+    PlayerStats stats;
+    stats.underruns = m_underruns;
+    stats.underrun_time = ((double) m_underrun_len)/m_sample_rate_hz;
+    stats.wakeups = m_wakeups;
+    stats.min_buffered_time = ((double) m_min_fill)/m_sample_rate_hz;
+    stats.buffer_time = ((double) m_fifo.m_size)/m_sample_rate_hz;
+    stats.device_latency = m_device_latency;
+    return stats;
+}
+
 //----------------------------------------------------------------------------
 // SoundPlayer - frontend
 //
@@ -600,7 +692,7 @@ bool SoundPlayer::Open(int sample_rate_hz)
 {
     if (!m_backend)
         m_backend = new SoundPlayerBackend;
-    if (!m_backend->Open(sample_rate_hz))
+    if (!m_backend->Open(sample_rate_hz, m_chunk_time, m_chunk_cnt))
     {
         delete m_backend;
         m_backend = 0;
@@ -657,7 +749,7 @@ bool SoundPlayer::Play(const Sound& sound)
 {
     if (!m_backend)
         m_backend = new SoundPlayerBackend;
-    if (!m_backend->Play(sound))
+    if (!m_backend->Play(sound, m_chunk_time, m_chunk_cnt))
     {
         delete m_backend;
         m_backend = 0;
@@ -741,3 +833,22 @@ void SoundPlayer::Flush(double t_timeout /*=1e9*/)
     if (m_backend)
         m_backend->Flush(t_timeout);
 }
+
+//----------------------------------------------------------------------------
+
+// Set chunk duration and FIFO depth, for the next Open or Play
+void SoundPlayer::SetBuffering(double chunk_time, int chunk_cnt)
+{
+    assert(chunk_time > 0 && chunk_cnt >= 2);
+    m_chunk_time = chunk_time;
+    m_chunk_cnt = chunk_cnt;
+}
+
+//----------------------------------------------------------------------------
+
+// Playback statistics since Open or Play
+// Callable from any thread
+PlayerStats SoundPlayer::GetStats() const
+{
+    return m_backend ? m_backend->GetStats() : PlayerStats();
+}
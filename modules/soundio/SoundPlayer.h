@@ -9,7 +9,9 @@
 //  * Hides the details of the audio I/O library it uses
 //  * Implemented using PortAudio
 //  * Uses a FIFO of data that PortAudio callback can collect
-//  * Uses a thread to read from file in background
+//  * Uses a thread to read from file in background, woken by the callback
+//  * Tunable chunk size and FIFO depth, for low latency
+//  * Reports underruns and buffering
 //  * Supports 16-bit integer and 32-bit float formats
 //  * Only supports mono
 //
@@ -25,10 +27,23 @@
 
 class SoundPlayerBackend;
 
+// Playback statistics
+struct PlayerStats
+{
+    int underruns = 0;              // callbacks that ran dry before the end
+    double underrun_time = 0;       // silence inserted by underruns, seconds
+    int wakeups = 0;                // refills signalled by the callback
+    double min_buffered_time = 0;   // lowest FIFO fill before the end, seconds
+    double buffer_time = 0;         // FIFO capacity, seconds
+    double device_latency = 0;      // callback to DAC, seconds
+};
+
 class SoundPlayer : public SoundSink
 {
 private:
     SoundPlayerBackend *m_backend = 0;
+    double m_chunk_time = 0.125;    // seconds per callback chunk
+    int m_chunk_cnt = 24;           // chunks in FIFO
 
 public:
     SoundPlayer() {};
@@ -38,6 +53,10 @@ public:
     SoundPlayer& operator=(SoundPlayer&& other);
     virtual ~SoundPlayer();
 
+    // Chunk duration and FIFO depth, used by the next Open or Play
+    // The default is 24 chunks of 125 ms. Smaller values give lower latency.
+    void SetBuffering(double chunk_time, int chunk_cnt);
+
     // Initialization before using Write interface
     bool Open(int sample_rate_hz);
 
@@ -64,6 +83,10 @@ public:
 
     // Stop playing and release the device so other programs can play sound
     void ReleaseDevice();
+
+    // Playback statistics since Open or Play
+    // Callable from any thread
+    PlayerStats GetStats() const;
 };
 
 #endif // SOUNDPLAYER_H
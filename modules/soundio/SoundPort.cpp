@@ -3,12 +3,14 @@
 //  SoundPort -- Common base class for player and recorder classes
 //               Wraps PortAudio stream management
 //               Adds thread safe status inquiries
+//               Runs on a VirtualDevice instead, when one is selected
 //
 //  Copyright (c) 2006-2022 Erik Persson
 //
 //----------------------------------------------------------------------------
 
 #include "SoundPort.h"
+#include "VirtualDevice.h"
 #include <portaudio.h>
 #include <stdio.h>
 #include <time.h>
@@ -73,9 +75,23 @@ bool SoundPort::OpenStream(
     double sample_rate_hz,
     int samples_per_chunk)
 {
-    if (m_stream)
+    if (IsStreamOpen())
         return true; // already open
 
+    if (VirtualDevice::IsSelected())
+    {
+        m_virtual = new VirtualDevice(
+            output, sample_format, sample_rate_hz, samples_per_chunk,
+            StreamCallback, this);
+        if (!m_virtual->Open())
+        {
+            delete m_virtual;
+            m_virtual = 0;
+            return false;
+        }
+        return true;
+    }
+
     if (!InitPortaudio())
         return false;
 
@@ -153,6 +169,13 @@ int SoundPort::StreamCallback(
 // This must be callable from different thread than GetElapsedTime()
 bool SoundPort::StartStream()
 {
+    if (m_virtual && !m_stream_started)
+    {
+        if (!m_virtual->Start())
+            return false;
+        m_start_time = GetCurrentTime();
+        m_stream_started = true;
+    }
     if (m_stream && !m_stream_started)
     {
         PaError err = Pa_StartStream( m_stream );
@@ -172,6 +195,11 @@ bool SoundPort::StartStream()
 // This will play all buffers processed in callback
 void SoundPort::StopStream()
 {
+    if (m_virtual)
+    {
+        m_virtual->Stop();
+        m_stream_started = false;
+    }
     if (m_stream)
     {
         // Stop after playing all buffers processed in callback
@@ -187,6 +215,12 @@ void SoundPort::StopStream()
 // Close portaudio stream
 void SoundPort::CloseStream()
 {
+    if (m_virtual)
+    {
+        delete m_virtual; // stops the timer thread
+        m_virtual = 0;
+        m_stream_started = false;
+    }
     if (m_stream)
     {
         PaError err = Pa_CloseStream( m_stream );
@@ -208,6 +242,17 @@ bool SoundPort::IsStreamStarted() const
 
 //----------------------------------------------------------------------------
 
+// Return true while the stream is calling back, like Pa_IsStreamActive
+// A virtual device recording from file stops at the end of the file
+bool SoundPort::IsStreamActive() const
+{
+    if (m_virtual)
+        return m_virtual->IsActive();
+    return m_stream && Pa_IsStreamActive(m_stream) == 1;
+}
+
+//----------------------------------------------------------------------------
+
 // Get the the stream was started
 // This can be called from any thread
 double SoundPort::GetStartTime() const
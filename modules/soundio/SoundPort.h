@@ -3,6 +3,7 @@
 //  SoundPort -- Common base class for player and recorder classes
 //               Wraps PortAudio stream management
 //               Adds thread safe status inquiries
+//               Runs on a VirtualDevice instead, when one is selected
 //
 //  Copyright (c) 2006-2022 Erik Persson
 //
@@ -14,12 +15,15 @@
 #include <portaudio.h>
 #include <atomic>
 
+class VirtualDevice;
+
 class SoundPort
 {
 private:
     bool m_portaudio_initialized = false;
 protected:
     PaStream *m_stream = 0;
+    VirtualDevice *m_virtual = 0; // used instead of m_stream when selected
 
     // These are made atomic so status inquiries can be made from any thread
     std::atomic<double> m_start_time = 0;
@@ -44,6 +48,10 @@ protected:
     bool StartStream();
     void StopStream();
     void CloseStream();
+    bool IsStreamOpen() const { return m_stream || m_virtual; }
+
+    // Check if the stream is running its callback, like Pa_IsStreamActive
+    bool IsStreamActive() const;
 
     // Thread safe status inquiry
 public:
@@ -18,47 +18,9 @@
 #include <ctype.h>
 #include <limits.h>
 #include <sndfile.h>
+#include <algorithm>
 #include <utility>
 
-//----------------------------------------------------------------------------
-// Base class for different format readers
-//----------------------------------------------------------------------------
-
-class SoundReaderBackend
-{
-protected:
-    // Pararmeters set by Open()
-    int m_sample_rate_hz = 0;
-    int m_channel_cnt = 0;
-    int64_t m_length = 0;
-    bool m_seekable = false;
-    int m_block_size = 0; // Preferred block size for reading, in samples
-
-public:
-    SoundReaderBackend() {}
-    SoundReaderBackend(const SoundReaderBackend& other) = delete;
-    virtual ~SoundReaderBackend() {}
-
-    int GetSampleRate() const { return m_sample_rate_hz; }
-    int GetChannelCnt() const { return m_channel_cnt; }
-    int64_t GetLength() const { return m_length; }
-    bool IsSeekable() const { return m_seekable; };
-    int GetBlockSize() const  { return m_block_size; }
-
-    // Attempt to open file for reading.
-    // If silent flag is set, do not print error message,
-    // this is useful when trying multiple formats
-    // Return false if file format is wrong.
-    virtual bool Open(const char *path, bool silent) = 0;
-
-    // This may fail on non-seekable format
-    // It may also fail on I/O error
-    virtual bool SetReadPos(int64_t pos) = 0;
-
-    // Read from current position
-    virtual bool Read(short *buf, int cnt) = 0;
-};
-
 //----------------------------------------------------------------------------
 // SndfileReader
 //----------------------------------------------------------------------------
@@ -444,7 +406,7 @@ bool SoundReader::SetReadPos(int64_t pos)
 //----------------------------------------------------------------------------
 
 // Read block into buffer, return pointer
-short *SoundReader::GetBlock(int block_no)
+short *SoundReader::GetBlock(int64_t block_no)
 {
     assert( block_no >= 0 && block_no < m_block_cnt);
     if (m_block_no == block_no)
@@ -500,12 +462,11 @@ bool SoundReader::Read(short *buf, int cnt)
         assert(m_read_pos >= 0 && m_read_pos < length);
         assert(m_read_pos+cnt <= length);
 
-        int block_no= m_read_pos/block_size;
-        int64_t block_start = ((int64_t) block_no)*block_size;
+        int64_t block_no= m_read_pos/block_size;
+        int64_t block_start = block_no*block_size;
         int64_t block_end = block_start + block_size;
 
-        int do_cnt = block_end - m_read_pos;
-        if (do_cnt>cnt) do_cnt = cnt;
+        int do_cnt = (int) std::min(block_end - m_read_pos, (int64_t) cnt);
 
         short *block = GetBlock(block_no);
         if (!block)
@@ -543,12 +504,11 @@ bool SoundReader::Read(float *buf, int cnt)
         assert(m_read_pos >= 0 && m_read_pos < length);
         assert(m_read_pos+cnt <= length);
 
-        int block_no = m_read_pos/block_size;
-        int64_t block_start = ((int64_t) block_no)*block_size;
+        int64_t block_no = m_read_pos/block_size;
+        int64_t block_start = block_no*block_size;
         int64_t block_end = block_start + block_size;
 
-        int do_cnt = block_end - m_read_pos;
-        if (do_cnt>cnt) do_cnt = cnt;
+        int do_cnt = (int) std::min(block_end - m_read_pos, (int64_t) cnt);
 
         short *block = GetBlock(block_no);
         if (!block)
@@ -589,7 +549,8 @@ bool SoundReader::Open(const char *path, bool silent /*=false*/)
     struct stat st;
     if (stat(path,&st))
     {
-        perror(path);
+        if (!silent)
+            perror(path);
         return false;
     }
 
@@ -619,24 +580,34 @@ bool SoundReader::Open(const char *path, bool silent /*=false*/)
 
     // Call the format-specific Open
     if (backend->Open(path, silent))
-    {
-        m_backend = backend;
+        return Open(backend);
 
-        auto length = m_backend->GetLength();
+    // Print no error message here, that is done in the format-specific Open
+    delete backend;
+    return false;
+}
 
-        m_block_size = m_backend->GetBlockSize();
-        if (m_block_size > length)
-            m_block_size = length;
-        m_block_cnt = (length + m_block_size-1)/m_block_size;
-        if (length)
-            m_block_buf = new short[m_block_size];
-    }
-    else
-    {
-        // Print no error message here, that is done in the format-specific Open
-        delete backend;
-    }
-    return m_backend != 0;
+//----------------------------------------------------------------------------
+
+bool SoundReader::Open(SoundReaderBackend *backend)
+{
+    delete m_backend;
+    delete[] m_block_buf;
+    m_block_buf = 0;
+    m_block_no = -1;
+    m_read_pos = 0;
+
+    m_backend = backend;
+
+    auto length = m_backend->GetLength();
+
+    m_block_size = m_backend->GetBlockSize();
+    if (m_block_size > length)
+        m_block_size = (int) length;
+    m_block_cnt = length ? (length + m_block_size-1)/m_block_size : 0;
+    if (length)
+        m_block_buf = new short[m_block_size];
+    return true;
 }
 
 //----------------------------------------------------------------------------
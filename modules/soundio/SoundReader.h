@@ -6,7 +6,8 @@
 //  * Provides a SoundSource interface - uniting offline and live cases
 //  * Non-copyable, but movable
 //  * Hides the details of audio codec libraries
-//  * Can use libsndfile or libmpg123 internally
+//  * Can use libsndfile or libmpg123 internally, or a SoundReaderBackend
+//    supplied by the caller
 //  * Provides efficient random access
 //  * Block cache (makes sense for compressed audio)
 //  * API is counted in samples, not stereo tuples.
@@ -23,7 +24,48 @@
 #include <stdint.h>
 #include "SoundSource.h"
 
-class SoundReaderBackend;
+//----------------------------------------------------------------------------
+// Base class for different format readers
+//----------------------------------------------------------------------------
+
+class SoundReaderBackend
+{
+protected:
+    // Pararmeters set by Open()
+    int m_sample_rate_hz = 0;
+    int m_channel_cnt = 0;
+    int64_t m_length = 0;
+    bool m_seekable = false;
+    int m_block_size = 0; // Preferred block size for reading, in samples
+
+public:
+    SoundReaderBackend() {}
+    SoundReaderBackend(const SoundReaderBackend& other) = delete;
+    virtual ~SoundReaderBackend() {}
+
+    int GetSampleRate() const { return m_sample_rate_hz; }
+    int GetChannelCnt() const { return m_channel_cnt; }
+    int64_t GetLength() const { return m_length; }
+    bool IsSeekable() const { return m_seekable; };
+    int GetBlockSize() const  { return m_block_size; }
+
+    // Attempt to open file for reading.
+    // If silent flag is set, do not print error message,
+    // this is useful when trying multiple formats
+    // Return false if file format is wrong.
+    virtual bool Open(const char *path, bool silent) = 0;
+
+    // This may fail on non-seekable format
+    // It may also fail on I/O error
+    virtual bool SetReadPos(int64_t pos) = 0;
+
+    // Read from current position
+    virtual bool Read(short *buf, int cnt) = 0;
+};
+
+//----------------------------------------------------------------------------
+// SoundReader
+//----------------------------------------------------------------------------
 
 // Common interface to file format readers
 class SoundReader : public SoundSource
@@ -33,8 +75,8 @@ protected:
 
     // Block buffer
     int m_block_size = 0;   // size of block
-    int m_block_cnt = 0;    // no. of blocks in file
-    int m_block_no = -1;    // no. of current loaded block or -1
+    int64_t m_block_cnt = 0;    // no. of blocks in file
+    int64_t m_block_no = -1;    // no. of current loaded block or -1
     short *m_block_buf = 0; // storage
 
     // Outwards-facing read position
@@ -51,6 +93,9 @@ public:
     // Open file
     bool Open(const char *path, bool silent = false);
 
+    // Take over an opened format reader
+    bool Open(SoundReaderBackend *backend);
+
     // SoundSource interface
     // Methods are documented in SoundSource.h
     int GetSampleRate() const override;
@@ -68,7 +113,7 @@ public:
     void Close() override;
 
 protected:
-    short *GetBlock(int block_no);
+    short *GetBlock(int64_t block_no);
 };
 
 #endif // SOUNDREADER_H
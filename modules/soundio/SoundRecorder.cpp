@@ -26,9 +26,25 @@ class SoundRecorderBackend : public SoundPort
 protected:
     int m_sample_rate_hz = 0;
     int m_samples_per_chunk = 0;
-    int64_t m_length = 0;
+    std::atomic<int64_t> m_length = 0;  // samples put in the FIFO
     int64_t m_read_pos = 0;
 
+    // Statistics, written by OnChunk only
+    std::atomic<int64_t> m_captured = 0;
+    std::atomic<int64_t> m_dropped = 0;
+    std::atomic<int> m_overruns = 0;
+    std::atomic<int> m_device_overflows = 0;
+    std::atomic<int> m_max_fill = 0;
+
+    // Capture time of recent chunks, in a ring indexed by chunk count
+    static const int STAMP_CNT = 64;
+    struct Stamp
+    {
+        std::atomic<int64_t> pos = 0;       // first sample of chunk, as read
+        std::atomic<double> adc_time = 0;   // capture time of that sample
+    } m_stamps[STAMP_CNT];
+    std::atomic<int64_t> m_stamp_cnt = 0;
+
     // FIFO
     struct Fifo
     {
@@ -74,6 +90,8 @@ public:
     bool Read(float *buf, int cnt);
     int GetReadAvail() const;
     int64_t GetReadPos() const { return m_read_pos; }
+    RecorderStats GetStats() const;
+    double GetCaptureTime(int64_t pos) const;
 };
 
 //----------------------------------------------------------------------------
@@ -95,6 +113,12 @@ bool SoundRecorderBackend::Open(int sample_rate_hz, int samples_per_chunk)
 
     m_length = 0;
     m_read_pos = 0;
+    m_captured = 0;
+    m_dropped = 0;
+    m_overruns = 0;
+    m_device_overflows = 0;
+    m_max_fill = 0;
+    m_stamp_cnt = 0;
 
     return OpenStream(false, paFloat32, sample_rate_hz, samples_per_chunk);
 }
@@ -103,7 +127,9 @@ bool SoundRecorderBackend::Open(int sample_rate_hz, int samples_per_chunk)
 
 SoundRecorderBackend::~SoundRecorderBackend()
 {
-    // Base class closes stream and terminates portaudio
+    // Close stream while OnChunk can still be called
+    // Base class terminates portaudio
+    CloseStream();
 }
 
 //----------------------------------------------------------------------------
@@ -226,20 +252,67 @@ int SoundRecorderBackend::OnChunk(
 {
     const sample_t *input = (const sample_t *) input_buffer;
     (void) output_buffer;
-    (void) time_info;
-    (void) status_flags;
+
+    // Stamp the chunk before its samples become readable
+    int64_t k = m_stamp_cnt;
+    m_stamps[k%STAMP_CNT].pos = m_length.load();
+    m_stamps[k%STAMP_CNT].adc_time = time_info ? time_info->inputBufferAdcTime : 0;
+    m_stamp_cnt = k+1;
+
+    if (status_flags & paInputOverflow)
+        m_device_overflows++;
 
     int transfered_len = m_fifo.Write(input, frames_per_buffer);
 
+    // Count losses, reporting is up to the reader
     if (transfered_len < (int) frames_per_buffer)
-        fprintf(stderr, "Overflow in SoundRecorderBackend\n");
+    {
+        m_dropped += frames_per_buffer - transfered_len;
+        m_overruns++;
+    }
+
+    int fill = m_fifo.GetReadAvail();
+    if (fill > m_max_fill)
+        m_max_fill = fill;
 
     m_length += transfered_len;
+    m_captured += frames_per_buffer;
 
     return paContinue;
 }
 
 
+//----------------------------------------------------------------------------
+
+RecorderStats SoundRecorderBackend::GetStats() const
+{
+    RecorderStats stats;
+    stats.captured = m_captured;
+    stats.dropped = m_dropped;
+    stats.overruns = m_overruns;
+    stats.device_overflows = m_device_overflows;
+    stats.max_fill = m_max_fill;
+    stats.fifo_size = m_fifo.m_size;
+    return stats;
+}
+
+//----------------------------------------------------------------------------
+
+// Extrapolate from the latest chunk that starts at or before pos
+double SoundRecorderBackend::GetCaptureTime(int64_t pos) const
+{
+    int64_t cnt = m_stamp_cnt;
+    if (cnt == 0)
+        return 0;
+
+    int64_t k = cnt-1;
+    while (k > 0 && k > cnt-STAMP_CNT && m_stamps[k%STAMP_CNT].pos > pos)
+        k--;
+
+    const Stamp& s = m_stamps[k%STAMP_CNT];
+    return s.adc_time + ((double) (pos - s.pos))/m_sample_rate_hz;
+}
+
 //----------------------------------------------------------------------------
 
 void SoundRecorderBackend::Start()
@@ -258,7 +331,8 @@ void SoundRecorderBackend::Stop()
 
 bool SoundRecorderBackend::IsRunning() const
 {
-    return IsStreamStarted();
+    // A virtual device recording from file stops at the end of the file
+    return IsStreamStarted() && (!m_virtual || IsStreamActive());
 }
 
 //----------------------------------------------------------------------------
@@ -458,6 +532,20 @@ bool SoundRecorder::Read(short *buf, int cnt)
 
 //----------------------------------------------------------------------------
 
+RecorderStats SoundRecorder::GetStats() const
+{
+    return m_backend ? m_backend->GetStats() : RecorderStats();
+}
+
+//----------------------------------------------------------------------------
+
+double SoundRecorder::GetCaptureTime(int64_t pos) const
+{
+    return m_backend ? m_backend->GetCaptureTime(pos) : 0;
+}
+
+//----------------------------------------------------------------------------
+
 void SoundRecorder::Close()
 {
     delete m_backend;
@@ -9,6 +9,7 @@
 //  * Implemented using PortAudio
 //  * Supports 16-bit integer and 32-bit float formats
 //  * Only supports mono
+//  * Counts samples lost to a full FIFO, and stamps chunks with capture time
 //
 //  Copyright (c) 2006-2022 Erik Persson
 //
@@ -22,6 +23,17 @@
 
 class SoundRecorderBackend;
 
+// Capture statistics
+struct RecorderStats
+{
+    int64_t captured = 0;       // samples delivered by the device
+    int64_t dropped = 0;        // samples lost because the FIFO was full
+    int overruns = 0;           // chunks that lost samples
+    int device_overflows = 0;   // input overflows reported by the device
+    int max_fill = 0;           // highest FIFO fill seen, in samples
+    int fifo_size = 0;          // FIFO capacity in samples
+};
+
 class SoundRecorder : public SoundSource
 {
 private:
@@ -54,6 +66,13 @@ public:
     int64_t GetReadPos() const override;
     bool SetReadPos(int64_t) override { return false; } // seeking not supported
     void Close() override;
+
+    // Capture statistics, callable from any thread
+    RecorderStats GetStats() const;
+
+    // Device capture time, in seconds of stream time, of a sample position
+    // Taken from the stamp of a recent chunk. Callable from any thread.
+    double GetCaptureTime(int64_t pos) const;
 };
 
 #endif // SOUNDRECORDER_H
@@ -19,16 +19,23 @@
 bool SoundSink::Write(const float *buf, int len)
 {
     short shortbuf[len];
+    ConvertToShort(shortbuf, buf, len);
+    return Write(shortbuf,len);
+}
+
+//----------------------------------------------------------------------------
+
+void SoundSink::ConvertToShort(short *dst, const float *src, int len)
+{
     for (int i= 0; i<len; i++)
     {
         // Multiply by 32768 and clip to 16-bit range -32768..32767
-        double val= 32768*buf[i];
+        double val= 32768*src[i];
         if (val >= 32767)
-            shortbuf[i]= 32767;
+            dst[i]= 32767;
         else if (val < -32768)
-            shortbuf[i]= -32768;
+            dst[i]= -32768;
         else
-            shortbuf[i]= (short) val;
+            dst[i]= (short) val;
     }
-    return Write(shortbuf,len);
 }
@@ -56,6 +56,9 @@ public:
     virtual void Close() = 0;
 
     virtual ~SoundSink() {}
+
+    // The conversion used by the float version of Write
+    static void ConvertToShort(short *dst, const float *src, int len);
 };
 
 #endif // SOUNDSINK_H
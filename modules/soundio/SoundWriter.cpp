@@ -4,14 +4,24 @@
 //
 //  Copyright (c) 2005 - 2022 Erik Persson
 //
+//  Write() only copies into a FIFO and returns. A writer thread empties
+//  the FIFO in batches of BATCH_LEN samples, so the file sees few large
+//  writes and callers don't wait for the disk, unless the FIFO is full.
 //----------------------------------------------------------------------------
 
 #include "SoundWriter.h"
 #include "SoundSink.h"
 #include <sndfile.h>
+#include <assert.h>
 #include <stdint.h>
 #include <string.h>
+#include <strings.h>
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <utility>
 
 //----------------------------------------------------------------------------
@@ -21,9 +31,50 @@
 class SoundWriterBackend
 {
 protected:
+    static const int BATCH_LEN = 65536;   // samples per write to the file
+    static const int FIFO_BATCHES = 8;    // FIFO size in batches
+
     SF_INFO m_info;
     SNDFILE *m_sf = 0;
-    std::atomic<int64_t> m_write_pos = 0;
+    int m_format = SOUND_FORMAT_PCM16;
+    std::atomic<int64_t> m_write_cnt = 0; // samples passed to Write
+
+    // FIFO, lock free with one writing and one reading thread
+    struct Fifo
+    {
+        float *m_buf = 0;
+        int m_size = 0;
+        std::atomic<int64_t> m_write_cnt = 0;
+        int m_write_index = 0;
+        std::atomic<int64_t> m_read_cnt = 0;
+        int m_read_index = 0;
+
+        virtual ~Fifo();
+        void Alloc(int size);
+        int GetReadAvail() const;
+        int GetWriteAvail() const;
+        int Read(float *buf, int len);
+        int Write(const float *buf, int len);
+
+    } m_fifo;
+
+    // Writer thread. The mutex only guards sleeping and the flags.
+    std::thread *m_thread = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_closing = false;
+    int64_t m_flush_target = 0; // FIFO read count to reach
+    int64_t m_flushed_cnt = 0;  // FIFO read count at last drain
+    int64_t m_sync_target = 0;  // FIFO read count to reach, then sync
+    int64_t m_synced_cnt = 0;   // FIFO read count at last sync
+    std::atomic<bool> m_ok = true;
+
+    // Batch buffers, used by the writer thread
+    float *m_batch = 0;
+    short *m_batch16 = 0;
+
+    void WriterThread();
+    bool WriteBatch(int len);
 
 public:
     SoundWriterBackend() {}
@@ -31,31 +82,142 @@ public:
     SoundWriterBackend& operator=(const SoundWriterBackend& other) = delete;
     virtual ~SoundWriterBackend();
 
-    bool Open(const char *path, int sample_rate);
+    bool Open(const char *path, int sample_rate, int channels, int format);
 
     int GetSampleRate() const;
     int64_t GetWritePos() const;
     bool Write(const short *buf, int len);
+    bool Write(const float *buf, int len);
+    void Flush(double timeout, bool sync);
     double GetWrittenTime() const;
     void Close();
 };
 
 //----------------------------------------------------------------------------
 
+SoundWriterBackend::Fifo::~Fifo()
+{
+    delete[] m_buf;
+}
+
+//----------------------------------------------------------------------------
+
+// Set up FIFO to hold size samples
+void SoundWriterBackend::Fifo::Alloc(int size)
+{
+    m_size = size;
+    delete[] m_buf;
+    m_buf = new float[m_size];
+    m_write_cnt = 0;
+    m_write_index = 0;
+    m_read_cnt = 0;
+    m_read_index = 0;
+}
+
+//----------------------------------------------------------------------------
+
+// Check how many samples are currently buffered
+int SoundWriterBackend::Fifo::GetReadAvail() const
+{
+    return (int) (m_write_cnt - m_read_cnt);
+}
+
+//----------------------------------------------------------------------------
+
+// Check how much space is free
+int SoundWriterBackend::Fifo::GetWriteAvail() const
+{
+    return m_size - GetReadAvail();
+}
+
+//----------------------------------------------------------------------------
+
+// Nonblocking read from buffer
+// Return no. of samples transfered
+int SoundWriterBackend::Fifo::Read(float *buf, int len)
+{
+    int transfered_len = 0;
+    assert(len >= 0);
+    while (1)
+    {
+        int avail = GetReadAvail();
+        int distance_to_wrap = m_size - m_read_index;
+        int amount = len;
+        if (amount > avail)
+            amount = avail;
+        if (amount > distance_to_wrap)
+            amount = distance_to_wrap;
+        if (amount == 0)
+            break;
+
+        memcpy(buf, m_buf + m_read_index, amount*sizeof(float));
+        buf += amount;
+        len -= amount;
+        transfered_len += amount;
+        m_read_cnt += amount;
+        m_read_index += amount;
+        if (m_read_index == m_size)
+            m_read_index = 0;
+    }
+    return transfered_len;
+}
+
+//----------------------------------------------------------------------------
+
+// Nonblocking write to buffer
+// Return no. of samples transfered
+int SoundWriterBackend::Fifo::Write(const float *buf, int len)
+{
+    int transfered_len = 0;
+    assert(len >= 0);
+    while (1)
+    {
+        int avail = GetWriteAvail();
+        int distance_to_wrap = m_size - m_write_index;
+        int amount = len;
+        if (amount > avail)
+            amount = avail;
+        if (amount > distance_to_wrap)
+            amount = distance_to_wrap;
+        if (amount == 0)
+            break;
+
+        memcpy(m_buf + m_write_index, buf, amount*sizeof(float));
+        buf += amount;
+        len -= amount;
+        transfered_len += amount;
+        m_write_cnt += amount;
+        m_write_index += amount;
+        if (m_write_index == m_size)
+            m_write_index = 0;
+    }
+    return transfered_len;
+}
+
+//----------------------------------------------------------------------------
+
 SoundWriterBackend::~SoundWriterBackend()
 {
+    Close();
 }
 
 //----------------------------------------------------------------------------
 
-bool SoundWriterBackend::Open(const char *path, int sample_rate)
+bool SoundWriterBackend::Open(const char *path, int sample_rate, int channels, int format)
 {
     Close();
 
+    // Container from the file name, FLAC only holds integer samples
+    const char *ext = strrchr(path, '.');
+    bool flac = ext && strcasecmp(ext, ".flac") == 0;
+
     memset(&m_info,0,sizeof(m_info));
-    m_info.channels= 1;
+    m_info.channels= channels;
     m_info.samplerate= sample_rate;
-    m_info.format= SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+    m_info.format= flac ? SF_FORMAT_FLAC | SF_FORMAT_PCM_16 :
+                   format == SOUND_FORMAT_FLOAT ? SF_FORMAT_WAV | SF_FORMAT_FLOAT :
+                   SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+    m_format = flac ? SOUND_FORMAT_PCM16 : format;
 
     if (!sf_format_check(&m_info))
         fprintf(stderr,"sf_format_check: Invalid format\n");
@@ -67,11 +229,92 @@ bool SoundWriterBackend::Open(const char *path, int sample_rate)
         return false;
     }
 
+    // Whole frames in each batch, and in the FIFO
+    int batch_len = BATCH_LEN - BATCH_LEN%channels;
+    m_fifo.Alloc(FIFO_BATCHES*batch_len);
+    m_batch = new float[BATCH_LEN];
+    m_batch16 = new short[BATCH_LEN];
+    m_write_cnt = 0;
+    m_closing = false;
+    m_flush_target = 0;
+    m_flushed_cnt = 0;
+    m_sync_target = 0;
+    m_synced_cnt = 0;
+    m_ok = true;
+
+    m_thread = new std::thread([this]() { WriterThread(); });
     return true;
 }
 
 //----------------------------------------------------------------------------
 
+// Write len samples from m_batch to the file
+bool SoundWriterBackend::WriteBatch(int len)
+{
+    sf_count_t cnt;
+    if (m_format == SOUND_FORMAT_FLOAT)
+        cnt = sf_write_float(m_sf, m_batch, len);
+    else
+    {
+        // Same rounding as SoundSink::Write, so shorts pass unchanged
+        SoundSink::ConvertToShort(m_batch16, m_batch, len);
+        cnt = sf_write_short(m_sf, m_batch16, len);
+    }
+    return cnt == len;
+}
+
+//----------------------------------------------------------------------------
+
+void SoundWriterBackend::WriterThread()
+{
+    int channels = m_info.channels;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        m_cond.wait(lock, [this]() {
+            return m_closing || m_flush_target > m_flushed_cnt ||
+                   m_fifo.GetReadAvail() >= BATCH_LEN;
+        });
+        bool drain = m_closing || m_flush_target > m_flushed_cnt;
+        bool sync = m_sync_target > m_synced_cnt;
+        lock.unlock();
+
+        // Write whole batches, or everything when draining
+        for (;;)
+        {
+            int avail = m_fifo.GetReadAvail();
+            if (avail < (drain ? 1 : BATCH_LEN))
+                break;
+            int len = std::min(avail, (int) BATCH_LEN);
+            len -= len%channels;
+            if (len == 0)
+                break;
+
+            m_fifo.Read(m_batch, len);
+            if (!WriteBatch(len))
+                m_ok = false;
+
+            // Wake a Write waiting for room
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_cond.notify_all();
+        }
+        // Only on request, as every sync waits for the disk
+        if (sync)
+            sf_write_sync(m_sf);
+
+        lock.lock();
+        if (drain)
+            m_flushed_cnt = m_fifo.m_read_cnt;
+        if (sync)
+            m_synced_cnt = m_fifo.m_read_cnt;
+        m_cond.notify_all();
+        if (m_closing && m_fifo.GetReadAvail() < channels)
+            break;
+    }
+}
+
+//----------------------------------------------------------------------------
+
 // Return sample rate in Hz
 int SoundWriterBackend::GetSampleRate() const
 {
@@ -80,27 +323,115 @@ int SoundWriterBackend::GetSampleRate() const
 
 //----------------------------------------------------------------------------
 
+// Return position in frames
 int64_t SoundWriterBackend::GetWritePos() const
 {
-    return m_write_pos;
+    return m_write_cnt/m_info.channels;
+}
+
+//----------------------------------------------------------------------------
+
+// Queue samples, waiting only if the FIFO is full
+// Returns false if the file could not be written, now or earlier
+bool SoundWriterBackend::Write(const float *buf, int len)
+{
+    if (!m_thread)
+        return false;
+
+    m_write_cnt += len;
+    while (len > 0)
+    {
+        int cnt = m_fifo.Write(buf, len);
+        buf += cnt;
+        len -= cnt;
+
+        if (len > 0 || m_fifo.GetReadAvail() >= BATCH_LEN)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.notify_all();
+            if (len > 0)
+                m_cond.wait(lock, [this]() {
+                    return m_fifo.GetWriteAvail() > 0 || !m_ok;
+                });
+        }
+        if (!m_ok)
+            return false;
+    }
+    return m_ok;
 }
 
 //----------------------------------------------------------------------------
 
 bool SoundWriterBackend::Write(const short *buf, int len)
 {
-    int cnt2 = sf_write_short(m_sf,(short *) buf,len);
-    m_write_pos += cnt2;
-    return cnt2 == len;
+    // Convert in chunks, so buffer can be on stack
+    const int chunk_size = 1024;
+    float fbuf[chunk_size];
+    while (len > 0)
+    {
+        int cnt = len<chunk_size ? len : chunk_size;
+        for (int i=0; i<cnt; i++)
+            fbuf[i] = buf[i]*(1.0f/32768);
+        if (!Write(fbuf, cnt))
+            return false;
+
+        buf += cnt;
+        len -= cnt;
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+// Write out all queued samples, and sync the file to disk if asked to
+// Waits at most timeout seconds for this
+void SoundWriterBackend::Flush(double timeout, bool sync)
+{
+    if (!m_thread)
+        return;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    int64_t target = m_fifo.m_write_cnt;
+    m_flush_target = std::max(m_flush_target, target);
+    if (sync)
+        m_sync_target = std::max(m_sync_target, target);
+    m_cond.notify_all();
+    m_cond.wait_for(lock, std::chrono::duration<double>(timeout), [&]() {
+        return (sync ? m_synced_cnt : m_flushed_cnt) >= target || !m_ok;
+    });
+}
+
+//----------------------------------------------------------------------------
+
+double SoundWriterBackend::GetWrittenTime() const
+{
+    return ((double) GetWritePos()) / m_info.samplerate;
 }
 
 //----------------------------------------------------------------------------
 
 void SoundWriterBackend::Close()
 {
+    if (m_thread)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closing = true;
+            m_cond.notify_all();
+        }
+        m_thread->join();
+        delete m_thread;
+        m_thread = 0;
+    }
+
     if (m_sf)
         sf_close(m_sf);
     m_sf = 0;
+
+    delete[] m_batch;
+    delete[] m_batch16;
+    m_batch = 0;
+    m_batch16 = 0;
 }
 
 //----------------------------------------------------------------------------
@@ -139,11 +470,11 @@ SoundWriter::~SoundWriter()
 
 //----------------------------------------------------------------------------
 
-bool SoundWriter::Open(const char *path, int sample_rate)
+bool SoundWriter::Open(const char *path, int sample_rate, int channels, int format)
 {
     delete m_backend;
     m_backend = new SoundWriterBackend;
-    if (!m_backend->Open(path, sample_rate))
+    if (!m_backend->Open(path, sample_rate, channels, format))
     {
         delete m_backend;
         m_backend = 0;
@@ -169,15 +500,26 @@ bool SoundWriter::Write(const short *buf, int len)
 
 bool SoundWriter::Write(const float *buf, int len)
 {
-    // Call SoundSink's default float write which converts to shorts
-    return SoundSink::Write(buf, len);
+    return m_backend ? m_backend->Write(buf,len) : false;
+}
+
+//----------------------------------------------------------------------------
+
+// Write out buffered audio to the file. Waits at most timeout seconds.
+void SoundWriter::Flush(double timeout)
+{
+    if (m_backend)
+        m_backend->Flush(timeout, false);
 }
 
 //----------------------------------------------------------------------------
 
-void SoundWriter::Flush(double)
+// Write out buffered audio and sync the file to disk, so it survives a
+// crash or power loss. Waits at most timeout seconds.
+void SoundWriter::Sync(double timeout)
 {
-    // not relevant when writing to file
+    if (m_backend)
+        m_backend->Flush(timeout, true);
 }
 
 //----------------------------------------------------------------------------
@@ -195,7 +537,7 @@ double SoundWriter::GetWrittenTime() const
 {
     if (!m_backend)
         return 0;
-    return ((double) m_backend->GetWritePos()) / m_backend->GetSampleRate();
+    return m_backend->GetWrittenTime();
 }
 
 //----------------------------------------------------------------------------
@@ -220,6 +562,7 @@ double SoundWriter::GetTimeLeft() const
 
 //----------------------------------------------------------------------------
 
+// Write out remaining audio, finish the file and release resources
 void SoundWriter::Close()
 {
     if (m_backend)
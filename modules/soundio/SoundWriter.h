@@ -7,8 +7,9 @@
 //  * Non-copyable, but movable
 //  * Hides the details of audio codec libraries
 //  * Uses libsndfile internally
-//  * Uses .wav format
-//  * Only supports mono
+//  * Mono, or several channels interleaved
+//  * 16-bit or 32-bit float .wav, or 16-bit .flac by file name
+//  * Writes to disk on a background thread, in large batches
 //
 //  Copyright (c) 2005-2022 Erik Persson
 //
@@ -20,6 +21,10 @@
 #include "SoundSink.h"
 #include <stdint.h>
 
+// Sample formats
+#define SOUND_FORMAT_PCM16 (0) // 16-bit integer
+#define SOUND_FORMAT_FLOAT (1) // 32-bit float, .wav only
+
 class SoundWriterBackend;
 
 class SoundWriter : public SoundSink
@@ -36,11 +41,18 @@ public:
     virtual ~SoundWriter();
 
     // Call to open file before using SoundSink interface below.
+    // With several channels, Write takes interleaved samples, and lengths
+    // count samples over all channels. GetWritePos counts frames.
+    // A path ending in .flac gives a FLAC file, always 16-bit.
     // Returns true on success.
-    bool Open(const char *path, int sample_rate);
+    bool Open(const char *path, int sample_rate, int channels = 1,
+              int format = SOUND_FORMAT_PCM16);
 
     // SoundSink interface
     // Methods are documented in SoundSink.h
+    // Write returns as soon as the samples are queued. It returns false
+    // once writing the file has failed. Flush writes out what is queued.
+    // Close finishes the file.
     int64_t GetWritePos() const override;
     bool Write(const short *buf, int len) override;
     bool Write(const float *buf, int len) override;
@@ -50,6 +62,9 @@ public:
     double GetElapsedTime() const override;
     double GetTimeLeft() const override;
     void Close() override;
+
+    // Flush, and sync the file to disk, e.g. for a recording checkpoint
+    void Sync(double timeout = 1e9);
 };
 
 #endif // SOUNDWRITER_H
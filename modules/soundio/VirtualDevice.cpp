@@ -0,0 +1,317 @@
+//----------------------------------------------------------------------------
+//
+//  VirtualDevice - Stand-in for a PortAudio stream
+//
+//  Copyright (c) 2023 Erik Persson
+//
+//  The device holds one chunk while the next is prepared, like a double
+//  buffered sound card. Chunk n is due at start + n*period and must be
+//  done one period later. A callback finishing after that has made the
+//  device play silence, or lose input, for the periods it overran. Those
+//  chunks are skipped, and the next callback gets the underflow or
+//  overflow flag, as PortAudio would report.
+//----------------------------------------------------------------------------
+
+#include "VirtualDevice.h"
+#include "SoundSink.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <random>
+
+//----------------------------------------------------------------------------
+// Selection and totals
+//----------------------------------------------------------------------------
+
+static std::mutex s_mutex;
+static bool s_selected = false;
+static VirtualDeviceConfig s_config;
+static VirtualDeviceStats s_total;
+
+//----------------------------------------------------------------------------
+
+//static
+void VirtualDevice::Select(const VirtualDeviceConfig *config)
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_selected = config != 0;
+    s_config = config ? *config : VirtualDeviceConfig();
+    s_total = VirtualDeviceStats();
+}
+
+//----------------------------------------------------------------------------
+
+//static
+bool VirtualDevice::IsSelected()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    return s_selected;
+}
+
+//----------------------------------------------------------------------------
+
+//static
+VirtualDeviceStats VirtualDevice::GetTotalStats()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    return s_total;
+}
+
+//----------------------------------------------------------------------------
+// Device
+//----------------------------------------------------------------------------
+
+VirtualDevice::VirtualDevice(
+    bool output,
+    PaSampleFormat sample_format,
+    double sample_rate_hz,
+    int samples_per_chunk,
+    PaStreamCallback *callback,
+    void *user_data) :
+    m_output(output),
+    m_sample_format(sample_format),
+    m_sample_rate_hz(sample_rate_hz),
+    m_samples_per_chunk(samples_per_chunk),
+    m_callback(callback),
+    m_user_data(user_data)
+{
+    assert(sample_format == paInt16 || sample_format == paFloat32);
+    assert(samples_per_chunk > 0);
+
+    std::lock_guard<std::mutex> lock(s_mutex);
+    m_config = s_config;
+
+    // Keep our own copies of the paths
+    if (m_config.play_path)
+        m_play_path = m_config.play_path;
+    if (m_config.record_path)
+        m_record_path = m_config.record_path;
+    m_config.play_path = 0;
+    m_config.record_path = 0;
+}
+
+//----------------------------------------------------------------------------
+
+VirtualDevice::~VirtualDevice()
+{
+    Stop();
+    m_play_sink.Close();
+}
+
+//----------------------------------------------------------------------------
+
+bool VirtualDevice::Open()
+{
+    int rate = (int) floor(0.5 + m_sample_rate_hz);
+
+    if (m_output && !m_play_path.empty())
+    {
+        if (!m_play_sink.Open(m_play_path.c_str(), rate))
+        {
+            fprintf(stderr, "Virtual device: Couldn't write %s\n", m_play_path.c_str());
+            return false;
+        }
+        m_play_open = true;
+    }
+
+    if (!m_output && !m_record_path.empty())
+    {
+        if (!m_record_src.ReadFromFile(m_record_path.c_str()))
+            return false; // message printed
+        if (m_record_src.GetSampleRate() != rate)
+            fprintf(stderr, "Virtual device: %s is %d Hz, recording at %d Hz as is\n",
+                m_record_path.c_str(), m_record_src.GetSampleRate(), rate);
+        m_record_pos = 0;
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+bool VirtualDevice::Start()
+{
+    if (m_thread.joinable())
+        return true;
+
+    m_stopping = false;
+    m_active = true;
+    m_thread = std::thread([this]() { Run(); });
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+void VirtualDevice::Stop()
+{
+    if (!m_thread.joinable())
+        return;
+
+    m_stopping = true;
+    m_thread.join();
+    m_active = false;
+
+    // Add to the totals
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_total.chunks += m_stats.chunks;
+    s_total.underruns += m_stats.underruns;
+    s_total.overruns += m_stats.overruns;
+    s_total.skipped_chunks += m_stats.skipped_chunks;
+    if (m_stats.max_callback_time > s_total.max_callback_time)
+        s_total.max_callback_time = m_stats.max_callback_time;
+    if (m_stats.max_lateness > s_total.max_lateness)
+        s_total.max_lateness = m_stats.max_lateness;
+    for (int k=0; k<VirtualDeviceStats::HIST_BINS; k++)
+    {
+        s_total.callback_hist[k] += m_stats.callback_hist[k];
+        s_total.lateness_hist[k] += m_stats.lateness_hist[k];
+    }
+    m_stats = VirtualDeviceStats();
+}
+
+//----------------------------------------------------------------------------
+
+// Histogram bin of a time in seconds
+//static
+int VirtualDevice::GetBin(double t)
+{
+    int bin = 0;
+    for (double us = t*1e6; us >= 1 && bin < VirtualDeviceStats::HIST_BINS-1; us *= 0.5)
+        bin++;
+    return bin;
+}
+
+//----------------------------------------------------------------------------
+
+// Timer thread
+void VirtualDevice::Run()
+{
+    typedef std::chrono::steady_clock Clock;
+    typedef std::chrono::duration<double> Seconds;
+
+    int chunk_len = m_samples_per_chunk;
+    double period = chunk_len/m_sample_rate_hz;
+    int sample_size = m_sample_format == paInt16 ? sizeof(short) : sizeof(float);
+    char *buf = new char[chunk_len*sample_size];
+    float *fbuf = new float[chunk_len];
+
+    std::mt19937 rng(m_config.seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    double stall_prob = m_config.stall_rate*period;
+
+    // Stream times are given in wall clock time, like SoundPort::GetCurrentTime
+    struct timespec tv;
+    clock_gettime(CLOCK_REALTIME, &tv);
+    double wall_start = tv.tv_nsec*1e-9 + tv.tv_sec;
+    Clock::time_point t_start = Clock::now();
+
+    PaStreamCallbackFlags flags = 0;
+    int64_t n = 0;
+    while (!m_stopping)
+    {
+        // Wait for chunk n to be due, plus injected delay
+        double t_due = n*period;
+        double delay = 0;
+        if (m_config.jitter > 0)
+            delay += m_config.jitter*uniform(rng);
+        if (stall_prob > 0 && uniform(rng) < stall_prob)
+            delay += m_config.stall_time;
+        std::this_thread::sleep_until(t_start +
+            std::chrono::duration_cast<Clock::duration>(Seconds(t_due + delay)));
+
+        // Input from file or silence
+        if (!m_output)
+        {
+            if (!m_record_path.empty())
+            {
+                if (m_record_pos >= m_record_src.GetLength())
+                    break; // end of recording
+                m_record_src.Read(m_record_pos, fbuf, chunk_len);
+                m_record_pos += chunk_len;
+            }
+            else
+                memset(fbuf, 0, chunk_len*sizeof(float));
+
+            if (m_sample_format == paInt16)
+                SoundSink::ConvertToShort((short*) buf, fbuf, chunk_len);
+            else
+                memcpy(buf, fbuf, chunk_len*sizeof(float));
+        }
+
+        double t_called = Seconds(Clock::now() - t_start).count();
+        PaStreamCallbackTimeInfo time_info;
+        time_info.currentTime = wall_start + t_called;
+        time_info.inputBufferAdcTime = wall_start + t_due - period;
+        time_info.outputBufferDacTime = wall_start + t_due + period;
+
+        int result = m_callback(
+            m_output ? 0 : buf,
+            m_output ? buf : 0,
+            chunk_len,
+            &time_info,
+            flags,
+            m_user_data);
+
+        double t_done = Seconds(Clock::now() - t_start).count();
+        flags = 0;
+
+        // Statistics
+        double callback_time = t_done - t_called;
+        double lateness = t_called - t_due;
+        m_stats.chunks++;
+        m_stats.callback_hist[GetBin(callback_time)]++;
+        m_stats.lateness_hist[GetBin(lateness)]++;
+        if (callback_time > m_stats.max_callback_time)
+            m_stats.max_callback_time = callback_time;
+        if (lateness > m_stats.max_lateness)
+            m_stats.max_lateness = lateness;
+
+        // Periods missed by finishing after the deadline
+        int64_t missed = t_done > t_due + period ?
+                         (int64_t) floor((t_done - t_due)/period) : 0;
+        if (missed)
+        {
+            if (m_output)
+            {
+                m_stats.underruns++;
+                flags = paOutputUnderflow;
+            }
+            else
+            {
+                m_stats.overruns++;
+                flags = paInputOverflow;
+            }
+            m_stats.skipped_chunks += missed;
+        }
+
+        // Output to file, after the silence played while we were late
+        if (m_output && m_play_open)
+        {
+            short silence[1024] = {};
+            for (int64_t left = missed*chunk_len; left > 0; left -= 1024)
+                m_play_sink.Write(silence, (int) std::min(left, (int64_t) 1024));
+
+            if (m_sample_format == paInt16)
+                m_play_sink.Write((const short*) buf, chunk_len);
+            else
+                m_play_sink.Write((const float*) buf, chunk_len);
+        }
+
+        // Input lost while we were late
+        if (!m_output)
+            m_record_pos += missed*chunk_len;
+
+        n += 1 + missed;
+        if (result != paContinue)
+            break;
+    }
+
+    delete[] buf;
+    delete[] fbuf;
+    m_active = false;
+}
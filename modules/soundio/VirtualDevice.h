@@ -0,0 +1,119 @@
+//----------------------------------------------------------------------------
+//
+//  VirtualDevice - Stand-in for a PortAudio stream
+//
+//  * Selected process-wide, then used by SoundPort instead of PortAudio
+//  * Calls the stream callback from a timer thread, at the stream's rate
+//  * Plays into a .wav file or discards, records from a .wav file or silence
+//  * Injects random jitter and scheduling stalls before callbacks
+//  * Counts underruns and overruns, where a callback misses its deadline
+//  * Keeps histograms of callback times and wakeup lateness
+//
+//  Copyright (c) 2023 Erik Persson
+//
+//----------------------------------------------------------------------------
+
+#ifndef VIRTUALDEVICE_H
+#define VIRTUALDEVICE_H
+
+#include "Sound.h"
+#include "SoundWriter.h"
+
+#include <portaudio.h>
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <thread>
+
+// Virtual device settings
+struct VirtualDeviceConfig
+{
+    const char *play_path = 0;   // .wav file to play into, 0 to discard
+    const char *record_path = 0; // .wav file to record from, 0 for silence
+    double jitter = 0;           // random delay of callbacks, up to seconds
+    double stall_time = 0;       // length of a scheduling stall, seconds
+    double stall_rate = 0;       // stalls per second, on average
+    unsigned seed = 1;           // seed for jitter and stalls
+};
+
+// Virtual device statistics
+// Histogram bin 0 counts times below 1 us, bin k times from 2^(k-1) us
+// up to 2^k us. The last bin also counts everything longer.
+struct VirtualDeviceStats
+{
+    static const int HIST_BINS = 24;
+
+    int64_t chunks = 0;            // callbacks made
+    int underruns = 0;             // output chunks completed too late
+    int overruns = 0;              // input chunks collected too late
+    int64_t skipped_chunks = 0;    // chunks lost to underruns and overruns
+    double max_callback_time = 0;  // seconds
+    double max_lateness = 0;       // seconds from due time to callback
+    int64_t callback_hist[HIST_BINS] = {};
+    int64_t lateness_hist[HIST_BINS] = {};
+};
+
+class VirtualDevice
+{
+    bool m_output;
+    PaSampleFormat m_sample_format;
+    double m_sample_rate_hz;
+    int m_samples_per_chunk;
+    PaStreamCallback *m_callback;
+    void *m_user_data;
+
+    VirtualDeviceConfig m_config;
+    std::string m_play_path;
+    std::string m_record_path;
+
+    Sound m_record_src;           // when recording from file
+    int64_t m_record_pos = 0;
+    SoundWriter m_play_sink;      // when playing into file
+    bool m_play_open = false;
+
+    std::thread m_thread;
+    std::atomic<bool> m_stopping = false;
+    std::atomic<bool> m_active = false;
+
+    VirtualDeviceStats m_stats;   // written by the timer thread
+
+public:
+    VirtualDevice() = delete;
+    VirtualDevice(const VirtualDevice&) = delete;
+
+    // Mono stream, as opened by SoundPort
+    VirtualDevice(
+        bool output,
+        PaSampleFormat sample_format,
+        double sample_rate_hz,
+        int samples_per_chunk,
+        PaStreamCallback *callback,
+        void *user_data);
+    ~VirtualDevice();
+
+    // Open the files of the stream, print a message on failure
+    bool Open();
+
+    // Stream control, similar to Pa_StartStream, Pa_StopStream
+    bool Start();
+    void Stop();
+
+    // True while started and the callback keeps going
+    // For recording from file, false once the file has run out
+    // Callable from any thread
+    bool IsActive() const { return m_active; }
+
+    // Select the virtual device for streams opened from now on,
+    // or PortAudio with config 0. The config is copied.
+    static void Select(const VirtualDeviceConfig *config);
+    static bool IsSelected();
+
+    // Statistics summed over all streams since Select, as of their Stop
+    static VirtualDeviceStats GetTotalStats();
+
+private:
+    void Run();
+    static int GetBin(double t);
+};
+
+#endif // VIRTUALDEVICE_H
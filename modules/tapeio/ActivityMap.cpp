@@ -0,0 +1,294 @@
+//----------------------------------------------------------------------------
+//
+//  ActivityMap - Coarse map of where a tape recording carries signal
+//
+//  Copyright (c) 2021-2023 Erik Persson
+//
+//  A block is considered active when it is clearly above the noise floor
+//  of the recording, and either has energy in the carrier bands or has a
+//  zero crossing rate within the range of the tape formats:
+//
+//      1200 Hz tone (slow '0')        2400 crossings/s
+//      Fast '0' (3 physical bits)     3200 crossings/s
+//      2400 Hz tone (slow/fast '1')   4800 crossings/s
+//
+//  Active blocks are then widened by a margin, and short inactive gaps
+//  are filled in, so only long stretches of dead tape get skipped.
+//----------------------------------------------------------------------------
+
+#include "ActivityMap.h"
+
+#include <soundio/Sound.h>
+
+#include <assert.h>
+#include <tgmath.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+//----------------------------------------------------------------------------
+
+// Goertzel filter state for a single frequency
+struct Goertzel
+{
+    float coeff = 0;
+    float s1 = 0;
+    float s2 = 0;
+
+    Goertzel(double f_hz, int rate)
+    {
+        coeff = 2*cos(2*M_PI*f_hz/rate);
+    }
+
+    // Return power at frequency and reset state
+    float Power()
+    {
+        float p = s1*s1 + s2*s2 - coeff*s1*s2;
+        s1 = s2 = 0;
+        return p;
+    }
+};
+
+//----------------------------------------------------------------------------
+
+ActivityMap::ActivityMap(const Sound& src, const DecoderOptions& options)
+{
+    m_sample_rate = src.GetSampleRate();
+    int64_t full_len = src.GetLength();
+
+    // Scan range
+    int64_t start_pos = 0;
+    int64_t end_pos = full_len;
+    if (options.start >= 0) // start specified?
+        start_pos = (int64_t) floor(0.5 + options.start*m_sample_rate);
+    if (options.end >= 0) // end specified?
+        end_pos = (int64_t) floor(0.5 + options.end*m_sample_rate);
+    if (end_pos > full_len)
+        end_pos = full_len;
+
+    // Blocks of 32 reference periods: about 6.7 ms
+    m_block_len = (int) floor(0.5 + 32.0*m_sample_rate/options.f_ref);
+    m_block_cnt = (int) ((full_len + m_block_len-1)/m_block_len);
+    m_active = new uint8_t[m_block_cnt];
+
+    // Blocks outside of the scan range are left to the decoders
+    memset(m_active, 1, m_block_cnt);
+
+    int block0 = (int) (start_pos/m_block_len);
+    int block1 = (int) ((end_pos + m_block_len-1)/m_block_len);
+    if (block1 <= block0)
+        return;
+    m_scan_block0 = block0;
+    m_scan_block1 = block1;
+
+    int scan_cnt = block1-block0;
+    float *rms = new float[scan_cnt];
+    bool *tonal = new bool[scan_cnt];
+
+    //------------------------------------------------------------------------
+    // Pass 1: Per block statistics
+    //------------------------------------------------------------------------
+
+    // Read many blocks at a time
+    const int CHUNK_BLOCKS = 64;
+    int chunk_len = CHUNK_BLOCKS*m_block_len;
+    float *buf = new float[chunk_len];
+
+    Goertzel g_low(options.f_ref/4.0, m_sample_rate);  // 1200 Hz nominally
+    Goertzel g_high(options.f_ref/2.0, m_sample_rate); // 2400 Hz nominally
+
+    for (int b0 = block0; b0<block1; b0 += CHUNK_BLOCKS)
+    {
+        int b1 = std::min(b0 + CHUNK_BLOCKS, block1);
+        bool ok = src.Read(((int64_t) b0)*m_block_len, buf, (b1-b0)*m_block_len);
+        assert(ok);
+
+        for (int b=b0; b<b1; b++)
+        {
+            const float *x = buf + (b-b0)*m_block_len;
+            int n = m_block_len;
+
+            float sum_x = 0;
+            for (int i=0; i<n; i++)
+                sum_x += x[i];
+            float mean = sum_x/n;
+
+            float e = 0;
+            for (int i=0; i<n; i++)
+            {
+                float y = x[i]-mean;
+                e += y*y;
+
+                float s0 = y + g_low.coeff*g_low.s1 - g_low.s2;
+                g_low.s2 = g_low.s1;
+                g_low.s1 = s0;
+
+                s0 = y + g_high.coeff*g_high.s1 - g_high.s2;
+                g_high.s2 = g_high.s1;
+                g_high.s1 = s0;
+            }
+            float block_rms = sqrt(e/n);
+
+            // Zero crossings, with hysteresis so low level hiss doesn't count
+            float h = .25*block_rms;
+            int crossings = 0;
+            int state = 0;
+            for (int i=0; i<n; i++)
+            {
+                float y = x[i]-mean;
+                int s = y>h ? 1 : y<-h ? -1 : state;
+                crossings += state && s != state;
+                state = s;
+            }
+            double zcr = ((double) crossings)*m_sample_rate/n; // per second
+
+            // Carrier energy relative to total. Close to 1 for a pure tone.
+            float carrier = e>0 ? 2*(g_low.Power() + g_high.Power())/(n*e) : 0;
+
+            rms[b-block0] = block_rms;
+            tonal[b-block0] =
+                carrier > .25 ||
+                (zcr >= .35*options.f_ref && zcr <= 1.4*options.f_ref);
+        }
+    }
+    delete[] buf;
+
+    //------------------------------------------------------------------------
+    // Pass 2: Classify against noise floor
+    //------------------------------------------------------------------------
+
+    // Estimate noise floor and signal level from the distribution of levels
+    std::vector<float> sorted(rms, rms+scan_cnt);
+    std::nth_element(sorted.begin(), sorted.begin() + scan_cnt/10, sorted.end());
+    float floor_rms = sorted[scan_cnt/10];
+    std::nth_element(sorted.begin(), sorted.begin() + scan_cnt*9/10, sorted.end());
+    float peak_rms = sorted[scan_cnt*9/10];
+
+    // Stay well below the signal level, so that a recording which is active
+    // throughout never gets skipped, and never go below -70 dBFS.
+    float thresh = fmax(3e-4f, fmin(2.5f*floor_rms, .25f*peak_rms));
+
+    for (int i=0; i<scan_cnt; i++)
+        tonal[i] = tonal[i] && rms[i] > thresh;
+
+    // Tape signal is continuous, while hum and clicks only qualify in
+    // some blocks. Take a majority vote over 9 blocks, about 60 ms.
+    const int VOTE_RADIUS = 4;
+    uint8_t *raw = new uint8_t[scan_cnt];
+    int votes = 0;
+    for (int i=-VOTE_RADIUS; i<scan_cnt; i++)
+    {
+        if (i+VOTE_RADIUS < scan_cnt)
+            votes += tonal[i+VOTE_RADIUS];
+        if (i-VOTE_RADIUS-1 >= 0)
+            votes -= tonal[i-VOTE_RADIUS-1];
+        if (i >= 0)
+            raw[i] = votes > VOTE_RADIUS;
+    }
+
+    //------------------------------------------------------------------------
+    // Pass 3: Widen active regions and fill in short gaps
+    //------------------------------------------------------------------------
+
+    double block_time = ((double) m_block_len)/m_sample_rate;
+    int margin = (int) ceil(0.25/block_time);   // 0.25 s each side
+    int min_gap = (int) ceil(1.0/block_time);   // only skip 1 s or more
+
+    // Dilate by margin
+    int last_active = -margin-1;
+    for (int i=0; i<scan_cnt; i++)
+    {
+        if (raw[i])
+            last_active = i;
+        m_active[block0+i] = i-last_active <= margin;
+    }
+    last_active = scan_cnt+margin;
+    for (int i=scan_cnt-1; i>=0; i--)
+    {
+        if (raw[i])
+            last_active = i;
+        if (last_active-i <= margin)
+            m_active[block0+i] = 1;
+    }
+
+    // Fill in short gaps
+    int i = 0;
+    while (i<scan_cnt)
+    {
+        int j = i;
+        while (j<scan_cnt && !m_active[block0+j])
+            j++;
+        if (j-i < min_gap)
+            for (int k=i; k<j; k++)
+                m_active[block0+k] = 1;
+        else
+            m_inactive_cnt += j-i;
+        i = j+1;
+    }
+
+    delete[] raw;
+    delete[] rms;
+    delete[] tonal;
+}
+
+//----------------------------------------------------------------------------
+
+ActivityMap::~ActivityMap()
+{
+    delete[] m_active;
+}
+
+//----------------------------------------------------------------------------
+
+double ActivityMap::GetInactiveTime() const
+{
+    return ((double) m_inactive_cnt)*m_block_len/m_sample_rate;
+}
+
+//----------------------------------------------------------------------------
+
+bool ActivityMap::FindRegion(int64_t pos, int64_t *start, int64_t *end) const
+{
+    int64_t b = pos/m_block_len;
+    if (b < m_scan_block0)
+        b = m_scan_block0;
+
+    while (b < m_scan_block1 && !m_active[b])
+        b++;
+    if (b >= m_scan_block1)
+        return false;
+
+    int64_t b1 = b;
+    while (b1 < m_scan_block1 && m_active[b1])
+        b1++;
+
+    *start = b*m_block_len;
+    *end = b1*m_block_len;
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+int ActivityMap::GetSkippableHops(int64_t window_offs, int windowlen, int hopsize,
+                                  int pos_rate) const
+{
+    assert(hopsize > 0);
+
+    // Convert window start to a block index
+    double k = ((double) m_sample_rate)/pos_rate;
+    int64_t b = (int64_t) floor(k*window_offs/m_block_len);
+    if (b < 0)
+        return 0;
+
+    // Find first active block
+    while (b < m_block_cnt && !m_active[b])
+        b++;
+
+    // Location of active audio in caller's coordinates
+    // Beyond end counts as active so we don't step past it
+    int64_t active_pos = (int64_t) floor(((double) b)*m_block_len/k);
+
+    // Advance until the window reaches the active audio
+    int64_t dist = active_pos - (window_offs + windowlen);
+    return dist >= 0 ? (int) (dist/hopsize + 1) : 0;
+}
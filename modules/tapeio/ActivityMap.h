@@ -0,0 +1,51 @@
+//----------------------------------------------------------------------------
+//
+//  ActivityMap - Coarse map of where a tape recording carries signal
+//
+//  * Single pre-scan pass over the source in short blocks
+//  * Block RMS, 1200/2400 Hz carrier energy and zero crossing rate
+//  * Lets decoders skip silence, hiss and motor noise between programs
+//
+//  Copyright (c) 2021-2023 Erik Persson
+//
+//----------------------------------------------------------------------------
+
+#ifndef ACTIVITYMAP_H
+#define ACTIVITYMAP_H
+
+#include "DecoderOptions.h"
+
+#include <stdint.h>
+
+class Sound;
+
+class ActivityMap
+{
+    int m_sample_rate = 0;
+    int m_block_len = 0;        // block length in source samples
+    int m_block_cnt = 0;
+    int m_scan_block0 = 0;      // range of blocks that were scanned
+    int m_scan_block1 = 0;
+    uint8_t *m_active = 0;      // 1 for blocks that need decoding
+    int m_inactive_cnt = 0;     // no. of blocks marked inactive
+
+public:
+    ActivityMap(const Sound& src, const DecoderOptions& options);
+    ActivityMap() = delete;
+    ActivityMap(const ActivityMap&) = delete;
+    virtual ~ActivityMap();
+
+    // Total duration of inactive audio, in seconds
+    double GetInactiveTime() const;
+
+    // Find next stretch of active audio at or after pos, in source samples.
+    // Return false if there is none.
+    bool FindRegion(int64_t pos, int64_t *start, int64_t *end) const;
+
+    // Return no. of hops a decoder window may advance without passing over
+    // any active audio. Positions are in samples at the given rate.
+    int GetSkippableHops(int64_t window_offs, int windowlen, int hopsize,
+                         int pos_rate) const;
+};
+
+#endif
@@ -45,7 +45,7 @@ Balancer::~Balancer()
 
 //----------------------------------------------------------------------------
 
-bool Balancer::Read(int where, float *buf, float *abuf, int len)
+bool Balancer::Read(int64_t where, float *buf, float *abuf, int len)
 {
     // Generate a threshold level
     int mm_margin = m_mm_filterlen>>1;
@@ -97,7 +97,7 @@ bool Balancer::Read(int where, float *buf, float *abuf, int len)
 
 //----------------------------------------------------------------------------
 
-bool Balancer::Read(int where, float *buf, int len)
+bool Balancer::Read(int64_t where, float *buf, int len)
 {
     return Read(where, buf, 0, len);
 }
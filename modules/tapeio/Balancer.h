@@ -31,9 +31,9 @@ public:
 
     // Interface similar to Sound for retreiving the output
     int GetSampleRate() const { return m_src.GetSampleRate(); }
-    int GetLength() const { return m_src.GetLength(); }
-    bool Read(int where, float *buf, int len);
-    bool Read(int where, float *buf, float *abuf, int len); // Version with amplitude
+    int64_t GetLength() const { return m_src.GetLength(); }
+    bool Read(int64_t where, float *buf, int len);
+    bool Read(int64_t where, float *buf, float *abuf, int len); // Version with amplitude
 };
 
 #endif
@@ -0,0 +1,783 @@
+//----------------------------------------------------------------------------
+//
+//  BatchRunner - List, extract or decode many inputs in one run
+//
+//  Copyright (c) 2021-2023 Erik Persson
+//
+//----------------------------------------------------------------------------
+
+#include "BatchRunner.h"
+#include "ActivityMap.h"
+#include "TapeDecoder.h"
+#include "WorkerPool.h"
+#include <soundio/Sound.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <tgmath.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <condition_variable>
+
+const double BATCH_MIN_CUT_GAP = 5;             // silence to cut at, seconds
+const int64_t BATCH_JOB_OVERHEAD = 4<<20;       // bytes per running job
+
+//----------------------------------------------------------------------------
+// MemoryBudget
+//----------------------------------------------------------------------------
+
+// Bytes of memory held by running jobs, bounded by a limit
+class MemoryBudget
+{
+    int64_t m_limit;
+    int64_t m_used = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+
+public:
+    MemoryBudget(int64_t limit) : m_limit(limit) {}
+
+    // Wait until n bytes fit in the budget. When nothing else is held
+    // they are granted anyway, so that a single large job still runs.
+    void Acquire(int64_t n)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [&] { return m_used == 0 || m_used + n <= m_limit; });
+        m_used += n;
+    }
+
+    void Release(int64_t n)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_used -= n;
+        }
+        m_cond.notify_all();
+    }
+};
+
+//----------------------------------------------------------------------------
+// Path helpers
+//----------------------------------------------------------------------------
+
+// Extension of path including the dot, or ""
+static const char *path_extension(const std::string& path)
+{
+    size_t slash = path.rfind('/');
+    size_t dot = path.rfind('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return "";
+    return path.c_str() + dot;
+}
+
+//----------------------------------------------------------------------------
+
+// Directory part of path, "." if none
+static std::string path_directory(const std::string& path)
+{
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos)
+        return ".";
+    return slash ? path.substr(0, slash) : "/";
+}
+
+//----------------------------------------------------------------------------
+
+// File name of path without directory and extension
+static std::string path_stem(const std::string& path)
+{
+    size_t slash = path.rfind('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash+1);
+    size_t dot = name.rfind('.');
+    return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+
+//----------------------------------------------------------------------------
+
+// Unique path dir/stem<suffix>, appending -<n> to the stem if needed
+static std::string unique_path(const std::string& dir, const std::string& stem,
+    const char *suffix, std::unordered_set<std::string> *used_paths)
+{
+    std::string path = dir + "/" + stem + suffix;
+    for (int unique_no = 1; used_paths->find(path) != used_paths->end(); unique_no++)
+        path = dir + "/" + stem + "-" + std::to_string(unique_no) + suffix;
+    used_paths->insert(path);
+    return path;
+}
+
+//----------------------------------------------------------------------------
+
+// Create a directory, or re-use an existing one
+static bool make_directory(const std::string& path)
+{
+    struct stat sbuf;
+    if (stat(path.c_str(), &sbuf) == 0)
+    {
+        errno = ENOTDIR;
+        return S_ISDIR(sbuf.st_mode);
+    }
+    return errno == ENOENT && mkdir(path.c_str(), 0777) == 0;
+}
+
+//----------------------------------------------------------------------------
+
+// Check if a file is a tape archive, by extension or by its leading
+// sync bytes. Return false with errno set if it can't be read.
+static bool is_tap_file(const std::string& path)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+
+    uint8_t sync[3] = { 0, 0, 0 };
+    size_t cnt = fread(sync, 1, sizeof(sync), f);
+    fclose(f);
+
+    errno = 0;
+    return strcasecmp(path_extension(path), ".tap") == 0 ||
+           (cnt == sizeof(sync) && sync[0] == 0x16 && sync[1] == 0x16 && sync[2] == 0x16);
+}
+
+//----------------------------------------------------------------------------
+
+// Escape string for JSON. Bytes above 127 are taken as Latin-1.
+static void print_json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (const uint8_t *p = (const uint8_t *) s; *p; p++)
+    {
+        if (*p == '"' || *p == '\\')
+            fprintf(f, "\\%c", *p);
+        else if (*p < 32 || *p > 126)
+            fprintf(f, "\\u%04x", *p);
+        else
+            fputc(*p, f);
+    }
+    fputc('"', f);
+}
+
+//----------------------------------------------------------------------------
+// BatchRunner
+//----------------------------------------------------------------------------
+
+BatchRunner::BatchRunner(const DecoderOptions& options, const BatchOptions& batch_options) :
+    m_options(options),
+    m_batch_options(batch_options)
+{
+    m_options.verbose = false;
+    m_options.quiet = true;
+    m_options.dump = false;
+
+    // Parallelism comes from running many jobs at once
+    m_options.threads = false;
+}
+
+//----------------------------------------------------------------------------
+
+// Check if a file found in a batch directory is a recording or tape archive
+bool BatchRunner::IsInputName(const std::string& path) const
+{
+    static const char *const extensions[] =
+        { ".wav", ".flac", ".ogg", ".aif", ".aiff", ".mp3", ".tap" };
+
+    const char *ext = path_extension(path);
+    for (const char *e : extensions)
+        if (strcasecmp(ext, e) == 0)
+            return m_batch_options.command != BATCH_DECODE || strcasecmp(e, ".tap") != 0;
+    return false;
+}
+
+//----------------------------------------------------------------------------
+
+// Collect input paths from a directory, or from a manifest file
+// with one path per line. Blank lines and lines starting with # are
+// skipped, and relative paths are taken relative to the manifest.
+bool BatchRunner::CollectPaths(const char *name, std::vector<std::string> *paths) const
+{
+    struct stat sbuf;
+    if (stat(name, &sbuf) != 0)
+    {
+        perror(name);
+        return false;
+    }
+
+    if (S_ISDIR(sbuf.st_mode))
+    {
+        DIR *dir = opendir(name);
+        if (!dir)
+        {
+            perror(name);
+            return false;
+        }
+        std::string prefix = name;
+        if (prefix.back() != '/')
+            prefix += '/';
+        while (struct dirent *entry = readdir(dir))
+        {
+            std::string path = prefix + entry->d_name;
+            if (entry->d_name[0] != '.' && IsInputName(path) &&
+                stat(path.c_str(), &sbuf) == 0 && S_ISREG(sbuf.st_mode))
+            {
+                paths->push_back(path);
+            }
+        }
+        closedir(dir);
+        std::sort(paths->begin(), paths->end());
+        return true;
+    }
+
+    FILE *f = fopen(name, "r");
+    if (!f)
+    {
+        perror(name);
+        return false;
+    }
+    std::string dir = path_directory(name);
+    char line[4096];
+    while (fgets(line, sizeof(line), f))
+    {
+        // Trim whitespace at both ends
+        char *p = line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        int len = strlen(p);
+        while (len && (p[len-1] == '\n' || p[len-1] == '\r' ||
+                       p[len-1] == ' ' || p[len-1] == '\t'))
+            p[--len] = 0;
+
+        if (len && p[0] != '#')
+            paths->push_back(p[0] == '/' ? std::string(p) : dir + "/" + p);
+    }
+    fclose(f);
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+// Look at an input, and name its output
+void BatchRunner::AddInput(const std::string& path)
+{
+    m_inputs.emplace_back();
+    BatchInput *in = &m_inputs.back();
+    in->path = path;
+    int command = m_batch_options.command;
+
+    Sound src;
+    if (src.ReadFromFile(path.c_str(), true /*silent*/))
+    {
+        in->sample_rate = src.GetSampleRate();
+        in->channel_cnt = src.GetFileChannelCnt();
+        in->duration = ((double) src.GetLength())/in->sample_rate;
+    }
+    else if (is_tap_file(path))
+    {
+        // Duration of the archive in fast format
+        struct stat sbuf;
+        in->duration = stat(path.c_str(), &sbuf) == 0 ? sbuf.st_size*32.0/m_options.f_ref : 0;
+        in->tap = true;
+    }
+    else
+    {
+        in->failed = true;
+        in->message = errno ? std::string("Couldn't read file: ") + strerror(errno) :
+                              "Not a recording or tape archive";
+    }
+
+    if (in->tap && command == BATCH_DECODE)
+    {
+        in->failed = true;
+        in->message = "Not an audio file";
+    }
+
+    if (in->failed)
+    {
+        fprintf(stderr, "%s: %s\n", path.c_str(), in->message.c_str());
+        return;
+    }
+
+    const char *output_dir = m_batch_options.output_dir;
+    std::string dir = output_dir ? std::string(output_dir) : path_directory(path);
+    if (command == BATCH_DECODE)
+        in->output = unique_path(dir, path_stem(path), ".tap", &m_used_paths);
+    else if (command == BATCH_EXTRACT)
+        in->output = unique_path(output_dir ? dir : ".", path_stem(path), "", &m_used_paths);
+}
+
+//----------------------------------------------------------------------------
+
+// Estimated peak memory use of decoding part of an input, in bytes
+int64_t BatchRunner::GetMemory(const BatchInput& in, double seconds) const
+{
+    if (in.tap)
+        return BATCH_JOB_OVERHEAD;
+
+    // Block cache of the recording, plus decoder state. Decimation
+    // renders the decimated waveform as floats.
+    int64_t samples = (int64_t) ceil(seconds*in.sample_rate);
+    int64_t bytes = 3*samples;
+    int down_factor = in.sample_rate/44100;
+    if (m_options.decimate && down_factor > 1)
+        bytes += 4*samples/down_factor;
+
+    // Split channels are decoded side by side
+    if (m_options.split_channels)
+        bytes *= in.channel_cnt;
+
+    return bytes + BATCH_JOB_OVERHEAD;
+}
+
+//----------------------------------------------------------------------------
+
+// Assemble the pieces of an input, write its output and print a summary.
+// Called by the job that finishes the last piece.
+void BatchRunner::FinishInput(BatchInput *in)
+{
+    int command = m_batch_options.command;
+    for (const auto& piece : in->pieces)
+    {
+        if (piece.failed)
+        {
+            in->failed = true;
+            in->message = "Couldn't read file";
+        }
+    }
+
+    // Name the files the way --list and --extract do
+    std::unordered_set<std::string> used_names;
+    std::vector<const TapeFile*> files;
+    for (const auto& piece : in->pieces)
+        for (const auto& file : piece.files)
+            files.push_back(&file);
+
+    for (const TapeFile *file : files)
+    {
+        char adjusted_name[34+4];
+        adjust_file_name(adjusted_name, sizeof(adjusted_name), &used_names,
+                         *file, command == BATCH_EXTRACT);
+
+        BatchEntry entry;
+        entry.name = adjusted_name;
+        entry.start_time = file->start_time;
+        entry.end_time = file->end_time;
+        entry.len = file->len;
+        entry.basic = file->basic;
+        entry.autorun = file->autorun;
+        entry.slow = file->slow;
+        entry.sync_errors = file->sync_errors;
+        entry.parity_errors = file->parity_errors;
+        in->entries.push_back(entry);
+        in->sync_errors += file->sync_errors;
+        in->parity_errors += file->parity_errors;
+    }
+
+    if (command == BATCH_EXTRACT && !in->failed)
+    {
+        if (!make_directory(in->output))
+        {
+            in->failed = true;
+            in->message = std::string("Couldn't create ") + in->output + ": " + strerror(errno);
+        }
+        for (size_t i= 0; i<files.size() && !in->failed; i++)
+        {
+            std::string path = in->output + "/" + in->entries[i].name;
+            if (!write_tap_file(path.c_str(), *files[i]))
+            {
+                in->failed = true;
+                in->message = std::string("Couldn't write ") + path + ": " + strerror(errno);
+            }
+        }
+    }
+
+    if (command == BATCH_DECODE && !in->failed)
+    {
+        for (const auto& piece : in->pieces)
+        {
+            in->byte_cnt += piece.bytes.size();
+            in->sync_errors += piece.sync_errors;
+            in->parity_errors += piece.parity_errors;
+        }
+
+        bool ok = false;
+        if (FILE *f = fopen(in->output.c_str(), "wb"))
+        {
+            ok = true;
+            for (const auto& piece : in->pieces)
+                if (!piece.bytes.empty() &&
+                    fwrite(piece.bytes.data(), 1, piece.bytes.size(), f) != piece.bytes.size())
+                    ok = false;
+            ok = fclose(f) == 0 && ok;
+        }
+        if (!ok)
+        {
+            in->failed = true;
+            in->message = std::string("Couldn't write ") + in->output + ": " + strerror(errno);
+        }
+    }
+
+    // Results are kept only in the report from here on
+    in->pieces.clear();
+    in->pieces.shrink_to_fit();
+
+    std::lock_guard<std::mutex> lock(m_print_mutex);
+    if (in->failed)
+        fprintf(stderr, "%s: %s\n", in->path.c_str(), in->message.c_str());
+    else if (command == BATCH_DECODE)
+        printf("%s: Decoded %" PRId64 " bytes to %s, %d sync errors, %d parity errors\n",
+               in->path.c_str(), in->byte_cnt, in->output.c_str(),
+               in->sync_errors, in->parity_errors);
+    else
+        printf("%s: %d file(s)%s%s, %d errors\n",
+               in->path.c_str(), (int) in->entries.size(),
+               command == BATCH_EXTRACT ? " extracted to " : "",
+               command == BATCH_EXTRACT ? in->output.c_str() : "",
+               in->sync_errors + in->parity_errors);
+    fflush(stdout);
+}
+
+//----------------------------------------------------------------------------
+
+// Decode piece k of an input
+void BatchRunner::RunPiece(BatchInput *in, int k)
+{
+    BatchPiece& piece = in->pieces[k];
+    int64_t memory = GetMemory(*in, piece.end - piece.start);
+    m_budget->Acquire(memory);
+
+    DecoderOptions options = m_options;
+    options.filename = in->path.c_str();
+
+    // A segment is decoded from a clip of the recording, so that only
+    // its own stretch gets cached, and its times are shifted back.
+    Sound src;
+    TapeDecoder *dec = 0;
+    double offset = 0;
+    if (!in->segmented)
+        dec = new TapeDecoder(options);
+    else if (src.ReadFromFile(options.filename, true /*silent*/))
+    {
+        src.Clip(piece.start, piece.end - piece.start);
+        options.start = -1;
+        options.end = -1;
+        offset = piece.start;
+        dec = new TapeDecoder(src, options);
+    }
+    else
+        piece.failed = true;
+
+    if (dec && m_batch_options.command == BATCH_DECODE)
+    {
+        DecodedByte b;
+        while (dec->ReadByte(&b))
+        {
+            piece.bytes.push_back(b.byte);
+            piece.sync_errors += b.sync_error;
+            piece.parity_errors += b.parity_error && !b.sync_error;
+        }
+    }
+    else if (dec)
+    {
+        TapeFile *file = new TapeFile;
+        while (dec->ReadFile(file))
+        {
+            file->start_time += offset;
+            file->end_time += offset;
+            piece.files.push_back(*file);
+        }
+        delete file;
+    }
+    delete dec;
+    src = Sound();
+
+    m_budget->Release(memory);
+
+    if (--in->pieces_left == 0)
+        FinishInput(in);
+}
+
+//----------------------------------------------------------------------------
+
+void BatchRunner::FindCuts(const Sound& src, const DecoderOptions& options,
+                           double min_gap, double offset, std::vector<double> *cuts)
+{
+    ActivityMap activity(src, options);
+
+    int rate = src.GetSampleRate();
+    int64_t min_gap_len = (int64_t) (min_gap*rate);
+    int64_t idle = 0; // start of current inactive stretch
+    int64_t start, end;
+    while (activity.FindRegion(idle, &start, &end))
+    {
+        if (start - idle >= min_gap_len)
+            cuts->push_back(offset + 0.5*(idle + start)/rate);
+        idle = end;
+    }
+    if (src.GetLength() - idle >= min_gap_len)
+        cuts->push_back(offset + 0.5*(idle + src.GetLength())/rate);
+}
+
+//----------------------------------------------------------------------------
+
+std::vector<BatchPiece> BatchRunner::PlanPieces(const std::vector<double>& cuts,
+                                                double t0, double t1, double segment)
+{
+    std::vector<BatchPiece> pieces;
+    double piece_start = t0;
+    for (double cut : cuts)
+    {
+        if (cut - piece_start >= segment && t1 - cut >= 0.25*segment)
+        {
+            BatchPiece piece;
+            piece.start = piece_start;
+            piece.end = cut;
+            pieces.push_back(piece);
+            piece_start = cut;
+        }
+    }
+    BatchPiece last;
+    last.start = piece_start;
+    last.end = t1;
+    pieces.push_back(last);
+    return pieces;
+}
+
+//----------------------------------------------------------------------------
+
+// Cut a long recording into segments at silent gaps, and queue a job for
+// each. The recording is scanned a chunk at a time, each from its own
+// Sound, so that the scan never caches more than a chunk.
+void BatchRunner::PlanInput(BatchInput *in)
+{
+    double t0 = m_options.start >= 0 ? m_options.start : 0;
+    double t1 = m_options.end >= 0 ? fmin(m_options.end, in->duration) : in->duration;
+    double segment = m_batch_options.segment;
+
+    int64_t memory = GetMemory(*in, segment);
+    m_budget->Acquire(memory);
+
+    DecoderOptions scan_options = m_options;
+    scan_options.start = -1;
+    scan_options.end = -1;
+
+    std::vector<double> cuts;
+    for (double c0 = t0; c0 < t1; c0 += segment)
+    {
+        Sound src;
+        if (!src.ReadFromFile(in->path.c_str(), true /*silent*/))
+            break;
+        src.Clip(c0, fmin(segment, t1-c0));
+        FindCuts(src, scan_options, BATCH_MIN_CUT_GAP, c0, &cuts);
+    }
+
+    m_budget->Release(memory);
+
+    in->pieces = PlanPieces(cuts, t0, t1, segment);
+    int piece_cnt = (int) in->pieces.size();
+    in->segmented = piece_cnt > 1;
+    in->segment_cnt = piece_cnt;
+    if (m_batch_options.verbose)
+    {
+        std::lock_guard<std::mutex> lock(m_print_mutex);
+        printf("%s: Decoding in %d segment(s)\n", in->path.c_str(), piece_cnt);
+    }
+
+    in->pieces_left = piece_cnt;
+    for (int k= 0; k<piece_cnt; k++)
+        m_pool->Submit([this, in, k] { RunPiece(in, k); });
+}
+
+//----------------------------------------------------------------------------
+
+void BatchRunner::WriteReport(FILE *f) const
+{
+    int command = m_batch_options.command;
+    const char *command_name = command == BATCH_LIST ? "list" :
+                               command == BATCH_EXTRACT ? "extract" : "decode";
+
+    int file_sum = 0;
+    int error_sum = 0;
+    int failed_cnt = 0;
+
+    fprintf(f, "{\n  \"command\": \"%s\",\n  \"inputs\": [", command_name);
+    for (size_t i= 0; i<m_inputs.size(); i++)
+    {
+        const BatchInput& in = m_inputs[i];
+        const char *status = in.failed ? "failed" :
+                             in.sync_errors || in.parity_errors ? "errors" :
+                             "ok";
+
+        fprintf(f, "%s\n    {\n      \"path\": ", i ? "," : "");
+        print_json_string(f, in.path.c_str());
+        fprintf(f, ",\n      \"status\": \"%s\"", status);
+        if (in.failed)
+        {
+            fprintf(f, ",\n      \"message\": ");
+            print_json_string(f, in.message.c_str());
+        }
+        fprintf(f, ",\n      \"format\": \"%s\"", in.tap ? "tap" : "audio");
+        if (!in.tap)
+        {
+            fprintf(f, ",\n      \"sample_rate\": %d", in.sample_rate);
+            fprintf(f, ",\n      \"channels\": %d", in.channel_cnt);
+        }
+        fprintf(f, ",\n      \"duration\": %.2f", in.duration);
+        fprintf(f, ",\n      \"segments\": %d", in.segment_cnt);
+        if (!in.output.empty())
+        {
+            fprintf(f, ",\n      \"output\": ");
+            print_json_string(f, in.output.c_str());
+        }
+        if (command == BATCH_DECODE)
+            fprintf(f, ",\n      \"bytes\": %" PRId64, in.byte_cnt);
+        fprintf(f, ",\n      \"sync_errors\": %d", in.sync_errors);
+        fprintf(f, ",\n      \"parity_errors\": %d", in.parity_errors);
+
+        if (command != BATCH_DECODE)
+        {
+            fprintf(f, ",\n      \"files\": [");
+            for (size_t j= 0; j<in.entries.size(); j++)
+            {
+                const BatchEntry& e = in.entries[j];
+                fprintf(f, "%s\n        { \"name\": ", j ? "," : "");
+                print_json_string(f, e.name.c_str());
+                fprintf(f, ", \"start\": %.2f, \"end\": %.2f, \"length\": %d, "
+                        "\"basic\": %s, \"autorun\": %s, \"slow\": %s, "
+                        "\"sync_errors\": %d, \"parity_errors\": %d }",
+                        e.start_time, e.end_time, e.len,
+                        e.basic ? "true" : "false",
+                        e.autorun ? "true" : "false",
+                        e.slow ? "true" : "false",
+                        e.sync_errors, e.parity_errors);
+            }
+            fprintf(f, "%s]", in.entries.empty() ? "" : "\n      ");
+        }
+        fprintf(f, "\n    }");
+
+        file_sum += (int) in.entries.size();
+        error_sum += in.sync_errors + in.parity_errors;
+        failed_cnt += in.failed;
+    }
+    fprintf(f, "%s],\n", m_inputs.empty() ? "" : "\n  ");
+    fprintf(f, "  \"totals\": { \"inputs\": %d, \"files\": %d, \"errors\": %d, \"failed\": %d }\n}\n",
+            (int) m_inputs.size(), file_sum, error_sum, failed_cnt);
+}
+
+//----------------------------------------------------------------------------
+
+int BatchRunner::Run(const char *name)
+{
+    std::vector<std::string> paths;
+    if (!CollectPaths(name, &paths))
+        return 1;
+
+    double segment = m_batch_options.segment;
+    int command = m_batch_options.command;
+    std::vector<BatchInput*> small_inputs;
+    std::vector<BatchInput*> large_inputs;
+    double total_time = 0;
+    for (const auto& path : paths)
+    {
+        AddInput(path);
+        BatchInput *in = &m_inputs.back();
+        if (in->failed)
+            continue;
+
+        // Separate channels need the whole file. So does decoding, which
+        // would otherwise get a different byte stream around the cuts.
+        bool splittable = !in->tap && segment > 0 && command != BATCH_DECODE &&
+            !(m_options.split_channels && in->channel_cnt > 1);
+        if (splittable && in->duration > 1.5*segment)
+            large_inputs.push_back(in);
+        else
+            small_inputs.push_back(in);
+        total_time += in->duration;
+    }
+
+    MemoryBudget budget(((int64_t) m_batch_options.memory) << 20);
+    m_budget = &budget;
+
+    // Enough threads for the jobs we expect, counting a segment per job
+    int job_cnt = (int) m_inputs.size() + (segment > 0 ? (int) (total_time/segment) : 0);
+    int thread_cnt = m_options.threads ? WorkerPool::GetHelperCount(job_cnt) : 0;
+    WorkerPool pool(thread_cnt);
+    m_pool = &pool;
+
+    // Longest first, so that the last jobs to finish are short ones
+    auto longer = [](const BatchInput *a, const BatchInput *b)
+    {
+        return a->duration > b->duration;
+    };
+    std::stable_sort(large_inputs.begin(), large_inputs.end(), longer);
+    std::stable_sort(small_inputs.begin(), small_inputs.end(), longer);
+
+    for (BatchInput *in : large_inputs)
+        pool.Submit([this, in] { PlanInput(in); });
+
+    // Pack short inputs into jobs of about one segment each
+    size_t i = 0;
+    while (i < small_inputs.size())
+    {
+        std::vector<BatchInput*> pack;
+        double pack_time = 0;
+        do
+        {
+            BatchInput *in = small_inputs[i++];
+            BatchPiece piece;
+            piece.start = m_options.start >= 0 ? m_options.start : 0;
+            piece.end = m_options.end >= 0 ? fmin(m_options.end, in->duration) : in->duration;
+            in->pieces.push_back(piece);
+            in->pieces_left = 1;
+            pack.push_back(in);
+            pack_time += in->duration;
+        }
+        while (i < small_inputs.size() && pack_time + small_inputs[i]->duration <= segment);
+
+        pool.Submit([this, pack]
+        {
+            for (BatchInput *in : pack)
+                RunPiece(in, 0);
+        });
+    }
+
+    pool.Wait();
+    m_pool = 0;
+    m_budget = 0;
+
+    // Report in input order
+    const char *output_dir = m_batch_options.output_dir;
+    std::string report_path = m_batch_options.report ? m_batch_options.report :
+        output_dir ? std::string(output_dir) + "/taperescue-report.json" :
+        "taperescue-report.json";
+    FILE *f = fopen(report_path.c_str(), "w");
+    bool report_ok = f != 0;
+    if (f)
+    {
+        WriteReport(f);
+        report_ok = fclose(f) == 0;
+    }
+    if (!report_ok)
+        perror(report_path.c_str());
+
+    int file_sum = 0;
+    int error_sum = 0;
+    int failed_cnt = 0;
+    for (const auto& in : m_inputs)
+    {
+        file_sum += (int) in.entries.size();
+        error_sum += in.sync_errors + in.parity_errors;
+        failed_cnt += in.failed;
+    }
+    printf("%d input(s), %d file(s), %d errors, %d failed\n",
+           (int) m_inputs.size(), file_sum, error_sum, failed_cnt);
+    if (report_ok)
+        printf("Report written to %s\n", report_path.c_str());
+
+    // Decoding errors are in the report, and don't fail the run
+    return !report_ok || failed_cnt ? 1 : 0;
+}
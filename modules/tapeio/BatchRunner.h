@@ -0,0 +1,149 @@
+//----------------------------------------------------------------------------
+//
+//  BatchRunner - List, extract or decode many inputs in one run
+//
+//  * Inputs are the recordings and tape archives in a directory, or the
+//    paths listed in a manifest file
+//  * Long recordings are cut into segments at silent gaps, so that one
+//    long tape keeps all cores busy, and short inputs are packed together
+//    into jobs of about the same length
+//  * Jobs share a WorkerPool, and hold an estimate of their memory use
+//    against a global budget while they run
+//  * Results are assembled per input as soon as its last job is done, and
+//    a JSON report covers all inputs at the end
+//
+//  Copyright (c) 2021-2023 Erik Persson
+//
+//----------------------------------------------------------------------------
+
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+
+#include "DecoderOptions.h"
+#include "TapeFile.h"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+class Sound;
+class WorkerPool;
+class MemoryBudget;
+
+#define BATCH_LIST    (0)
+#define BATCH_EXTRACT (1)
+#define BATCH_DECODE  (2)
+
+struct BatchOptions
+{
+    int command = BATCH_LIST;
+    double segment = 300;        // Seconds to cut long recordings into, 0 for never
+    int memory = 1024;           // Memory budget in MB
+    const char *output_dir = 0;  // Default: inputs' own for decode, current for extract
+    const char *report = 0;      // Default: taperescue-report.json in output_dir
+    bool verbose = false;        // Report segment counts
+};
+
+// Stretch of an input decoded by one job
+struct BatchPiece
+{
+    double start = 0;                   // seconds
+    double end = 0;
+    std::vector<TapeFile> files;        // for list and extract
+    std::vector<uint8_t> bytes;         // for decode
+    int sync_errors = 0;
+    int parity_errors = 0;
+    bool failed = false;
+};
+
+// File found in an input, as reported
+struct BatchEntry
+{
+    std::string name;
+    double start_time;
+    double end_time;
+    int len;
+    bool basic;
+    bool autorun;
+    bool slow;
+    int sync_errors;
+    int parity_errors;
+};
+
+struct BatchInput
+{
+    std::string path;
+    std::string output;                 // .tap file or directory, if any
+    bool tap = false;                   // tape archive rather than audio
+    int sample_rate = 0;
+    int channel_cnt = 0;
+    double duration = 0;                // seconds, estimated for archives
+    bool segmented = false;             // pieces are clipped from the audio
+    int segment_cnt = 1;
+
+    std::vector<BatchPiece> pieces;
+    std::atomic<int> pieces_left = 0;
+
+    // Report
+    bool failed = false;
+    std::string message;
+    std::vector<BatchEntry> entries;
+    int64_t byte_cnt = 0;
+    int sync_errors = 0;
+    int parity_errors = 0;
+};
+
+class BatchRunner
+{
+    DecoderOptions m_options;
+    BatchOptions m_batch_options;
+
+    std::deque<BatchInput> m_inputs;
+    std::unordered_set<std::string> m_used_paths;
+    WorkerPool *m_pool = 0;
+    MemoryBudget *m_budget = 0;
+    std::mutex m_print_mutex;
+
+public:
+    BatchRunner(const DecoderOptions& options, const BatchOptions& batch_options);
+    BatchRunner(const BatchRunner&) = delete;
+    virtual ~BatchRunner() {}
+
+    // Process all inputs of a directory or manifest, and write the report.
+    // Return command status: 1 if the inputs couldn't be listed, an input
+    // couldn't be read or its output written, or the report couldn't be
+    // written. Decoding errors only go in the report. (0=success)
+    int Run(const char *name);
+
+    int GetInputCount() const { return (int) m_inputs.size(); }
+    const BatchInput& GetInput(int i) const { return m_inputs[i]; }
+
+    // Midpoints of the silent gaps of at least min_gap seconds in src,
+    // offset by the given time, appended to cuts
+    static void FindCuts(const Sound& src, const DecoderOptions& options,
+                         double min_gap, double offset, std::vector<double> *cuts);
+
+    // Split t0..t1 at cuts into pieces of at least the segment time,
+    // without a short one at the end
+    static std::vector<BatchPiece> PlanPieces(const std::vector<double>& cuts,
+                                              double t0, double t1, double segment);
+
+    // Write the JSON report
+    void WriteReport(FILE *f) const;
+
+private:
+    bool CollectPaths(const char *name, std::vector<std::string> *paths) const;
+    bool IsInputName(const std::string& path) const;
+    void AddInput(const std::string& path);
+    int64_t GetMemory(const BatchInput& in, double seconds) const;
+    void PlanInput(BatchInput *in);
+    void RunPiece(BatchInput *in, int k);
+    void FinishInput(BatchInput *in);
+};
+
+#endif
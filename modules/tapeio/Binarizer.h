@@ -9,6 +9,8 @@
 #ifndef BINARIZER_H
 #define BINARIZER_H
 
+#include <stdint.h>
+
 class Binarizer
 {
 public:
@@ -16,7 +18,7 @@ public:
 
     // Sound parameters
     virtual int GetSampleRate() const = 0;
-    virtual int GetLength() const = 0;
+    virtual int64_t GetLength() const = 0;
 
     // Main entry point. Return no. of bit events found
     virtual int Read(
@@ -26,13 +28,19 @@ public:
         bool *evt_vals,       // Value transitioned to (or sustained)
         int evt_maxcnt,       // Max no of events to detect
 
-        int core_start,       // Offset in samples to region of interest
+        int64_t core_start,   // Offset in samples to region of interest
         int core_len,         // Length in samples of region of interest
 
         float *dbgbuf,        // Debug output buffer [core_len]
         int given_rise_edge,  // -1: no known phase, >=0: force a given rise edge
         double t_clk,         // Expected clock, nominally samplerate/4800.0
         double dt_clk) = 0;   // Half-range of clock search window
+
+    // Optionally load and filter input ahead of a Read with the same
+    // core_start and core_len, and given_rise_edge>=0 if has_rise_edge.
+    // May run on another thread, but not at the same time as Read.
+    virtual void Prefetch(int64_t /*core_start*/, int /*core_len*/,
+                          bool /*has_rise_edge*/) {}
 };
 
 #endif
@@ -24,6 +24,9 @@ class DecoderBackend
 public:
     virtual ~DecoderBackend() {}
     virtual bool DecodeByte(DecodedByte *b) = 0;
+
+    // Amount of audio skipped as inactive, in seconds
+    virtual double GetSkippedTime() const { return 0; }
 };
 
 //----------------------------------------------------------------------------
@@ -34,12 +34,22 @@ struct DecoderOptions
     bool fast = false;           // Decode only fast mode when set
     bool slow = false;           // Decode only slow mode when set
     bool dual = false;           // Use dual-mode (fast+slow) decoder when set
-    bool dump = false;           // Write dump-demod.wav and/or dump-dual.wav
+    bool dump = false;           // Write dump-<decoder>.wav while decoding
+    int dump_channel = -1;       // Name dumps dump-<decoder>-ch<n>.wav if >= 0
     int binner = BINNER_PATTERN; // Bit extractor for dual decoder
     int band = BAND_DUAL;        // Band to use in demodulation based decoder
     int cue = CUE_AUTO;          // Method to recognize bits in Xenon decoder
     int fdec = FDEC_ORIG;        // Bit to byte decoder to use for fast format
     int f_ref = 4800;            // Nominal bit frequency in Hz
+    bool decimate = true;        // Bring high sample rates down before decoding
+    bool skip = true;            // Skip inactive stretches of tape when set
+    bool survey = true;          // Measure format and clock before decoding
+    double clock_window = 1;     // Relative width of clock search window
+    bool threads = true;         // Run independent decoding work in parallel
+    int beam = 16;               // Xenon byte track beam width, 0 for exhaustive
+    bool beam_audit = false;     // Also run exhaustive search, count differences
+    bool split_channels = false; // Decode each channel of a stereo file, keep the best
+    bool quiet = false;          // Suppress parser warnings
 };
 
 #endif
@@ -7,10 +7,12 @@
 //----------------------------------------------------------------------------
 
 #include "DemodDecoder.h"
+#include "ActivityMap.h"
 #include "Demodulator.h"
 #include "DecodedByte.h"
 #include "DecoderBackend.h"
 #include "filters.h"
+#include "DumpWriter.h"
 
 #include <soundio/Sound.h>
 
@@ -92,7 +94,7 @@ static int demod_viterbi(
     int s_d = t_a_max;
     int s_e = t_a_max+t_d_max;
     float scores[ns];
-    for (int s=0; s<ns; s+=2)
+    for (int s=0; s<ns; s++)
     {
         float y = buf[0];
         scores[s] =
@@ -225,22 +227,24 @@ static int demod_viterbi(
 //----------------------------------------------------------------------------
 
 DemodDecoder::DemodDecoder(const Sound& src,
-                           const DecoderOptions& options) :
+                           const DecoderOptions& options,
+                           const ActivityMap *activity) :
     m_demod0(src, 4800, false), // low band
     m_demod1(src, 4800, true),  // high band
-    m_options(options)
+    m_options(options),
+    m_activity(activity)
 {
     // Sub sampled sample rate
     int ss_sample_rate = m_demod0.GetSampleRate();
 
     // Clip interval
-    int full_len = m_demod0.GetLength();
+    int64_t full_len = m_demod0.GetLength();
     m_start_pos = 0;
     if (options.start >= 0) // start specified?
-        m_start_pos = (int) floor(0.5 + options.start*ss_sample_rate);
+        m_start_pos = (int64_t) floor(0.5 + options.start*ss_sample_rate);
     m_end_pos = full_len;
     if (options.end >= 0) // end specified?
-        m_end_pos = (int) floor(0.5 + options.end*ss_sample_rate);
+        m_end_pos = (int64_t) floor(0.5 + options.end*ss_sample_rate);
     if (m_end_pos > full_len)
         m_end_pos = full_len;
     if (m_end_pos < m_start_pos+1)
@@ -249,8 +253,8 @@ DemodDecoder::DemodDecoder(const Sound& src,
     // Clock parameters
     m_t_ref = ((double) ss_sample_rate)/options.f_ref; // reference physical bit period
     m_t_clk = m_t_ref;         // center of current search window
-    m_dt_min = .07*m_t_ref;    // minimum search window half width
-    m_dt_max = .25*m_t_ref;    // maximum search window half width
+    m_dt_max = .25*m_t_ref*options.clock_window; // maximum search window half width
+    m_dt_min = fmin(.07*m_t_ref, m_dt_max);      // minimum search window half width
     m_dt_clk = m_dt_max;       // current search window helf width
 
     // Main buffer, window length and hop size
@@ -277,12 +281,15 @@ DemodDecoder::DemodDecoder(const Sound& src,
     m_byte_index = 0;
 
     // Dump support
-    m_dump_snd = 0;
+    m_dump = 0;
     m_dump_buf = 0;
     if (options.dump)
     {
-        int dump_len = m_end_pos-m_start_pos;
-        m_dump_snd = new Sound(dump_len, ss_sample_rate);
+        int64_t dump_len = m_end_pos-m_start_pos;
+        m_dump = new DumpWriter(DumpWriter::Path("demod", options.dump_channel).c_str(),
+                                ss_sample_rate, dump_len, 1, m_windowlen);
+        if (!m_dump->IsOk())
+            exit(1);
         m_dump_buf = new float[m_windowlen];
     }
 }
@@ -297,25 +304,50 @@ DemodDecoder::~DemodDecoder()
     delete[] m_onset_buf;
     delete[] m_byte_buf;
 
-    if (m_dump_snd)
-    {
-        const char *dump_file = "dump-demod.wav";
-        printf("Writing dump to %s\n", dump_file);
-        if (!m_dump_snd->WriteToFile(dump_file))
-        {
-            fprintf(stderr, "Couldn't write %s\n", dump_file);
-            exit(1);
-        }
-    }
-    delete m_dump_snd;
+    if (m_dump && !m_dump->Close())
+        exit(1);
+    delete m_dump;
     delete[] m_dump_buf;
 }
 
 //----------------------------------------------------------------------------
 
+// Jump over windows that hold no active audio
+// Restart clock tracking since tape speed may differ after the gap
+void DemodDecoder::SkipInactive()
+{
+    if (!m_activity)
+        return;
+
+    int hops = m_activity->GetSkippableHops(
+        m_window_offs, m_windowlen, m_hopsize, m_demod0.GetSampleRate());
+    if (hops == 0)
+        return;
+
+    int64_t new_offs = m_window_offs + ((int64_t) hops)*m_hopsize;
+    m_skipped_len += (new_offs < m_end_pos ? new_offs : m_end_pos) - m_window_offs;
+    m_window_offs = new_offs;
+
+    m_fno = 0; // don't reuse buffered signal
+    m_t_clk = m_t_ref;
+    m_dt_clk = m_dt_max;
+    m_boundary_byte_onset = -1;
+}
+
+//----------------------------------------------------------------------------
+
+double DemodDecoder::GetSkippedTime() const
+{
+    return ((double) m_skipped_len)/m_demod0.GetSampleRate();
+}
+
+//----------------------------------------------------------------------------
+
 // Decode one window, return false if there was nothing to decode
 bool DemodDecoder::DecodeWindow()
 {
+    SkipInactive();
+
     if (m_window_offs>=m_end_pos)
         return false; // nothing to decode
 
@@ -352,7 +384,7 @@ bool DemodDecoder::DecodeWindow()
     if (!first_window &&
         m_boundary_byte_onset >= m_window_offs &&
         m_boundary_byte_onset < m_window_offs+m_windowlen)
-        given_onset = m_boundary_byte_onset-m_window_offs;
+        given_onset = (int) (m_boundary_byte_onset-m_window_offs);
 
     // Run viterbi to detect bytes in buffer
     int onset_cnt = demod_viterbi(
@@ -373,7 +405,7 @@ bool DemodDecoder::DecodeWindow()
     {
         int x0 = m_onset_buf[i];
         int x1 = m_onset_buf[i+1];
-        int onset = m_window_offs+x0;
+        int64_t onset = m_window_offs+x0;
 
         if (x0 >= right_limit)
             continue; // deal with in next window instead
@@ -387,8 +419,8 @@ bool DemodDecoder::DecodeWindow()
         for (int b= 0; b<13; b++)
         {
             double x = x0 + ((16.0/209)*b + (8.0/209))*(x1-x0);
-            levels[0][b] = interp_lin(m_buf0, m_end_pos, x);
-            levels[1][b] = interp_lin(m_buf1, m_end_pos, x);
+            levels[0][b] = interp_lin(m_buf0, m_windowlen, x);
+            levels[1][b] = interp_lin(m_buf1, m_windowlen, x);
         }
 
         // Normalize the levels to 0..1 range
@@ -476,7 +508,7 @@ bool DemodDecoder::DecodeWindow()
     }
 
     // Save data in debug dump
-    if (m_dump_snd)
+    if (m_dump)
     {
         float maxval = m_buf[0];
         for (int i=0; i<m_windowlen; i++)
@@ -494,9 +526,9 @@ bool DemodDecoder::DecodeWindow()
         }
 
         // Write out core part only
-        m_dump_snd->Write(m_window_offs+(m_windowlen-m_hopsize)/2-m_start_pos,
-                        m_dump_buf+(m_windowlen-m_hopsize)/2,
-                        m_hopsize);
+        m_dump->Write(0, m_window_offs+(m_windowlen-m_hopsize)/2-m_start_pos,
+                      m_dump_buf+(m_windowlen-m_hopsize)/2,
+                      m_hopsize);
     }
 
     m_window_offs += m_hopsize;
@@ -14,15 +14,18 @@
 #include "Demodulator.h"
 
 class Sound;
+class ActivityMap;
+class DumpWriter;
 
 class DemodDecoder : public DecoderBackend
 {
     Demodulator m_demod0, m_demod1;
     DecoderOptions m_options;
+    const ActivityMap *m_activity = 0;
 
     // Clip interval
-    int m_start_pos = 0;
-    int m_end_pos = 0;
+    int64_t m_start_pos = 0;
+    int64_t m_end_pos = 0;
 
     // Clock parameters
     double m_t_ref  = 0;   // nominal physical bit period
@@ -34,7 +37,8 @@ class DemodDecoder : public DecoderBackend
     // Main buffer, window length and hop size
     int m_windowlen = 0;
     int m_hopsize = 0;
-    int m_window_offs = 0;
+    int64_t m_window_offs = 0;
+    int64_t m_skipped_len = 0;  // samples skipped as inactive
     int m_fno = 0;
     float *m_buf0 = 0;  // Low band demodulated signal
     float *m_buf1 = 0;  // High band demodulated signal
@@ -43,8 +47,8 @@ class DemodDecoder : public DecoderBackend
     // Buffer of byte onset locations determined in window
     int m_onset_bufsize = 0;
     int *m_onset_buf = 0;
-    int m_boundary_byte_onset = -1;  // onset for use as viterbi boundary
-    int m_last_byte_onset = -1;      // location of last emitted byte
+    int64_t m_boundary_byte_onset = -1;  // onset for use as viterbi boundary
+    int64_t m_last_byte_onset = -1;      // location of last emitted byte
 
     // Buffer to hold bytes decoded from window
     int m_byte_bufsize = 0;
@@ -52,19 +56,22 @@ class DemodDecoder : public DecoderBackend
     int m_byte_cnt = 0;
     int m_byte_index = 0;
 
-    Sound *m_dump_snd = 0;
+    DumpWriter *m_dump = 0;
     float *m_dump_buf = 0;
 
 public:
     DemodDecoder(const DemodDecoder&) = delete;
     DemodDecoder(const Sound& src,
-                 const DecoderOptions& options);
+                 const DecoderOptions& options,
+                 const ActivityMap *activity = 0);
 
     virtual ~DemodDecoder();
 
     bool DecodeByte(DecodedByte *b) override;
+    double GetSkippedTime() const override;
 
 private:
+    void SkipInactive();
     bool DecodeWindow();
 };
 
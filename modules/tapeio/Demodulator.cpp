@@ -45,7 +45,7 @@ Demodulator::Demodulator(const Sound& src,
     int src_rate = src.GetSampleRate();
 
     // Length of entire ta  xpe in subsampled resolution
-    m_ss_len = (int) floor( 0.5 + ((double)src.GetLength()) * m_ss_rate / src_rate );
+    m_ss_len = (int64_t) floor( 0.5 + ((double)src.GetLength()) * m_ss_rate / src_rate );
 
     // Carrier period in input samples
     m_t_carrier = (src_rate + carrier_hz/2)/carrier_hz;
@@ -103,7 +103,7 @@ Demodulator::~Demodulator()
 
 //----------------------------------------------------------------------------
 
-bool Demodulator::ReadDemodFullres(int where, float *buf, int len)
+bool Demodulator::ReadDemodFullres(int64_t where, float *buf, int len)
 {
     int filter_margin = m_t_lowpass/2;
     int ibuf_len = len+2*filter_margin;
@@ -150,7 +150,7 @@ bool Demodulator::ReadDemodFullres(int where, float *buf, int len)
 
 //----------------------------------------------------------------------------
 
-bool Demodulator::ReadDemod(int where, float *buf, int bufsize)
+bool Demodulator::ReadDemod(int64_t where, float *buf, int bufsize)
 {
     // First read in high resolution,
     // Then subsample to the output resolution
@@ -158,9 +158,9 @@ bool Demodulator::ReadDemod(int where, float *buf, int bufsize)
     double k_subsamp = double(src_rate)/m_ss_rate;
 
     int interp_filter_margin = 3;
-    int t0 = (int) ( floor(k_subsamp*where) - interp_filter_margin);
-    int t1 = (int) ( ceil(k_subsamp*(where+bufsize-1)) ) + interp_filter_margin;
-    int dsin_len = t1+1-t0;
+    int64_t t0 = (int64_t) ( floor(k_subsamp*where) - interp_filter_margin);
+    int64_t t1 = (int64_t) ( ceil(k_subsamp*(where+bufsize-1)) ) + interp_filter_margin;
+    int dsin_len = (int) (t1+1-t0);
 
     // Allocate downsampling input buffer
     if (m_dsin_buf_size < dsin_len)
@@ -181,7 +181,7 @@ bool Demodulator::ReadDemod(int where, float *buf, int bufsize)
 
 //----------------------------------------------------------------------------
 
-bool Demodulator::Read(int where, float *buf, int len)
+bool Demodulator::Read(int64_t where, float *buf, int len)
 {
     // Generate a threshold level for the demodulated signal
     int mm_margin = m_mm_filterlen/2;
@@ -19,7 +19,7 @@ class Demodulator
     Sound m_src;
 
     int m_ss_rate;     // subsampled output rate, 2400 seems a good value
-    int m_ss_len;      // subsampled length
+    int64_t m_ss_len;  // subsampled length
     bool m_use_high_band;
     int m_t_carrier;
     int m_t_lowpass;
@@ -55,15 +55,15 @@ public:
 
     // Interface similar to Sound for retreiving the output
     int GetSampleRate() const { return m_ss_rate; }
-    int GetLength() const { return m_ss_len; }
-    bool Read(int where, float *buf, int len);
+    int64_t GetLength() const { return m_ss_len; }
+    bool Read(int64_t where, float *buf, int len);
 
 private:
     // Stage 1 result - demodulation result, full resolution
-    bool ReadDemodFullres(int where, float *buf, int len);
+    bool ReadDemodFullres(int64_t where, float *buf, int len);
 
     // Stage 2 result - demodulation result, downsampled
-    bool ReadDemod(int where, float *buf, int len);
+    bool ReadDemod(int64_t where, float *buf, int len);
 };
 
 #endif
@@ -7,12 +7,15 @@
 //----------------------------------------------------------------------------
 
 #include "DualDecoder.h"
+#include "ActivityMap.h"
 #include "GridBinarizer.h"
 #include "SuperBinarizer.h"
 #include "PatternBinarizer.h"
 #include "DecodedByte.h"
 #include "filters.h"
 #include "Balancer.h"
+#include "WorkerPool.h"
+#include "DumpWriter.h"
 
 #include <soundio/Sound.h>
 
@@ -26,75 +29,161 @@
 // Slow mode binary to byte decoder
 //----------------------------------------------------------------------------
 
+// Buffers for decode_slow_bytes, kept from window to window
+struct SlowScratch
+{
+    int size = 0;         // Capacity in bit events
+    uint64_t *edges = 0;  // Bit k set when bin_vals[k] != bin_vals[k+1]
+    bool *bits = 0;       // Bit values as they look
+    int *costs = 0;       // [x*13+s]
+    uint8_t *jumps = 0;   // [x*13+s] distance back to predecessor
+
+    ~SlowScratch()
+    {
+        delete[] edges;
+        delete[] bits;
+        delete[] costs;
+        delete[] jumps;
+    }
+
+    void Reserve(int n)
+    {
+        if (size >= n)
+            return;
+        delete[] edges;
+        delete[] bits;
+        delete[] costs;
+        delete[] jumps;
+        size = n;
+        edges = new uint64_t[n/64 + 2];
+        bits = new bool[n];
+        costs = new int[n*13];
+        jumps = new uint8_t[n*13];
+    }
+};
+
+//----------------------------------------------------------------------------
+
+// Count edges among the 15 transitions following bit x
+static inline int count_edges(const uint64_t *edges, int x)
+{
+    int w = x>>6;
+    int b = x&63;
+    uint64_t window = edges[w] >> b;
+    if (b > 64-15)
+        window |= edges[w+1] << (64-b);
+    return __builtin_popcountll(window & 0x7fff);
+}
+
+//----------------------------------------------------------------------------
+
 // Slow format byte extraction from binarized signal
 // Returns no. of bytes found
 static int decode_slow_bytes(
     int *byte_xs, uint16_t *byte_zs, int maxcnt,
     const bool *bin_vals, int bin_cnt, // Binary signal
-    int given_byte_x)   // <0: no known phase, >=0: force a given byte location
+    int given_byte_x,   // <0: no known phase, >=0: force a given byte location
+    SlowScratch *scratch)
 {
     const int NS = 13; // No. of physical bits per byte
     const int BOUNDARY_COST = 1<<30; // cost for violating given_byte_x
 
+    scratch->Reserve(bin_cnt);
+    bool *bits = scratch->bits;
+    int *costs = scratch->costs;
+    uint8_t *jumps = scratch->jumps;
+
+    // Pack edges into a bitset, with zeros past the last edge
+    uint64_t *edges = scratch->edges;
+    int word_cnt = bin_cnt/64 + 2;
+    for (int w= 0; w<word_cnt; w++)
+        edges[w] = 0;
+    for (int k= 0; k+1<bin_cnt; k++)
+        edges[k>>6] |= ((uint64_t) (bin_vals[k] != bin_vals[k+1])) << (k&63);
+
     // Forward pass
-    bool *bits = new bool[bin_cnt];
-    int *costs = new int[bin_cnt*NS]; // [x*NS+s]
-    int *preds = new int[bin_cnt*NS];
     for (int x=0; x<bin_cnt; x++)
     {
         // Count 7-15 edges among 16 bit block starting x
-        int edge_cnt = 0;
-        for (int dx= 0; dx<15 && x+dx+1<bin_cnt; dx++)
-            edge_cnt += (bin_vals[x+dx] != bin_vals[x+dx+1]);
+        int edge_cnt = count_edges(edges, x);
 
         bits[x] = edge_cnt>=11; // bits as they look
 
         int c0 = edge_cnt-7;  // cost when 0 expected
         int c1 = 15-edge_cnt; // cost when 1 expected
 
+        // Cost for not starting on an edge
+        int off_edge = x>0 && bin_vals[x] == bin_vals[x-1];
+
+        const int k = 3;  // 1=bad 2=ok
+        int local_costs[NS];
         for (int s=0; s<NS; s++)
-        {
-            const int k = 3;  // 1=bad 2=ok
-            int local_cost =
+            local_costs[s] = off_edge + (
                 s == 0      ? k*c0 :  // 0-bit cost -4..4
                 s >= 10     ? k*c1 :  // 1-bit cost 0..4
                 edge_cnt<11 ? c0 :  // 0-bit cost -4..4
-                              c1;   // 1-bit cost 0..4
+                              c1);  // 1-bit cost 0..4
 
-            // Cost for not starting on an edge
-            if (x>0 && bin_vals[x] == bin_vals[x-1])
-                local_cost ++;
+        int *row = costs + x*NS;
+        uint8_t *jump_row = jumps + x*NS;
 
-            const int JUMP_MIN=14;
-            const int JUMP_MAX=18;
-            if (x<JUMP_MAX)
+        const int JUMP_MIN=14;
+        const int JUMP_MAX=18;
+        if (x<JUMP_MAX)
+        {
+            for (int s=0; s<NS; s++)
             {
-                costs[x*NS+s] = local_cost;
-                preds[x*NS+s] = x-16;
+                row[s] = local_costs[s];
+                jump_row[s] = 16;
 
                 if (given_byte_x >= 0)
                     // This is deducted later if given byte is hit
-                    costs[x*NS+s] += BOUNDARY_COST;
+                    row[s] += BOUNDARY_COST;
+            }
+        }
+        else
+        {
+            // Each state s follows state s-1, and state 0 follows NS-1.
+            // Nominal jump is 16, or 17 into state 0. Start from a jump
+            // of 16 without cost, then try all jumps in order.
+            int best_cps[NS];
+            int best_jumps[NS];
+            const int *row16 = costs + (x-16)*NS;
+            best_cps[0] = row16[NS-1];
+            best_jumps[0] = 16;
+            for (int s=1; s<NS; s++)
+            {
+                best_cps[s] = row16[s-1];
+                best_jumps[s] = 16;
             }
-            else
+
+            for (int jump = JUMP_MIN; jump <= JUMP_MAX; jump++)
             {
-                int sp = s==0 ? NS-1: s-1;
-                int best_xp = x-16;
-                int best_cp = costs[best_xp*NS + sp];
+                const int *prow = costs + (x-jump)*NS;
 
-                for (int jump = JUMP_MIN; jump <= JUMP_MAX; jump++)
+                int cp = prow[NS-1] + abs(jump-17);
+                if (cp < best_cps[0])
                 {
-                    int jump_cost = abs(jump-(s==0 ? 17:16));
-                    int xp = x-jump;
-                    int cp = costs[xp*NS+sp] + jump_cost;
-                    if (cp < best_cp)
+                    best_cps[0] = cp;
+                    best_jumps[0] = jump;
+                }
+
+                int jump_cost = abs(jump-16);
+                for (int s=1; s<NS; s++)
+                {
+                    int cp = prow[s-1] + jump_cost;
+                    if (cp < best_cps[s])
                     {
-                        best_cp = cp;
-                        best_xp = xp;
+                        best_cps[s] = cp;
+                        best_jumps[s] = jump;
                     }
                 }
-                costs[x*NS+s] = best_cp + local_cost;
-                preds[x*NS+s] = best_xp;
+            }
+
+            for (int s=0; s<NS; s++)
+            {
+                row[s] = best_cps[s] + local_costs[s];
+                jump_row[s] = best_jumps[s];
             }
         }
 
@@ -143,7 +232,7 @@ static int decode_slow_bytes(
             byte_cnt++;
         }
 
-        x = preds[x*NS+s];
+        x -= jumps[x*NS+s];
         s = s==0 ? NS-1:s-1;
     }
 
@@ -162,9 +251,6 @@ static int decode_slow_bytes(
         byte_zs[j] = tz;
     }
 
-    delete[] bits;
-    delete[] costs;
-    delete[] preds;
     return byte_cnt;
 }
 
@@ -782,18 +868,20 @@ static int decode_fast_bytes(
 DualDecoder::DualDecoder(const Sound& src,
                          const DecoderOptions& options,
                          bool enable_fast,
-                         bool enable_slow) :
-    m_options(options)
+                         bool enable_slow,
+                         const ActivityMap *activity) :
+    m_options(options),
+    m_activity(activity)
 {
     m_sample_rate = src.GetSampleRate();
-    int full_len = src.GetLength();
+    int64_t full_len = src.GetLength();
 
     m_start_pos = 0;
     m_end_pos = full_len;
     if (m_options.start >= 0) // start specified?
-        m_start_pos = (int) floor(0.5 + m_options.start*m_sample_rate);
+        m_start_pos = (int64_t) floor(0.5 + m_options.start*m_sample_rate);
     if (m_options.end >= 0) // end specified?
-        m_end_pos = (int) floor(0.5 + m_options.end*m_sample_rate);
+        m_end_pos = (int64_t) floor(0.5 + m_options.end*m_sample_rate);
     if (m_end_pos > full_len)
         m_end_pos = full_len;
     if (m_end_pos < m_start_pos+1)
@@ -805,8 +893,9 @@ DualDecoder::DualDecoder(const Sound& src,
     // Clock search window half width
     // This can at most be 20% since 2*1.2=3.8 before a 3-period can
     // look the same as a 2-period
-    m_dt_max = .20*m_t_ref;  // maximum search window half width
-    m_dt_min = .07*m_t_ref;  // minimum search window half width
+    // Narrowed further when the clock has been measured up front
+    m_dt_max = .20*m_t_ref*options.clock_window; // maximum search window half width
+    m_dt_min = fmin(.07*m_t_ref, m_dt_max);      // minimum search window half width
     m_dt_clk = m_dt_max;
     m_t_clk = m_t_ref;
 
@@ -834,15 +923,23 @@ DualDecoder::DualDecoder(const Sound& src,
     m_bit_evt_cnt = 0;
 
     // Dump
-    m_dump_snd = 0;
+    m_dump = 0;
     m_dump_buf = 0;
     if (m_options.dump)
     {
-        int dump_len = m_end_pos-m_start_pos;
-        m_dump_snd = new Sound(dump_len, m_sample_rate);
+        int64_t dump_len = m_end_pos-m_start_pos;
+        m_dump = new DumpWriter(DumpWriter::Path("dual", m_options.dump_channel).c_str(),
+                                m_sample_rate, dump_len, 1, m_windowlen);
+        if (!m_dump->IsOk())
+            exit(1);
     }
     m_dump_buf = new float[m_windowlen];
 
+    m_slow_scratch = new SlowScratch;
+
+    // Threads for the byte decoders and prefetch, 0 to run them in turn
+    m_pool = new WorkerPool(options.threads ? WorkerPool::GetHelperCount(3) : 0);
+
     // [0]=fast [1]=slow
     m_byte_decoders[0].enabled = enable_fast;
     m_byte_decoders[1].enabled = enable_slow;
@@ -863,22 +960,16 @@ DualDecoder::DualDecoder(const Sound& src,
 
 DualDecoder::~DualDecoder()
 {
+    delete m_pool;
     delete m_binarizer;
+    delete m_slow_scratch;
 
     delete[] m_bit_evt_xs;
     delete[] m_bit_evt_vals;
 
-    if (m_dump_snd)
-    {
-        const char *dump_file = "dump-dual.wav";
-        printf("Writing dump to %s\n", dump_file);
-        if (!m_dump_snd->WriteToFile(dump_file))
-        {
-            fprintf(stderr, "Couldn't write %s\n", dump_file);
-            exit(1);
-        }
-    }
-    delete m_dump_snd;
+    if (m_dump && !m_dump->Close())
+        exit(1);
+    delete m_dump;
     delete[] m_dump_buf;
 
     for (int slow = 0; slow<2; slow++)
@@ -898,6 +989,28 @@ void DualDecoder::DecodeByteWindow(bool last_window)
     double detected_t_clk = m_t_ref;
     double detected_dt_clk = m_dt_max;
 
+    // Decode from bits to bytes, fast and slow side by side.
+    // They only share the bit events, which stay constant meanwhile.
+    int byte_evt_cnts[2] = {0, 0};
+    for (int slow = 0; slow<2; slow++)
+        if (m_byte_decoders[slow].enabled)
+            m_pool->Submit([this, slow, &byte_evt_cnts]
+            {
+                ByteDecoder *byte_decoder = &m_byte_decoders[slow];
+                if (slow)
+                    byte_evt_cnts[slow] = decode_slow_bytes(
+                        byte_decoder->xs, byte_decoder->zs, byte_decoder->bufsize,
+                        m_bit_evt_vals, m_bit_evt_cnt,
+                        byte_decoder->boundary_x,
+                        m_slow_scratch);
+                else
+                    byte_evt_cnts[slow] = decode_fast_bytes(m_options.fdec,
+                        byte_decoder->xs, byte_decoder->zs, byte_decoder->bufsize,
+                        m_bit_evt_vals, m_bit_evt_cnt,
+                        byte_decoder->boundary_x);
+            });
+    m_pool->Wait();
+
     for (int slow = 0; slow<2; slow++)
     {
         ByteDecoder *byte_decoder = &m_byte_decoders[slow];
@@ -908,19 +1021,7 @@ void DualDecoder::DecodeByteWindow(bool last_window)
         int right_limit = last_window ? m_windowlen : (m_windowlen+m_hopsize)/2;
 
         double k_time = 1.0/m_sample_rate; // seconds per balanced sample
-
-        // Decode from bits to byte
-        int byte_evt_cnt;
-        if (slow)
-            byte_evt_cnt = decode_slow_bytes(
-                byte_decoder->xs, byte_decoder->zs, byte_decoder->bufsize,
-                m_bit_evt_vals, m_bit_evt_cnt,
-                byte_decoder->boundary_x);
-        else
-            byte_evt_cnt = decode_fast_bytes(m_options.fdec,
-                byte_decoder->xs, byte_decoder->zs, byte_decoder->bufsize,
-                m_bit_evt_vals, m_bit_evt_cnt,
-                byte_decoder->boundary_x);
+        int byte_evt_cnt = byte_evt_cnts[slow];
 
         int nominal_bins_per_byte = slow ? 209 : 32;
         int t_half_byte = (int) float(0.5 + nominal_bins_per_byte*m_t_ref/2);
@@ -935,7 +1036,7 @@ void DualDecoder::DecodeByteWindow(bool last_window)
         {
             int bix = byte_decoder->xs[i]; // Bit index into bit window
             assert(bix >= 0 && bix < m_bit_evt_cnt);
-            int x = m_window_offs + m_bit_evt_xs[bix]; // Global sample offset
+            int64_t x = m_window_offs + m_bit_evt_xs[bix]; // Global sample offset
 
             // Annotate global time
             byte_decoder->times[i] = k_time*x;
@@ -996,6 +1097,73 @@ void DualDecoder::DecodeByteWindow(bool last_window)
 
 //----------------------------------------------------------------------------
 
+// Find the bit events to carry over to the next window:
+// keep_cnt events, starting at index delete_left
+void DualDecoder::FindKeptEvents(int right_limit,
+                                 int *out_delete_left, int *out_keep_cnt) const
+{
+    int bit_evt_cnt = m_bit_evt_cnt;
+    while (bit_evt_cnt && m_bit_evt_xs[bit_evt_cnt-1] > right_limit)
+        bit_evt_cnt--;
+    // Make sure last kept event is a rise event
+
+    // Discard events that will be to the left of next window
+    // We can delete events to the left regardless of event type
+    int delete_left = 0;
+    while (delete_left<bit_evt_cnt && m_bit_evt_xs[delete_left] < 0)
+        delete_left++;
+
+    // Discard bit events that are to the right of the window core
+    // They will be analyzed more reliably using the next window
+    // However make sure that the last kept event is a rise edge.
+    int delete_right = 0;
+    for (int i= bit_evt_cnt-1; i>=delete_left; i--)
+         if (i>0 && !m_bit_evt_vals[i-1] && m_bit_evt_vals[i]) // rise edge at i
+             if (m_bit_evt_xs[i] >= right_limit)
+                delete_right = bit_evt_cnt-1-i;
+
+    int keep_cnt = bit_evt_cnt - delete_left - delete_right;
+    assert(keep_cnt >= 1);
+
+    *out_delete_left = delete_left;
+    *out_keep_cnt = keep_cnt;
+}
+
+//----------------------------------------------------------------------------
+
+// Have the binarizer load the next window on the pool, while the
+// byte decoders run. Where the next window starts depends only on the
+// bit events, not on the bytes found. DecodeByteWindow joins the job.
+void DualDecoder::PrefetchNextWindow()
+{
+    int64_t next_offs = m_window_offs + m_hopsize;
+    if (next_offs >= m_end_pos)
+        return; // no next window
+    if (m_activity && m_activity->GetSkippableHops(
+            next_offs, m_windowlen, m_hopsize, m_sample_rate) > 0)
+        return; // next window jumps ahead
+
+    // Same start as DecodeWindow will pick, from the last kept event
+    int delete_left, keep_cnt;
+    FindKeptEvents((m_windowlen+m_hopsize)/2, &delete_left, &keep_cnt);
+    int given_rise_edge = m_bit_evt_xs[delete_left+keep_cnt-1] - m_hopsize;
+    if (given_rise_edge < 0)
+        return;
+
+    int64_t core_start = next_offs + (m_windowlen-m_hopsize)/2;
+    if (given_rise_edge < m_windowlen/2)
+        core_start = next_offs + given_rise_edge;
+    int core_len = (int) (next_offs + (m_windowlen+m_hopsize)/2 - core_start);
+
+    Binarizer *binarizer = m_binarizer;
+    m_pool->Submit([binarizer, core_start, core_len]
+    {
+        binarizer->Prefetch(core_start, core_len, true);
+    });
+}
+
+//----------------------------------------------------------------------------
+
 // Update bit coordinates to new frame of reference on bit window shift
 void DualDecoder::AdvanceByteWindow(int advance_bits)
 {
@@ -1012,8 +1180,44 @@ void DualDecoder::AdvanceByteWindow(int advance_bits)
 
 //----------------------------------------------------------------------------
 
+// Jump over windows that hold no active audio
+// Restart clock tracking since tape speed may differ after the gap
+void DualDecoder::SkipInactive()
+{
+    if (!m_activity)
+        return;
+
+    int hops = m_activity->GetSkippableHops(
+        m_window_offs, m_windowlen, m_hopsize, m_sample_rate);
+    if (hops == 0)
+        return;
+
+    int64_t new_offs = m_window_offs + ((int64_t) hops)*m_hopsize;
+    m_skipped_len += (new_offs < m_end_pos ? new_offs : m_end_pos) - m_window_offs;
+    m_window_offs = new_offs;
+
+    // Stashed bit events and boundaries refer to the old window
+    m_bit_evt_cnt = 0;
+    for (int slow = 0; slow<2; slow++)
+        m_byte_decoders[slow].boundary_x = -1;
+
+    m_t_clk = m_t_ref;
+    m_dt_clk = m_dt_max;
+}
+
+//----------------------------------------------------------------------------
+
+double DualDecoder::GetSkippedTime() const
+{
+    return ((double) m_skipped_len)/m_sample_rate;
+}
+
+//----------------------------------------------------------------------------
+
 bool DualDecoder::DecodeWindow()
 {
+    SkipInactive();
+
     if (m_window_offs >= m_end_pos)
         return false; // nothing to decode
 
@@ -1032,36 +1236,40 @@ bool DualDecoder::DecodeWindow()
     }
 
     // By default we offset by 1/4 into the legacy window
-    int core_start = m_window_offs + (m_windowlen-m_hopsize)/2;
+    // Offsets into the window stay 32-bit, only core_start is global
+    int core_offs = (m_windowlen-m_hopsize)/2;
 
     // If we have a reasonable boundary condition,
     // then use it as the start.
     if (given_rise_edge >= 0 && given_rise_edge < m_windowlen/2)
-        core_start = m_window_offs + given_rise_edge;
+        core_offs = given_rise_edge;
 
-    int core_end   = m_window_offs + (m_windowlen+m_hopsize)/2;
-    int core_len   = core_end-core_start;
+    int64_t core_start = m_window_offs + core_offs;
+    int core_len   = (m_windowlen+m_hopsize)/2 - core_offs;
     int old_cnt    = m_bit_evt_cnt;
 
     if (given_rise_edge>=0)
-        given_rise_edge -= (core_start-m_window_offs);
+        given_rise_edge -= core_offs;
 
     // Run the binarizer
     // First is a rise event.
     m_bit_evt_cnt += m_binarizer->Read(
         m_bit_evt_xs+old_cnt, m_bit_evt_vals+old_cnt, m_bit_evt_bufsize-old_cnt,
         core_start, core_len,
-        m_dump_buf+(core_start-m_window_offs),
+        m_dump_buf+core_offs,
         given_rise_edge,
         m_t_clk, m_dt_clk);
 
     for (int i= old_cnt; i<m_bit_evt_cnt; i++)
-        m_bit_evt_xs[i] += (core_start-m_window_offs); // adjust for skipped part of waveform
+        m_bit_evt_xs[i] += core_offs; // adjust for skipped part of waveform
 
+    // Binarizer input for the next window loads meanwhile
+    if (!last_window)
+        PrefetchNextWindow();
     DecodeByteWindow(last_window);
 
     // Save data in debug dump
-    if (m_dump_snd)
+    if (m_dump)
     {
         if (0) // Draw bits as pulse wave
         {
@@ -1107,33 +1315,14 @@ bool DualDecoder::DecodeWindow()
         }
 
         // Write out range that we binarized
-        m_dump_snd->Write(core_start - m_start_pos,
-                        m_dump_buf+(core_start-m_window_offs),
-                        core_len);
+        m_dump->Write(0, core_start - m_start_pos,
+                      m_dump_buf+core_offs,
+                      core_len);
     }
 
     int right_limit = last_window ? m_windowlen : (m_windowlen+m_hopsize)/2;
-    while (m_bit_evt_cnt && m_bit_evt_xs[m_bit_evt_cnt-1] > right_limit)
-        m_bit_evt_cnt--;
-    // Make sure last kept event is a rise event
-
-    // Discard events that will be to the left of next window
-    // We can delete events to the left regardless of event type
-    int delete_left = 0;
-    while (delete_left<m_bit_evt_cnt && m_bit_evt_xs[delete_left] < 0)
-        delete_left++;
-
-    // Discard bit events that are to the right of the window core
-    // They will be analyzed more reliably using the next window
-    // However make sure that the last kept event is a rise edge.
-    int delete_right = 0;
-    for (int i= m_bit_evt_cnt-1; i>=delete_left; i--)
-         if (i>0 && !m_bit_evt_vals[i-1] && m_bit_evt_vals[i]) // rise edge at i
-             if (m_bit_evt_xs[i] >= right_limit)
-                delete_right = m_bit_evt_cnt-1-i;
-
-    int keep_cnt = m_bit_evt_cnt - delete_left - delete_right;
-    assert(keep_cnt >= 1);
+    int delete_left, keep_cnt;
+    FindKeptEvents(right_limit, &delete_left, &keep_cnt);
 
     // Shift bit events left in buffer
     // Change frame of reference to that of next window
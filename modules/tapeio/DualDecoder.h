@@ -6,6 +6,8 @@
 //  The decoder which works in two steps
 //  * Binarization, format neutral
 //  * Bit to byte, slow and fast run in parallel
+//  * Both byte decoders, and loading of the next window, may run on
+//    worker threads
 //
 //  Copyright (c) 2021-2022 Erik Persson
 //
@@ -19,16 +21,22 @@
 #include "Binarizer.h"
 
 class Sound;
+class ActivityMap;
+class DumpWriter;
+class WorkerPool;
+struct SlowScratch;
 
 class DualDecoder : public DecoderBackend
 {
     Binarizer *m_binarizer = 0;
+    WorkerPool *m_pool = 0;
     DecoderOptions m_options;
+    const ActivityMap *m_activity = 0;
     int m_sample_rate = 0;
 
     // Clip interval
-    int m_start_pos = 0;
-    int m_end_pos = 0;
+    int64_t m_start_pos = 0;
+    int64_t m_end_pos = 0;
 
     // Clock parameters
     double m_t_ref  = 0;  // nominal physical bit period
@@ -40,7 +48,8 @@ class DualDecoder : public DecoderBackend
     // Main buffer, window length and hop size
     int m_windowlen = 0;
     int m_hopsize = 0;
-    int m_window_offs = 0;
+    int64_t m_window_offs = 0;
+    int64_t m_skipped_len = 0;  // samples skipped as inactive
 
     // Bit event buffer
     int m_bit_evt_bufsize = 0;
@@ -57,15 +66,16 @@ class DualDecoder : public DecoderBackend
         uint16_t *zs = 0;     // 13-bit LSB first representation
         double *times = 0;    // global time in seconds
         int boundary_x = -1;  // event for use as viterbi boundary
-        int last_x = -1;      // location of last emitted byte
+        int64_t last_x = -1;  // location of last emitted byte
         int emit_start = 0;   // range of events to emit
         int emit_end = 0;
     };
 
     ByteDecoder m_byte_decoders[2]; // 0=fast 1=slow
+    SlowScratch *m_slow_scratch = 0;
 
     // Dump
-    Sound *m_dump_snd = 0;
+    DumpWriter *m_dump = 0;
     float *m_dump_buf = 0;
 
 public:
@@ -73,14 +83,19 @@ public:
     DualDecoder(const Sound& src,
                 const DecoderOptions& options,
                 bool enable_fast,
-                bool enable_slow);
+                bool enable_slow,
+                const ActivityMap *activity = 0);
     virtual ~DualDecoder();
 
     bool DecodeByte(DecodedByte *b) override;
+    double GetSkippedTime() const override;
 
 private:
+    void SkipInactive();
     void DecodeByteWindow(bool last_window);
     void AdvanceByteWindow(int advance_bits);
+    void FindKeptEvents(int right_limit, int *out_delete_left, int *out_keep_cnt) const;
+    void PrefetchNextWindow();
     bool DecodeWindow();
 };
 
@@ -0,0 +1,126 @@
+//----------------------------------------------------------------------------
+//
+//  DumpWriter - Streaming writer for decoder debug dumps
+//
+//  Copyright (c) 2021-2023 Erik Persson
+//
+//  Frames are handed to the SoundWriter once they fall more than 'history'
+//  frames behind the furthest write. Its FIFO makes the writes return at
+//  once, and makes the decoder wait for the disk only when it is full,
+//  which bounds the memory used. Stretches that were never written are
+//  written as zeros a block at a time, so a long gap takes no memory.
+//----------------------------------------------------------------------------
+
+#include "DumpWriter.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+//----------------------------------------------------------------------------
+
+DumpWriter::DumpWriter(const char *path, int sample_rate, int64_t len,
+                       int channels, int history) :
+    m_path(path),
+    m_channels(channels),
+    m_len(len),
+    m_history(history)
+{
+    assert(channels >= 1 && len >= 0 && history >= 0);
+    printf("Writing dump to %s\n", path);
+    m_open = m_writer.Open(path, sample_rate, channels);
+    if (!m_open)
+        fprintf(stderr, "Couldn't write %s\n", path);
+}
+
+//----------------------------------------------------------------------------
+
+DumpWriter::~DumpWriter()
+{
+    Close();
+}
+
+//----------------------------------------------------------------------------
+
+std::string DumpWriter::Path(const char *name, int channel)
+{
+    std::string path = std::string("dump-") + name;
+    if (channel >= 0)
+        path += "-ch" + std::to_string(channel);
+    return path + ".wav";
+}
+
+//----------------------------------------------------------------------------
+
+void DumpWriter::Write(int channel, int64_t where, const float *buf, int len)
+{
+    assert(channel >= 0 && channel < m_channels);
+    if (!IsOk())
+        return;
+
+    int64_t end = std::min(where+len, m_len);
+
+    // Hand off whole blocks that can no longer be rewritten, before
+    // making room for the new samples
+    int64_t settled = std::max((int64_t) 0, end - m_history - m_pending_pos);
+    if (settled >= BLOCK_LEN)
+        Hand(settled - settled%BLOCK_LEN);
+
+    // Drop samples outside of the file, or already handed off
+    int64_t start = std::max(where, m_pending_pos);
+    if (start >= end)
+        return;
+    buf += start-where;
+
+    int64_t pending_end = m_pending_pos + (int64_t) m_pending.size()/m_channels;
+    if (end > pending_end)
+        m_pending.resize((end - m_pending_pos)*m_channels, 0);
+
+    float *dst = m_pending.data() + (start - m_pending_pos)*m_channels + channel;
+    for (int64_t i=0; i<end-start; i++)
+        dst[i*m_channels] = buf[i];
+}
+
+//----------------------------------------------------------------------------
+
+// Write frames from m_pending_pos. Frames beyond m_pending were never
+// written, and are written as zeros.
+void DumpWriter::Hand(int64_t frames)
+{
+    int64_t avail = std::min((int64_t) m_pending.size()/m_channels, frames);
+    for (int64_t done=0; done<avail; done+=BLOCK_LEN)
+    {
+        int64_t cnt = std::min((int64_t) BLOCK_LEN, avail-done);
+        m_ok &= m_writer.Write(m_pending.data() + done*m_channels, (int) cnt*m_channels);
+    }
+
+    if (frames > avail)
+    {
+        std::vector<float> zeros(BLOCK_LEN*m_channels, 0);
+        for (int64_t done=avail; done<frames; done+=BLOCK_LEN)
+        {
+            int64_t cnt = std::min((int64_t) BLOCK_LEN, frames-done);
+            m_ok &= m_writer.Write(zeros.data(), (int) cnt*m_channels);
+        }
+    }
+
+    m_pending.erase(m_pending.begin(), m_pending.begin() + avail*m_channels);
+    m_pending_pos += frames;
+}
+
+//----------------------------------------------------------------------------
+
+bool DumpWriter::Close()
+{
+    if (!IsOk())
+        return false;
+
+    Hand(m_len - m_pending_pos);
+    m_writer.Close();
+    m_open = false;
+
+    if (!m_ok)
+        fprintf(stderr, "Couldn't write %s\n", m_path.c_str());
+    return m_ok;
+}
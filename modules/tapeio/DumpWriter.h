@@ -0,0 +1,70 @@
+//----------------------------------------------------------------------------
+//
+//  DumpWriter - Streaming writer for decoder debug dumps
+//
+//  * Writes dump-<xxx>.wav while decoding, window by window
+//  * One or more channels, interleaved in one file
+//  * Windows may rewrite a bounded stretch of recent samples
+//  * File I/O on the SoundWriter's own writer thread
+//  * Unwritten stretches, e.g. skipped silence, come out as zeros
+//
+//  Copyright (c) 2021-2023 Erik Persson
+//
+//----------------------------------------------------------------------------
+
+#ifndef DUMPWRITER_H
+#define DUMPWRITER_H
+
+#include <soundio/SoundWriter.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class DumpWriter
+{
+    static const int BLOCK_LEN = 16384;  // frames per write
+
+    std::string m_path;
+    SoundWriter m_writer;
+    int m_channels;
+    int64_t m_len;          // length of the file in frames
+    int m_history;          // frames that may still be rewritten
+
+    // Frames from m_pending_pos on, not yet handed to the writer.
+    // Holds at most history plus one block.
+    std::vector<float> m_pending;
+    int64_t m_pending_pos = 0;
+
+    bool m_open = false;
+    bool m_ok = true;
+
+public:
+    DumpWriter() = delete;
+    DumpWriter(const DumpWriter&) = delete;
+
+    // Writes before position 0 or at len and beyond are dropped.
+    // Each write may reach at most 'history' frames back from the end of
+    // the furthest write so far.
+    DumpWriter(const char *path, int sample_rate, int64_t len,
+               int channels, int history);
+    ~DumpWriter();
+
+    // File name dump-<name>.wav, or dump-<name>-ch<channel>.wav if channel >= 0
+    static std::string Path(const char *name, int channel);
+
+    // Check that the file could be opened, else a message has been printed
+    bool IsOk() const { return m_open; }
+
+    // Write samples of one channel at a position in frames
+    void Write(int channel, int64_t where, const float *buf, int len);
+
+    // Write what remains, pad to full length and close the file
+    // Return true if everything was written, else print a message
+    bool Close();
+
+private:
+    void Hand(int64_t frames);
+};
+
+#endif
@@ -0,0 +1,158 @@
+//----------------------------------------------------------------------------
+//
+//  FilterCache - Shared cache of filtered signals
+//
+//  Copyright (c) 2021-2023 Erik Persson
+//
+//  Windows are filtered outside the entry lock, so threads that miss
+//  filter in parallel. When two threads miss on the same window, the first
+//  one to finish inserts its result.
+//----------------------------------------------------------------------------
+
+#include "FilterCache.h"
+#include "filters.h"
+
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+//----------------------------------------------------------------------------
+// Registry
+//----------------------------------------------------------------------------
+
+static std::mutex s_registry_mutex;
+static std::vector<FilterCache*> s_registry;
+
+//----------------------------------------------------------------------------
+
+FilterCache *FilterCache::Acquire(const Sound& src, int kind, int param)
+{
+    std::lock_guard<std::mutex> lock(s_registry_mutex);
+
+    FilterCache *entry = 0;
+    for (FilterCache *e : s_registry)
+        if (e->m_src.GetId() == src.GetId() &&
+            e->m_kind == kind &&
+            e->m_param == param)
+            entry = e;
+
+    if (!entry)
+    {
+        entry = new FilterCache(src, kind, param);
+        s_registry.push_back(entry);
+    }
+    entry->m_ref_cnt++;
+    return entry;
+}
+
+//----------------------------------------------------------------------------
+
+void FilterCache::Release()
+{
+    std::lock_guard<std::mutex> lock(s_registry_mutex);
+
+    assert(m_ref_cnt > 0);
+    if (--m_ref_cnt)
+        return;
+
+    s_registry.erase(std::find(s_registry.begin(), s_registry.end(), this));
+    delete this;
+}
+
+//----------------------------------------------------------------------------
+// Entry
+//----------------------------------------------------------------------------
+
+FilterCache::FilterCache(const Sound& src, int kind, int param) :
+    m_src(src),
+    m_kind(kind),
+    m_param(param)
+{
+    assert(kind == FILTER_HANN_LOWPASS);
+    assert(param & 1);
+}
+
+//----------------------------------------------------------------------------
+
+FilterCache::~FilterCache()
+{
+    for (int k=0; k<CACHE_WINDOWS; k++)
+        delete[] m_windows[k].data;
+}
+
+//----------------------------------------------------------------------------
+
+// Filter one window from the source
+bool FilterCache::Compute(float *out, int64_t start, int len) const
+{
+    // Hann lowpass
+    int margin = m_param>>1;
+    int ibuf_len = len + 2*margin;
+    float *ibuf = new float[ibuf_len];
+    bool ok = m_src.Read(start - margin, ibuf, ibuf_len);
+    hann_lowpass(out, len, ibuf, ibuf_len, m_param);
+    delete[] ibuf;
+
+    return ok;
+}
+
+//----------------------------------------------------------------------------
+
+bool FilterCache::Read(int64_t where, float *buf, int len)
+{
+    float *fresh = 0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        // Look up, and find the least recently used slot on the way
+        // A longer window from the same start has the same values
+        int slot = -1;
+        int lru = 0;
+        for (int k=0; k<CACHE_WINDOWS; k++)
+        {
+            const Window& w = m_windows[k];
+            if (w.data && w.start == where && w.len >= len)
+                slot = k;
+            if (w.last_use < m_windows[lru].last_use)
+                lru = k;
+        }
+
+        if (slot < 0 && fresh)
+        {
+            // Insert our result
+            slot = lru;
+            delete[] m_windows[slot].data;
+            m_windows[slot].start = where;
+            m_windows[slot].len = len;
+            m_windows[slot].data = fresh;
+            fresh = 0;
+        }
+
+        if (slot >= 0)
+        {
+            m_windows[slot].last_use = ++m_use_cnt;
+            memcpy(buf, m_windows[slot].data, len*sizeof(float));
+            break;
+        }
+
+        // Miss, compute without holding the lock
+        lock.unlock();
+        fresh = new float[len];
+        bool ok = Compute(fresh, where, len);
+        lock.lock();
+
+        if (!ok)
+        {
+            // Don't cache failed reads
+            lock.unlock();
+            memcpy(buf, fresh, len*sizeof(float));
+            delete[] fresh;
+            return false;
+        }
+    }
+    lock.unlock();
+    delete[] fresh; // lost a race
+
+    return true;
+}
@@ -0,0 +1,71 @@
+//----------------------------------------------------------------------------
+//
+//  FilterCache - Shared cache of filtered signals
+//
+//  * One entry per source sound, filter kind and filter parameter
+//  * Entries are reference counted, and shared by all users in the process
+//  * Output is kept per window read, and recently used windows are kept,
+//    so other users reading the same window get it for free
+//  * Output is the same as filtering the window directly. The running sum
+//    filters start at the window, so windows are not split or merged.
+//  * Thread safe
+//
+//  Copyright (c) 2021-2023 Erik Persson
+//
+//----------------------------------------------------------------------------
+
+#ifndef FILTERCACHE_H
+#define FILTERCACHE_H
+
+#include <soundio/Sound.h>
+
+#include <mutex>
+#include <stdint.h>
+
+#define FILTER_HANN_LOWPASS (0) // parameter: odd filter length
+
+class FilterCache
+{
+    static const int CACHE_WINDOWS = 16; // windows kept per entry
+
+    struct Window
+    {
+        int64_t start = 0;
+        int len = 0;
+        float *data = 0;        // 0 if slot is unused
+        uint64_t last_use = 0;
+    };
+
+    Sound m_src;
+    int m_kind;
+    int m_param;
+    int m_ref_cnt = 0;          // guarded by the registry mutex
+
+    std::mutex m_mutex;         // guards the windows
+    Window m_windows[CACHE_WINDOWS];
+    uint64_t m_use_cnt = 0;
+
+    FilterCache(const Sound& src, int kind, int param);
+    ~FilterCache();
+
+public:
+    FilterCache() = delete;
+    FilterCache(const FilterCache&) = delete;
+
+    // Get the shared entry for a filter, creating it on first use
+    static FilterCache *Acquire(const Sound& src, int kind, int param);
+
+    // Drop a reference from Acquire. The last one deletes the entry.
+    void Release();
+
+    // Interface similar to Sound for retreiving the output
+    // Callable from any thread
+    int GetSampleRate() const { return m_src.GetSampleRate(); }
+    int64_t GetLength() const { return m_src.GetLength(); }
+    bool Read(int64_t where, float *buf, int len);
+
+private:
+    bool Compute(float *out, int64_t start, int len) const;
+};
+
+#endif
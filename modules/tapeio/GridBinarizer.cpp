@@ -44,7 +44,7 @@ int GridBinarizer::Read(
     int *evt_xs,          // Locations of events. First one is rising edge
     bool *evt_vals,       // Value transitioned to (or sustained)
     int evt_maxcnt,       // Max no of events to detect
-    int core_start,       // Offset in samples to region of interest
+    int64_t core_start,   // Offset in samples to region of interest
     int core_len,         // Length in samples of region of interest
     float *dbgbuf,        // Debug output buffer [len]
     int given_rise_edge,  // -1: no known phase, >=0: force a given rise edge
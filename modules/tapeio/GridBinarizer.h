@@ -30,7 +30,7 @@ public:
 
     // Sound parameters
     int GetSampleRate() const override { return m_lowpass.GetSampleRate(); }
-    int GetLength() const override { return m_lowpass.GetLength(); }
+    int64_t GetLength() const override { return m_lowpass.GetLength(); }
 
     // Main entry point. Return no. of events found
     int Read(
@@ -40,7 +40,7 @@ public:
         bool *evt_vals,       // Value transitioned to (or sustained)
         int evt_maxcnt,       // Max no of events to detect
 
-        int core_start,       // Offset in samples to region of interest
+        int64_t core_start,   // Offset in samples to region of interest
         int core_len,         // Length in samples of region of interest
 
         float *dbgbuf,        // Debug output buffer [len]
@@ -2,50 +2,29 @@
 //
 //  LowpassFilter
 //
-//  Copyright (c) 2021-2022 Erik Persson
+//  Copyright (c) 2021-2023 Erik Persson
 //
 //----------------------------------------------------------------------------
 
 #include "LowpassFilter.h"
-#include "filters.h"
-#include <assert.h>
-#include <tgmath.h>
 
 //----------------------------------------------------------------------------
 
-LowpassFilter::LowpassFilter(const Sound& src, int lp_filterlen) :
-    m_src(src)
+LowpassFilter::LowpassFilter(const Sound& src, int lp_filterlen)
 {
-    assert(lp_filterlen & 1);
-    m_lp_filterlen = lp_filterlen;
+    m_cache = FilterCache::Acquire(src, FILTER_HANN_LOWPASS, lp_filterlen);
 }
 
 //----------------------------------------------------------------------------
 
 LowpassFilter::~LowpassFilter()
 {
-    delete[] m_ibuf;
+    m_cache->Release();
 }
 
 //----------------------------------------------------------------------------
 
-bool LowpassFilter::Read(int where, float *buf, int len)
+bool LowpassFilter::Read(int64_t where, float *buf, int len)
 {
-    int lp_margin = m_lp_filterlen>>1;
-    int ibuf_len =  len + 2*lp_margin;
-
-     // Allocate buffers
-    if (m_ibuf_size < ibuf_len)
-    {
-        delete[] m_ibuf;
-        m_ibuf = new float[ibuf_len];
-    }
-
-    // Read source
-    bool ok = m_src.Read(where - lp_margin, m_ibuf, ibuf_len);
-
-    // Low-pass filter
-    hann_lowpass(buf, len, m_ibuf, ibuf_len, m_lp_filterlen);
-
-    return ok;
+    return m_cache->Read(where, buf, len);
 }
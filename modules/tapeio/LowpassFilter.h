@@ -2,23 +2,22 @@
 //
 //  LowpassFilter - Bit pattern template correlation filter
 //
-//  Copyright (c) 2021-2022 Erik Persson
+//  * Hann lowpass of a sound
+//  * Output is shared through FilterCache with other filters of the same
+//    sound and length
+//
+//  Copyright (c) 2021-2023 Erik Persson
 //
 //----------------------------------------------------------------------------
 
 #ifndef SNIPPETFILTER_H
 #define SNIPPETFILTER_H
 
-#include <soundio/Sound.h>
+#include "FilterCache.h"
 
 class LowpassFilter
 {
-    Sound m_src;
-
-    // Balancing buffers (Read)
-    int m_lp_filterlen; // length of Hann lowpass filter
-    float *m_ibuf = 0;
-    int m_ibuf_size = 0;
+    FilterCache *m_cache;
 
 public:
     LowpassFilter(const Sound& src, int lp_filterlen);
@@ -27,9 +26,9 @@ public:
     virtual ~LowpassFilter();
 
     // Interface similar to Sound for retreiving the output
-    int GetSampleRate() const { return m_src.GetSampleRate(); }
-    int GetLength() const { return m_src.GetLength(); }
-    bool Read(int where, float *buf, int len);
+    int GetSampleRate() const { return m_cache->GetSampleRate(); }
+    int64_t GetLength() const { return m_cache->GetLength(); }
+    bool Read(int64_t where, float *buf, int len);
 };
 
 #endif
@@ -19,6 +19,182 @@
 #include <stdio.h>
 #include <string.h>
 
+//----------------------------------------------------------------------------
+// Forward pass
+//----------------------------------------------------------------------------
+
+// Viterbi forward pass over the RHFL states, see PatternBinarizer::Read.
+// Leaves the final costs in out_costs[4*t_clk_max], and the predecessors of
+// R,H,F,L at each sample in pred[bufsize*4].
+//
+// TMIN and TMAX are t_clk_min and t_clk_max when known at compile time,
+// or 0 for the generic version. With both known, state arrays have fixed
+// size and the predecessor scans and pattern scoring have constant trip
+// counts, so that the compiler unrolls and vectorizes them.
+template<int TMIN, int TMAX>
+static void rhfl_forward(
+    float *out_costs, short *pred,
+    const float *buf, const float *abuf, int bufsize,
+    const float *pattern, int given_rise_edge,
+    int t_clk_min_in, int t_clk_max_in)
+{
+    const int t_clk_min = TMIN ? TMIN : t_clk_min_in;
+    const int t_clk_max = TMAX ? TMAX : t_clk_max_in;
+    assert(t_clk_min == t_clk_min_in && t_clk_max == t_clk_max_in);
+
+    const int ns = 4*t_clk_max;
+    const int s_r = 0;
+    const int s_h = 1*t_clk_max;
+    const int s_f = 2*t_clk_max;
+    const int s_l = 3*t_clk_max;
+    const int t_slope = t_clk_min + (t_clk_min&1);
+    const int s_trig_r = s_r + t_slope/2-1;
+
+    // Allocate a movable "scrollable" cost vector
+    const int scroll_margin = ns>64 ? ns:64;
+    float cost_storage[ns + scroll_margin];
+    float *costs = cost_storage + scroll_margin;
+
+    // Set initial costs
+    for (int s=0; s<ns; s++)
+        costs[s] = fabs( buf[0] - pattern[s]*abuf[0] );
+
+    // Force a rise edge if requested
+    if (given_rise_edge == 0)
+        for (int s= 0; s<ns; s++)
+            costs[s] = s==s_trig_r ? 0 : 1e20;
+
+    pred[0] = 0; // unused
+    pred[1] = 0; // unused
+    pred[2] = 0; // unused
+    pred[3] = 0; // unused
+
+    for (int i= 1; i<bufsize; i++)
+    {
+        // Find best predecessor for each state
+        int p;
+        float c;
+
+        // Find best predecessor of H
+        p = s_r + t_clk_max-1;
+        c = costs[p];
+        #pragma GCC unroll 16
+        for (int s = s_r+t_clk_min-1; s<s_r+t_clk_max-1; s++)
+            if (c > costs[s])
+            {
+                c= costs[s];
+                p = s;
+            }
+        pred[i*4+1] = p;
+        float c_h = c;
+
+        // Find best predecessor of F
+        // This might be H or H's predecessor R
+        // Start with p,c kept from H's predececessor R
+        #pragma GCC unroll 16
+        for (int s = s_h+t_clk_min-1; s<s_h+t_clk_max; s++)
+            if (c > costs[s])
+            {
+                c= costs[s];
+                p = s;
+            }
+        pred[i*4+2] = p;
+        float c_f = c;
+
+        // Find best predecessor of L
+        p = s_f + t_clk_max-1;
+        c = costs[p];
+        #pragma GCC unroll 16
+        for (int s = s_f+t_clk_min-1; s<s_f+t_clk_max-1; s++)
+            if (c > costs[s])
+            {
+                c= costs[s];
+                p = s;
+            }
+        pred[i*4+3] = p;
+        float c_l = c;
+
+        // Find best predecessor of R
+        // This might be L or L's predecessor F
+        // Start with p,c kept from L's predececessor F
+        #pragma GCC unroll 16
+        for (int s = s_l+t_clk_min-1; s<s_l+t_clk_max; s++)
+            if (c > costs[s])
+            {
+                c= costs[s];
+                p = s;
+            }
+        pred[i*4+0] = p;
+        float c_r = c;
+
+        // Move costs one step down (to higher index)
+        if (costs != cost_storage)
+            // Fast case: Move elements down by moving base pointer up
+            costs--;
+        else
+        {
+            // Slow case: Place array at cost_storage+scroll_margin
+            //            Copy old data to offset 1 in the new storage
+            memcpy(cost_storage+scroll_margin+1, cost_storage, (ns-1)*sizeof(costs[0]));
+            costs = cost_storage + scroll_margin;
+        }
+
+        costs[s_r] = c_r;
+        costs[s_h] = c_h;
+        costs[s_f] = c_f;
+        costs[s_l] = c_l;
+
+        // Score local signal against pattern
+        // First 2*t_clk_max states are mirrored by the later 2*clk_max states
+        float amp = abuf[i], sig = buf[i];
+        for (int s=0; s<t_slope; s++)
+        {
+            float p = pattern[s]*amp; // rise curve
+            costs[s] += fabs(sig-p);
+            costs[2*t_clk_max + s] += fabs(sig+p); // flipped
+        }
+        float dh = fabs(sig-amp); // cost of high plateau
+        float dl = fabs(sig+amp); // cost of low plateau
+        for (int s=t_slope; s<2*t_clk_max; s++)
+        {
+            costs[s] += dh;
+            costs[2*t_clk_max + s] += dl;
+        }
+
+        // Force a rise edge if requested
+        if (given_rise_edge == i)
+            for (int s= 0; s<ns; s++)
+                costs[s] = s==s_trig_r ? 0 : 1e20;
+    }
+
+    memcpy(out_costs, costs, ns*sizeof(costs[0]));
+}
+
+//----------------------------------------------------------------------------
+
+// Specializations for the clock windows seen with the default settings,
+// at t_ref = 9.2 (44.1 kHz), 10 (48 kHz) and 20 (96 kHz with --no-decimate)
+#define RHFL_KERNEL(t_min, t_max) { t_min, t_max, rhfl_forward<t_min, t_max> }
+
+static const struct
+{
+    int t_clk_min;
+    int t_clk_max;
+    RhflKernel kernel;
+} rhfl_kernels[] =
+{
+    RHFL_KERNEL( 7,10), RHFL_KERNEL( 7,11), RHFL_KERNEL( 7,12), RHFL_KERNEL( 7,13),
+    RHFL_KERNEL( 8,10), RHFL_KERNEL( 8,11), RHFL_KERNEL( 8,12), RHFL_KERNEL( 8,13),
+    RHFL_KERNEL( 9,10), RHFL_KERNEL( 9,11), RHFL_KERNEL( 9,12), RHFL_KERNEL( 9,13),
+    RHFL_KERNEL(10,11), RHFL_KERNEL(10,12), RHFL_KERNEL(10,13),
+    RHFL_KERNEL(16,21), RHFL_KERNEL(16,22), RHFL_KERNEL(16,23), RHFL_KERNEL(16,24),
+    RHFL_KERNEL(17,21), RHFL_KERNEL(17,22), RHFL_KERNEL(17,23), RHFL_KERNEL(17,24),
+    RHFL_KERNEL(18,21), RHFL_KERNEL(18,22), RHFL_KERNEL(18,23), RHFL_KERNEL(18,24),
+    RHFL_KERNEL(19,21), RHFL_KERNEL(19,22), RHFL_KERNEL(19,23), RHFL_KERNEL(19,24),
+};
+
+#undef RHFL_KERNEL
+
 //----------------------------------------------------------------------------
 
 PatternBinarizer::PatternBinarizer(const Sound& src,
@@ -31,6 +207,19 @@ PatternBinarizer::PatternBinarizer(const Sound& src,
         ((int) floor(12.0*t_ref)) | 1 // lp_filterlen
     )
 {
+    // Pick kernels for the clock windows around t_ref
+    m_kernel_t_min = (int) floor(0.5 + t_ref) - KERNEL_SPAN+1;
+    m_kernel_t_max = (int) floor(0.5 + t_ref);
+    for (int i= 0; i<KERNEL_SPAN; i++)
+        for (int j= 0; j<KERNEL_SPAN; j++)
+            m_kernels[i][j] = rhfl_forward<0,0>;
+    for (const auto& k : rhfl_kernels)
+    {
+        int i = k.t_clk_min - m_kernel_t_min;
+        int j = k.t_clk_max - m_kernel_t_max;
+        if (i>=0 && i<KERNEL_SPAN && j>=0 && j<KERNEL_SPAN)
+            m_kernels[i][j] = k.kernel;
+    }
 }
 
 //----------------------------------------------------------------------------
@@ -42,35 +231,41 @@ PatternBinarizer::~PatternBinarizer()
 }
 
 //----------------------------------------------------------------------------
-// Main function
+
+RhflKernel PatternBinarizer::GetKernel(int t_clk_min, int t_clk_max) const
+{
+    int i = t_clk_min - m_kernel_t_min;
+    int j = t_clk_max - m_kernel_t_max;
+    if (i>=0 && i<KERNEL_SPAN && j>=0 && j<KERNEL_SPAN)
+        return m_kernels[i][j];
+    return rhfl_forward<0,0>;
+}
+
 //----------------------------------------------------------------------------
 
-// Viterbi physical bit segmentation of demodulated signal
-// Returns no. of physical bits found
-int PatternBinarizer::Read(
-    int *evt_xs,          // Locations of events. First one is rising edge
-    bool *evt_vals,       // Value transitioned to (or sustained)
-    int evt_maxcnt,       // Max no of events to detect
-    int core_start,       // Offset in samples to region of interest
-    int core_len,         // Length in samples of region of interest
-    float *dbgbuf,        // Debug output buffer [core_len]
-    int given_rise_edge,  // -1: no known phase, >=0: force a given rise edge
-    double t_clk,         // Expected clock, nominally samplerate/4800.0
-    double dt_clk)        // Half-range of clock search window
+// Extent of the loaded window around the core
+void PatternBinarizer::GetWindow(int core_len, bool has_rise_edge,
+                                 int *left_margin, int *bufsize) const
 {
     // Margin on each side of core window
     // This is about 0.05s, 2400 samples in case of 44.1 kHz,
     // Can be compared to a slow byte which is 1920 samles.
-    int left_margin = 24*GetSampleRate()/441;
-    int right_margin = left_margin;
+    *left_margin = 24*GetSampleRate()/441;
+    int right_margin = *left_margin;
 
     // Disable left margin when we have a given rise edge
     // Gives 10-25% speedup
-    if (given_rise_edge >= 0)
-        left_margin = 0;
+    if (has_rise_edge)
+        *left_margin = 0;
 
-    int bufsize = left_margin + core_len + right_margin;
+    *bufsize = *left_margin + core_len + right_margin;
+}
+
+//----------------------------------------------------------------------------
 
+// Load balanced signal into m_buf and m_abuf
+void PatternBinarizer::Load(int64_t window_offs, int bufsize)
+{
     // Allocate buffers
     if (m_bufsize < bufsize)
     {
@@ -83,21 +278,20 @@ int PatternBinarizer::Read(
         m_loaded_end = 0; // nothing loaded in buffers
     }
 
-    //--------------------------------------------------
-    // Load buffers
-    //--------------------------------------------------
+    // Already loaded by Prefetch?
+    if (m_loaded_start == window_offs && m_loaded_end == window_offs + bufsize)
+        return;
 
     // Eliminate overlapping reads
-    int window_offs = core_start-left_margin;
     int overlap = 0; // amount of overlap
     if (m_loaded_start< window_offs &&
         m_loaded_end  > window_offs) // old overlaps our start
     {
-        int hop = window_offs-m_loaded_start;
+        int64_t hop = window_offs-m_loaded_start;
         if (hop > 0 && hop < bufsize)
         {
             // Move overlapping data left
-            overlap = m_loaded_end - window_offs;
+            overlap = (int) (m_loaded_end - window_offs);
             assert(overlap>0);
             if (overlap>bufsize-1)
                 overlap = bufsize-1;
@@ -115,6 +309,37 @@ int PatternBinarizer::Read(
     // Note what we loaded so we can reuse overlap
     m_loaded_start = window_offs;
     m_loaded_end = window_offs + bufsize;
+}
+
+//----------------------------------------------------------------------------
+
+void PatternBinarizer::Prefetch(int64_t core_start, int core_len, bool has_rise_edge)
+{
+    int left_margin, bufsize;
+    GetWindow(core_len, has_rise_edge, &left_margin, &bufsize);
+    Load(core_start-left_margin, bufsize);
+}
+
+//----------------------------------------------------------------------------
+// Main function
+//----------------------------------------------------------------------------
+
+// Viterbi physical bit segmentation of demodulated signal
+// Returns no. of physical bits found
+int PatternBinarizer::Read(
+    int *evt_xs,          // Locations of events. First one is rising edge
+    bool *evt_vals,       // Value transitioned to (or sustained)
+    int evt_maxcnt,       // Max no of events to detect
+    int64_t core_start,   // Offset in samples to region of interest
+    int core_len,         // Length in samples of region of interest
+    float *dbgbuf,        // Debug output buffer [core_len]
+    int given_rise_edge,  // -1: no known phase, >=0: force a given rise edge
+    double t_clk,         // Expected clock, nominally samplerate/4800.0
+    double dt_clk)        // Half-range of clock search window
+{
+    int left_margin, bufsize;
+    GetWindow(core_len, given_rise_edge >= 0, &left_margin, &bufsize);
+    Load(core_start-left_margin, bufsize);
 
     // Adjust given_rise_edge to by margin
     if (given_rise_edge >= 0)
@@ -165,119 +390,12 @@ int PatternBinarizer::Read(
     for (int i=0; i<2*t_clk_max; i++)
         pattern[2*t_clk_max + i] = -pattern[i]; // fall, low
 
-    // Allocate a movable "scrollable" cost vector
-    int scroll_margin = ns>64 ? ns:64;
-    float cost_storage[ns + scroll_margin];
-    float *costs = cost_storage + scroll_margin;
-
-    // Set initial costs
-    for (int s=0; s<ns; s++)
-        costs[s] = fabs( m_buf[0] - pattern[s]*m_abuf[0] );
-
-    // Force a rise edge if requested
-    if (given_rise_edge == 0)
-        for (int s= 0; s<ns; s++)
-            costs[s] = s==s_trig_r ? 0 : 1e20;
-
+    // Forward pass
+    float costs[ns];
     short *pred = new short[bufsize*4];
-    pred[0] = 0; // unused
-    pred[1] = 0; // unused
-    pred[2] = 0; // unused
-    pred[3] = 0; // unused
-
-    for (int i= 1; i<bufsize; i++)
-    {
-        // Find best predecessor for each state
-        int p;
-        float c;
-
-        // Find best predecessor of H
-        p = s_r + t_clk_max-1;
-        c = costs[p];
-        for (int s = s_r+t_clk_min-1; s<s_r+t_clk_max-1; s++)
-            if (c > costs[s])
-            {
-                c= costs[s];
-                p = s;
-            }
-        pred[i*4+1] = p;
-        float c_h = c;
-
-        // Find best predecessor of F
-        // This might be H or H's predecessor R
-        // Start with p,c kept from H's predececessor R
-        for (int s = s_h+t_clk_min-1; s<s_h+t_clk_max; s++)
-            if (c > costs[s])
-            {
-                c= costs[s];
-                p = s;
-            }
-        pred[i*4+2] = p;
-        float c_f = c;
-
-        // Find best predecessor of L
-        p = s_f + t_clk_max-1;
-        c = costs[p];
-        for (int s = s_f+t_clk_min-1; s<s_f+t_clk_max-1; s++)
-            if (c > costs[s])
-            {
-                c= costs[s];
-                p = s;
-            }
-        pred[i*4+3] = p;
-        float c_l = c;
-
-        // Find best predecessor of R
-        // This might be L or L's predecessor F
-        // Start with p,c kept from L's predececessor F
-        for (int s = s_l+t_clk_min-1; s<s_l+t_clk_max; s++)
-            if (c > costs[s])
-            {
-                c= costs[s];
-                p = s;
-            }
-        pred[i*4+0] = p;
-        float c_r = c;
-
-        // Move costs one step down (to higher index)
-        if (costs != cost_storage)
-            // Fast case: Move elements down by moving base pointer up
-            costs--;
-        else
-        {
-            // Slow case: Place array at cost_storage+scroll_margin
-            //            Copy old data to offset 1 in the new storage
-            memcpy(cost_storage+scroll_margin+1, cost_storage, (ns-1)*sizeof(costs[0]));
-            costs = cost_storage + scroll_margin;
-        }
-
-        costs[s_r] = c_r;
-        costs[s_h] = c_h;
-        costs[s_f] = c_f;
-        costs[s_l] = c_l;
-
-        // Score local signal against pattern
-        // First 2*t_clk_max states are mirrored by the later 2*clk_max states
-        float amp = m_abuf[i], sig = m_buf[i];
-        for (int s=0; s<t_slope; s++)
-        {
-            float p = pattern[s]*amp; // rise curve
-            costs[s] += fabs(sig-p);
-            costs[2*t_clk_max + s] += fabs(sig+p); // flipped
-        }
-        float dh = fabs(sig-amp); // cost of high plateau
-        float dl = fabs(sig+amp); // cost of low plateau
-        for (int s=t_slope; s<2*t_clk_max; s++)
-        {
-            costs[s] += dh;
-            costs[2*t_clk_max + s] += dl;
-        }
-
-        // Force a rise edge if requested
-        if (given_rise_edge == i)
-            for (int s= 0; s<ns; s++)
-                costs[s] = s==s_trig_r ? 0 : 1e20;
-    }
+    RhflKernel kernel = GetKernel(t_clk_min, t_clk_max);
+    kernel(costs, pred, m_buf, m_abuf, bufsize, pattern, given_rise_edge,
+           t_clk_min, t_clk_max);
 
     // Backtrace
     int s = 0;
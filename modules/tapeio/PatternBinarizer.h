@@ -14,6 +14,13 @@
 #include "Binarizer.h"
 #include "Balancer.h"
 
+// Viterbi forward pass, specialized for some clock windows
+typedef void (*RhflKernel)(
+    float *out_costs, short *pred,
+    const float *buf, const float *abuf, int bufsize,
+    const float *pattern, int given_rise_edge,
+    int t_clk_min, int t_clk_max);
+
 class PatternBinarizer : public Binarizer
 {
     Balancer m_balancer;
@@ -21,8 +28,15 @@ class PatternBinarizer : public Binarizer
     float *m_buf = 0;    // Balanced signal
     float *m_abuf = 0;   // Amplitude buffer
     int m_bufsize = 0;
-    int m_loaded_start = 0;
-    int m_loaded_end = 0;
+    int64_t m_loaded_start = 0;
+    int64_t m_loaded_end = 0;
+
+    // Forward pass kernels indexed by t_clk_min and t_clk_max,
+    // from m_kernel_t_min and m_kernel_t_max and up
+    static const int KERNEL_SPAN = 5;
+    RhflKernel m_kernels[KERNEL_SPAN][KERNEL_SPAN];
+    int m_kernel_t_min = 0;
+    int m_kernel_t_max = 0;
 
 public:
     PatternBinarizer(const PatternBinarizer&) = delete;
@@ -31,7 +45,7 @@ public:
 
     // Sound parameters
     int GetSampleRate() const override { return m_balancer.GetSampleRate(); }
-    int GetLength() const override { return m_balancer.GetLength(); }
+    int64_t GetLength() const override { return m_balancer.GetLength(); }
 
     // Main entry point. Return no. of bit events found
     int Read(
@@ -41,7 +55,7 @@ public:
         bool *evt_vals,       // Value transitioned to (or sustained)
         int evt_maxcnt,       // Max no of events to detect
 
-        int core_start,       // Offset in samples to region of interest
+        int64_t core_start,   // Offset in samples to region of interest
         int core_len,         // Length in samples of region of interest
 
         float *dbgbuf,        // Debug output buffer [core_len]
@@ -49,6 +63,14 @@ public:
         double t_clk,         // Expected clock, nominally samplerate/4800.0
         double dt_clk         // Half-range of clock search window
     ) override;
+
+    void Prefetch(int64_t core_start, int core_len, bool has_rise_edge) override;
+
+private:
+    void GetWindow(int core_len, bool has_rise_edge,
+                   int *left_margin, int *bufsize) const;
+    void Load(int64_t window_offs, int bufsize);
+    RhflKernel GetKernel(int t_clk_min, int t_clk_max) const;
 };
 
 #endif
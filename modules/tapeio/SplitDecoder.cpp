@@ -0,0 +1,210 @@
+//----------------------------------------------------------------------------
+//
+//  SplitDecoder - best-of decoding of the channels of a stereo file
+//
+//  Copyright (c) 2023 Erik Persson
+//
+//  All channels are decoded up front. The files found in each channel
+//  are then ranked by errors, where a truncated file counts its missing
+//  bytes, and taken best first as long as they don't overlap a file
+//  already taken. Stretches between the files come from the channel with
+//  the most error free bytes there. The merged stream is parsed again by
+//  TapeDecoder, as if it came from a single channel.
+//----------------------------------------------------------------------------
+
+#include "SplitDecoder.h"
+#include "TapeDecoder.h"
+#include "TapeFile.h"
+#include "TapeParser.h"
+
+#include <soundio/Sound.h>
+
+#include <assert.h>
+#include <tgmath.h>
+#include <algorithm>
+#include <thread>
+
+//----------------------------------------------------------------------------
+
+// Index of first byte at or after time t, searching forward from 'from'
+static size_t seek_time(const std::vector<DecodedByte>& bytes, size_t from, double t)
+{
+    while (from < bytes.size() && bytes[from].time < t)
+        from++;
+    return from;
+}
+
+//----------------------------------------------------------------------------
+
+SplitDecoder::SplitDecoder(const DecoderOptions& options, int channel_cnt,
+                           TapeParser *log) :
+    m_options(options),
+    m_log(log),
+    m_channel_bytes(channel_cnt),
+    m_cursors(channel_cnt, 0)
+{
+    assert(channel_cnt >= 1);
+    m_log->VerboseLog("Decoding %d channels separately\n", channel_cnt);
+
+    if (m_options.threads)
+    {
+        std::vector<std::thread> threads;
+        for (int c=0; c<channel_cnt; c++)
+            threads.emplace_back(&SplitDecoder::DecodeChannel, this, c);
+        for (auto& thread : threads)
+            thread.join();
+    }
+    else
+    {
+        for (int c=0; c<channel_cnt; c++)
+            DecodeChannel(c);
+    }
+
+    Merge();
+}
+
+//----------------------------------------------------------------------------
+
+// Decode one channel into m_channel_bytes
+void SplitDecoder::DecodeChannel(int channel)
+{
+    Sound src;
+    if (!src.ReadFromFile(m_options.filename, true /*silent*/, channel))
+        return;
+
+    // Messages come from parsing the merged stream. Each channel writes
+    // its own dumps, named by channel.
+    DecoderOptions options = m_options;
+    options.verbose = false;
+    options.quiet = true;
+    options.dump_channel = channel;
+    options.split_channels = false;
+
+    TapeDecoder dec(src, options);
+    DecodedByte b;
+    while (dec.ReadByte(&b))
+        m_channel_bytes[channel].push_back(b);
+}
+
+//----------------------------------------------------------------------------
+
+// Pick the channel for each stretch of tape
+void SplitDecoder::Merge()
+{
+    // Parser collecting the files of a channel
+    class FileCollector : public TapeParser
+    {
+        std::vector<Segment> *m_files;
+        int m_channel;
+    public:
+        FileCollector(std::vector<Segment> *files, int channel) :
+            TapeParser(false, true /*quiet*/), m_files(files), m_channel(channel) {}
+
+        void OnFile(const TapeFile& file) override
+        {
+            Segment s;
+            s.start = file.start_time;
+            s.end = file.end_time;
+            s.channel = m_channel;
+            s.errors = file.sync_errors + file.parity_errors;
+            m_files->push_back(s);
+        }
+    };
+
+    int channel_cnt = (int) m_channel_bytes.size();
+    std::vector<Segment> files;
+    for (int c=0; c<channel_cnt; c++)
+    {
+        FileCollector parser(&files, c);
+        for (const auto& b : m_channel_bytes[c])
+            parser.PutByte(b);
+        parser.Flush();
+    }
+
+    // Best file first, ties go to the longer file, then the lower channel
+    std::sort(files.begin(), files.end(), [](const Segment& a, const Segment& b)
+    {
+        if (a.errors != b.errors)
+            return a.errors < b.errors;
+        if (a.end-a.start != b.end-b.start)
+            return a.end-a.start > b.end-b.start;
+        return a.channel < b.channel;
+    });
+
+    std::vector<Segment> taken;
+    for (const auto& f : files)
+    {
+        bool overlaps = false;
+        for (const auto& t : taken)
+            overlaps |= f.start < t.end && t.start < f.end;
+        if (!overlaps)
+            taken.push_back(f);
+    }
+    std::sort(taken.begin(), taken.end(), [](const Segment& a, const Segment& b)
+    {
+        return a.start < b.start;
+    });
+
+    // Fill in the stretches between files
+    Segment end_mark;
+    end_mark.start = end_mark.end = HUGE_VAL;
+    taken.push_back(end_mark);
+
+    std::vector<size_t> cursors(channel_cnt, 0);
+    double t = -HUGE_VAL;
+    for (const auto& f : taken)
+    {
+        if (f.start > t)
+        {
+            Segment gap;
+            gap.start = t;
+            gap.end = f.start;
+            int best_cnt = -1;
+            for (int c=0; c<channel_cnt; c++)
+            {
+                const auto& bytes = m_channel_bytes[c];
+                size_t i0 = seek_time(bytes, cursors[c], gap.start);
+                size_t i1 = seek_time(bytes, i0, gap.end);
+                int good_cnt = 0;
+                for (size_t i=i0; i<i1; i++)
+                    good_cnt += !bytes[i].sync_error && !bytes[i].parity_error;
+                if (good_cnt > best_cnt)
+                {
+                    best_cnt = good_cnt;
+                    gap.channel = c;
+                }
+                cursors[c] = i1;
+            }
+            m_segments.push_back(gap);
+        }
+        if (f.end < HUGE_VAL)
+            m_segments.push_back(f);
+        t = f.end;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+bool SplitDecoder::DecodeByte(DecodedByte *b)
+{
+    while (m_segment_index < (int) m_segments.size())
+    {
+        const Segment& s = m_segments[m_segment_index];
+        const auto& bytes = m_channel_bytes[s.channel];
+        size_t& i = m_cursors[s.channel];
+
+        i = seek_time(bytes, i, s.start);
+        if (i < bytes.size() && bytes[i].time < s.end)
+        {
+            if (!m_segment_started && s.errors >= 0)
+                m_log->VerboseLog(s.start, "Using channel %d for next file, %d errors\n",
+                                  s.channel, s.errors);
+            m_segment_started = true;
+            *b = bytes[i++];
+            return true;
+        }
+        m_segment_index++;
+        m_segment_started = false;
+    }
+    return false;
+}
@@ -0,0 +1,58 @@
+//----------------------------------------------------------------------------
+//
+//  SplitDecoder - best-of decoding of the channels of a stereo file
+//
+//  * Each channel is decoded by a full TapeDecoder, on its own thread
+//  * Byte streams are merged file by file, taking each file from the
+//    channel that decoded it with the fewest errors
+//  * Helps with misaligned azimuth and dead tracks, where mixing the
+//    channels would cancel the signal
+//
+//  Copyright (c) 2023 Erik Persson
+//
+//----------------------------------------------------------------------------
+
+#ifndef SPLITDECODER_H
+#define SPLITDECODER_H
+
+#include "DecoderBackend.h"
+#include "DecoderOptions.h"
+#include "DecodedByte.h"
+
+#include <stddef.h>
+#include <vector>
+
+class TapeParser;
+
+class SplitDecoder : public DecoderBackend
+{
+    // Stretch of tape, taken from one channel
+    struct Segment
+    {
+        double start = 0;
+        double end = 0;
+        int channel = 0;
+        int errors = -1;  // errors of the file, -1 between files
+    };
+
+    DecoderOptions m_options;
+    TapeParser *m_log;    // for verbose messages, not owned
+
+    std::vector<std::vector<DecodedByte>> m_channel_bytes;
+    std::vector<Segment> m_segments;
+    int m_segment_index = 0;
+    bool m_segment_started = false;
+    std::vector<size_t> m_cursors; // next byte per channel
+
+public:
+    SplitDecoder(const DecoderOptions& options, int channel_cnt, TapeParser *log);
+    SplitDecoder(const SplitDecoder&) = delete;
+
+    bool DecodeByte(DecodedByte *b) override;
+
+private:
+    void DecodeChannel(int channel);
+    void Merge();
+};
+
+#endif
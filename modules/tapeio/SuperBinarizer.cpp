@@ -17,6 +17,112 @@
 #include <stdio.h>
 #include <string.h>
 
+//----------------------------------------------------------------------------
+// Forward propagation
+//----------------------------------------------------------------------------
+
+// Predecessors are packed 4 to a byte, as the step from the successor's
+// state: 0..2 for s-1..s+1, and 3 when the initial score stood, which
+// backtraces to the middle state.
+#define GRID_PRED_INIT (3)
+
+static inline int get_grid_pred(const uint8_t *grid_preds, int a, int s, int ns)
+{
+    int v = (grid_preds[a>>2] >> (2*(a&3))) & 3;
+    return v == GRID_PRED_INIT ? ns/2 : s + v - 1;
+}
+
+//----------------------------------------------------------------------------
+
+// Update states 0..s_end-1 with successors at grid point i1+s1
+template<int NS>
+static inline void grid_pull(
+    float *band, int band_mask, uint8_t *grid_preds, const float *row,
+    int i1, int ns_in, int s_end)
+{
+    const int ns = NS ? NS : ns_in;
+
+    #pragma GCC unroll 64
+    for (int s1= 0; s1<s_end; s1++)
+    {
+        float *cell = band + ((i1+s1) & band_mask)*ns + s1;
+        float score = *cell;
+        int pred = -1;
+        for (int s0 = s1-1; s0<=s1+1; s0++)
+            if (s0 >= 0 && s0 < ns && score < row[s0])
+            {
+                score = row[s0];
+                pred = s0;
+            }
+        if (pred >= 0)
+        {
+            // Each grid point is pulled once, so the field still holds
+            // GRID_PRED_INIT (all ones)
+            int a1 = (i1+s1)*ns + s1;
+            *cell = score;
+            grid_preds[a1>>2] ^= (GRID_PRED_INIT ^ (pred-s1+1)) << (2*(a1&3));
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+
+// Propagate scores through the grid, see SuperBinarizer::Read.
+// State s at grid point i is reached from states s-1..s+1 at grid point
+// i-di_min-s. Each point pulls from its three predecessors, which come
+// in the same order as if each predecessor had pushed, so ties resolve
+// the same way.
+//
+// Only the scores of grid points i..i+di_max are live at point i, so
+// they are kept in a band of rows which wraps around.
+//
+// NS is the no. of states when known at compile time, 0 for the generic
+// version. When known, the state loops have constant trip counts and
+// the checks at the state range ends go away.
+template<int NS>
+static void grid_forward(
+    float *band, int band_rows, uint8_t *grid_preds,
+    int ni, int ns_in, int di_min, int di_max,
+    const float *edf_buf, int bufsize, double kscale,
+    float start_score, float invalid_score,
+    int boundary_i, float boundary_score)
+{
+    const int ns = NS ? NS : ns_in;
+    assert(ns == ns_in);
+    assert(band_rows > di_max && (band_rows & (band_rows-1)) == 0);
+    int band_mask = band_rows-1;
+
+    // Paths may start anywhere before di_max
+    for (int i=0; i<di_max && i<ni; i++)
+        for (int s= 0; s<ns; s++)
+            band[i*ns+s] = start_score;
+
+    for (int i=0; i<ni; i++)
+    {
+        float edge_score = interp_lin(edf_buf, bufsize, kscale*i);
+        float add_score = edge_score + (i==boundary_i ? boundary_score:0);
+
+        float *row = band + (i & band_mask)*ns;
+        for (int s= 0; s<ns; s++)
+            row[s] += add_score;
+
+        // Enter the row which the last state reaches first
+        if (i+di_max < ni)
+        {
+            float *new_row = band + ((i+di_max) & band_mask)*ns;
+            for (int s= 0; s<ns; s++)
+                new_row[s] = invalid_score;
+        }
+
+        // Near the end of the grid, only the first states have successors
+        int s_end = ni-i-di_min;
+        if (s_end >= ns)
+            grid_pull<NS>(band, band_mask, grid_preds, row, i+di_min, ns, ns);
+        else
+            grid_pull<NS>(band, band_mask, grid_preds, row, i+di_min, ns, s_end);
+    }
+}
+
 //----------------------------------------------------------------------------
 
 SuperBinarizer::SuperBinarizer(const Sound& src,
@@ -40,6 +146,8 @@ SuperBinarizer::~SuperBinarizer()
     delete[] m_band_buf;
     delete[] m_mag_buf;
     delete[] m_edf_buf;
+    delete[] m_grid_band_buf;
+    delete[] m_grid_pred_buf;
 }
 
 //----------------------------------------------------------------------------
@@ -50,7 +158,7 @@ int SuperBinarizer::Read(
     int *evt_xs,          // Locations of events. First one is rising edge
     bool *evt_vals,       // Value transitioned to (or sustained)
     int evt_maxcnt,       // Max no of events to detect
-    int core_start,       // Offset in samples to region of interest
+    int64_t core_start,   // Offset in samples to region of interest
     int core_len,         // Length in samples of region of interest
     float *dbgbuf,        // Debug output buffer [len]
     int given_rise_edge,  // -1: no known phase, >=0: force a given rise edge
@@ -179,60 +287,81 @@ int SuperBinarizer::Read(
     int di_max = SCALE*(int) floor(0.5 + t_clk + dt_clk);
 
     int ns = di_max - di_min + 1;
-    assert(ns<256); // so we can use uint8_t
 
+    // Score band, rounded up to a power of two rows
+    int band_rows = 1;
+    while (band_rows <= di_max)
+        band_rows *= 2;
+    if (m_grid_band_size < band_rows*ns)
+    {
+        delete[] m_grid_band_buf;
+        m_grid_band_size = band_rows*ns;
+        m_grid_band_buf = new float[m_grid_band_size];
+    }
+
+    // Packed predecessors for the whole grid
     int ni = SCALE*bufsize;
-    float *grid_scores = new float[ni*ns];
-    uint8_t *grid_pred_ss = new uint8_t[ni*ns];
-    double kscale = 1.0/SCALE;
-    for (int i=0; i<ni; i++)
+    int pred_size = (ni*ns+3)/4;
+    if (m_grid_pred_size < pred_size)
     {
-        double score =  i>=di_max         ? INVALID_GRID_SCORE :
-                        given_rise_edge>=0 ? -BOUNDARY_GRID_SCORE :
-                        0;
-        for (int s= 0; s<ns; s++)
-        {
-            grid_scores[i*ns+s] = score;
-            grid_pred_ss[i*ns+s] = ns/2;
-        }
+        delete[] m_grid_pred_buf;
+        m_grid_pred_size = pred_size;
+        m_grid_pred_buf = new uint8_t[m_grid_pred_size];
     }
+    memset(m_grid_pred_buf, 0xff, pred_size); // all GRID_PRED_INIT
+
+    double kscale = 1.0/SCALE;
+    float start_score = given_rise_edge>=0 ? -BOUNDARY_GRID_SCORE : 0;
 
     // Forward propagation
-    for (int i=0; i<ni; i++)
+    // ns is SCALE times the clock window width plus one. Windows of up to
+    // 8 samples cover 44.1 to 96 kHz with the default clock windows.
+    int boundary_i = given_rise_edge>=0 ? SCALE*given_rise_edge : -1;
+    switch (ns)
     {
-        float edge_score = interp_lin(m_edf_buf, bufsize, kscale*i);
-        float boundary_score = i==SCALE*given_rise_edge? BOUNDARY_GRID_SCORE:0;
-
-        for (int s= 0; s<ns; s++)
-            grid_scores[i*ns+s] += edge_score + boundary_score;
-
-        for (int s0 = 0; s0<ns; s0++)
-            for (int s1=s0-1; s1<=s0+1; s1++)
-                if (s1 >= 0 && s1 < ns && i+di_min + s1<ni)
-                {
-                    int i1 = i + di_min + s1;
-                    int a0 = i*ns+s0;
-                    int a1 = i1*ns+s1;
-                    if (grid_scores[a1] < grid_scores[a0])
-                    {
-                        grid_scores[a1] = grid_scores[a0];
-                        grid_pred_ss[a1] = s0;
-                    }
-                }
+#define GRID_FORWARD(n) \
+    case n: \
+        grid_forward<n>(m_grid_band_buf, band_rows, m_grid_pred_buf, \
+                        ni, ns, di_min, di_max, \
+                        m_edf_buf, bufsize, kscale, \
+                        start_score, INVALID_GRID_SCORE, \
+                        boundary_i, BOUNDARY_GRID_SCORE); \
+        break;
+    GRID_FORWARD(1*SCALE+1)
+    GRID_FORWARD(2*SCALE+1)
+    GRID_FORWARD(3*SCALE+1)
+    GRID_FORWARD(4*SCALE+1)
+    GRID_FORWARD(5*SCALE+1)
+    GRID_FORWARD(6*SCALE+1)
+    GRID_FORWARD(7*SCALE+1)
+    GRID_FORWARD(8*SCALE+1)
+#undef GRID_FORWARD
+    default:
+        grid_forward<0>(m_grid_band_buf, band_rows, m_grid_pred_buf,
+                        ni, ns, di_min, di_max,
+                        m_edf_buf, bufsize, kscale,
+                        start_score, INVALID_GRID_SCORE,
+                        boundary_i, BOUNDARY_GRID_SCORE);
     }
 
     //------------------------------------------------
     // Find best end state
     //------------------------------------------------
 
+    // The last di_max rows are still in the band
+    auto end_score = [&](int i, int s)
+    {
+        return m_grid_band_buf[(i & (band_rows-1))*ns + s];
+    };
+
     int best_i = ni-1;
     int best_s = 0;
-    auto best_r = grid_scores[best_i*ns+best_s];
+    auto best_r = end_score(best_i, best_s);
     for (int i= ni-di_max; i<ni; i++)
         for (int s=0; s<ns; s++)
-            if (best_r < grid_scores[best_i*ns+best_s])
+            if (best_r < end_score(best_i, best_s))
             {
-                best_r = grid_scores[best_i*ns+best_s];
+                best_r = end_score(best_i, best_s);
                 best_i = i/SCALE;
                 best_s = s;
             }
@@ -255,14 +384,11 @@ int SuperBinarizer::Read(
             found_given_edge = true;
         if (1)
             m_edf_buf[x] = 0.8; // Paint gridpoint
-        int sp = grid_pred_ss[i*ns+s];
+        int sp = get_grid_pred(m_grid_pred_buf, i*ns+s, s, ns);
         i -= di_min + s;
         s = sp;
     }
 
-    delete[] grid_scores;
-    delete[] grid_pred_ss;
-
     //------------------------------------------------------------------------
 
     // Check that we managed to meet the boundary condition
@@ -26,6 +26,12 @@ class SuperBinarizer : public Binarizer
     float *m_edf_buf = 0;   // Edge detection function
     int m_bufsize = 0;
 
+    // Grid search, kept between calls
+    float *m_grid_band_buf = 0;   // Scores of the live grid rows
+    int m_grid_band_size = 0;
+    uint8_t *m_grid_pred_buf = 0; // Predecessor states, 2 bits per point
+    int m_grid_pred_size = 0;
+
 public:
     SuperBinarizer(const SuperBinarizer&) = delete;
     SuperBinarizer(const Sound& src, double t_ref);
@@ -33,7 +39,7 @@ public:
 
     // Sound parameters
     int GetSampleRate() const override { return m_short_filter.GetSampleRate(); }
-    int GetLength() const override { return m_long_filter.GetLength(); }
+    int64_t GetLength() const override { return m_long_filter.GetLength(); }
 
     // Main entry point. Return no. of events found
     int Read(
@@ -43,7 +49,7 @@ public:
         bool *evt_vals,       // Value transitioned to (or sustained)
         int evt_maxcnt,       // Max no of events to detect
 
-        int core_start,       // Offset in samples to region of interest
+        int64_t core_start,   // Offset in samples to region of interest
         int core_len,         // Length in samples of region of interest
 
         float *dbgbuf,        // Debug output buffer [len]
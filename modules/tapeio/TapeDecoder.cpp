@@ -5,25 +5,32 @@
 //  Internally two different decoders
 //  * demod_decoder - a demodulation based, slow format only decoder
 //  * dual_decoder - a decoder capable of both slow and fast formats
+//  Optionally decodes the channels of a stereo file separately and merges
+//  the results, see SplitDecoder
 //
 //  Copyright (c) 2021-2022 Erik Persson
 //
 //----------------------------------------------------------------------------
 
 #include "TapeDecoder.h"
+#include "ActivityMap.h"
 #include "DecodedByte.h"
 #include "DecoderBackend.h"
 #include "TrivialDecoder.h"
 #include "DemodDecoder.h"
 #include "DualDecoder.h"
 #include "XenonDecoder.h"
+#include "SplitDecoder.h"
 #include "TapeFile.h"
 #include "TapeParser.h"
+#include "TapeSurvey.h"
+#include "ThreadedBackend.h"
 
 #include <soundio/Sound.h>
 
 #include <assert.h>
 #include <stdlib.h>
+#include <tgmath.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -35,7 +42,8 @@ class MyParser : public TapeParser
 {
     TapeDecoder *m_dec;
 public:
-    MyParser(bool verbose, TapeDecoder *dec) : TapeParser(verbose)
+    MyParser(bool verbose, bool quiet, TapeDecoder *dec) :
+        TapeParser(verbose, quiet)
     {
         m_dec = dec;
     }
@@ -54,7 +62,7 @@ public:
 TapeDecoder::TapeDecoder(const DecoderOptions& options) :
     m_options(options)
 {
-    m_parser = new MyParser(options.verbose, this);
+    m_parser = new MyParser(options.verbose, options.quiet, this);
     Open();
 }
 
@@ -64,49 +72,91 @@ TapeDecoder::TapeDecoder(const char *filename) :
     m_options()
 {
     m_options.filename = filename;
-    m_parser = new MyParser(false, this);
+    m_parser = new MyParser(false, false, this);
     Open();
 }
 
 //----------------------------------------------------------------------------
 
-void TapeDecoder::Open()
+TapeDecoder::TapeDecoder(const Sound& src, const DecoderOptions& options) :
+    m_options(options)
 {
-    assert(m_options.filename);
+    m_parser = new MyParser(options.verbose, options.quiet, this);
+    Open(&src);
+}
 
-    // Select slow or fast in case clearly specified.
-    // Otherwise clear both flags for autodetect.
-    m_select_fast = m_options.fast && !m_options.slow;
-    m_select_slow = m_options.slow && !m_options.fast;
+//----------------------------------------------------------------------------
+
+// Open the given waveform, or else the file named in the options
+void TapeDecoder::Open(const Sound *opt_src)
+{
+    assert(opt_src || m_options.filename);
 
     Sound src;
+    if (opt_src)
+        src = *opt_src;
 
-    if (!src.ReadFromFile(m_options.filename, true /*silent*/))
+    if (!opt_src && !src.ReadFromFile(m_options.filename, true /*silent*/))
     {
         // Read as TAP archive
         m_backend0 = new TrivialDecoder(m_options);
     }
-    else if (m_options.dual)
+    else if (!opt_src && m_options.split_channels && src.GetFileChannelCnt() > 1)
     {
-        // Dual format (fast+slow) two-stage decoder
-        // Enable just one format in case clearly specified
-        // Otherwise enable both decoders for autodetect
-        bool decode_fast = m_options.fast || !m_options.slow;
-        bool decode_slow = m_options.slow || !m_options.fast;
-        m_backend0 = new DualDecoder(src, m_options, decode_fast, decode_slow);
+        // Each channel on its own, then the best of them
+        m_backend0 = new SplitDecoder(m_options, src.GetFileChannelCnt(), m_parser);
     }
     else
     {
-        // For fast format: Xenon decoder
-        if (!m_options.slow)
-            m_backend0 = new XenonDecoder(src, m_options);
-
-        // For slow format: Demodulation based decoder
-        // Faster and more accurate than dual_decoder, but can't do fast mode
-        if (!m_options.fast)
-            m_backend1 = new DemodDecoder(src, m_options);
+        // Decimate 88.2 kHz and up, which cost more without helping
+        if (m_options.decimate)
+            Decimate(&src);
+
+        // Pre-scan for stretches of silence and noise
+        if (m_options.skip || m_options.survey)
+            m_activity = new ActivityMap(src, m_options);
+        const ActivityMap *skip_map = m_options.skip ? m_activity : 0;
+
+        // Measure format and clock, may narrow down the options
+        if (m_options.survey)
+            Survey(src);
+
+        if (m_options.dual)
+        {
+            // Dual format (fast+slow) two-stage decoder
+            // Enable just one format in case clearly specified
+            // Otherwise enable both decoders for autodetect
+            bool decode_fast = m_options.fast || !m_options.slow;
+            bool decode_slow = m_options.slow || !m_options.fast;
+            m_backend0 = new DualDecoder(src, m_options, decode_fast, decode_slow,
+                                         skip_map);
+        }
+        else
+        {
+            // For fast format: Xenon decoder
+            if (!m_options.slow)
+                m_backend0 = new XenonDecoder(src, m_options, skip_map);
+
+            // For slow format: Demodulation based decoder
+            // Faster and more accurate than dual_decoder, but can't do fast mode
+            if (!m_options.fast)
+                m_backend1 = new DemodDecoder(src, m_options, skip_map);
+
+            // Decode both formats side by side. ReadByte merges them
+            // in time order, as it would with the plain backends.
+            if (m_backend0 && m_backend1 && m_options.threads)
+            {
+                m_backend0 = new ThreadedBackend(m_backend0);
+                m_backend1 = new ThreadedBackend(m_backend1);
+            }
+        }
     }
 
+    // Select slow or fast in case clearly specified.
+    // Otherwise clear both flags for autodetect.
+    m_select_fast = m_options.fast && !m_options.slow;
+    m_select_slow = m_options.slow && !m_options.fast;
+
     // Peek buffer
     // Always have one byte read out unless at EOF
     m_backend0_byte_ok = m_backend0 && m_backend0->DecodeByte(&m_backend0_byte);
@@ -115,10 +165,76 @@ void TapeDecoder::Open()
 
 //----------------------------------------------------------------------------
 
+// Downsample by an integer factor to a canonical rate of 44.1 kHz or more.
+// Windows, filters and state spaces in all backends scale with the rate,
+// and about 9 samples per physical bit is plenty.
+// The factor must divide the rate, so that the result is a whole number
+// of Hz. This holds for all the usual multiples of 44.1 and 48 kHz.
+void TapeDecoder::Decimate(Sound *src)
+{
+    const int canonical_rate = 44100;
+
+    int rate = src->GetSampleRate();
+    int down_factor = rate/canonical_rate;
+    if (down_factor > 1 && rate % down_factor != 0)
+    {
+        m_parser->VerboseLog("Not decimating %d Hz input, no whole factor\n", rate);
+    }
+    else if (down_factor > 1)
+    {
+        m_parser->VerboseLog("Decimating %d Hz input to %d Hz\n",
+                             rate, rate/down_factor);
+
+        // Filtered lazily, block by block. The computed blocks are cached
+        // while the pre-scan, survey and decoders all share the sound.
+        src->Downsample(down_factor);
+    }
+}
+
+//----------------------------------------------------------------------------
+
+// Run spectral survey of the tape
+// Restrict to one format, and narrow the clock search, when it is clear
+void TapeDecoder::Survey(const Sound& src)
+{
+    TapeSurvey survey(src, *m_activity, m_options);
+
+    for (int i=0; i<survey.GetRegionCount(); i++)
+    {
+        const SurveyRegion& region = survey.GetRegion(i);
+        const char *format =
+            region.format == SURVEY_FAST ? "fast" :
+            region.format == SURVEY_SLOW ? "slow" : "unknown";
+        if (region.f_clk > 0)
+            m_parser->VerboseLog(region.start, "Survey: %s format, clock %.0f Hz\n",
+                                 format, region.f_clk);
+        else
+            m_parser->VerboseLog(region.start, "Survey: %s format, clock unknown\n",
+                                 format);
+    }
+
+    // An explicit format takes precedence
+    if (!m_options.fast && !m_options.slow)
+    {
+        m_options.fast = survey.GetFormat() == SURVEY_FAST;
+        m_options.slow = survey.GetFormat() == SURVEY_SLOW;
+    }
+
+    // Track the measured clock in a window about half as wide
+    if (survey.GetClock() > 0)
+    {
+        m_options.f_ref = (int) floor(0.5 + survey.GetClock());
+        m_options.clock_window = .5;
+    }
+}
+
+//----------------------------------------------------------------------------
+
 TapeDecoder::~TapeDecoder()
 {
     delete m_backend0;
     delete m_backend1;
+    delete m_activity;
     delete m_parser;
 }
 
@@ -175,11 +291,30 @@ bool TapeDecoder::ReadByte(DecodedByte *b)
                 return true;
         }
     }
+    ReportEnd();
     return false; // End of tape
 }
 
 //----------------------------------------------------------------------------
 
+// Log how much audio the backends skipped, once at end of tape
+void TapeDecoder::ReportEnd()
+{
+    if (m_end_reported)
+        return;
+    m_end_reported = true;
+
+    double t = 0;
+    if (m_backend0)
+        t = m_backend0->GetSkippedTime();
+    if (m_backend1 && t < m_backend1->GetSkippedTime())
+        t = m_backend1->GetSkippedTime();
+    if (t > 0)
+        m_parser->VerboseLog("Skipped %.1f seconds of inactive audio\n", t);
+}
+
+//----------------------------------------------------------------------------
+
 // Decode waveform to bytestream and parse to files
 bool TapeDecoder::ReadFile(TapeFile *file)
 {
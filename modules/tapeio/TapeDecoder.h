@@ -16,6 +16,8 @@
 #include <vector>
 
 class DecoderBackend;
+class ActivityMap;
+class Sound;
 
 //----------------------------------------------------------------------------
 
@@ -24,6 +26,7 @@ class TapeDecoder
 {
     DecoderOptions m_options;
 
+    ActivityMap *m_activity = 0;
     DecoderBackend *m_backend0 = 0;
     DecoderBackend *m_backend1 = 0;
 
@@ -37,10 +40,14 @@ class TapeDecoder
     TapeParser *m_parser = 0;
     TapeFile *m_result_file = 0;
     bool m_result_file_produced = false;
+    bool m_end_reported = false;
 
 public:
     TapeDecoder(const DecoderOptions& options);
     TapeDecoder(const char *filename);
+
+    // Decode a waveform in memory, options.filename is not used
+    TapeDecoder(const Sound& src, const DecoderOptions& options);
     virtual ~TapeDecoder();
 
     // Main entry point - read one file from tape
@@ -60,7 +67,10 @@ public:
     void OnFile(const TapeFile& file);
 
 private:
-    void Open();
+    void Open(const Sound *opt_src = 0);
+    void Decimate(Sound *src);
+    void Survey(const Sound& src);
+    void ReportEnd();
 };
 
 #endif
@@ -7,20 +7,98 @@
 //----------------------------------------------------------------------------
 
 #include "TapeEncoder.h"
+#include "WorkerPool.h"
 #include <soundio/SoundWriter.h>
 #include <soundio/SoundPlayer.h>
 #include <tgmath.h>
 #include <assert.h>
+#include <string.h>
 #include <unistd.h>
+#include <algorithm>
+#include <numeric>
+
+// We use 60% of the available amplitude range
+static const float s_levels[LEVEL_CNT] = { -0.6, 0, 0.6 };
+
+// Ramps per chunk in parallel encoding, about 27 seconds of output
+static const int64_t CHUNK_RAMPS = 1<<17;
+
+// Chunks rendered at a time, about 4.7 MB of samples each at 44100 Hz
+static const int MAX_BATCH_LEN = 8;
 
 //----------------------------------------------------------------------------
 
 TapeEncoder::TapeEncoder()
 {
+}
+
+//----------------------------------------------------------------------------
+
+// Set up the ramp template and fragment table for a sample rate
+//
+// The template is a raised cosine over one switching period, which keeps
+// the edges band-limited well below the Nyquist rate. Output sample n
+// falls at the phase n*m_ramp_step modulo m_ramp_len. This is the exact
+// rational SWITCH_RATE/rate, reduced and then scaled up to at least
+// RAMP_MIN_LEN points, so the phase never drifts. At 44100 Hz this
+// gives 48/441.
+bool TapeEncoder::SetRate(int rate)
+{
+    if (rate < 2*SWITCH_RATE)
+    {
+        fprintf(stderr, "Sample rate %d Hz too low for encoding\n", rate);
+        return false;
+    }
+    if (rate > ENCODER_MAX_RATE)
+    {
+        fprintf(stderr, "Sample rate %d Hz too high for encoding\n", rate);
+        return false;
+    }
+    if (rate == m_rate)
+        return true;
+
+    int g = std::gcd(rate, SWITCH_RATE);
+    int len = rate/g;
+    int step = SWITCH_RATE/g;
+    int scale = (RAMP_MIN_LEN + len-1)/len;
+    m_rate = rate;
+    m_ramp_len = len*scale;
+    m_ramp_step = step*scale;
+
     // Form a template m_ramp from 0.0 to 1.0
-    float k = M_PI/RAMP_LEN;
-    for (int i= 0; i<RAMP_LEN; i++)
+    m_ramp.resize(m_ramp_len);
+    float k = M_PI/m_ramp_len;
+    for (int i= 0; i<m_ramp_len; i++)
         m_ramp[i] = .5 - .5 * cos(k*i);
+
+    // Render every ramp between two levels, from every start phase.
+    // The phase advances by m_ramp_step per sample and wraps by m_ramp_len
+    // per ramp, so a ramp always starts at a phase below m_ramp_step.
+    int max_cnt = (m_ramp_len + m_ramp_step-1)/m_ramp_step;
+    m_fragments.resize(LEVEL_CNT*LEVEL_CNT*m_ramp_step);
+    m_fragment_data.resize(m_fragments.size()*max_cnt);
+    float *data = m_fragment_data.data();
+    for (int from=0; from<LEVEL_CNT; from++)
+        for (int to=0; to<LEVEL_CNT; to++)
+            for (int phase0=0; phase0<m_ramp_step; phase0++)
+            {
+                Fragment& f = m_fragments[(from*LEVEL_CNT + to)*m_ramp_step + phase0];
+                float y0 = s_levels[from];
+                float y = s_levels[to];
+                int phase = phase0;
+                f.data = data;
+                f.cnt = 0;
+                while (phase<m_ramp_len)
+                {
+                    assert(f.cnt < max_cnt);
+                    data[f.cnt++] = y0 + m_ramp[phase]*(y-y0);
+                    phase += m_ramp_step;
+                }
+                f.next_phase = phase - m_ramp_len;
+                assert(f.next_phase < m_ramp_step);
+                data += max_cnt;
+            }
+    return true;
 }
 
 //----------------------------------------------------------------------------
@@ -35,114 +113,122 @@ TapeEncoder::~TapeEncoder()
 // Write out buffered samples to sound file or line out
 void TapeEncoder::EmitFlush()
 {
-    if (m_buf_cnt && m_open && m_ok)
+    if (m_synth.buf.size() && m_open && m_ok)
     {
-        m_ok = m_sink->Write(m_buf, m_buf_cnt);
+        m_ok = m_sink->Write(m_synth.buf.data(), (int) m_synth.buf.size());
     }
-    m_buf_cnt = 0;
+    m_synth.buf.clear();
 }
 
 //----------------------------------------------------------------------------
 
-void TapeEncoder::EmitSample(float y)
+// Switch to level via cosine ramp, copied from the fragment table
+void TapeEncoder::RampTo(Synth *s, int level) const
 {
-    assert(m_buf_cnt < ENCODER_BUFSIZE);
-    m_buf[m_buf_cnt++] = y;
-    if (m_buf_cnt == ENCODER_BUFSIZE)
-        EmitFlush();
+    const Fragment& f = GetFragment(s->last_level, level, s->ramp_phase);
+    size_t cnt = s->buf.size();
+    s->buf.resize(cnt + f.cnt);
+    memcpy(s->buf.data() + cnt, f.data, f.cnt*sizeof(float));
+    s->ramp_phase = f.next_phase;
+    s->last_level = level;
 }
 
 //----------------------------------------------------------------------------
 
-// Switch to value via cosine ramp
-void TapeEncoder::RampTo(float y)
+void TapeEncoder::EmitBit(Synth *s, bool val) const
 {
-    float y0 = m_last_y;
-    while (m_ramp_phase<RAMP_LEN)
-    {
-        float yy = y0 + m_ramp[m_ramp_phase]*(y-y0);
-        EmitSample(yy);
-        m_ramp_phase += RAMP_STEP;
-    }
-    m_ramp_phase -= RAMP_LEN;
-    m_last_y = y;
-}
-
-//----------------------------------------------------------------------------
-
-void TapeEncoder::EmitBit(bool val)
-{
-    // We use 60% of the available amplitude range
-    RampTo(val ? 0.6 : -0.6);
-    m_last_bit = val;
+    RampTo(s, val ? LEVEL_HIGH : LEVEL_LOW);
+    s->last_bit = val;
 }
 
 //----------------------------------------------------------------------------
 
 // If no filename is given then output to speaker
-bool TapeEncoder::Open(const char *opt_filename, bool slow)
+bool TapeEncoder::Open(const char *opt_filename, bool slow, int rate)
 {
     Close();
     m_slow = slow;
+    if (!SetRate(rate))
+        return m_ok = false;
 
     if (opt_filename)
     {
         SoundWriter *writer = new SoundWriter;
         m_sink = writer;
-        m_ok = m_open = writer->Open(opt_filename, ENCODER_RATE);
+        m_ok = m_open = writer->Open(opt_filename, rate);
     }
     else
     {
         SoundPlayer *player = new SoundPlayer;
         m_sink = player;
-        m_ok = m_open = player->Open(ENCODER_RATE);
+        m_ok = m_open = player->Open(rate);
     }
-    m_last_y = 0;
-    m_last_bit = false;
-    m_ramp_phase = 0;
+    m_own_sink = true;
+    m_synth = Synth();
+    m_synth.buf.reserve(2*ENCODER_BUFSIZE);
     return m_ok;
 }
 
 //----------------------------------------------------------------------------
 
-bool TapeEncoder::EncodeBit(bool val)
+// Encode into a sink owned by the caller
+bool TapeEncoder::Open(SoundSink *sink, bool slow, int rate)
 {
-    bool polarity = m_last_bit;
+    assert(sink);
+    Close();
+    m_slow = slow;
+    if (!SetRate(rate))
+        return m_ok = false;
+
+    m_sink = sink;
+    m_own_sink = false;
+    m_ok = m_open = true;
+    m_synth = Synth();
+    m_synth.buf.reserve(2*ENCODER_BUFSIZE);
+    return m_ok;
+}
+
+//----------------------------------------------------------------------------
+
+// Each bit ends on the polarity it started with
+void TapeEncoder::EncodeBit(Synth *s, bool val) const
+{
+    bool polarity = s->last_bit;
     if (m_slow)
     {
         for (int i= 0; i<16; i++)
         {
             bool y = val ? !(i&1) : !(i&2);
-            EmitBit( y ^ polarity );
+            EmitBit( s, y ^ polarity );
         }
     }
     else
     {
-        EmitBit( !polarity );
-        EmitBit( polarity );
+        EmitBit( s, !polarity );
+        EmitBit( s, polarity );
         if (!val)
-            EmitBit( polarity );
+            EmitBit( s, polarity );
     }
-    return m_ok;
 }
 
 //----------------------------------------------------------------------------
 
-void TapeEncoder::EncodeByte(uint8_t byte)
+// Each byte inverts the polarity, by its extra cycle
+void TapeEncoder::EncodeByte(Synth *s, uint8_t byte) const
 {
-    EncodeBit(false);    // start bit
+    EncodeBit(s, false);    // start bit
     bool parity = true;
     for (int i=0; i<8; i++)
     {
         bool bit = (byte>>i)&1;
-        EncodeBit(bit); // data bit
+        EncodeBit(s, bit); // data bit
         parity ^= bit;
     }
-    EncodeBit(parity);    // odd parity
-    EncodeBit(true);      // stop bits
-    EncodeBit(true);      // stop bits
-    EncodeBit(true);      // stop bits
-    EmitBit(!m_last_bit); // extra cycle
+    EncodeBit(s, parity);    // odd parity
+    EncodeBit(s, true);      // stop bits
+    EncodeBit(s, true);      // stop bits
+    EncodeBit(s, true);      // stop bits
+    EmitBit(s, !s->last_bit); // extra cycle
 }
 
 //----------------------------------------------------------------------------
@@ -163,22 +249,134 @@ void TapeEncoder::FinishEncode()
 // Function which runs in background thread
 void TapeEncoder::EncodeThread()
 {
-    for (auto c: m_inbuf)
-        EncodeByte(c);
+    int helper_cnt = !m_threads ? 0 :
+                     m_helper_cnt >= 0 ? m_helper_cnt :
+                     WorkerPool::GetHelperCount(MAX_BATCH_LEN);
+    if (!helper_cnt || !EncodeParallel(helper_cnt))
+    {
+        for (auto c: m_inbuf)
+        {
+            EncodeByte(&m_synth, c);
+            if ((int) m_synth.buf.size() >= ENCODER_BUFSIZE)
+                EmitFlush();
+        }
+    }
     m_inbuf.clear();
-    RampTo(0);
+    RampTo(&m_synth, LEVEL_ZERO);
     EmitFlush();
     m_sink->Flush(); // make sure player starts even if sound was short
 }
 
 //----------------------------------------------------------------------------
 
-void TapeEncoder::CountBit(bool val)
+// Encode m_inbuf in chunks on worker threads, and write them in order
+//
+// The state at the start of each chunk is known without encoding what
+// comes before. Every ramp advances the phase by m_ramp_step per sample
+// and wraps by m_ramp_len, so after n ramps from phase p0, s samples have
+// been output, where s is the least with p0 + s*m_ramp_step - n*m_ramp_len
+// >= 0, and that is the new phase. Every byte inverts the polarity, and
+// leaves the level at the polarity.
+// Return false, having done nothing, if the input is less than two chunks.
+bool TapeEncoder::EncodeParallel(int helper_cnt)
+{
+    // Split into chunks of about CHUNK_RAMPS ramps
+    std::vector<size_t> chunk_start;
+    std::vector<int64_t> chunk_ramps; // ramps before chunk
+    int64_t ramps = 0;
+    for (size_t i=0; i<m_inbuf.size(); i++)
+    {
+        if (i==0 || ramps - chunk_ramps.back() >= CHUNK_RAMPS)
+        {
+            chunk_start.push_back(i);
+            chunk_ramps.push_back(ramps);
+        }
+        ramps += CountByte(m_inbuf[i]);
+    }
+    chunk_start.push_back(m_inbuf.size());
+    int chunk_cnt = (int) chunk_ramps.size();
+
+    if (chunk_cnt < 2)
+        return false; // not worth it
+
+    // Render a batch of chunks at a time, to bound the memory used
+    int batch_len = std::min(helper_cnt+1, MAX_BATCH_LEN);
+    WorkerPool pool(batch_len-1);
+    std::vector<Synth> synths(batch_len);
+    Synth first = m_synth;
+    EmitFlush();
+
+    for (int c0=0; c0<chunk_cnt && m_ok; c0+=batch_len)
+    {
+        int cnt = std::min(batch_len, chunk_cnt-c0);
+        for (int k=0; k<cnt; k++)
+        {
+            int c = c0+k;
+            Synth *s = &synths[k];
+            if (c==0)
+                *s = first;
+            else
+            {
+                int64_t n = chunk_ramps[c];
+                int64_t s_cnt = (n*m_ramp_len - first.ramp_phase + m_ramp_step-1)/m_ramp_step;
+                s->ramp_phase = (int) (first.ramp_phase + s_cnt*m_ramp_step - n*m_ramp_len);
+                s->last_bit = first.last_bit ^ (chunk_start[c] & 1);
+                s->last_level = s->last_bit ? LEVEL_HIGH : LEVEL_LOW;
+            }
+            s->buf.clear();
+
+            pool.Submit([this, s, c, &chunk_start]()
+            {
+                for (size_t i=chunk_start[c]; i<chunk_start[c+1]; i++)
+                    EncodeByte(s, m_inbuf[i]);
+            });
+        }
+        pool.Wait();
+
+        for (int k=0; k<cnt && m_ok; k++)
+            m_ok = m_sink->Write(synths[k].buf.data(), (int) synths[k].buf.size());
+
+        // Carry on from the end of the batch
+        m_synth.ramp_phase = synths[cnt-1].ramp_phase;
+        m_synth.last_level = synths[cnt-1].last_level;
+        m_synth.last_bit = synths[cnt-1].last_bit;
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+// Number of ramps to encode a bit
+int TapeEncoder::CountBit(bool val) const
 {
     if (m_slow)
-        m_put_phys_bits += 16;
+        return 16;
     else
-        m_put_phys_bits += val ? 2 : 3;
+        return val ? 2 : 3;
+}
+
+//----------------------------------------------------------------------------
+
+// Number of ramps to encode a byte
+int TapeEncoder::CountByte(uint8_t byte) const
+{
+    if (m_slow)
+        return 209;
+
+    int cnt = CountBit(false);    // start bit
+    bool parity = true;
+    for (int i=0; i<8; i++)
+    {
+        bool bit = (byte>>i)&1;
+        cnt += CountBit(bit); // data bit
+        parity ^= bit;
+    }
+    cnt += CountBit(parity);    // odd parity
+    cnt += CountBit(true);      // stop bits
+    cnt += CountBit(true);      // stop bits
+    cnt += CountBit(true);      // stop bits
+    cnt += 1; // extra cycle
+    return cnt;
 }
 
 //----------------------------------------------------------------------------
@@ -189,24 +387,7 @@ void TapeEncoder::PutByte(uint8_t byte)
     FinishEncode();
 
     m_inbuf.push_back(byte);
-    if (m_slow)
-        m_put_phys_bits += 209;
-    else
-    {
-        CountBit(false);    // start bit
-        bool parity = true;
-        for (int i=0; i<8; i++)
-        {
-            bool bit = (byte>>i)&1;
-            CountBit(bit); // data bit
-            parity ^= bit;
-        }
-        CountBit(parity);    // odd parity
-        CountBit(true);      // stop bits
-        CountBit(true);      // stop bits
-        CountBit(true);      // stop bits
-        m_put_phys_bits += 1; // extra cycle
-    }
+    m_put_phys_bits += CountByte(byte);
 }
 
 //----------------------------------------------------------------------------
@@ -276,13 +457,17 @@ bool TapeEncoder::Close()
 
     if (m_open)
     {
-        m_sink->Close();
+        if (m_own_sink)
+            m_sink->Close();
+        else
+            m_sink->Flush();
         m_open = false;
     }
 
     if (m_sink)
     {
-        delete m_sink;
+        if (m_own_sink)
+            delete m_sink;
         m_sink = 0;
     }
 
@@ -298,7 +483,7 @@ double TapeEncoder::GetDuration() const
         return 0; // no ramping out in this case
 
     // A.k.a 1.0/4800
-    double cycle_time = ((double) RAMP_LEN)/RAMP_STEP/ENCODER_RATE;
+    double cycle_time = ((double) m_ramp_len)/m_ramp_step/m_rate;
     return cycle_time*(m_put_phys_bits+1); // one extra for end ramp
 }
 
@@ -317,7 +502,7 @@ double TapeEncoder::GetElapsedTime() const
 {
     double t = m_sink->GetElapsedTime(); // thread safe
     double t1 = GetDuration();
-    double tol = 10.0/ENCODER_RATE; // 10 sample tolerance for rounding error
+    double tol = 10.0/m_rate; // 10 sample tolerance for rounding error
 
     // Make sure to arrive at duration even in case of some roundoff error.
     return t > t1-tol ? t1 : t;
@@ -2,6 +2,10 @@
 //
 //  TapeEncoder - encoder for Oric tape format
 //
+//  * Synthesizes from pre-rendered ramps between output levels
+//  * Any sample rate, stepping through the ramp with an exact rational phase
+//  * Encodes in the background, and large inputs in parallel chunks
+//
 //  Copyright (c) 2021-2022 Erik Persson
 //
 //----------------------------------------------------------------------------
@@ -18,25 +22,58 @@
 class SoundSink;
 
 #define ENCODER_BUFSIZE (1024)
-#define ENCODER_RATE    (44100)
-#define RAMP_LEN        (441) // No. of samples in ramp template
-#define RAMP_STEP       (48)  // Step to take for 4800 Hz switching rate
+#define ENCODER_RATE    (44100) // Default sample rate
+#define ENCODER_MAX_RATE (192000) // Highest sample rate
+#define SWITCH_RATE     (4800)  // Level switches per second
+#define RAMP_MIN_LEN    (400)   // Least no. of points in ramp template
+
+// Output levels, as indices into the fragment table
+#define LEVEL_LOW       (0)
+#define LEVEL_ZERO      (1)
+#define LEVEL_HIGH      (2)
+#define LEVEL_CNT       (3)
 
 class TapeEncoder
 {
+    // Pre-rendered ramp from one level to another
+    // Ramps start at a phase below m_ramp_step, so there are m_ramp_step
+    // of each
+    struct Fragment
+    {
+        const float *data;  // in m_fragment_data
+        int cnt;
+        int next_phase;
+    };
+
+    // Synthesis state and rendered samples, one per thread encoding
+    struct Synth
+    {
+        std::vector<float> buf;
+        int ramp_phase = 0; // 0..m_ramp_step-1
+        int last_level = LEVEL_ZERO;
+        bool last_bit = false;
+    };
+
     int m_put_phys_bits = 0;
     std::vector<uint8_t> m_inbuf;
 
-    float m_buf[ENCODER_BUFSIZE];
-    int m_buf_cnt = 0;
+    Synth m_synth;
     SoundSink *m_sink = 0;
+    bool m_own_sink = false;
     bool m_open = false;
     bool m_ok = true;
     bool m_slow = true;
-    float m_ramp[RAMP_LEN];
-    int m_ramp_phase = 0; // 0..RAMP_LEN-1;
-    float m_last_y = 0;
-    bool m_last_bit = false;
+    bool m_threads = true;
+    int m_helper_cnt = -1;
+
+    // Ramp template covering one switching period, and the step through
+    // it per output sample. m_ramp_step/m_ramp_len is SWITCH_RATE/m_rate.
+    int m_rate = 0;
+    int m_ramp_len = 0;
+    int m_ramp_step = 0;
+    std::vector<float> m_ramp;
+    std::vector<Fragment> m_fragments; // [from][to][phase]
+    std::vector<float> m_fragment_data;
 
     // Background encoding
     std::thread *m_enc_thread = 0;
@@ -46,7 +83,23 @@ public:
     ~TapeEncoder();
 
     // Open output file or player
-    bool Open(const char *opt_filename, bool slow);
+    // Rates below 2*SWITCH_RATE or above ENCODER_MAX_RATE are refused.
+    bool Open(const char *opt_filename, bool slow, int rate = ENCODER_RATE);
+
+    // Output to a sink opened by the caller, at the given rate
+    // The sink is flushed but not closed, and must outlive the encoder
+    // or the next Open.
+    bool Open(SoundSink *sink, bool slow, int rate = ENCODER_RATE);
+
+    // Sample rate of the output
+    int GetSampleRate() const { return m_rate; }
+
+    // Allow encoding large inputs on several threads (default on)
+    // Output is the same either way
+    void SetThreads(bool threads) { m_threads = threads; }
+
+    // Helper threads for large inputs, -1 to follow the no. of cores
+    void SetHelperCount(int helper_cnt) { m_helper_cnt = helper_cnt; }
 
     // Enqueue single byte for encoding
     void PutByte(uint8_t byte);
@@ -75,15 +128,22 @@ public:
     void Flush(double timeout = 1e9);
 
 protected:
+    bool SetRate(int rate);
+    const Fragment& GetFragment(int from, int to, int phase) const
+    {
+        return m_fragments[(from*LEVEL_CNT + to)*m_ramp_step + phase];
+    }
+
     void EmitFlush();
-    void EmitSample(float y);
-    void RampTo(float y);
-    void EmitBit(bool val);
-    bool EncodeBit(bool val);
-    void EncodeByte(uint8_t byte);
-    void CountBit(bool val);
+    void RampTo(Synth *s, int level) const;
+    void EmitBit(Synth *s, bool val) const;
+    void EncodeBit(Synth *s, bool val) const;
+    void EncodeByte(Synth *s, uint8_t byte) const;
+    int CountBit(bool val) const;
+    int CountByte(uint8_t byte) const;
 
     void EncodeThread();
+    bool EncodeParallel(int helper_cnt);
     void StartEncode();
     void FinishEncode();
 };
@@ -0,0 +1,145 @@
+//----------------------------------------------------------------------------
+//
+//  TapeFile - File extracted from tape
+//
+//  Copyright (c) 2021-2023 Erik Persson
+//
+//----------------------------------------------------------------------------
+
+#include "TapeFile.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <tgmath.h>
+
+//----------------------------------------------------------------------------
+
+// Check if file name can be used for extracted file
+static bool is_valid_file_name(const uint8_t *name)
+{
+    bool is_valid = false;
+    if (name[0]) // Forbid empty filename
+    {
+        is_valid = true;
+
+        // Forbid non-ASCII chars
+        // Forbid Windows illegal chars
+        // 0-31 \ / : * ? " < > | 128-255
+        for (int i= 0; name[i]; i++)
+        {
+            uint8_t c = name[i];
+            if (c<32 || c>127 || c=='\\' || c=='/' || c==':' || c=='*' ||
+                c=='?' || c=='"' || c=='<' || c=='>' || c=='|')
+            {
+                is_valid = false;
+            }
+        }
+
+        // Also forbid names matching our autogenerated names
+        if (name[0] == 'F' &&
+            name[1] == 'I' &&
+            name[2] == 'L' &&
+            name[3] == 'E' &&
+            name[4] == '_' &&
+            name[5] == 'A' &&
+            name[6] == 'T' &&
+            name[7] == '_')
+        {
+            is_valid = false;
+        }
+    }
+    return is_valid;
+}
+
+//----------------------------------------------------------------------------
+
+// Adjust file name from tape so it can be used on disk
+// Add used names to set
+void adjust_file_name(char *adjusted_name, int bufsize,
+    std::unordered_set<std::string> *used_names,
+    const TapeFile& file, bool add_extension)
+{
+    // Normally 0-15 chars in filename
+    // Tolerate 16 in case terminal null is absent
+
+    // Avoid empty or otherwise problematic names
+    char valid_name[32];
+    assert(strlen((const char *) file.name)<=16);
+    if (is_valid_file_name(file.name))
+        strcpy(valid_name, (const char *) file.name);
+    else
+    {
+        int sec0 = (int) floor(file.start_time);
+        int len = snprintf(valid_name, sizeof(valid_name),
+                 "FILE_AT_%02d_%02d", sec0/60, sec0%60);
+        assert(len < (int) sizeof(valid_name));
+    }
+
+    // If the same file name occurs multiple times,
+    // append -<n> where n makes the file name unique.
+    if (1)
+    {
+        char try_name[44];
+        assert(strlen(valid_name) < sizeof(try_name));
+        strcpy(try_name, valid_name);
+
+        int unique_no = 0;
+        while (used_names->find(try_name) != used_names->end())
+        {
+            unique_no++;
+            int len = snprintf(try_name, sizeof(try_name),
+                "%s-%d", valid_name, unique_no);
+            assert(len < (int) sizeof(try_name));
+        }
+        assert((int) strlen(try_name) < bufsize);
+        strcpy(adjusted_name, try_name);
+        used_names->insert(adjusted_name);
+    }
+
+    // Add .tap extension
+    if (add_extension)
+    {
+        assert((int) strlen(adjusted_name)+4 < bufsize);
+        strcat(adjusted_name, ".tap");
+    }
+}
+
+//----------------------------------------------------------------------------
+
+// Write one file as a .tap archive of its own
+// Return false on failure, with errno set
+bool write_tap_file(const char *path, const TapeFile& file)
+{
+    bool ok = false;
+    if (FILE *f = fopen(path, "wb"))
+    {
+        ok = true;
+
+        uint8_t preamble[4] = { 0x16, 0x16, 0x16, 0x24 };
+        if (fwrite(preamble, 1, 4, f) != 4)
+            ok = false;
+
+        if (ok)
+        {
+            if (fwrite(file.header, 1, sizeof(file.header), f) != sizeof(file.header))
+                ok = false;
+        }
+
+        if (ok)
+        {
+            size_t namelen = strlen((const char *) file.name) + 1;
+            if (fwrite(file.name, 1, namelen, f) != namelen)
+                ok = false;
+        }
+
+        if (ok && file.len)
+        {
+            if (fwrite(file.payload, 1, file.len, f) != (size_t) file.len)
+                ok = false;
+        }
+
+        fclose(f);
+    }
+    return ok;
+}
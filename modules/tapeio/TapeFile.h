@@ -2,7 +2,7 @@
 //
 //  TapeFile - File extracted from tape
 //
-//  Copyright (c) 2021-2022 Erik Persson
+//  Copyright (c) 2021-2023 Erik Persson
 //
 //----------------------------------------------------------------------------
 
@@ -10,6 +10,8 @@
 #define TAPEFILE_H
 
 #include <stdint.h>
+#include <string>
+#include <unordered_set>
 
 //----------------------------------------------------------------------------
 
@@ -35,4 +37,16 @@ struct TapeFile
     double   end_time;     // time past end byte, seconds
 };
 
+//----------------------------------------------------------------------------
+
+// Adjust file name from tape so it can be used on disk
+// Add used names to set
+void adjust_file_name(char *adjusted_name, int bufsize,
+    std::unordered_set<std::string> *used_names,
+    const TapeFile& file, bool add_extension);
+
+// Write one file as a .tap archive of its own
+// Return false on failure, with errno set
+bool write_tap_file(const char *path, const TapeFile& file);
+
 #endif
@@ -39,10 +39,11 @@ static void print_time(FILE *f, double time)
 
 //----------------------------------------------------------------------------
 
-TapeParser::TapeParser(bool verbose)
+TapeParser::TapeParser(bool verbose, bool quiet)
 {
     Reset();
     m_verbose = verbose;
+    m_quiet = quiet;
 }
 
 //----------------------------------------------------------------------------
@@ -311,7 +312,7 @@ void TapeParser::PutByte(const DecodedByte& b)
                 PrintFlush();
                 if (m_verbose)
                     VerboseLog(b.time, "Unsupported header, ignoring file\n");
-                else
+                else if (!m_quiet)
                 {
                     if (m_scout_file.sync_errors || m_scout_file.parity_errors)
                         // Suspect the reason is decoding quality rather than exotic file type
@@ -392,7 +393,7 @@ void TapeParser::PutByte(const DecodedByte& b)
             PrintFlush();
             if (m_verbose)
                 VerboseLog(b.time, "Too long file name, ignoring file\n");
-            else
+            else if (!m_quiet)
             {
                 if (m_scout_file.sync_errors || m_scout_file.parity_errors)
                     // Suspect the reason is decoding quality rather than exotic file type
@@ -421,7 +422,8 @@ void TapeParser::FlushPayload()
         int capacity = sizeof(m_payload_file.payload)/sizeof(m_payload_file.payload[0]);
 
         int missing_bytes = m_payload_file.len - m_payload_offs;
-        fprintf(stderr, "Warning: File truncated with %d missing bytes\n", missing_bytes);
+        if (!m_quiet)
+            fprintf(stderr, "Warning: File truncated with %d missing bytes\n", missing_bytes);
 
         // Pad file to its expected length
         while (missing_bytes--)
@@ -33,6 +33,7 @@ class TapeParser
     TapeFile m_payload_file; // data of file in late stage processing
 
     bool m_verbose;          // print out log of parser events when set
+    bool m_quiet;            // suppress warnings when set
 
     DecodedByte m_printbuf[16];
     int m_printbuf_cnt = 0;
@@ -44,7 +45,7 @@ protected:
     double m_last_time = 0;  // time coordinate of last processed byte
 
 public:
-    TapeParser(bool verbose);
+    TapeParser(bool verbose, bool quiet = false);
     virtual ~TapeParser() {};
 
     // This may be overriden to capture extracted files
@@ -0,0 +1,184 @@
+//----------------------------------------------------------------------------
+//
+//  TapeSurvey - Spectral pre-analysis of a tape recording
+//
+//  Copyright (c) 2021-2023 Erik Persson
+//
+//  Both formats are built from physical bits on a grid at the bit clock.
+//  The squared derivative of the signal peaks at each transition, so its
+//  spectrum has a line at the bit clock regardless of the data. We find
+//  it with a sweep of Goertzel filters, summing power over short blocks
+//  to get a smooth estimate.
+//
+//  Given the clock, the format shows in the 1200 Hz tone (clock/4) that
+//  only slow format has. Fast format spreads its power over many lines.
+//
+//  Polarity is not estimated. The encoder inverts fast format after every
+//  byte and slow format is symmetric, so it carries no information, and
+//  the decoders already accept either polarity.
+//----------------------------------------------------------------------------
+
+#include "TapeSurvey.h"
+#include "ActivityMap.h"
+
+#include <soundio/Sound.h>
+
+#include <assert.h>
+#include <tgmath.h>
+#include <algorithm>
+
+//----------------------------------------------------------------------------
+
+// Sum of Goertzel power at one frequency over consecutive blocks of n samples
+static double block_power(const float *x, int len, int n, double f_hz, int rate)
+{
+    float coeff = 2*cos(2*M_PI*f_hz/rate);
+    double sum = 0;
+    for (int b=0; b+n<=len; b+=n)
+    {
+        float s1 = 0;
+        float s2 = 0;
+        for (int i=0; i<n; i++)
+        {
+            float s0 = x[b+i] + coeff*s1 - s2;
+            s2 = s1;
+            s1 = s0;
+        }
+        sum += s1*s1 + s2*s2 - coeff*s1*s2;
+    }
+    return sum;
+}
+
+//----------------------------------------------------------------------------
+
+TapeSurvey::TapeSurvey(const Sound& src, const ActivityMap& activity,
+                       const DecoderOptions& options)
+{
+    int sample_rate = src.GetSampleRate();
+
+    // Leave out the margins ActivityMap adds, and look at most at 2 s
+    // at the start of each region, which is leader and header.
+    int margin = sample_rate/4;
+    int max_len = 2*sample_rate;
+    int min_len = sample_rate/5;
+    float *buf = new float[max_len];
+
+    int64_t start, end;
+    int64_t pos = 0;
+    while (activity.FindRegion(pos, &start, &end))
+    {
+        SurveyRegion region;
+        region.start = ((double) start)/sample_rate;
+        region.end = ((double) end)/sample_rate;
+
+        int len = (int) std::min(end-start-2*margin, (int64_t) max_len);
+        if (len >= min_len)
+        {
+            bool ok = src.Read(start+margin, buf, len);
+            assert(ok);
+            Analyze(&region, buf, len, sample_rate, options.f_ref);
+        }
+
+        m_regions.push_back(region);
+        pos = end;
+    }
+    delete[] buf;
+
+    // Combine - act only on a consistent picture
+    int n = (int) m_regions.size();
+    if (n == 0)
+        return;
+
+    m_format = m_regions[0].format;
+    for (int i=1; i<n; i++)
+        if (m_regions[i].format != m_format)
+            m_format = SURVEY_UNKNOWN;
+
+    double clks[n];
+    for (int i=0; i<n; i++)
+        clks[i] = m_regions[i].f_clk;
+    std::sort(clks, clks+n);
+    double median = clks[n/2];
+    if (clks[0] >= .97*median && clks[n-1] <= 1.03*median)
+        m_f_clk = median;
+}
+
+//----------------------------------------------------------------------------
+
+void TapeSurvey::Analyze(SurveyRegion *region, const float *x, int len,
+                         int sample_rate, int f_ref)
+{
+    // Remove DC
+    double sum = 0;
+    for (int i=0; i<len; i++)
+        sum += x[i];
+    float mean = sum/len;
+
+    // Squared derivative, also DC free
+    float *e = new float[len];
+    double sum_e = 0;
+    for (int i=0; i<len-1; i++)
+    {
+        float d = x[i+1]-x[i];
+        e[i] = d*d;
+        sum_e += e[i];
+    }
+    e[len-1] = 0;
+    float mean_e = sum_e/len;
+    for (int i=0; i<len; i++)
+        e[i] -= mean_e;
+
+    // 50 ms blocks: 20 Hz resolution, fine enough for a 10 Hz sweep step
+    int n = sample_rate/20;
+
+    // Sweep +-20% around the nominal clock
+    const int STEPS = 48;
+    double step = .2*f_ref/STEPS;
+    double powers[2*STEPS+1];
+    int best = 0;
+    for (int k=0; k<=2*STEPS; k++)
+    {
+        powers[k] = block_power(e, len, n, f_ref + (k-STEPS)*step, sample_rate);
+        if (powers[k] > powers[best])
+            best = k;
+    }
+    delete[] e;
+
+    // Require a clear line over the background
+    double sorted[2*STEPS+1];
+    std::copy(powers, powers+2*STEPS+1, sorted);
+    std::nth_element(sorted, sorted+STEPS, sorted+2*STEPS+1);
+    if (!(powers[best] > 10*sorted[STEPS]))
+        return;
+
+    // Parabolic interpolation between sweep steps
+    double f_clk = f_ref + (best-STEPS)*step;
+    if (best > 0 && best < 2*STEPS)
+    {
+        double a = powers[best-1];
+        double b = powers[best];
+        double c = powers[best+1];
+        double den = a - 2*b + c;
+        if (den < 0)
+            f_clk += .5*step*(a-c)/den;
+    }
+    region->f_clk = f_clk;
+
+    // Format from the 1200 Hz tone of a slow '0', relative to total power.
+    // About 1 for a pure tone, 0.2 for slow data and well below .01 for fast.
+    float *y = new float[len];
+    double energy = 0;
+    for (int i=0; i<len; i++)
+    {
+        y[i] = x[i]-mean;
+        energy += y[i]*y[i];
+    }
+    double tone = energy>0 ?
+        2*block_power(y, len, n, f_clk/4, sample_rate)/(n*energy) : 0;
+    delete[] y;
+
+    if (tone > .05)
+        region->format = SURVEY_SLOW;
+    else if (tone < .01)
+        region->format = SURVEY_FAST;
+}
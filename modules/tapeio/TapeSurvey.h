@@ -0,0 +1,63 @@
+//----------------------------------------------------------------------------
+//
+//  TapeSurvey - Spectral pre-analysis of a tape recording
+//
+//  * Runs on the start of each active region, ahead of decoding
+//  * Estimates format (fast or slow) and actual bit clock (tape speed)
+//  * Lets TapeDecoder pick one backend and narrow its clock search
+//
+//  Copyright (c) 2021-2023 Erik Persson
+//
+//----------------------------------------------------------------------------
+
+#ifndef TAPESURVEY_H
+#define TAPESURVEY_H
+
+#include "DecoderOptions.h"
+
+#include <vector>
+
+#define SURVEY_UNKNOWN (0)
+#define SURVEY_FAST    (1)
+#define SURVEY_SLOW    (2)
+
+class Sound;
+class ActivityMap;
+
+// Findings for one stretch of active audio
+struct SurveyRegion
+{
+    double start = 0;           // Start time in seconds
+    double end = 0;             // End time in seconds
+    int format = SURVEY_UNKNOWN;
+    double f_clk = 0;           // Measured bit frequency in Hz, 0 if unclear
+};
+
+class TapeSurvey
+{
+    std::vector<SurveyRegion> m_regions;
+    int m_format = SURVEY_UNKNOWN;
+    double m_f_clk = 0;
+
+public:
+    TapeSurvey(const Sound& src, const ActivityMap& activity,
+               const DecoderOptions& options);
+    TapeSurvey() = delete;
+    TapeSurvey(const TapeSurvey&) = delete;
+    virtual ~TapeSurvey() {}
+
+    int GetRegionCount() const { return (int) m_regions.size(); }
+    const SurveyRegion& GetRegion(int i) const { return m_regions[i]; }
+
+    // Format found in every region, SURVEY_UNKNOWN if unclear or mixed
+    int GetFormat() const { return m_format; }
+
+    // Bit clock in Hz agreed on by every region, 0 if unclear or spread out
+    double GetClock() const { return m_f_clk; }
+
+private:
+    void Analyze(SurveyRegion *region, const float *x, int len,
+                 int sample_rate, int f_ref);
+};
+
+#endif
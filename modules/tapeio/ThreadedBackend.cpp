@@ -0,0 +1,132 @@
+//----------------------------------------------------------------------------
+//
+//  ThreadedBackend - runs a decoder backend on a worker thread
+//
+//  Copyright (c) 2021-2023 Erik Persson
+//
+//  The queue itself takes no lock. The worker only writes m_write_cnt and
+//  the reader only writes m_read_cnt, publishing the queue entries with
+//  release stores that the other side reads with acquire loads.
+//
+//  A side about to sleep sets its waiting flag under the mutex and then
+//  checks the queue again. The other side updates its counter and then
+//  reads the flag, and only takes the mutex and signals when it is set.
+//  Fences between the two steps on each side make sure that at least one
+//  of them sees the other, so no wakeup is lost. A full queue is left to
+//  drain to half before the worker is woken, so it is signaled once per
+//  batch rather than once per byte.
+//----------------------------------------------------------------------------
+
+#include "ThreadedBackend.h"
+
+#include <assert.h>
+
+//----------------------------------------------------------------------------
+
+ThreadedBackend::ThreadedBackend(DecoderBackend *backend) :
+    m_backend(backend)
+{
+    assert(backend);
+    m_thread = new std::thread(&ThreadedBackend::Run, this);
+}
+
+//----------------------------------------------------------------------------
+
+ThreadedBackend::~ThreadedBackend()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_not_full.notify_one();
+    m_thread->join();
+    delete m_thread;
+    delete m_backend;
+}
+
+//----------------------------------------------------------------------------
+
+// Wake up the other side, if it is waiting
+// Called after updating a counter or a flag that the other side waits for
+void ThreadedBackend::Wake(std::atomic<bool>& waiting, std::condition_variable& cond)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed))
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+        cond.notify_one();
+    }
+}
+
+//----------------------------------------------------------------------------
+
+// Worker thread - decode until end of tape, or until stopped
+void ThreadedBackend::Run()
+{
+    DecodedByte b;
+    while (!m_stopping && m_backend->DecodeByte(&b))
+    {
+        // Wait for room in queue, and then for it to drain to half
+        int64_t write_cnt = m_write_cnt.load(std::memory_order_relaxed);
+        if (write_cnt - m_read_cnt.load(std::memory_order_acquire) >= QUEUE_SIZE)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_writer_waiting = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            m_not_full.wait(lock, [&] {
+                return write_cnt - m_read_cnt.load(std::memory_order_acquire) <= QUEUE_SIZE/2 ||
+                       m_stopping;
+            });
+            m_writer_waiting = false;
+        }
+        if (m_stopping)
+            break;
+
+        m_queue[write_cnt % QUEUE_SIZE] = b;
+        m_write_cnt.store(write_cnt+1, std::memory_order_release);
+        Wake(m_reader_waiting, m_not_empty);
+    }
+    m_done.store(true, std::memory_order_release);
+    Wake(m_reader_waiting, m_not_empty);
+}
+
+//----------------------------------------------------------------------------
+
+bool ThreadedBackend::DecodeByte(DecodedByte *b)
+{
+    // Wait for a byte or end of tape
+    int64_t read_cnt = m_read_cnt.load(std::memory_order_relaxed);
+    if (m_write_cnt.load(std::memory_order_acquire) == read_cnt)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_reader_waiting = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        m_not_empty.wait(lock, [&] {
+            return m_write_cnt.load(std::memory_order_acquire) != read_cnt ||
+                   m_done.load(std::memory_order_acquire);
+        });
+        m_reader_waiting = false;
+
+        // The worker may have written a last byte right before finishing
+        if (m_write_cnt.load(std::memory_order_acquire) == read_cnt)
+            return false;
+    }
+
+    *b = m_queue[read_cnt % QUEUE_SIZE];
+    m_read_cnt.store(read_cnt+1, std::memory_order_release);
+
+    // Let the worker go on once the queue is down to half
+    int64_t write_cnt = m_write_cnt.load(std::memory_order_relaxed);
+    if (write_cnt - (read_cnt+1) <= QUEUE_SIZE/2)
+        Wake(m_writer_waiting, m_not_full);
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+double ThreadedBackend::GetSkippedTime() const
+{
+    return m_done ? m_backend->GetSkippedTime() : 0;
+}
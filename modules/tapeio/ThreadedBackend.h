@@ -0,0 +1,62 @@
+//----------------------------------------------------------------------------
+//
+//  ThreadedBackend - runs a decoder backend on a worker thread
+//
+//  * The worker decodes ahead into a bounded single producer,
+//    single consumer queue
+//  * DecodeByte hands out the bytes in the order the backend produced them
+//  * Lets TapeDecoder run independent backends side by side
+//
+//  Copyright (c) 2021-2023 Erik Persson
+//
+//----------------------------------------------------------------------------
+
+#ifndef THREADEDBACKEND_H
+#define THREADEDBACKEND_H
+
+#include "DecoderBackend.h"
+#include "DecodedByte.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+class ThreadedBackend : public DecoderBackend
+{
+    DecoderBackend *m_backend = 0; // Owned, used only by the worker
+
+    // Queue of decoded bytes. Each counter is written by one side only.
+    static const int QUEUE_SIZE = 1024;
+    DecodedByte m_queue[QUEUE_SIZE];
+    std::atomic<int64_t> m_write_cnt = 0;
+    std::atomic<int64_t> m_read_cnt = 0;
+    std::atomic<bool> m_done = false;     // Set by worker at end of tape
+    std::atomic<bool> m_stopping = false; // Set to make worker quit early
+
+    // Only for sleeping on a full or empty queue. A side only signals the
+    // other when it has said it is waiting.
+    std::mutex m_mutex;
+    std::condition_variable m_not_empty;
+    std::condition_variable m_not_full;
+    std::atomic<bool> m_reader_waiting = false;
+    std::atomic<bool> m_writer_waiting = false;
+
+    std::thread *m_thread = 0;
+
+public:
+    ThreadedBackend(DecoderBackend *backend); // Takes ownership
+    ThreadedBackend(const ThreadedBackend&) = delete;
+    virtual ~ThreadedBackend();
+
+    bool DecodeByte(DecodedByte *b) override;
+
+    // Valid once DecodeByte has returned false
+    double GetSkippedTime() const override;
+
+private:
+    void Run();
+    void Wake(std::atomic<bool>& waiting, std::condition_variable& cond);
+};
+
+#endif
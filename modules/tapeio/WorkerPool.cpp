@@ -0,0 +1,105 @@
+//----------------------------------------------------------------------------
+//
+//  WorkerPool - small set of persistent worker threads
+//
+//  Copyright (c) 2021-2023 Erik Persson
+//
+//----------------------------------------------------------------------------
+
+#include "WorkerPool.h"
+
+#include <assert.h>
+#include <algorithm>
+
+//----------------------------------------------------------------------------
+
+WorkerPool::WorkerPool(int thread_cnt)
+{
+    assert(thread_cnt >= 0);
+    for (int i= 0; i<thread_cnt; i++)
+        m_threads.push_back(new std::thread(&WorkerPool::Run, this));
+}
+
+//----------------------------------------------------------------------------
+
+WorkerPool::~WorkerPool()
+{
+    Wait();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_job_cond.notify_all();
+
+    for (auto thread : m_threads)
+    {
+        thread->join();
+        delete thread;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+int WorkerPool::GetHelperCount(int n)
+{
+    int cores = (int) std::thread::hardware_concurrency(); // 0 if unknown
+    return std::max(0, std::min(n, cores) - 1);
+}
+
+//----------------------------------------------------------------------------
+
+void WorkerPool::Submit(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(job);
+    }
+    m_job_cond.notify_one();
+}
+
+//----------------------------------------------------------------------------
+
+// Run the oldest queued job, if any. Called with the lock held.
+bool WorkerPool::RunOne(std::unique_lock<std::mutex>& lock)
+{
+    if (m_jobs.empty())
+        return false;
+
+    auto job = m_jobs.front();
+    m_jobs.pop_front();
+    m_busy_cnt++;
+
+    lock.unlock();
+    job();
+    lock.lock();
+
+    m_busy_cnt--;
+    if (m_jobs.empty() && m_busy_cnt == 0)
+        m_done_cond.notify_all();
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+void WorkerPool::Wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (RunOne(lock))
+        ;
+    m_done_cond.wait(lock, [this] { return m_jobs.empty() && m_busy_cnt == 0; });
+}
+
+//----------------------------------------------------------------------------
+
+// Worker thread
+void WorkerPool::Run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_job_cond.wait(lock, [this] { return !m_jobs.empty() || m_stopping; });
+        if (m_stopping)
+            return;
+        RunOne(lock);
+    }
+}
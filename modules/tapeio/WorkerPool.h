@@ -0,0 +1,58 @@
+//----------------------------------------------------------------------------
+//
+//  WorkerPool - small set of persistent worker threads
+//
+//  * Jobs are submitted in batches, and Wait() joins the whole batch
+//  * Threads stay alive between batches, so a batch per window is cheap
+//  * With no threads, jobs run on the caller's thread in Wait()
+//
+//  Copyright (c) 2021-2023 Erik Persson
+//
+//----------------------------------------------------------------------------
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool
+{
+    std::vector<std::thread*> m_threads;
+    std::deque<std::function<void()>> m_jobs; // Not yet started
+    int m_busy_cnt = 0;                       // Started, not finished
+    bool m_stopping = false;
+
+    std::mutex m_mutex;
+    std::condition_variable m_job_cond;  // Signals new jobs
+    std::condition_variable m_done_cond; // Signals finished jobs
+
+public:
+    // Zero threads is allowed
+    WorkerPool(int thread_cnt);
+    WorkerPool(const WorkerPool&) = delete;
+    virtual ~WorkerPool();
+
+    // Number of threads to use for n-way parallel work on this host,
+    // with the caller's thread counted as one
+    static int GetHelperCount(int n);
+
+    int GetThreadCount() const { return (int) m_threads.size(); }
+
+    // Queue a job
+    void Submit(std::function<void()> job);
+
+    // Wait until all submitted jobs have finished. The caller's thread
+    // helps out with jobs not yet picked up.
+    void Wait();
+
+private:
+    void Run();
+    bool RunOne(std::unique_lock<std::mutex>& lock);
+};
+
+#endif
@@ -7,8 +7,10 @@
 //----------------------------------------------------------------------------
 
 #include "XenonDecoder.h"
+#include "ActivityMap.h"
 #include "DecodedByte.h"
 #include "filters.h"
+#include "DumpWriter.h"
 
 #include <soundio/Sound.h>
 
@@ -990,6 +992,285 @@ void read_byte_underside(
     *out_t_clk = t_clk;             // Re-estimated clock period
 }
 
+//----------------------------------------------------------------------------
+// Byte track selection
+//----------------------------------------------------------------------------
+// This differs from classic Activity Selection in that we must favour
+// bytes that come directly after another byte. Taking a byte scores by the
+// clarity of its start bit, with a bonus when it reads correctly. Jumping
+// to where the next byte should start scores up to 50 when another byte
+// is taken there, and 15 for a polarity flip.
+//
+// Both searches return the indices of the taken bytes, last byte first.
+
+// Score for taking byte read at x
+static int take_score(uint16_t z, int x,
+                      const int8_t *start_detect, int given_byte_x)
+{
+    // Award the given byte position
+    int given_bonus = given_byte_x == x ? 100000 : 0;
+
+    // Award based on clarity of start bit
+    int start_score = abs(start_detect[x]);
+
+    int vanity_bonus = is_sync_ok(z) && is_parity_ok(z);
+    return start_score + 50*vanity_bonus + 50*given_bonus;
+}
+
+//----------------------------------------------------------------------------
+
+// Exhaustive search, a two-state model over every sample
+static int select_track_exhaustive(
+    int *track,                                    // Taken reads (output)
+    const int *rd_xs, const uint16_t *rd_dxs,      // Byte reads
+    const uint16_t *rd_zs, const float *rd_tcs, int rd_cnt,
+    const int8_t *start_detect, int len,           // Start labelling
+    int given_byte_x)                              // Location of given byte
+{
+    const int ns = 2; // States: 0=skip 1=take
+    int *scores = new int[len*ns];
+    int *preds = new int[len*ns]; // last taken read, -1 if none
+    for (int i= 0; i<len*ns; i++)
+    {
+        scores[i] = 0;
+        preds[i] = -1;
+    }
+
+    int rd_ix = 0; // Scan position in extrapolated bytes
+
+    // Forward pass
+    for (int i=0; i<len; i++)
+    {
+        // Skipping: Propagate to both states the right.
+        for (int s1= 0; s1<ns; s1++)
+            if (i+1<len && scores[(i+1)*2+s1]<scores[i*2+0])
+            {
+                scores[(i+1)*2+s1] = scores[i*2+0];
+                preds[(i+1)*2+s1] = preds[i*2+0];
+            }
+
+        if (rd_ix<rd_cnt && rd_xs[rd_ix]==i) // byte to be taken?
+        {
+            auto dx = rd_dxs[rd_ix];
+            auto tc = rd_tcs[rd_ix];
+
+            // Add local score for taking the byte
+            scores[i*2+1] += take_score(rd_zs[rd_ix], i, start_detect, given_byte_x);
+
+            // Jump to where the next byte should be
+            int d_max = (int) floor(0.5 + 4*tc);   // search range on each side
+            for (int d=-d_max; d<=d_max; d++)
+            {
+                int chain_score = 50 - 50*std::abs(d)/(d_max+1);
+
+                int i1 = i+dx+d;
+                if (i1>i && i1<len)
+                {
+                    int polarity_bonus = sign(start_detect[i1]) == -sign(start_detect[i]);
+                    for (int s1=0; s1<ns; s1++)
+                    {
+                        int score = scores[i*2+1] + chain_score*(s1==1) + 15*polarity_bonus;
+
+                        if (scores[i1*2+s1] < score)
+                        {
+                            scores[i1*2+s1] = score;
+                            preds[i1*2+s1] = rd_ix;
+                        }
+                    }
+                }
+            }
+            rd_ix++;
+        }
+        else
+            scores[i*2+1] = -100000; // nothing to take here
+    }
+
+    // Find best end state
+    int s = 0;
+    for (int s1=0; s1<ns; s1++)
+        if (scores[(len-1)*ns+s] < scores[(len-1)*ns+s1])
+            s = s1;
+
+    int track_len = 0;
+    for (int r = preds[(len-1)*ns+s]; r >= 0; r = preds[rd_xs[r]*ns+1])
+        track[track_len++] = r;
+
+    delete[] scores;
+    delete[] preds;
+    return track_len;
+}
+
+//----------------------------------------------------------------------------
+
+// Beam search over the start bit candidates only
+// Keeps the best 'beam' taken bytes that can still chain to a later byte,
+// and sets *overflow if any other had to be dropped. Otherwise the result
+// is the same as from the exhaustive search, ties included.
+static int select_track_beam(
+    int *track, bool *overflow,                    // Taken reads (output)
+    const int *rd_xs, const uint16_t *rd_dxs,      // Byte reads
+    const uint16_t *rd_zs, const float *rd_tcs, int rd_cnt,
+    const int8_t *start_detect, int len,           // Start labelling
+    int given_byte_x,                              // Location of given byte
+    int beam)                                      // Max no. of live takes
+{
+    assert(beam > 0);
+    *overflow = false;
+
+    int *scores = new int[rd_cnt]; // best score with read r taken
+    int *preds = new int[rd_cnt];  // read taken before r, -1 if none
+    int *los = new int[rd_cnt];    // range where r lands in the skip state
+    int *his = new int[rd_cnt];
+    int *live = new int[beam];     // takes in reach of the next read
+    int live_cnt = 0;
+
+    // A take lands in the skip state with its score where the next byte
+    // should be, and with 15 more where the polarity flips. Keep the first
+    // landing of each kind until the scan passes it.
+    struct Landing
+    {
+        int x;
+        int score;
+        int r;
+    };
+    Landing *landings = new Landing[2*rd_cnt];
+    int landing_cnt = 0;
+
+    // Skip state: best score passed so far, and the takes which reached it
+    int skip_score = 0;
+    int *tops = new int[rd_cnt];
+    int top_cnt = 0;
+
+    for (int r= 0; r<=rd_cnt; r++)
+    {
+        int x = r<rd_cnt ? rd_xs[r] : len;
+
+        // Pass landings before x
+        int k = 0;
+        for (int j= 0; j<landing_cnt; j++)
+        {
+            const Landing& l = landings[j];
+            if (l.x >= x)
+                landings[k++] = l;
+            else if (skip_score < l.score)
+            {
+                skip_score = l.score;
+                tops[0] = l.r;
+                top_cnt = 1;
+            }
+            else if (skip_score == l.score && skip_score > 0)
+                tops[top_cnt++] = l.r;
+        }
+        landing_cnt = k;
+
+        // The exhaustive search hands the skip state on from sample to
+        // sample, but lets an equal landing take over. So the winner is
+        // the first take which lands the best score at the latest sample.
+        int skip_pred = -1;
+        int skip_x = -1;
+        for (int j= 0; j<top_cnt; j++)
+        {
+            int p = tops[j];
+            int pol = sign(start_detect[rd_xs[p]]);
+            bool flip = skip_score != scores[p];
+            int i1 = std::min(his[p], x-1);
+            while ((sign(start_detect[i1]) == -pol) != flip)
+                i1--;
+            assert(i1 >= los[p]);
+            if (skip_x < i1 || (skip_x == i1 && p < skip_pred))
+            {
+                skip_x = i1;
+                skip_pred = p;
+            }
+        }
+
+        if (r == rd_cnt)
+        {
+            track[0] = skip_pred;
+            break;
+        }
+
+        // Chain from a live take, or come from the skip state
+        int best_score = 0;
+        int best_pred = -1;
+        int n = 0;
+        for (int j= 0; j<live_cnt; j++)
+        {
+            int p = live[j];
+            int d = x - (rd_xs[p] + rd_dxs[p]);
+            int d_max = (int) floor(0.5 + 4*rd_tcs[p]);
+            if (d > d_max)
+                continue; // out of reach from now on
+            live[n++] = p;
+
+            if (d >= -d_max && x > rd_xs[p])
+            {
+                int chain_score = 50 - 50*std::abs(d)/(d_max+1);
+                int polarity_bonus = sign(start_detect[x]) == -sign(start_detect[rd_xs[p]]);
+                int score = scores[p] + chain_score + 15*polarity_bonus;
+                if (best_score < score)
+                {
+                    best_score = score;
+                    best_pred = p;
+                }
+            }
+        }
+        live_cnt = n;
+        if (best_score < skip_score)
+        {
+            best_score = skip_score;
+            best_pred = skip_pred;
+        }
+        scores[r] = best_score + take_score(rd_zs[r], x, start_detect, given_byte_x);
+        preds[r] = best_pred;
+
+        // Landings, assuming the next byte is far enough away that
+        // they come in after the skip state has been handed on
+        int d_max = (int) floor(0.5 + 4*rd_tcs[r]);
+        los[r] = std::max(x+1, x + rd_dxs[r] - d_max);
+        his[r] = std::min(len-1, x + rd_dxs[r] + d_max);
+        int pol = sign(start_detect[x]);
+        bool found[2] = { false, false };
+        for (int i1= los[r]; i1<=his[r] && !(found[0] && found[1]); i1++)
+        {
+            bool flip = sign(start_detect[i1]) == -pol;
+            if (!found[flip])
+                landings[landing_cnt++] = { i1, scores[r] + 15*flip, r };
+            found[flip] = true;
+        }
+
+        // Keep the best takes
+        if (live_cnt < beam)
+            live[live_cnt++] = r;
+        else
+        {
+            *overflow = true;
+            int worst = 0;
+            for (int j= 1; j<live_cnt; j++)
+                if (scores[live[j]] < scores[live[worst]])
+                    worst = j;
+            if (scores[live[worst]] < scores[r])
+            {
+                std::copy(live+worst+1, live+live_cnt, live+worst);
+                live[live_cnt-1] = r;
+            }
+        }
+    }
+
+    int track_len = 0;
+    for (int r = track[0]; r >= 0; r = preds[r])
+        track[track_len++] = r;
+
+    delete[] scores;
+    delete[] preds;
+    delete[] los;
+    delete[] his;
+    delete[] live;
+    delete[] landings;
+    delete[] tops;
+    return track_len;
+}
+
 //----------------------------------------------------------------------------
 // Xenon byte decoder
 //----------------------------------------------------------------------------
@@ -1009,7 +1290,8 @@ static int xenon_decode_bytes(
     DecoderOptions& options,                       // User selectable settings
     float t_min, float t_max,                      // Clock range
     int given_byte_x,                              // Location of given byte
-    bool given_byte_use_area)                      // Reader for given byte
+    bool given_byte_use_area,                      // Reader for given byte
+    TrackStats *stats)                             // Track search statistics
 {
     // Settings
     float t_clk = (t_min+t_max)/2;
@@ -1085,106 +1367,52 @@ static int xenon_decode_bytes(
     // Byte track selection
     //---------------------------------------------------------------------
 
-    // This differs from classic Activity Selection in that we must favour
-    // bytes that come directly after another byte.
-    // A two-state model where chained bytes are rewarded
-    const int ns = 2; // States: 0=skip 1=take
-    int *scores = new int[len*ns];
-    uint8_t *pred_ss = new uint8_t[len*ns];
-    int *pred_xs = new int[len*ns];
-    int *pred_zs = new int[len*ns];
-    float *pred_tcs = new float[len*ns];
-    for (int i= 0; i<len*ns; i++)
-    {
-        scores[i] = 0;
-        pred_ss[i] = 0;
-        pred_xs[i] = -1;
-        pred_zs[i] = 0;
-        pred_tcs[i] = t_clk;
-    }
-
-    int rd_ix = 0; // Scan position in extrapolated bytes
+    int *track = new int[rd_cnt+1];
+    int track_len = -1;
+    bool overflow = false;
+    stats->windows++;
 
-    // Forward pass
-    for (int i=0; i<len; i++)
+    if (options.beam > 0)
     {
-        // Skipping: Propagate to both states the right.
-        for (int s1= 0; s1<ns; s1++)
-            if (i+1<len && scores[(i+1)*2+s1]<scores[i*2+0])
-            {
-                scores [(i+1)*2+s1] = scores [i*2+0];
-                pred_ss[(i+1)*2+s1] = pred_ss[i*2+0];
-                pred_xs[(i+1)*2+s1] = pred_xs[i*2+0];
-                pred_zs[(i+1)*2+s1] = pred_zs[i*2+0];
-                pred_tcs[(i+1)*2+s1] = pred_tcs[i*2+0];
-            }
-
-        // Award the given byte position
-        int given_bonus = given_byte_x == i ? 100000 : 0;
+        track_len = select_track_beam(
+            track, &overflow,
+            rd_xs, rd_dxs, rd_zs, rd_tcs, rd_cnt,
+            start_detect, len, given_byte_x, options.beam);
 
-        // Award based on clarity of start bit
-        int start_score = abs(start_detect[i]);
+        if (overflow)
+            stats->overflows++;
 
-        if (rd_ix<rd_cnt && rd_xs[rd_ix]==i) // byte to be taken?
+        if (options.beam_audit)
         {
-            auto dx = rd_dxs[rd_ix];
-            auto z  = rd_zs[rd_ix];
-            auto tc = rd_tcs[rd_ix];
-            int vanity_bonus = is_sync_ok(z) && is_parity_ok(z);
-
-            // Add local score for taking the byte
-            scores[i*2+1] += start_score + 50*vanity_bonus + 50*given_bonus;
-
-            // Jump to where the next byte should be
-            // Add up to 50 bonus when chaining to another take
-            // Add 15 bonus for polarity flip
-            int d_max = (int) floor(0.5 + 4*tc);   // search range on each side
-            for (int d=-d_max; d<=d_max; d++)
-            {
-                int chain_score = 50 - 50*std::abs(d)/(d_max+1);
-
-                int i1 = i+dx+d;
-                if (i1>i && i1<len)
-                {
-                    int polarity_bonus = sign(start_detect[i1]) == -sign(start_detect[i]);
-                    for (int s1=0; s1<ns; s1++)
-                    {
-                        int score = scores[i*2+1] + chain_score*(s1==1) + 15*polarity_bonus;
-
-                        if (scores[i1*2+s1] < score)
-                        {
-                            scores[i1*2+s1] = score;
-                            pred_ss[i1*2+s1] = 1;
-                            pred_xs[i1*2+s1] = i;
-                            pred_zs[i1*2+s1] = z;
-                            pred_tcs[i1*2+s1] = rd_tcs[rd_ix];
-                        }
-                    }
-                }
-            }
-            rd_ix++;
+            // Audit against the exhaustive search
+            int *exact_track = new int[rd_cnt+1];
+            int exact_len = select_track_exhaustive(
+                exact_track,
+                rd_xs, rd_dxs, rd_zs, rd_tcs, rd_cnt,
+                start_detect, len, given_byte_x);
+            if (exact_len != track_len ||
+                !std::equal(track, track+track_len, exact_track))
+                stats->changes++;
+            delete[] exact_track;
         }
-        else
-            scores[i*2+1] = -100000; // nothing to take here
     }
 
-    // Backtrace, with gap filling
-    // Find best end state
-    int s = 0;
-    for (int s1=0; s1<ns; s1++)
-        if (scores[(len-1)*ns+s] < scores[(len-1)*ns+s1])
-            s = s1;
+    if (track_len < 0 || overflow)
+        track_len = select_track_exhaustive(
+            track,
+            rd_xs, rd_dxs, rd_zs, rd_tcs, rd_cnt,
+            start_detect, len, given_byte_x);
 
-    int a = (len-1)*ns+s;
-    s = pred_ss[a];
-    int      x = pred_xs[a];
-    uint16_t z = pred_zs[a];
-    float tc = pred_tcs[a];
+    // Backtrace, with gap filling
     int byte_cnt = 0;
     int good_byte_cnt = 0;
     float sum_tc = 0;
-    while (x >= 0)
+    for (int k= 0; k<track_len; k++)
     {
+        int      x = rd_xs[track[k]];
+        uint16_t z = rd_zs[track[k]];
+        float   tc = rd_tcs[track[k]];
+
         // Pad insertion
         // We clearly don't want a missed byte to cause a displacement
         // of the whole file.
@@ -1216,19 +1444,8 @@ static int xenon_decode_bytes(
             good_byte_cnt++;
             sum_tc += tc;
         }
-
-        int a = x*ns+s;
-        s = pred_ss[a];
-        x = pred_xs[a];
-        z = pred_zs[a];
-        tc = pred_tcs[a];
     }
-
-    delete[] scores;
-    delete[] pred_ss;
-    delete[] pred_xs;
-    delete[] pred_zs;
-    delete[] pred_tcs;
+    delete[] track;
 
     if (good_byte_cnt >= 5)
         *t_est = fmax(t_min, fmin(t_max, sum_tc / good_byte_cnt));
@@ -1318,23 +1535,25 @@ static int xenon_decode_bytes(
 //----------------------------------------------------------------------------
 
 XenonDecoder::XenonDecoder(const Sound& src,
-                           const DecoderOptions& options) :
+                           const DecoderOptions& options,
+                           const ActivityMap *activity) :
     m_lp_filter(
         src,
         // Set a filter length of two reference clock cycles
         ((int) floor(2.0*src.GetSampleRate()/options.f_ref)) | 1
     ),
-    m_options(options)
+    m_options(options),
+    m_activity(activity)
 {
     m_sample_rate = src.GetSampleRate();
-    int full_len = src.GetLength();
+    int64_t full_len = src.GetLength();
 
     m_start_pos = 0;
     m_end_pos = full_len;
     if (m_options.start >= 0) // start specified?
-        m_start_pos = (int) floor(0.5 + m_options.start*m_sample_rate);
+        m_start_pos = (int64_t) floor(0.5 + m_options.start*m_sample_rate);
     if (m_options.end >= 0) // end specified?
-        m_end_pos = (int) floor(0.5 + m_options.end*m_sample_rate);
+        m_end_pos = (int64_t) floor(0.5 + m_options.end*m_sample_rate);
     if (m_end_pos > full_len)
         m_end_pos = full_len;
     if (m_end_pos < m_start_pos+1)
@@ -1346,8 +1565,9 @@ XenonDecoder::XenonDecoder(const Sound& src,
     // Clock search window half width
     // This can at most be 20% since 2*1.2=3.8 before a 3-period can
     // look the same as a 2-period
-    m_dt_max = .20*m_t_ref;  // maximum search window half width
-    m_dt_min = .07*m_t_ref;  // minimum search window half width
+    // Narrowed further when the clock has been measured up front
+    m_dt_max = .20*m_t_ref*options.clock_window; // maximum search window half width
+    m_dt_min = std::min(.07*m_t_ref, m_dt_max);  // minimum search window half width
     m_dt_clk = m_dt_max;
     m_t_clk = m_t_ref;
 
@@ -1370,12 +1590,16 @@ XenonDecoder::XenonDecoder(const Sound& src,
     m_window_offs = m_start_pos - m_start_pos%m_hopsize - m_window_margin;
 
     // Dump
-    m_dump_snd = 0;
+    // Dump channels: [0] NPIF with start bits, [1] WPIF, [2] start detection
+    m_dump = 0;
     m_dump_buf = 0;
     if (m_options.dump)
     {
-        int dump_len = m_end_pos-m_start_pos;
-        m_dump_snd = new Sound(dump_len, m_sample_rate);
+        int64_t dump_len = m_end_pos-m_start_pos;
+        m_dump = new DumpWriter(DumpWriter::Path("xenon", m_options.dump_channel).c_str(),
+                                m_sample_rate, dump_len, 3, m_windowlen);
+        if (!m_dump->IsOk())
+            exit(1);
     }
     m_dump_buf = new float[m_windowlen];
 
@@ -1397,18 +1621,22 @@ XenonDecoder::~XenonDecoder()
     delete[] m_start_detect_buf;
     delete[] m_use_area_buf;
 
-    if (m_dump_snd)
+    if (m_dump && !m_dump->Close())
+        exit(1);
+    delete m_dump;
+    delete[] m_dump_buf;
+
+    // Diagnostics go to stderr, so they stay out of listings on stdout
+    if ((m_options.verbose || m_options.beam_audit) &&
+        m_options.beam > 0 && m_track_stats.windows)
     {
-        const char *dump_file = "dump-xenon.wav";
-        printf("Writing dump to %s\n", dump_file);
-        if (!m_dump_snd->WriteToFile(dump_file))
-        {
-            fprintf(stderr, "Couldn't write %s\n", dump_file);
-            exit(1);
-        }
+        fprintf(stderr, "Byte track beam overflowed in %d of %d windows",
+                m_track_stats.overflows, m_track_stats.windows);
+        if (m_options.beam_audit)
+            fprintf(stderr, ", result differed from exhaustive search in %d",
+                    m_track_stats.changes);
+        fprintf(stderr, "\n");
     }
-    delete m_dump_snd;
-    delete[] m_dump_buf;
 
     delete[] m_byte_xs;
     delete[] m_byte_zs;
@@ -1417,8 +1645,41 @@ XenonDecoder::~XenonDecoder()
 
 //----------------------------------------------------------------------------
 
+// Jump over windows that hold no active audio
+// Restart clock tracking since tape speed may differ after the gap
+void XenonDecoder::SkipInactive()
+{
+    if (!m_activity)
+        return;
+
+    int hops = m_activity->GetSkippableHops(
+        m_window_offs, m_windowlen, m_hopsize, m_sample_rate);
+    if (hops == 0)
+        return;
+
+    int64_t new_offs = m_window_offs + ((int64_t) hops)*m_hopsize;
+    m_skipped_len += std::min(new_offs, m_end_pos) - m_window_offs;
+    m_window_offs = new_offs;
+
+    m_t_clk = m_t_ref;
+    m_dt_clk = m_dt_max;
+    m_byte_boundary_x = -1;
+    m_byte_boundary_use_area = false;
+}
+
+//----------------------------------------------------------------------------
+
+double XenonDecoder::GetSkippedTime() const
+{
+    return ((double) m_skipped_len)/m_sample_rate;
+}
+
+//----------------------------------------------------------------------------
+
 bool XenonDecoder::DecodeWindow()
 {
+    SkipInactive();
+
     if (m_window_offs >= m_end_pos)
         return false; // nothing to decode
 
@@ -1462,7 +1723,7 @@ bool XenonDecoder::DecodeWindow()
     //------------------------------------------------------------------------
 
     int given_byte_x = m_byte_boundary_x>=0 ?
-        m_byte_boundary_x-m_window_offs : -1;
+        (int) (m_byte_boundary_x-m_window_offs) : -1;
     bool given_byte_use_area = m_byte_boundary_use_area;
 
     float t_est = m_t_clk;
@@ -1474,7 +1735,8 @@ bool XenonDecoder::DecodeWindow()
         m_lp_buf, m_wpif_buf, m_npif_buf, windowlen,
         m_options,
         m_t_clk-m_dt_clk, m_t_clk+m_dt_clk,
-        given_byte_x, given_byte_use_area);
+        given_byte_x, given_byte_use_area,
+        &m_track_stats);
 
     // Add a dummy byte if nothing was decoded
     if (byte_evt_cnt == 0)
@@ -1502,7 +1764,7 @@ bool XenonDecoder::DecodeWindow()
 
     for (int i= 0; i<byte_evt_cnt; i++)
     {
-        int x = m_window_offs + m_byte_xs[i]; // Global sample offset
+        int64_t x = m_window_offs + m_byte_xs[i]; // Global sample offset
 
         // Annotate global time
         m_byte_times[i] = k_time*x;
@@ -1561,19 +1823,25 @@ bool XenonDecoder::DecodeWindow()
     //------------------------------------------------------------------------
 
     // Save data in debug dump
-    if (m_dump_snd)
+    if (m_dump)
     {
+        // Write out core part of window only
+        int64_t dump_pos = m_window_offs + m_window_margin - m_start_pos;
+        const int x0 = m_window_margin;
+
         // Debug output: our wide peak indication function
         // Annotate start bits
         for (int i= 0; i<windowlen; i++)
             m_dump_buf[i] =
                 .5*m_start_detect_buf[i]/DETECT_MAX +
                 .5*m_npif_buf[i];
+        m_dump->Write(0, dump_pos, m_dump_buf + x0, m_hopsize);
+
+        m_dump->Write(1, dump_pos, m_wpif_buf + x0, m_hopsize);
 
-        // Write out core part of window oinly
-        m_dump_snd->Write(m_window_offs + m_window_margin - m_start_pos,
-                          m_dump_buf + m_window_margin,
-                          m_hopsize);
+        for (int i= x0; i<x0+m_hopsize; i++)
+            m_dump_buf[i] = ((float) m_start_detect_buf[i])/DETECT_MAX;
+        m_dump->Write(2, dump_pos, m_dump_buf + x0, m_hopsize);
     }
 
     m_window_offs += m_hopsize;
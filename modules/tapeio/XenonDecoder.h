@@ -14,16 +14,27 @@
 #include "LowpassFilter.h"
 
 class Sound;
+class ActivityMap;
+class DumpWriter;
+
+// Byte track search statistics
+struct TrackStats
+{
+    int windows = 0;   // No. of searches
+    int overflows = 0; // Beam had to drop a take, exhaustive search used
+    int changes = 0;   // Beam result differed from exhaustive (audit only)
+};
 
 class XenonDecoder : public DecoderBackend
 {
     LowpassFilter m_lp_filter;
     DecoderOptions m_options;
+    const ActivityMap *m_activity = 0;
     int m_sample_rate = 0;
 
     // Clip interval
-    int m_start_pos = 0;
-    int m_end_pos = 0;
+    int64_t m_start_pos = 0;
+    int64_t m_end_pos = 0;
 
     // Clock parameters
     double m_t_ref  = 0;  // nominal physical bit period
@@ -36,7 +47,8 @@ class XenonDecoder : public DecoderBackend
     int m_windowlen = 0;
     int m_hopsize = 0;
     int m_window_margin = 0;
-    int m_window_offs = 0;
+    int64_t m_window_offs = 0;
+    int64_t m_skipped_len = 0;  // samples skipped as inactive
     float *m_lp_buf = 0;    // Lowpass filtered input
     float *m_wpif_buf = 0;  // Wide pulse indication (0110)
     float *m_npif_buf = 0;  // Narrow pulse indication (010)
@@ -51,25 +63,30 @@ class XenonDecoder : public DecoderBackend
     int *m_byte_xs = 0;          // byte event locations, as bit offset in window
     uint16_t *m_byte_zs = 0;     // 13-bit LSB first representation
     double *m_byte_times = 0;    // global time in seconds
-    int m_byte_boundary_x = -1;  // event for use as viterbi boundary
+    int64_t m_byte_boundary_x = -1;  // event for use as viterbi boundary
     bool m_byte_boundary_use_area = false; // read mode for boundary
-    int m_byte_last_x = -1;      // location of last emitted byte
+    int64_t m_byte_last_x = -1;      // location of last emitted byte
     int m_byte_emit_start = 0;   // range of events to emit
     int m_byte_emit_end = 0;
 
+    TrackStats m_track_stats;
+
     // Dump
-    Sound *m_dump_snd = 0;
+    DumpWriter *m_dump = 0;
     float *m_dump_buf = 0;
 
 public:
     XenonDecoder(const XenonDecoder&) = delete;
     XenonDecoder(const Sound& src,
-                const DecoderOptions& options);
+                const DecoderOptions& options,
+                const ActivityMap *activity = 0);
     virtual ~XenonDecoder();
 
     bool DecodeByte(DecodedByte *b) override;
+    double GetSkippedTime() const override;
 
 private:
+    void SkipInactive();
     bool DecodeWindow();
 };
 
@@ -6,21 +6,44 @@
 //
 //----------------------------------------------------------------------------
 
+#include <tapeio/ActivityMap.h>
+#include <tapeio/BatchRunner.h>
+#include <tapeio/DumpWriter.h>
+#include <tapeio/FilterCache.h>
+#include <tapeio/LowpassFilter.h>
 #include <tapeio/TapeDecoder.h>
 #include <tapeio/TapeEncoder.h>
+#include <tapeio/TapeSurvey.h>
+#include <tapeio/ThreadedBackend.h>
+#include <tapeio/filters.h>
+#include <soundio/Downsampler.h>
+#include <soundio/SoundMemWriter.h>
+#include <soundio/SoundPlayer.h>
+#include <soundio/SoundReader.h>
+#include <soundio/SoundRecorder.h>
+#include <soundio/SoundWriter.h>
+#include <soundio/VirtualDevice.h>
 
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <tgmath.h>
 #include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
 
 //----------------------------------------------------------------------------
 // Loopback test
 //----------------------------------------------------------------------------
 
-void loopback_test(bool slow, bool dual)
+void loopback_test(bool slow, bool dual, bool in_memory)
 {
-    printf("Running loopback test, %s mode\n", slow ? "slow" : "fast");
+    printf("Running loopback test, %s mode%s\n", slow ? "slow" : "fast",
+           in_memory ? ", in memory" : "");
 
     const uint8_t testvector[] = { 0x16, 0x16, 0x16, 0x24, 0x00, 0x55, 0xaa, 0xff };
     int testvector_len = sizeof(testvector)/sizeof(testvector[0]);
@@ -31,9 +54,21 @@ void loopback_test(bool slow, bool dual)
     int err = snprintf(filename, sizeof(filename), "/tmp/loopback_test_%d.wav",(int) getpid());
     assert(err >= 0);
 
-    printf("  Encoding to WAV file %s\n", filename);
+    SoundMemWriter writer;
     TapeEncoder enc;
-    if (enc.Open(filename, slow))
+    bool opened;
+    if (in_memory)
+    {
+        printf("  Encoding to memory\n");
+        writer.Open(ENCODER_RATE);
+        opened = enc.Open(&writer, slow);
+    }
+    else
+    {
+        printf("  Encoding to WAV file %s\n", filename);
+        opened = enc.Open(filename, slow);
+    }
+    if (opened)
     {
         printf("  Writing %d bytes\n", testvector_len);
         for (int i= 0; i<testvector_len; i++)
@@ -41,29 +76,39 @@ void loopback_test(bool slow, bool dual)
     }
     if (!enc.Close())
     {
-        fprintf(stderr, "Error: Write to %s failed\n", filename);
+        if (in_memory)
+            fprintf(stderr, "Error: Encoding failed\n");
+        else
+            fprintf(stderr, "Error: Write to %s failed\n", filename);
         test_ok = false;
     }
 
     DecoderOptions options;
-    options.filename = filename;
     options.dual = dual;
     options.fast = !slow;
     options.slow = slow;
 
-    TapeDecoder dec(options);
+    TapeDecoder *dec;
+    if (in_memory)
+        dec = new TapeDecoder(writer.GetSound(), options);
+    else
+    {
+        options.filename = filename;
+        dec = new TapeDecoder(options);
+    }
 
     // Decode all
     DecodedByte b;
     std::vector<uint8_t> decoded_bytes;
     int parity_errors = 0;
     int sync_errors = 0;
-    while (dec.ReadByte(&b))
+    while (dec->ReadByte(&b))
     {
         decoded_bytes.push_back(b.byte);
         parity_errors += b.parity_error;
         sync_errors += b.sync_error;
     }
+    delete dec;
 
     int decoded_len = (int) decoded_bytes.size();
     printf("  Decoded %d bytes using %s decoder\n", decoded_len, dual? "dual":"default");
@@ -89,7 +134,7 @@ void loopback_test(bool slow, bool dual)
             test_ok = false;
         }
 
-    if (test_ok)
+    if (test_ok && !in_memory)
     {
         (void) remove(filename);
         printf("  Removing file %s\n", filename);
@@ -106,6 +151,1710 @@ void loopback_test(bool slow, bool dual)
     }
 }
 
+//----------------------------------------------------------------------------
+// Helpers
+//----------------------------------------------------------------------------
+
+// Leader of sync bytes followed by pseudo-random bytes
+static std::vector<uint8_t> make_test_bytes(int leader_len, int len)
+{
+    std::vector<uint8_t> bytes(leader_len, 0x16);
+    bytes.push_back(0x24);
+    uint32_t x = 12345;
+    for (int i= 0; i<len; i++)
+    {
+        x = x*1103515245 + 12345;
+        bytes.push_back((uint8_t) (x >> 16));
+    }
+    return bytes;
+}
+
+//----------------------------------------------------------------------------
+
+// Encode bytes into memory, and play the result back at the given rate
+static Sound encode_bytes(const std::vector<uint8_t>& bytes, bool slow, int playback_rate,
+                          int encoder_rate = ENCODER_RATE)
+{
+    SoundMemWriter writer;
+    writer.Open(encoder_rate);
+    TapeEncoder enc;
+    if (enc.Open(&writer, slow, encoder_rate))
+        for (uint8_t byte : bytes)
+            enc.PutByte(byte);
+    if (!enc.Close())
+    {
+        fprintf(stderr, "Error: Encoding failed\n");
+        exit(1);
+    }
+
+    Sound sound = writer.GetSound();
+    std::vector<float> buf(sound.GetLength());
+    sound.GetBuffer(buf.data());
+    return Sound(buf.data(), buf.size(), playback_rate);
+}
+
+//----------------------------------------------------------------------------
+
+// Decode the whole sound. Return no. of errors among the first cnt bytes.
+static int decode_bytes(const Sound& src, const DecoderOptions& options,
+                        int cnt, std::vector<uint8_t> *bytes)
+{
+    TapeDecoder dec(src, options);
+    DecodedByte b;
+    int errors = 0;
+    while (dec.ReadByte(&b))
+    {
+        if ((int) bytes->size() < cnt)
+            errors += b.sync_error || b.parity_error;
+        bytes->push_back(b.byte);
+    }
+    return errors;
+}
+
+//----------------------------------------------------------------------------
+// Survey test
+//----------------------------------------------------------------------------
+
+// The survey must measure the speed of the tape, and the decoders must
+// decode it when tracking the measured clock
+void survey_test(int percent_fast)
+{
+    printf("Running survey test, tape speed %+d%%\n", percent_fast);
+
+    std::vector<uint8_t> bytes = make_test_bytes(256, 1500);
+    Sound src = encode_bytes(bytes, false, ENCODER_RATE*(100+percent_fast)/100);
+
+    bool test_ok = true;
+
+    DecoderOptions options;
+    options.dual = true;
+
+    ActivityMap activity(src, options);
+    TapeSurvey survey(src, activity, options);
+    double f_clk = options.f_ref*(100+percent_fast)/100.0;
+    printf("  Measured clock %.0f Hz, expected %.0f Hz\n", survey.GetClock(), f_clk);
+    if (fabs(survey.GetClock() - f_clk) > .005*f_clk)
+    {
+        printf("  Clock measured wrong\n");
+        test_ok = false;
+    }
+
+    std::vector<uint8_t> decoded;
+    int errors = decode_bytes(src, options, (int) bytes.size(), &decoded);
+    printf("  Decoded %d bytes, %d errors\n", (int) decoded.size(), errors);
+    if (errors || decoded.size() < bytes.size() ||
+        !std::equal(bytes.begin(), bytes.end(), decoded.begin()))
+    {
+        printf("  Decoded bytes differ\n");
+        test_ok = false;
+    }
+
+    if (test_ok)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Padding test
+//----------------------------------------------------------------------------
+
+// Two programs separated by long silence. Skipping the silence must not
+// change the bytes. The survey must not change them either, except for
+// stray 0x00 bytes outside the payloads: tracking the surveyed clock in a
+// narrower window keeps the slow decoder locked where a tone starts and
+// stops, so it picks up a null byte there.
+void padding_test(bool slow)
+{
+    printf("Running padding test, %s mode\n", slow ? "slow" : "fast");
+
+    std::vector<uint8_t> bytes = make_test_bytes(64, 300);
+    Sound program = encode_bytes(bytes, slow, ENCODER_RATE);
+    int64_t program_len = program.GetLength();
+    std::vector<float> p(program_len);
+    program.GetBuffer(p.data());
+
+    // Silence, program, silence, program, silence
+    std::vector<float> samples;
+    for (int i= 0; i<2; i++)
+    {
+        samples.insert(samples.end(), (10+10*i)*ENCODER_RATE, 0);
+        samples.insert(samples.end(), p.begin(), p.end());
+    }
+    samples.insert(samples.end(), 5*ENCODER_RATE, 0);
+    Sound src(samples.data(), (int64_t) samples.size(), ENCODER_RATE);
+
+    bool test_ok = true;
+
+    DecoderOptions options;
+    ActivityMap activity(src, options);
+    printf("  Inactive %.1f s of %.1f s\n", activity.GetInactiveTime(), src.GetDuration());
+    if (activity.GetInactiveTime() < 30)
+    {
+        printf("  Too little silence found\n");
+        test_ok = false;
+    }
+
+    // The encoder adds leader and trailer bytes, so look for the payloads
+    auto payload = std::find(bytes.begin(), bytes.end(), 0x24);
+    int payload_len = (int) (bytes.end() - payload);
+    std::vector<uint8_t> programs[2];
+
+    for (int survey= 1; survey>=0; survey--)
+    {
+        options.survey = survey;
+
+        options.skip = true;
+        std::vector<uint8_t> skipped;
+        int errors = decode_bytes(src, options, INT_MAX, &skipped);
+
+        options.skip = false;
+        std::vector<uint8_t> full;
+        int full_errors = decode_bytes(src, options, INT_MAX, &full);
+
+        printf("  Survey %s: decoded %d bytes, %d errors, without skip %d bytes, %d errors\n",
+               survey ? "on" : "off", (int) skipped.size(), errors,
+               (int) full.size(), full_errors);
+        if (skipped != full)
+        {
+            printf("  Decoded bytes differ\n");
+            test_ok = false;
+        }
+
+        auto first = std::search(skipped.begin(), skipped.end(), payload, bytes.end());
+        auto second = first == skipped.end() ? first :
+            std::search(first+1, skipped.end(), payload, bytes.end());
+        if (errors || second == skipped.end())
+        {
+            printf("  Decoded bytes are wrong\n");
+            test_ok = false;
+        }
+        else
+        {
+            // Keep the payloads, and what surrounds them but stray nulls
+            for (auto b = skipped.begin(); b != skipped.end(); b++)
+                if (*b || (b >= first && b < first+payload_len) ||
+                    (b >= second && b < second+payload_len))
+                    programs[survey].push_back(*b);
+        }
+    }
+
+    if (test_ok && programs[0] != programs[1])
+    {
+        printf("  Survey changed more than stray nulls\n");
+        test_ok = false;
+    }
+
+    if (test_ok)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Threads test
+//----------------------------------------------------------------------------
+
+// Running the decoders on worker threads must give the same bytes as
+// running them in turn on one thread
+void threads_test(bool slow, bool dual)
+{
+    printf("Running threads test, %s mode%s\n", slow ? "slow" : "fast",
+           dual ? ", dual decoder" : "");
+
+    std::vector<uint8_t> bytes = make_test_bytes(64, 1000);
+    Sound src = encode_bytes(bytes, slow, ENCODER_RATE);
+
+    bool test_ok = true;
+
+    DecoderOptions options;
+    options.dual = dual;
+    std::vector<uint8_t> threaded;
+    int errors = decode_bytes(src, options, (int) bytes.size(), &threaded);
+
+    options.threads = false;
+    std::vector<uint8_t> single;
+    int single_errors = decode_bytes(src, options, (int) bytes.size(), &single);
+
+    printf("  Decoded %d bytes, %d errors, on one thread %d bytes, %d errors\n",
+           (int) threaded.size(), errors, (int) single.size(), single_errors);
+    if (threaded != single || errors != single_errors)
+    {
+        printf("  Decoded bytes differ\n");
+        test_ok = false;
+    }
+    if (errors || threaded.size() < bytes.size())
+    {
+        printf("  Decoded bytes are wrong\n");
+        test_ok = false;
+    }
+
+    if (test_ok)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+
+// Backend producing a counting byte sequence, pausing now and then
+class CountingBackend : public DecoderBackend
+{
+    int m_cnt = 0;
+    int m_len;
+
+public:
+    CountingBackend(int len) : m_len(len) {}
+
+    bool DecodeByte(DecodedByte *b) override
+    {
+        if (m_cnt == m_len)
+            return false;
+        if (m_cnt % 5000 == 4999)
+            usleep(1000);
+        b->time = m_cnt;
+        b->byte = (uint8_t) m_cnt++;
+        return true;
+    }
+};
+
+//----------------------------------------------------------------------------
+
+// The queue must hand over every byte in order, whether the reader or the
+// worker is the one waiting, and must let the worker stop early
+void queue_test()
+{
+    printf("Running queue test\n");
+
+    const int len = 100000;
+    bool test_ok = true;
+
+    for (int reader_pauses= 0; reader_pauses<2; reader_pauses++)
+    {
+        ThreadedBackend backend(new CountingBackend(len));
+        DecodedByte b;
+        int cnt = 0;
+        while (backend.DecodeByte(&b))
+        {
+            if (b.time != cnt || b.byte != (uint8_t) cnt)
+            {
+                test_ok = false;
+                break;
+            }
+            if (reader_pauses && cnt % 3000 == 0)
+                usleep(2000);
+            cnt++;
+        }
+        printf("  Reader %s: %d of %d bytes\n",
+               reader_pauses ? "pausing" : "running", cnt, len);
+        if (cnt != len)
+            test_ok = false;
+    }
+
+    // Destroy while the worker waits on a full queue
+    {
+        ThreadedBackend backend(new CountingBackend(len));
+        DecodedByte b;
+        backend.DecodeByte(&b);
+        usleep(10000);
+    }
+
+    if (test_ok)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Filter cache test
+//----------------------------------------------------------------------------
+
+// Users of the same filtered signal must share a cache entry. Reads through
+// the cache, from several threads, must be identical to filtering each
+// window directly, for the filter lengths of every decoding mode.
+void filter_cache_test()
+{
+    printf("Running filter cache test\n");
+
+    const int len = 100000;
+    std::vector<float> samples(len);
+    uint32_t x = 1;
+    for (int i= 0; i<len; i++)
+    {
+        x = x*1103515245 + 12345;
+        samples[i] = ((int) (x >> 16) - 32768)/32768.0f;
+    }
+    Sound src(samples.data(), len, ENCODER_RATE);
+
+    bool test_ok = true;
+
+    // Sharing follows the identity of the waveform data
+    const int filterlen = 37;
+    Sound copy = src;
+    FilterCache *a = FilterCache::Acquire(src, FILTER_HANN_LOWPASS, filterlen);
+    FilterCache *b = FilterCache::Acquire(copy, FILTER_HANN_LOWPASS, filterlen);
+    FilterCache *c = FilterCache::Acquire(src, FILTER_HANN_LOWPASS, filterlen+2);
+    copy.Write(0, samples.data(), 1);
+    FilterCache *d = FilterCache::Acquire(copy, FILTER_HANN_LOWPASS, filterlen);
+    if (a != b || a == c || a == d)
+    {
+        printf("  Cache entries are shared wrong\n");
+        test_ok = false;
+    }
+    a->Release();
+    b->Release();
+    c->Release();
+    d->Release();
+
+    // Xenon, Grid and the short Super filter are two bit cycles long,
+    // the long Super filter twelve
+    double t_ref = ENCODER_RATE/(double) DecoderOptions().f_ref;
+    for (int cycles : {2, 12})
+    {
+        int lp_filterlen = ((int) floor(cycles*t_ref)) | 1;
+        int margin = lp_filterlen>>1;
+        LowpassFilter shared(src, lp_filterlen);
+
+        // Overlapping windows, also beyond the ends, each read twice and
+        // once shorter, as the decoders do
+        const int thread_cnt = 4;
+        const int windowlen = 5000;
+        std::vector<int> mismatches(thread_cnt, 0);
+        std::vector<std::thread> threads;
+        for (int t= 0; t<thread_cnt; t++)
+            threads.emplace_back([&, t]()
+            {
+                LowpassFilter filter(src, lp_filterlen);
+                std::vector<float> ibuf(windowlen + 2*margin);
+                std::vector<float> expected(windowlen);
+                std::vector<float> buf(windowlen);
+                for (int64_t where= -windowlen + 700*t; where<len; where += windowlen/3)
+                {
+                    src.Read(where - margin, ibuf.data(), (int) ibuf.size());
+                    hann_lowpass(expected.data(), windowlen, ibuf.data(),
+                                 (int) ibuf.size(), lp_filterlen);
+                    for (int pass= 0; pass<3; pass++)
+                    {
+                        int cnt = pass < 2 ? windowlen : windowlen/2;
+                        (pass ? filter : shared).Read(where, buf.data(), cnt);
+                        mismatches[t] += !std::equal(buf.begin(), buf.begin()+cnt,
+                                                     expected.begin());
+                    }
+                }
+            });
+        for (auto& thread : threads)
+            thread.join();
+
+        int mismatch_cnt = 0;
+        for (int m : mismatches)
+            mismatch_cnt += m;
+        printf("  Filter length %d: %d windows differ\n", lp_filterlen, mismatch_cnt);
+        if (mismatch_cnt)
+            test_ok = false;
+    }
+
+    if (test_ok)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Copy-on-write test
+//----------------------------------------------------------------------------
+
+// Compare a sound with the expected samples
+static bool sound_equals(const Sound& sound, const std::vector<float>& expected)
+{
+    std::vector<float> buf(sound.GetLength());
+    return sound.GetLength() == (int64_t) expected.size() &&
+           sound.Read(0, buf.data(), (int) buf.size()) &&
+           buf == expected;
+}
+
+//----------------------------------------------------------------------------
+
+// Writes to a copy of a sound, on pages shared or not, must not show up in
+// the original, nor the other way around
+void copy_on_write_test()
+{
+    printf("Running copy-on-write test\n");
+
+    const int len = 300000;
+    std::vector<float> expected_a(len, 0);
+
+    // Write across several pages
+    Sound a(len, ENCODER_RATE);
+    std::vector<float> buf(100000);
+    for (int i= 0; i<(int) buf.size(); i++)
+        buf[i] = (float) i;
+    a.Write(50000, buf.data(), (int) buf.size());
+    std::copy(buf.begin(), buf.end(), expected_a.begin() + 50000);
+    std::vector<float> expected_b = expected_a;
+
+    bool test_ok = true;
+
+    // Write the copy on a shared page, and in a silent stretch
+    Sound b = a;
+    std::fill(buf.begin(), buf.end(), -1.0f);
+    b.Write(60000, buf.data(), 10000);
+    b.Write(250000, buf.data(), 20000);
+    std::fill(expected_b.begin() + 60000, expected_b.begin() + 70000, -1.0f);
+    std::fill(expected_b.begin() + 250000, expected_b.begin() + 270000, -1.0f);
+
+    // Write the original on a page that is still shared
+    std::fill(buf.begin(), buf.end(), 2.0f);
+    a.Write(140000, buf.data(), 5000);
+    std::fill(expected_a.begin() + 140000, expected_a.begin() + 145000, 2.0f);
+
+    // Extend the copy
+    b.Append(buf.data(), 1000);
+    expected_b.insert(expected_b.end(), 1000, 2.0f);
+
+    // Modify a third copy that has been rendered to memory
+    Sound c = b;
+    std::vector<float> expected_c = expected_b;
+    {
+        std::vector<float> c_buf(c.GetLength());
+        c.GetBuffer(c_buf.data());
+        c = Sound(c_buf.data(), c_buf.size(), c.GetSampleRate());
+    }
+    float three = 3.0f;
+    c.Write(65000, &three, 1);
+    expected_c[65000] = 3.0f;
+
+    // Unshared in-memory sounds are written in place, shared ones copied
+    const void *c_id = c.GetId();
+    c.Write(65001, &three, 1);
+    expected_c[65001] = 3.0f;
+    if (c.GetId() != c_id)
+    {
+        printf("  Unshared memory sound was not written in place\n");
+        test_ok = false;
+    }
+    Sound d = c;
+    std::vector<float> expected_d = expected_c;
+    d.Write(65002, &three, 1);
+    expected_d[65002] = 3.0f;
+    if (d.GetId() == c.GetId() || !sound_equals(d, expected_d))
+    {
+        printf("  Shared memory sound was written in place\n");
+        test_ok = false;
+    }
+
+    if (!sound_equals(a, expected_a) ||
+        !sound_equals(b, expected_b) ||
+        !sound_equals(c, expected_c))
+    {
+        printf("  Writes leaked between copies\n");
+        test_ok = false;
+    }
+    if (a.GetId() == b.GetId() || b.GetId() == c.GetId())
+    {
+        printf("  Written copies have the same id\n");
+        test_ok = false;
+    }
+
+    if (test_ok)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Clip test
+//----------------------------------------------------------------------------
+
+// Clips of clips must read the right window of the source, also when a
+// clip is empty. Computed sounds read by several consumers must give the
+// same samples as when read by one.
+void clip_test()
+{
+    printf("Running clip test\n");
+
+    const int rate = 1200;
+    const int len = 12000;
+    std::vector<float> samples(len);
+    for (int i= 0; i<len; i++)
+        samples[i] = (float) i;
+    Sound src(samples.data(), len, rate);
+
+    bool test_ok = true;
+
+    // Nested clips, 2-9 s then 3-5 s of that
+    Sound nested = src;
+    nested.Clip(2, 7);
+    nested.Clip(3, 2);
+    std::vector<float> expected(samples.begin() + 6000, samples.begin() + 8400);
+    if (!sound_equals(nested, expected))
+    {
+        printf("  Nested clip is wrong\n");
+        test_ok = false;
+    }
+
+    // Empty clips, at the end of the source and past it, clipped again
+    for (double skip : {10.0, 12.0})
+    {
+        Sound empty = src;
+        empty.Clip(skip, 1);
+        empty.Clip(1, 1);
+        empty.Clip(0.5, 1);
+        float x = 1;
+        if (empty.GetLength() != 0 || !empty.Read(0, &x, 1) || x != 0)
+        {
+            printf("  Empty clip at %.0f s is wrong\n", skip);
+            test_ok = false;
+        }
+    }
+
+    // Mixed and resampled, read by one consumer and then by two
+    std::vector<float> reversed(samples.rbegin(), samples.rend());
+    Sound computed = src;
+    computed.Mix(Sound(reversed.data(), len, rate), .25);
+    computed.Resample(2, 3);
+    const int margin = 100;
+    int computed_len = (int) computed.GetLength();
+    std::vector<float> direct(computed_len + 2*margin);
+    computed.Read(-margin, direct.data(), (int) direct.size());
+
+    Sound shared = computed;
+    for (int start= -margin; start<computed_len; start+=977)
+    {
+        int cnt = std::min(5000, computed_len+margin-start);
+        std::vector<float> buf(cnt);
+        if (!shared.Read(start, buf.data(), cnt) ||
+            !std::equal(buf.begin(), buf.end(), direct.begin() + start+margin))
+        {
+            printf("  Shared computed sound differs at %d\n", start);
+            test_ok = false;
+        }
+    }
+
+    if (test_ok)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Split channel test
+//----------------------------------------------------------------------------
+
+// Pseudo-random file contents, the test bytes without their sync byte
+static std::vector<uint8_t> make_payload(int len)
+{
+    std::vector<uint8_t> bytes = make_test_bytes(0, len);
+    bytes.erase(bytes.begin());
+    return bytes;
+}
+
+//----------------------------------------------------------------------------
+
+// Bytes of a data file, with leader
+static std::vector<uint8_t> make_file_bytes(const char *name, int len)
+{
+    std::vector<uint8_t> bytes(64, 0x16);
+    bytes.push_back(0x24);
+    uint16_t start = 0x0500;
+    uint16_t end = start + len-1;
+    const uint8_t header[9] = { 0, 0, 0x80, 0, (uint8_t) (end>>8), (uint8_t) end,
+                                (uint8_t) (start>>8), (uint8_t) start, 0 };
+    bytes.insert(bytes.end(), header, header+9);
+    bytes.insert(bytes.end(), name, name+strlen(name)+1);
+
+    std::vector<uint8_t> payload = make_payload(len);
+    bytes.insert(bytes.end(), payload.begin(), payload.end());
+    return bytes;
+}
+
+//----------------------------------------------------------------------------
+
+// Decode files, return no. of files that are complete and error free
+static int count_good_files(TapeDecoder *dec, int len)
+{
+    TapeFile *file = new TapeFile;
+    std::vector<uint8_t> payload = make_payload(len);
+    int good_cnt = 0;
+    while (dec->ReadFile(file))
+        good_cnt += !file->sync_errors && !file->parity_errors &&
+                    file->len == len &&
+                    std::equal(payload.begin(), payload.end(), file->payload);
+    delete file;
+    return good_cnt;
+}
+
+//----------------------------------------------------------------------------
+
+// Two files on a stereo tape, each with a dropout in one of the channels.
+// Decoding the channels separately must get both files right.
+void split_channel_test()
+{
+    printf("Running split channel test\n");
+
+    const int len = 500;
+    std::vector<Sound> programs;
+    programs.push_back(encode_bytes(make_file_bytes("FIRST", len), false, ENCODER_RATE));
+    programs.push_back(encode_bytes(make_file_bytes("SECOND", len), false, ENCODER_RATE));
+
+    // Silence, program, silence, program, silence. Program k has a
+    // dropout in channel k.
+    std::vector<float> samples;
+    for (int k= 0; k<2; k++)
+    {
+        samples.insert(samples.end(), 2*2*ENCODER_RATE, 0);
+        int64_t program_len = programs[k].GetLength();
+        std::vector<float> p(program_len);
+        programs[k].GetBuffer(p.data());
+        for (int64_t i= 0; i<program_len; i++)
+        {
+            bool dropout = i > program_len/2 && i < program_len/2 + ENCODER_RATE/10;
+            samples.push_back(dropout && k==0 ? 0 : p[i]);
+            samples.push_back(dropout && k==1 ? 0 : p[i]);
+        }
+    }
+    samples.insert(samples.end(), 2*2*ENCODER_RATE, 0);
+
+    char filename[200];
+    int err = snprintf(filename, sizeof(filename), "/tmp/split_test_%d.wav",(int) getpid());
+    assert(err >= 0);
+
+    bool test_ok = true;
+
+    SoundWriter writer;
+    if (!writer.Open(filename, ENCODER_RATE, 2) ||
+        !writer.Write(samples.data(), (int) samples.size()))
+    {
+        fprintf(stderr, "Error: Write to %s failed\n", filename);
+        exit(1);
+    }
+    writer.Close();
+
+    DecoderOptions options;
+    options.fast = true;
+
+    // Each channel alone only gets one file
+    for (int c= 0; c<2; c++)
+    {
+        Sound src;
+        src.ReadFromFile(filename, true /*silent*/, c);
+        TapeDecoder dec(src, options);
+        int good_cnt = count_good_files(&dec, len);
+        printf("  Channel %d: %d good files\n", c, good_cnt);
+        if (good_cnt != 1)
+        {
+            printf("  Expected one good file\n");
+            test_ok = false;
+        }
+    }
+
+    options.filename = filename;
+    options.split_channels = true;
+    TapeDecoder dec(options);
+    int good_cnt = count_good_files(&dec, len);
+    printf("  Split channels: %d good files\n", good_cnt);
+    if (good_cnt != 2)
+    {
+        printf("  Expected two good files\n");
+        test_ok = false;
+    }
+
+    if (test_ok)
+    {
+        (void) remove(filename);
+        printf("  Removing file %s\n", filename);
+    }
+
+    if (test_ok)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Dump writer test
+//----------------------------------------------------------------------------
+
+// Windows that overlap the previous one, a gap in one channel and writes
+// beyond the end must come out in the file as written, with zeros where
+// nothing was written
+void dump_writer_test()
+{
+    printf("Running dump writer test\n");
+
+    const int64_t len = 100500;
+    const int step = 2000;
+    const int history = 3000;
+
+    // Channel 0 windows overlap by 1000 frames, and the later one wins.
+    // Channel 1 windows don't overlap, and skip 40000..70000 and the end.
+    auto value0 = [](int64_t i, int64_t pos) { return (float) (.5*sin(i*.01) + .1*(pos/step%3)); };
+    auto value1 = [](int64_t i) { return (float) (-.3*cos(i*.003)); };
+    auto skipped1 = [](int64_t i) { return (i >= 40000 && i < 70000) || i >= 90000; };
+
+    char filename[200];
+    int err = snprintf(filename, sizeof(filename), "/tmp/dump_test_%d.wav",(int) getpid());
+    assert(err >= 0);
+
+    bool test_ok = true;
+
+    DumpWriter dump(filename, ENCODER_RATE, len, 2, history);
+    if (!dump.IsOk())
+        exit(1);
+
+    std::vector<float> buf(step + 1000);
+    for (int64_t pos= 0; pos<len+step; pos+=step)
+    {
+        if (!skipped1(pos))
+        {
+            for (int i= 0; i<step; i++)
+                buf[i] = value1(pos+i);
+            dump.Write(1, pos, buf.data(), step);
+        }
+
+        for (int i= 0; i<step+1000; i++)
+            buf[i] = value0(pos+i, pos);
+        dump.Write(0, pos, buf.data(), step+1000);
+    }
+
+    if (!dump.Close())
+        exit(1);
+
+    for (int c= 0; c<2; c++)
+    {
+        Sound src;
+        src.ReadFromFile(filename, true /*silent*/, c);
+        if (src.GetLength() != len)
+        {
+            printf("  Channel %d: %lld frames, expected %lld\n", c,
+                   (long long) src.GetLength(), (long long) len);
+            test_ok = false;
+            continue;
+        }
+
+        std::vector<float> samples(len);
+        src.GetBuffer(samples.data());
+        int64_t bad_cnt = 0;
+        for (int64_t i= 0; i<len; i++)
+        {
+            float expected = c==0 ? value0(i, i - i%step) :
+                             skipped1(i - i%step) ? 0 : value1(i);
+            if (fabs(samples[i] - expected) > 1e-4)
+                bad_cnt++;
+        }
+        printf("  Channel %d: %lld bad samples\n", c, (long long) bad_cnt);
+        if (bad_cnt != 0)
+            test_ok = false;
+    }
+
+    if (test_ok)
+    {
+        (void) remove(filename);
+        printf("  Removing file %s\n", filename);
+    }
+
+    if (test_ok)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Large file test
+//----------------------------------------------------------------------------
+
+// Format reader for a mono recording that exists only as a formula.
+// Sample values depend on the high bits of the position too.
+class SyntheticReader : public SoundReaderBackend
+{
+    int64_t m_pos = 0;
+
+public:
+    SyntheticReader(int64_t length, bool seekable)
+    {
+        m_sample_rate_hz = 8000;
+        m_channel_cnt = 1;
+        m_length = length;
+        m_seekable = seekable;
+        m_block_size = 1; // many blocks
+    }
+
+    static short Value(int64_t pos) { return (short) (pos ^ (pos >> 15) ^ (pos >> 31)); }
+
+    bool Open(const char *, bool) override { return true; }
+
+    bool SetReadPos(int64_t pos) override
+    {
+        if (!m_seekable)
+            return false;
+        m_pos = pos;
+        return true;
+    }
+
+    bool Read(short *buf, int cnt) override
+    {
+        if (m_pos + cnt > m_length)
+            return false;
+        for (int i= 0; i<cnt; i++)
+            buf[i] = Value(m_pos + i);
+        m_pos += cnt;
+        return true;
+    }
+};
+
+// Reading a file must work beyond 2^31 samples and 2^31 reader blocks,
+// and out of order when the reader can't seek
+void large_file_test(bool seekable)
+{
+    printf("Running large file test, %s\n", seekable ? "seekable" : "not seekable");
+
+    int64_t len = seekable ? 5000000000 : 100000;
+    std::vector<int64_t> starts;
+    if (seekable)
+        starts = { 0, (int64_t) INT_MAX - 50, (int64_t) UINT_MAX - 50, len - 100 };
+    else
+        starts = { 50000, 10000, len - 100 };
+
+    SoundReader reader;
+    reader.Open(new SyntheticReader(len, seekable));
+    Sound src(std::move(reader));
+
+    bool test_ok = src.GetLength() == len;
+
+    // Read across each start, with padding after the end
+    const int cnt = 120;
+    for (int64_t start : starts)
+    {
+        short buf[cnt];
+        float fbuf[cnt];
+        if (!src.Read(start, buf, cnt) || !src.Read(start, fbuf, cnt))
+        {
+            printf("  Read at %lld failed\n", (long long) start);
+            test_ok = false;
+            continue;
+        }
+
+        for (int i= 0; i<cnt; i++)
+        {
+            short expected = start+i < len ? SyntheticReader::Value(start+i) : 0;
+            if (buf[i] != expected || fbuf[i] != expected/32768.f)
+            {
+                printf("  Wrong sample at %lld\n", (long long) (start+i));
+                test_ok = false;
+                break;
+            }
+        }
+    }
+
+    if (test_ok)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Resample test
+//----------------------------------------------------------------------------
+
+// Streaming the input in uneven blocks must give the same output as block
+// mode, and Sound::Resample must accept factors with a common divisor
+void resample_test(int up_factor, int down_factor)
+{
+    printf("Running resample test, factor %d/%d\n", up_factor, down_factor);
+
+    const int len = 20000;
+    const int rate = 48000;
+    std::vector<float> src(len);
+    for (int i= 0; i<len; i++)
+        src[i] = sin(2*M_PI*1000*i/rate) + .5*sin(.3*i*i/len);
+
+    bool test_ok = true;
+
+    // Block mode
+    Downsampler ds(up_factor, down_factor);
+    int outlen = (int) (((int64_t) len)*up_factor/down_factor);
+    std::vector<float> expected(outlen);
+    ds.Downsample(expected.data(), outlen, src.data(), len, 0);
+
+    // Streaming mode, followed by silence to flush the last outputs
+    int extra = ds.GetExtraSamplesNeeded();
+    src.insert(src.end(), 2*extra + down_factor, 0);
+    std::vector<float> streamed(outlen + down_factor + 1);
+    int got = 0;
+    int block = 1;
+    for (int i= 0; i<(int) src.size(); i += block, block = block*3 % 1001)
+    {
+        int n = std::min(block, (int) src.size() - i);
+        got += ds.Process(streamed.data()+got, (int) streamed.size()-got, src.data()+i, n);
+    }
+    if (got < outlen)
+    {
+        printf("  Streamed %d samples, expected %d\n", got, outlen);
+        test_ok = false;
+    }
+    for (int i= 0; i<std::min(got, outlen) && test_ok; i++)
+        if (fabs(streamed[i] - expected[i]) > 1e-5)
+        {
+            printf("  Streamed sample %d is %f, expected %f\n", i, streamed[i], expected[i]);
+            test_ok = false;
+        }
+
+    // Sound backend, which sees the unreduced factors
+    Sound sound(src.data(), len, rate);
+    sound.Resample(2*up_factor, 2*down_factor);
+    std::vector<float> resampled(outlen);
+    if (sound.GetSampleRate() != rate*up_factor/down_factor ||
+        sound.GetLength() != outlen ||
+        !sound.Read(0, resampled.data(), outlen))
+    {
+        printf("  Resampled sound has wrong format\n");
+        test_ok = false;
+    }
+    for (int i= 0; i<outlen && test_ok; i++)
+        if (fabs(resampled[i] - expected[i]) > 1e-5)
+        {
+            printf("  Resampled sample %d is %f, expected %f\n", i, resampled[i], expected[i]);
+            test_ok = false;
+        }
+
+    if (test_ok)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Beam test
+//----------------------------------------------------------------------------
+
+// The Xenon decoder's byte track beam must give the same bytes as the
+// exhaustive search, on a clean, a fast and a noisy recording with dropouts
+void beam_test()
+{
+    printf("Running beam test\n");
+
+    std::vector<uint8_t> bytes = make_test_bytes(256, 1000);
+    std::vector<Sound> recordings;
+    recordings.push_back(encode_bytes(bytes, false, ENCODER_RATE));
+    recordings.push_back(encode_bytes(bytes, false, ENCODER_RATE*105/100));
+
+    Sound program = encode_bytes(bytes, false, ENCODER_RATE);
+    std::vector<float> noisy(program.GetLength());
+    program.GetBuffer(noisy.data());
+    uint32_t x = 1;
+    for (size_t i= 0; i<noisy.size(); i++)
+    {
+        x = x*1103515245 + 12345;
+        noisy[i] += .7*((int) (x >> 16 & 0xffff) - 32768)/32768;
+        if (i % 30000 < 150)
+            noisy[i] = 0; // dropout
+    }
+    recordings.push_back(Sound(noisy.data(), noisy.size(), ENCODER_RATE));
+
+    bool test_ok = true;
+    for (const Sound& src : recordings)
+    {
+        std::vector<DecodedByte> decoded[2];
+        for (int k= 0; k<2; k++)
+        {
+            DecoderOptions options;
+            options.fast = true; // Xenon decoder alone
+            options.beam = k ? 0 : 16;
+            TapeDecoder dec(src, options);
+            DecodedByte b;
+            while (dec.ReadByte(&b))
+                decoded[k].push_back(b);
+        }
+
+        int errors = 0, diffs = 0;
+        for (const DecodedByte& b : decoded[0])
+            errors += b.sync_error || b.parity_error;
+        for (size_t i= 0; i<std::min(decoded[0].size(), decoded[1].size()); i++)
+            diffs += decoded[0][i].byte != decoded[1][i].byte ||
+                     decoded[0][i].sync_error != decoded[1][i].sync_error ||
+                     decoded[0][i].parity_error != decoded[1][i].parity_error;
+        printf("  Beam %d bytes, %d errors, exhaustive %d bytes, %d differ\n",
+               (int) decoded[0].size(), errors, (int) decoded[1].size(), diffs);
+        if (decoded[0].size() != decoded[1].size() || diffs)
+            test_ok = false;
+    }
+
+    if (test_ok)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Decimate test
+//----------------------------------------------------------------------------
+
+// A high rate recording must decode without errors with and without
+// decimation
+void decimate_test(int rate, bool slow)
+{
+    printf("Running decimate test, %d Hz, %s mode\n", rate, slow ? "slow" : "fast");
+
+    std::vector<uint8_t> bytes = make_test_bytes(256, 1000);
+    Sound src = encode_bytes(bytes, slow, rate, rate);
+
+    bool test_ok = true;
+
+    DecoderOptions options;
+    options.dual = true;
+    std::vector<uint8_t> listing[2];
+    int errors[2];
+    for (int k= 0; k<2; k++)
+    {
+        options.decimate = k==1;
+        errors[k] = decode_bytes(src, options, (int) bytes.size(), &listing[k]);
+        printf("  %s: decoded %d bytes, %d errors\n", k ? "Decimated" : "Full rate",
+               (int) listing[k].size(), errors[k]);
+    }
+    // The tone after the last byte may give a stray byte either way
+    for (int k= 0; k<2; k++)
+        if (errors[k] || listing[k].size() < bytes.size() ||
+            !std::equal(bytes.begin(), bytes.end(), listing[k].begin()))
+        {
+            printf("  Bytes decoded wrong\n");
+            test_ok = false;
+        }
+
+    if (test_ok)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Batch tests
+//----------------------------------------------------------------------------
+
+// Programs separated by silence, with the given seconds of silence before
+// each and at the end
+static Sound make_spaced_tape(const std::vector<uint8_t>& bytes,
+                              const std::vector<int>& gaps)
+{
+    Sound program = encode_bytes(bytes, false, ENCODER_RATE);
+    int64_t program_len = program.GetLength();
+    std::vector<float> p(program_len);
+    program.GetBuffer(p.data());
+
+    std::vector<float> samples;
+    for (size_t i= 0; i<gaps.size(); i++)
+    {
+        samples.insert(samples.end(), gaps[i]*ENCODER_RATE, 0);
+        if (i+1 < gaps.size())
+            samples.insert(samples.end(), p.begin(), p.end());
+    }
+    return Sound(samples.data(), (int64_t) samples.size(), ENCODER_RATE);
+}
+
+//----------------------------------------------------------------------------
+
+// Long recordings must be cut in the middle of long silent gaps, into
+// pieces of at least the segment time, without a short one at the end
+void batch_plan_test()
+{
+    printf("Running batch plan test\n");
+
+    bool test_ok = true;
+
+    std::vector<BatchPiece> pieces =
+        BatchRunner::PlanPieces({100, 250, 320, 610, 700}, 0, 750, 300);
+    const double expected[][2] = { {0, 320}, {320, 750} };
+    bool pieces_ok = pieces.size() == 2;
+    for (size_t i= 0; pieces_ok && i<pieces.size(); i++)
+        pieces_ok = pieces[i].start == expected[i][0] && pieces[i].end == expected[i][1];
+    pieces = BatchRunner::PlanPieces({}, 10, 50, 300);
+    pieces_ok = pieces_ok && pieces.size() == 1 &&
+                pieces[0].start == 10 && pieces[0].end == 50;
+    if (!pieces_ok)
+    {
+        printf("  Pieces planned wrong\n");
+        test_ok = false;
+    }
+
+    // Gaps of 10, 3 and 20 s, then 8 s at the end. The short gap is kept.
+    std::vector<uint8_t> bytes = make_file_bytes("PROG", 300);
+    Sound src = make_spaced_tape(bytes, {10, 3, 20, 8});
+    double program_time = (src.GetDuration() - 41)/3;
+    double gaps[][2] = { {0, 10},
+                         {10+3+2*program_time, 10+3+20+2*program_time},
+                         {src.GetDuration()-8, src.GetDuration()} };
+
+    std::vector<double> cuts;
+    BatchRunner::FindCuts(src, DecoderOptions(), 5, 100, &cuts);
+    bool cuts_ok = cuts.size() == 3;
+    for (size_t i= 0; cuts_ok && i<cuts.size(); i++)
+    {
+        printf("  Cut at %.1f s, in gap %.1f - %.1f s\n", cuts[i]-100, gaps[i][0], gaps[i][1]);
+        cuts_ok = cuts[i]-100 > gaps[i][0] && cuts[i]-100 < gaps[i][1];
+    }
+    if (!cuts_ok)
+    {
+        printf("  Found %d cuts, expected 3 in the long gaps\n", (int) cuts.size());
+        test_ok = false;
+    }
+
+    if (test_ok)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+
+// A batch run must fail only when an input can't be read or the report
+// can't be written. Decoding errors only go in the report. Files that
+// aren't recordings are recognized as archives by extension or by their
+// leading sync bytes, and are otherwise failed.
+void batch_status_test()
+{
+    printf("Running batch status test\n");
+
+    char dir[] = "/tmp/batch_test_XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror(dir);
+        exit(1);
+    }
+    std::string prefix = std::string(dir) + "/";
+
+    // A recording where the second program has a dropout
+    std::vector<uint8_t> bytes = make_file_bytes("PROG", 300);
+    Sound src = make_spaced_tape(bytes, {1, 2, 1});
+    int64_t program_len = (src.GetLength() - 4*ENCODER_RATE)/2;
+    std::vector<float> dropout(ENCODER_RATE/50, 0);
+    src.Write(3*ENCODER_RATE + program_len + program_len*3/4, dropout.data(),
+              (int) dropout.size());
+    src.WriteToFile((prefix + "tape.wav").c_str());
+
+    // An archive without .tap extension, and a file that is neither
+    if (FILE *f = fopen((prefix + "archive.bin").c_str(), "wb"))
+    {
+        fwrite(bytes.data(), 1, bytes.size(), f);
+        fclose(f);
+    }
+    if (FILE *f = fopen((prefix + "notes.wav").c_str(), "wb"))
+    {
+        fputs("Side A: PROG\n", f);
+        fclose(f);
+    }
+
+    FILE *f = fopen((prefix + "good.txt").c_str(), "w");
+    fputs("tape.wav\narchive.bin\n", f);
+    fclose(f);
+    f = fopen((prefix + "all.txt").c_str(), "w");
+    fputs("tape.wav\narchive.bin\nnotes.wav\nmissing.wav\n", f);
+    fclose(f);
+
+    bool test_ok = true;
+
+    DecoderOptions options;
+    BatchOptions batch_options;
+    std::string report = prefix + "report.json";
+    batch_options.report = report.c_str();
+
+    struct
+    {
+        const char *manifest;
+        const char *report;  // 0 for the default
+        int expected_status;
+    }
+    runs[] =
+    {
+        { "good.txt", 0, 0 },
+        { "all.txt", 0, 1 },
+        { "good.txt", "missing/report.json", 1 },
+    };
+    for (const auto& run : runs)
+    {
+        std::string report_path = prefix + (run.report ? run.report : "report.json");
+        batch_options.report = report_path.c_str();
+        BatchRunner runner(options, batch_options);
+        int status = runner.Run((prefix + run.manifest).c_str());
+        printf("  %s, report %s: status %d\n", run.manifest, report_path.c_str(), status);
+        if (status != run.expected_status)
+        {
+            printf("  Expected status %d\n", run.expected_status);
+            test_ok = false;
+        }
+
+        // Check how the inputs were taken
+        for (int i= 0; i<runner.GetInputCount(); i++)
+        {
+            const BatchInput& in = runner.GetInput(i);
+            std::string name = in.path.substr(in.path.rfind('/')+1);
+            bool in_ok =
+                name == "tape.wav" ? !in.failed && !in.tap && in.entries.size() == 2 &&
+                                     in.sync_errors + in.parity_errors > 0 :
+                name == "archive.bin" ? !in.failed && in.tap && in.entries.size() == 1 :
+                in.failed && !in.tap;
+            if (!in_ok)
+            {
+                printf("  %s was taken wrong\n", name.c_str());
+                test_ok = false;
+            }
+        }
+    }
+
+    for (const char *name : { "tape.wav", "archive.bin", "notes.wav",
+                              "good.txt", "all.txt", "report.json" })
+        (void) remove((prefix + name).c_str());
+    (void) rmdir(dir);
+
+    if (test_ok)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Encoder tests
+//----------------------------------------------------------------------------
+
+// The original encoder, stepping 48 points at a time through a 441 point
+// ramp at 44100 Hz
+struct ReferenceEncoder
+{
+    bool slow;
+    float ramp[441];
+    int ramp_phase = 0;
+    float last_y = 0;
+    bool last_bit = false;
+    std::vector<float> out;
+
+    ReferenceEncoder(bool slow) : slow(slow)
+    {
+        float k = M_PI/441;
+        for (int i= 0; i<441; i++)
+            ramp[i] = .5 - .5 * cos(k*i);
+    }
+
+    void RampTo(float y)
+    {
+        float y0 = last_y;
+        while (ramp_phase<441)
+        {
+            out.push_back(y0 + ramp[ramp_phase]*(y-y0));
+            ramp_phase += 48;
+        }
+        ramp_phase -= 441;
+        last_y = y;
+    }
+
+    void EmitBit(bool val)
+    {
+        RampTo(val ? 0.6 : -0.6);
+        last_bit = val;
+    }
+
+    void EncodeBit(bool val)
+    {
+        bool polarity = last_bit;
+        if (slow)
+        {
+            for (int i= 0; i<16; i++)
+            {
+                bool y = val ? !(i&1) : !(i&2);
+                EmitBit( y ^ polarity );
+            }
+        }
+        else
+        {
+            EmitBit( !polarity );
+            EmitBit( polarity );
+            if (!val)
+                EmitBit( polarity );
+        }
+    }
+
+    void EncodeByte(uint8_t byte)
+    {
+        EncodeBit(false);    // start bit
+        bool parity = true;
+        for (int i=0; i<8; i++)
+        {
+            bool bit = (byte>>i)&1;
+            EncodeBit(bit); // data bit
+            parity ^= bit;
+        }
+        EncodeBit(parity);    // odd parity
+        EncodeBit(true);      // stop bits
+        EncodeBit(true);
+        EncodeBit(true);
+        EmitBit(!last_bit);   // extra cycle
+    }
+};
+
+//----------------------------------------------------------------------------
+
+// Output from the fragment table at 44100 Hz must be bit-identical to the
+// original encoder
+void encoder_reference_test(bool slow)
+{
+    printf("Running encoder reference test, %s mode\n", slow ? "slow" : "fast");
+
+    std::vector<uint8_t> bytes = make_test_bytes(64, 500);
+    ReferenceEncoder ref(slow);
+    for (uint8_t byte : bytes)
+        ref.EncodeByte(byte);
+    ref.RampTo(0);
+
+    Sound sound = encode_bytes(bytes, slow, ENCODER_RATE);
+    std::vector<float> buf(sound.GetLength());
+    sound.GetBuffer(buf.data());
+    printf("  %d samples, reference %d samples\n", (int) buf.size(), (int) ref.out.size());
+
+    if (buf.size() == ref.out.size() &&
+        memcmp(buf.data(), ref.out.data(), buf.size()*sizeof(float)) == 0)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+
+// Encoding in parallel chunks, over more than one batch, must give the
+// same output as encoding serially
+void encoder_parallel_test(bool slow)
+{
+    printf("Running encoder parallel test, %s mode\n", slow ? "slow" : "fast");
+
+    // About 6 chunks of 2^17 ramps
+    std::vector<uint8_t> bytes = make_test_bytes(64, slow ? 4000 : 26000);
+
+    std::vector<float> out[2];
+    for (int k= 0; k<2; k++)
+    {
+        SoundMemWriter writer;
+        writer.Open(ENCODER_RATE);
+        TapeEncoder enc;
+        enc.SetThreads(k==1);
+        enc.SetHelperCount(3); // batches of 4 chunks, even on one core
+        if (enc.Open(&writer, slow))
+            for (uint8_t byte : bytes)
+                enc.PutByte(byte);
+        if (!enc.Close())
+        {
+            printf("  Encoding failed\n");
+            exit(1);
+        }
+        Sound sound = writer.GetSound();
+        out[k].resize(sound.GetLength());
+        sound.GetBuffer(out[k].data());
+    }
+    printf("  Serial %d samples, parallel %d samples\n",
+           (int) out[0].size(), (int) out[1].size());
+
+    if (out[0] == out[1])
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+
+// Encoding at other rates than 44100 Hz must decode, and keep the length
+// of the tape in seconds
+void encoder_rate_test(int rate, bool slow)
+{
+    printf("Running encoder rate test, %d Hz, %s mode\n", rate, slow ? "slow" : "fast");
+
+    std::vector<uint8_t> bytes = make_test_bytes(256, 500);
+    Sound src = encode_bytes(bytes, slow, rate, rate);
+    Sound ref = encode_bytes(bytes, slow, ENCODER_RATE);
+
+    bool test_ok = true;
+    if (fabs(src.GetDuration() - ref.GetDuration()) > 1.0/ENCODER_RATE)
+    {
+        printf("  Duration %.6f s, expected %.6f s\n", src.GetDuration(), ref.GetDuration());
+        test_ok = false;
+    }
+
+    DecoderOptions options;
+    options.dual = true;
+    std::vector<uint8_t> decoded;
+    int errors = decode_bytes(src, options, (int) bytes.size(), &decoded);
+    printf("  Decoded %d bytes, %d errors\n", (int) decoded.size(), errors);
+    if (errors || decoded.size() < bytes.size() ||
+        !std::equal(bytes.begin(), bytes.end(), decoded.begin()))
+    {
+        printf("  Bytes decoded wrong\n");
+        test_ok = false;
+    }
+
+    // Out of range rates are refused
+    SoundMemWriter writer;
+    TapeEncoder enc;
+    if (enc.Open(&writer, slow, 2*SWITCH_RATE-1) ||
+        enc.Open(&writer, slow, ENCODER_MAX_RATE+1))
+    {
+        printf("  Out of range rate accepted\n");
+        test_ok = false;
+    }
+
+    if (test_ok)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Player test
+//----------------------------------------------------------------------------
+
+// The player must refill a small buffer in time, and count the times the
+// writer lets it run dry. Plays in real time to a virtual device.
+void player_test()
+{
+    printf("Running player test\n");
+
+    VirtualDeviceConfig config; // discard output
+    VirtualDevice::Select(&config);
+
+    const int rate = 44100;
+    std::vector<float> tone(rate/2);
+    for (int i= 0; i<(int) tone.size(); i++)
+        tone[i] = .5*sin(2*M_PI*1000*i/rate);
+
+    bool test_ok = true;
+
+    // Playing a sound, the refill thread keeps up with 200 ms of buffer
+    {
+        SoundPlayer player;
+        player.SetBuffering(.025, 8);
+        if (!player.Play(Sound(tone.data(), tone.size(), rate)))
+        {
+            printf("  Play failed\n");
+            test_ok = false;
+        }
+        player.Flush();
+        PlayerStats stats = player.GetStats();
+        printf("  Played: %d underruns, buffer low %.0f of %.0f ms, %d refills\n",
+               stats.underruns, stats.min_buffered_time*1e3, stats.buffer_time*1e3,
+               stats.wakeups);
+        if (stats.underruns || !stats.wakeups || fabs(stats.buffer_time - .2) > .001)
+        {
+            printf("  Refill didn't keep up\n");
+            test_ok = false;
+        }
+    }
+
+    // Writing with a pause longer than the 80 ms buffer runs it dry
+    {
+        SoundPlayer player;
+        player.SetBuffering(.01, 8);
+        if (!player.Open(rate))
+        {
+            printf("  Open failed\n");
+            test_ok = false;
+        }
+        player.Write(tone.data(), rate/10);
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        player.Write(tone.data(), rate/10);
+        player.Flush();
+        PlayerStats stats = player.GetStats();
+        printf("  Written: %d underruns, %.3f s of silence\n",
+               stats.underruns, stats.underrun_time);
+        if (!stats.underruns || stats.underrun_time < .05)
+        {
+            printf("  Underrun not counted\n");
+            test_ok = false;
+        }
+        player.Close();
+    }
+
+    VirtualDevice::Select(0);
+
+    if (test_ok)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Virtual device test
+//----------------------------------------------------------------------------
+
+// Play and record at the same time on virtual devices with jittered
+// callbacks. Stalls longer than a chunk must show up as underruns and
+// overruns, and jitter within a chunk must not.
+void virtual_device_test(bool stalls)
+{
+    printf("Running virtual device test, %s\n", stalls ? "with stalls" : "jitter only");
+
+    VirtualDeviceConfig config; // discard output, record silence
+    config.jitter = .002;
+    config.stall_time = stalls ? .1 : 0;
+    config.stall_rate = stalls ? 10 : 0;
+    VirtualDevice::Select(&config);
+
+    const int rate = 44100;
+    const int chunk_len = rate/50; // 20 ms
+    std::vector<float> tone(rate);
+    for (int i= 0; i<(int) tone.size(); i++)
+        tone[i] = .5*sin(2*M_PI*1000*i/rate);
+
+    bool test_ok = true;
+    RecorderStats rec_stats;
+    {
+        SoundPlayer player;
+        player.SetBuffering(.02, 8);
+        SoundRecorder recorder;
+        if (!player.Play(Sound(tone.data(), tone.size(), rate)) ||
+            !recorder.Open(rate, chunk_len))
+        {
+            printf("  Open failed\n");
+            test_ok = false;
+        }
+
+        // Record for as long as the tone plays
+        recorder.Start();
+        std::vector<float> buf(chunk_len);
+        for (int64_t pos = 0; pos < (int64_t) tone.size(); pos += chunk_len)
+            recorder.Read(buf.data(), chunk_len);
+        recorder.Stop();
+        rec_stats = recorder.GetStats();
+        player.Flush();
+    } // streams stop here, adding to the totals
+
+    VirtualDeviceStats stats = VirtualDevice::GetTotalStats();
+    VirtualDevice::Select(0);
+    printf("  %lld callbacks, %d underruns, %d overruns, %lld chunks skipped, "
+           "%d overflows seen by recorder\n",
+           (long long) stats.chunks, stats.underruns, stats.overruns,
+           (long long) stats.skipped_chunks, rec_stats.device_overflows);
+
+    if (stalls)
+    {
+        if (!stats.underruns || !stats.overruns ||
+            stats.skipped_chunks < stats.underruns + stats.overruns)
+        {
+            printf("  Stalls not counted\n");
+            test_ok = false;
+        }
+    }
+    else if (stats.underruns || stats.overruns || stats.skipped_chunks)
+    {
+        printf("  Jitter counted as underruns or overruns\n");
+        test_ok = false;
+    }
+
+    // The next callback after an overrun reports it, unless it was the last
+    if (rec_stats.device_overflows > stats.overruns ||
+        rec_stats.device_overflows < stats.overruns - 1)
+    {
+        printf("  Recorder saw %d overflows\n", rec_stats.device_overflows);
+        test_ok = false;
+    }
+
+    if (test_ok)
+    {
+        printf("  Test successful\n");
+    }
+    else
+    {
+        printf("  Test failed\n");
+        exit(1);
+    }
+}
+
 //----------------------------------------------------------------------------
 // main
 //----------------------------------------------------------------------------
@@ -113,11 +1862,49 @@ void loopback_test(bool slow, bool dual)
 // Return test status (0=success)
 int main(int, char **)
 {
-    //            slow   dual
-    loopback_test(false, false);
-    loopback_test(true,  false);
-    loopback_test(false, true);
-    loopback_test(true,  true);
+    //            slow   dual   in_memory
+    loopback_test(false, false, false);
+    loopback_test(true,  false, false);
+    loopback_test(false, true,  false);
+    loopback_test(true,  true,  false);
+    loopback_test(false, false, true);
+    loopback_test(true,  true,  true);
+    padding_test(false);
+    padding_test(true);
+    threads_test(false, false);
+    threads_test(true,  false);
+    threads_test(false, true);
+    queue_test();
+    filter_cache_test();
+    copy_on_write_test();
+    clip_test();
+    split_channel_test();
+    dump_writer_test();
+    large_file_test(true);
+    large_file_test(false);
+    survey_test(1);
+    survey_test(5);
+    survey_test(-10);
+    resample_test(1, 3);
+    resample_test(2, 3);
+    resample_test(147, 160);
+    beam_test();
+    decimate_test(96000, false);
+    decimate_test(96000, true);
+    decimate_test(88200, false);
+    batch_plan_test();
+    batch_status_test();
+    encoder_reference_test(false);
+    encoder_reference_test(true);
+    encoder_parallel_test(false);
+    encoder_parallel_test(true);
+    encoder_rate_test(22050, false);
+    encoder_rate_test(32000, true);
+    encoder_rate_test(48000, false);
+    encoder_rate_test(ENCODER_MAX_RATE, false);
+    player_test();
+    virtual_device_test(false);
+    virtual_device_test(true);
     printf("Testing complete\n");
     return 0;
 }
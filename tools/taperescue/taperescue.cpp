@@ -6,20 +6,30 @@
 //
 //----------------------------------------------------------------------------
 
+#include <tapeio/BatchRunner.h>
 #include <tapeio/TapeFile.h>
 #include <tapeio/TapeDecoder.h>
 #include <tapeio/TapeEncoder.h>
+#include <soundio/Sound.h>
 #include <soundio/SoundPlayer.h>
 #include <soundio/SoundRecorder.h>
 #include <soundio/SoundWriter.h>
+#include <soundio/VirtualDevice.h>
 #include <option/Option.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 #include <unordered_set>
 
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <tgmath.h>
 
 #include <sys/fcntl.h>
@@ -56,6 +66,21 @@ BoolOption g_dual('2',"dual", "Use dual-mode two-stage decoder");
 BoolOption g_verbose('v',"verbose", "Print hex dump and diagnostic information");
 BoolOption g_dump('D',"dump", "Write intermediate waveform(s) named dump-<xxx>.wav");
 IntOption g_clock('c',"clock", "Decoder bit rate in Hz (default 4800)", 4800);
+BoolOption g_no_skip(30, "no-skip", "Decode silent stretches of tape too");
+BoolOption g_no_survey(31, "no-survey", "Don't measure format and clock up front");
+BoolOption g_no_decimate(32, "no-decimate", "Decode at the full input sample rate");
+BoolOption g_no_threads(28, "no-threads", "Decode and encode on a single thread");
+BoolOption g_split_channels(29, "split-channels", "Decode stereo channels separately and keep the best of each file");
+BoolOption g_float(2, "float", "Record 32-bit float samples instead of 16-bit");
+StringOption g_virtual_audio(3, "virtual-audio", "Play into or record from a .wav file, or 'null', instead of audio device", 0);
+IntOption g_jitter(4, "jitter", "Delay virtual audio callbacks randomly up to this many microseconds", 0);
+IntOption g_stall(5, "stall", "Stall virtual audio callbacks this many ms, about once a second", 0);
+IntOption g_rate(6, "rate", "Sample rate in Hz for encoding (default 44100)", ENCODER_RATE);
+IntOption g_buffer(14, "buffer", "Audio output buffer in ms for --play (default 3000)", 3000);
+BoolOption g_batch('b',"batch", "List, extract or decode all recordings in a directory or manifest");
+IntOption g_memory(7, "memory", "Memory budget in MB for --batch (default 1024)", 1024);
+IntOption g_segment(8, "segment", "Split --batch inputs into segments of about this many seconds, 0 for never (default 300)", 300);
+StringOption g_report(9, "report", "Write --batch report to this file (default taperescue-report.json)", 0);
 
 // Sub-options to the demodulation decoder
 BoolOption g_low_band(0, "low-band", "Listen to 1200 Hz band only, ignore 2400 Hz");
@@ -64,6 +89,8 @@ BoolOption g_high_band(1, "high-band", "Listen to 2400 Hz band only, ignore 1200
 // Sub-options to the Xenon decoder
 BoolOption g_area_cue(10, "area-cue", "Use only area measure to read bits");
 BoolOption g_wide_cue(11, "wide-cue", "Use only wide pulse location to read bits");
+IntOption g_beam(12, "beam", "Byte track beam width, 0 for exhaustive (default 16)", 16);
+BoolOption g_beam_audit(13, "beam-audit", "Compare byte track beam with exhaustive search");
 
 // Sub-options to the dual decoder
 BoolOption g_grid(20, "grid", "Use alteranative bit extractor named Grid");
@@ -82,6 +109,7 @@ static int help(const char *progname)
     fprintf(stderr,"       %s -l/--list    [options] <in.tap/wav>\n",progname);
     fprintf(stderr,"       %s -x/--extract [options] <in.tap/wav>\n",progname);
     fprintf(stderr,"       %s -d/--decode  [options] <in.wav> <out.tap>\n",progname);
+    fprintf(stderr,"       %s -b -l/-x/-d  [options] <dir/manifest>\n",progname);
     fprintf(stderr,"       %s -e/--encode  [options] <in.tap> <out.wav>\n",progname);
     fprintf(stderr,"       %s -p/--play    [options] <in.tap/wav>\n",progname);
     fprintf(stderr,"       %s -r/--record  [options] <out.wav>\n",progname);
@@ -142,100 +170,6 @@ static bool prepare_dest_dir(const char *name, bool verbose)
     return true; // success - directory now exists
 }
 
-//----------------------------------------------------------------------------
-// File name helpers
-//----------------------------------------------------------------------------
-
-// Check if file name can be used for extracted file
-static bool is_valid_file_name(const uint8_t *name)
-{
-    bool is_valid = false;
-    if (name[0]) // Forbid empty filename
-    {
-        is_valid = true;
-
-        // Forbid non-ASCII chars
-        // Forbid Windows illegal chars
-        // 0-31 \ / : * ? " < > | 128-255
-        for (int i= 0; name[i]; i++)
-        {
-            uint8_t c = name[i];
-            if (c<32 || c>127 || c=='\\' || c=='/' || c==':' || c=='*' ||
-                c=='?' || c=='"' || c=='<' || c=='>' || c=='|')
-            {
-                is_valid = false;
-            }
-        }
-
-        // Also forbid names matching our autogenerated names
-        if (name[0] == 'F' &&
-            name[1] == 'I' &&
-            name[2] == 'L' &&
-            name[3] == 'E' &&
-            name[4] == '_' &&
-            name[5] == 'A' &&
-            name[6] == 'T' &&
-            name[7] == '_')
-        {
-            is_valid = false;
-        }
-    }
-    return is_valid;
-}
-
-//----------------------------------------------------------------------------
-
-// Adjust file name from tape so it can be used on disk
-// Add used names to set
-static void adjust_file_name(char *adjusted_name, int bufsize,
-    std::unordered_set<std::string> *used_names,
-    const TapeFile& file, bool add_extension)
-{
-    // Normally 0-15 chars in filename
-    // Tolerate 16 in case terminal null is absent
-
-    // Avoid empty or otherwise problematic names
-    char valid_name[32];
-    assert(strlen((const char *) file.name)<=16);
-    if (is_valid_file_name(file.name))
-        strcpy(valid_name, (const char *) file.name);
-    else
-    {
-        int sec0 = (int) floor(file.start_time);
-        int len = snprintf(valid_name, sizeof(valid_name),
-                 "FILE_AT_%02d_%02d", sec0/60, sec0%60);
-        assert(len < (int) sizeof(valid_name));
-    }
-
-    // If the same file name occurs multiple times,
-    // append -<n> where n makes the file name unique.
-    if (1)
-    {
-        char try_name[44];
-        assert(strlen(valid_name) < sizeof(try_name));
-        strcpy(try_name, valid_name);
-
-        int unique_no = 0;
-        while (used_names->find(try_name) != used_names->end())
-        {
-            unique_no++;
-            int len = snprintf(try_name, sizeof(try_name),
-                "%s-%d", valid_name, unique_no);
-            assert(len < (int) sizeof(try_name));
-        }
-        assert((int) strlen(try_name) < bufsize);
-        strcpy(adjusted_name, try_name);
-        used_names->insert(adjusted_name);
-    }
-
-    // Add .tap extension
-    if (add_extension)
-    {
-        assert((int) strlen(adjusted_name)+4 < bufsize);
-        strcat(adjusted_name, ".tap");
-    }
-}
-
 //----------------------------------------------------------------------------
 // Concatenate opt_dirname and filename into malloced string
 // opt_dirname may be 0
@@ -385,37 +319,7 @@ static void extract_file(TapeDecoder& dec, const TapeFile& file, const char *ext
         printf("\n");
     }
 
-    bool ok = false;
-    if (FILE *f = fopen(full_name, "wb"))
-    {
-        ok = true;
-
-        uint8_t preamble[4] = { 0x16, 0x16, 0x16, 0x24 };
-        if (fwrite(preamble, 1, 4, f) != 4)
-            ok = false;
-
-        if (ok)
-        {
-            if (fwrite(file.header, 1, sizeof(file.header), f) != sizeof(file.header))
-                ok = false;
-        }
-
-        if (ok)
-        {
-            size_t namelen = strlen((const char *) file.name) + 1;
-            if (fwrite(file.name, 1, namelen, f) != namelen)
-                ok = false;
-        }
-
-        if (ok && file.len)
-        {
-            if (fwrite(file.payload, 1, file.len, f) != (size_t) file.len)
-                ok = false;
-        }
-
-        fclose(f);
-    }
-
+    bool ok = write_tap_file(full_name, file);
     if (!ok)
         perror(full_name);
     free(full_name);
@@ -503,6 +407,55 @@ static int decode(const DecoderOptions& options, const char *oname)
     return sync_errors || parity_errors ? 1 : 0;
 }
 
+//----------------------------------------------------------------------------
+// Batch mode
+//----------------------------------------------------------------------------
+
+// Run --list, --extract or --decode over all inputs of a directory or manifest
+// Return command status (0=success)
+static int batch(const DecoderOptions& options)
+{
+    // Output directory, defaulting to the inputs' own for --decode
+    // and to the current directory for --extract
+    if (g_output_dir && !prepare_dest_dir(g_output_dir, g_verbose))
+        exit(1);
+
+    BatchOptions batch_options;
+    batch_options.command = g_list ? BATCH_LIST : g_extract ? BATCH_EXTRACT : BATCH_DECODE;
+    batch_options.segment = g_segment;
+    batch_options.memory = g_memory;
+    batch_options.output_dir = g_output_dir;
+    batch_options.report = g_report;
+    batch_options.verbose = g_verbose;
+
+    BatchRunner runner(options, batch_options);
+    return runner.Run(options.filename);
+}
+
+//----------------------------------------------------------------------------
+// Audio output
+//----------------------------------------------------------------------------
+
+// Split the --buffer time into the player's usual 24 chunks
+static void set_buffering(SoundPlayer *player)
+{
+    const int chunk_cnt = 24;
+    player->SetBuffering(g_buffer*1e-3/chunk_cnt, chunk_cnt);
+}
+
+//----------------------------------------------------------------------------
+
+// Report underruns, or all of the buffering with --verbose
+static void print_player_stats(const PlayerStats& stats)
+{
+    if (stats.underruns || g_verbose)
+        printf("Played with %d underruns, %.3f s of silence inserted, "
+               "buffer low %.0f of %.0f ms, %d refills\n",
+               stats.underruns, stats.underrun_time,
+               stats.min_buffered_time*1e3, stats.buffer_time*1e3,
+               stats.wakeups);
+}
+
 //----------------------------------------------------------------------------
 // Encode command
 //----------------------------------------------------------------------------
@@ -520,7 +473,19 @@ static int encode(const char *iname, const char *opt_oname)
         printf("Playing tape archive %s\n", iname);
 
     TapeEncoder enc;
-    if (enc.Open(opt_oname, slow))
+    enc.SetThreads(!g_no_threads);
+
+    // Play through our own player, to set its buffering
+    SoundPlayer player;
+    bool open_ok;
+    if (opt_oname)
+        open_ok = enc.Open(opt_oname, slow, g_rate);
+    else
+    {
+        set_buffering(&player);
+        open_ok = player.Open(g_rate) && enc.Open(&player, slow, g_rate);
+    }
+    if (open_ok)
     {
         if (!enc.PutFile(iname))
         {
@@ -545,7 +510,11 @@ static int encode(const char *iname, const char *opt_oname)
             printf("\n");
         }
         if (enc.Close())
+        {
+            if (!opt_oname)
+                print_player_stats(player.GetStats());
             return 0; // success
+        }
     }
 
     if (opt_oname)
@@ -569,6 +538,7 @@ static int play(const char *filename)
     {
         // Play .wav as is
         SoundPlayer player;
+        set_buffering(&player);
         player.Play(src);
 
         // Loop while playing to present time progress on stdout
@@ -584,6 +554,7 @@ static int play(const char *filename)
         }
         player.Flush(); // wait the last fraction of second
         printf("\n");
+        print_player_stats(player.GetStats());
         return 0;
     }
 
@@ -602,6 +573,50 @@ static void sigint_handler(int)
     g_broken = true;
 }
 
+// Latest chunk, handed from the capture loop to the meter thread
+struct MeterSlot
+{
+    std::mutex mutex;
+    std::vector<float> chunk;
+    double time = 0;
+    bool fresh = false;
+};
+
+// Print recording time and volume of a chunk
+static void print_meter(const float *chunk, int chunk_len, double time)
+{
+    // Calculate RMS of the window
+    float sum_x = 0, sum_x2 = 0;
+    for (int i=0; i<chunk_len; i++)
+    {
+        auto x = chunk[i];
+        sum_x += x;
+        sum_x2 += x*x;
+    }
+    // sum( (x - a)^2 ) = sum( x2 + a2 - 2xa) = sum(x2) + n*a2 - 2a*sum(x)
+    float a = sum_x/chunk_len; // average
+    float rms = sqrt(sum_x2/chunk_len + a*a - 2*a*sum_x/chunk_len);
+
+    // Display using 20-step log volume scale
+    float rms_low  = 0.001, rms_high = 0.9;
+    int steps = 20;
+    int vol = rms<=rms_low  ? 0 :
+              rms>=rms_high ? steps-1 :
+              floor(0.5 + (steps-1)*log(rms/rms_low)/log(rms_high/rms_low));
+    char indicator[steps+1];
+    for (int i=0; i<steps; i++)
+        indicator[i] = vol>i ? '#': '-';
+    indicator[steps] = 0;
+
+    int secs = floor(time);
+    int mins = secs/60;
+    secs %= 60;
+    printf("\rRecording %02d:%02d |%s|", mins, secs, indicator);
+    fflush(stdout);
+}
+
+//----------------------------------------------------------------------------
+
 // Record from line in or speaker and write .wav file
 // Return command status (0=success)
 static int record(const char *filename)
@@ -616,16 +631,43 @@ static int record(const char *filename)
     SoundRecorder recorder;
     SoundWriter writer;
     bool read_ok = recorder.Open(sample_rate_hz, chunk_len);
-    bool write_ok = writer.Open(filename, sample_rate_hz);
+    bool write_ok = writer.Open(filename, sample_rate_hz, 1,
+                                g_float ? SOUND_FORMAT_FLOAT : SOUND_FORMAT_PCM16);
     recorder.Start();
+    double t_synced = 0;
+    bool ended = false;
 
     printf("Recording %02d:%02d", 0,0);
     fflush(stdout);
 
+    // Metering runs on its own thread, so the terminal can't hold up capture
+    MeterSlot meter;
+    std::atomic<bool> meter_done = false;
+    std::thread meter_thread([&]()
+    {
+        std::vector<float> x;
+        while (!meter_done)
+        {
+            double time = -1;
+            {
+                std::lock_guard<std::mutex> lock(meter.mutex);
+                if (meter.fresh)
+                {
+                    x.swap(meter.chunk);
+                    time = meter.time;
+                    meter.fresh = false;
+                }
+            }
+            if (time >= 0)
+                print_meter(x.data(), (int) x.size(), time);
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    });
+
     // Loop the following operations
     // * Read from SoundRecorder
-    // * Print RMS values
-    // * Write using SoundWriter
+    // * Queue for writing, SoundWriter writes the file on its own thread
+    // * Pass on to metering, skipped if the meter is busy
     while (read_ok && write_ok)
     {
         read_ok = recorder.Read(chunk, chunk_len);
@@ -633,45 +675,50 @@ static int record(const char *filename)
             break;
         double time = recorder.GetElapsedTime();
 
-        // Calculate RMS of the window
-        float sum_x = 0, sum_x2 = 0;
-        for (int i=0; i<chunk_len; i++)
-        {
-            auto x = chunk[i];
-            sum_x += x;
-            sum_x2 += x*x;
-        }
-        // sum( (x - a)^2 ) = sum( x2 + a2 - 2xa) = sum(x2) + n*a2 - 2a*sum(x)
-        float a = sum_x/chunk_len; // average
-        float rms = sqrt(sum_x2/chunk_len + a*a - 2*a*sum_x/chunk_len);
-
-        // Display using 20-step log volume scale
-        float rms_low  = 0.001, rms_high = 0.9;
-        int steps = 20;
-        int vol = rms<=rms_low  ? 0 :
-                  rms>=rms_high ? steps-1 :
-                  floor(0.5 + (steps-1)*log(rms/rms_low)/log(rms_high/rms_low));
-        char indicator[steps+1];
-        for (int i=0; i<steps; i++)
-            indicator[i] = vol>i ? '#': '-';
-        indicator[steps] = 0;
-
-        int secs = floor(time);
-        int mins = secs/60;
-        secs %= 60;
-        printf("\rRecording %02d:%02d |%s|", mins, secs, indicator);
-        fflush(stdout);
-
         if (g_broken)
         {
             recorder.Stop();
             break;
         }
         write_ok = writer.Write(chunk, chunk_len);
+
+        // A virtual device recording from file stops at its end
+        if (!recorder.IsRunning())
+        {
+            ended = true;
+            break;
+        }
+
+        std::unique_lock<std::mutex> lock(meter.mutex, std::try_to_lock);
+        if (lock.owns_lock())
+        {
+            meter.chunk.assign(chunk, chunk+chunk_len);
+            meter.time = time;
+            meter.fresh = true;
+        }
+
+        // Sync to disk now and then, so a crash loses little
+        if (time >= t_synced + 10)
+        {
+            writer.Sync(0); // nonblocking
+            t_synced = time;
+        }
     }
+    meter_done = true;
+    meter_thread.join();
     printf("\n");
 
     delete[] chunk;
+    writer.Close();
+
+    // Account for every sample, so a clean capture can be trusted
+    RecorderStats stats = recorder.GetStats();
+    if (stats.fifo_size)
+        printf("Captured %lld samples, %lld dropped in %d overruns, "
+               "%d device overflows, FIFO peak %d%%\n",
+               (long long) stats.captured, (long long) stats.dropped,
+               stats.overruns, stats.device_overflows,
+               100*stats.max_fill/stats.fifo_size);
 
     if (g_broken)
     {
@@ -679,6 +726,11 @@ static int record(const char *filename)
         g_broken = false;
         return 0; // success
     }
+    else if (ended && write_ok)
+    {
+        printf("Recording ended\n");
+        return 0; // success
+    }
     else if (!read_ok)
     {
         fprintf(stderr,"Error reading audio input\n");
@@ -690,6 +742,44 @@ static int record(const char *filename)
     return 1; // failure
 }
 
+//----------------------------------------------------------------------------
+// Virtual audio device
+//----------------------------------------------------------------------------
+
+// Print a histogram of times, one line per non-empty bin
+static void print_histogram(const char *title, const int64_t *hist)
+{
+    printf("%s:\n", title);
+    for (int k=0; k<VirtualDeviceStats::HIST_BINS; k++)
+    {
+        if (!hist[k])
+            continue;
+        if (k==0)
+            printf("  %9s < 1 us", "");
+        else if (k==VirtualDeviceStats::HIST_BINS-1)
+            printf("  %9d+ us    ", 1<<(k-1));
+        else
+            printf("  %9d-%-9d us", 1<<(k-1), 1<<k);
+        printf("  %lld\n", (long long) hist[k]);
+    }
+}
+
+//----------------------------------------------------------------------------
+
+// Report how the real-time paths kept up with the virtual device
+static void print_virtual_stats()
+{
+    VirtualDeviceStats stats = VirtualDevice::GetTotalStats();
+    printf("Virtual device: %lld callbacks, %d underruns, %d overruns, "
+           "%lld chunks skipped\n",
+           (long long) stats.chunks, stats.underruns, stats.overruns,
+           (long long) stats.skipped_chunks);
+    printf("Max callback time %.3f ms, max lateness %.3f ms\n",
+           stats.max_callback_time*1e3, stats.max_lateness*1e3);
+    print_histogram("Callback time", stats.callback_hist);
+    print_histogram("Lateness", stats.lateness_hist);
+}
+
 //----------------------------------------------------------------------------
 // main
 //----------------------------------------------------------------------------
@@ -733,9 +823,22 @@ int main(int argc, char **argv)
         illegal_options = true;
     }
 
+    if (g_batch && !g_list && !g_extract && !g_decode)
+    {
+        fprintf(stderr, "Error: --batch needs --list, --extract or --decode\n");
+        illegal_options = true;
+    }
+
+    if (g_memory <= 0 || g_segment < 0)
+    {
+        fprintf(stderr, "Error: Non-positive --memory or negative --segment\n");
+        illegal_options = true;
+    }
+
     int filename_cnt_expected =
         g_help   ? 0 :
         g_version? 0 :
+        g_batch  ? 1 :
         g_decode ? 2 :
         g_encode ? 2 :
                    1;
@@ -748,9 +851,37 @@ int main(int argc, char **argv)
         illegal_options = true;
     }
 
-    if (g_output_dir && !g_extract)
+    if (g_output_dir && !g_extract && !(g_batch && g_decode))
         fprintf(stderr, "Warning: Option --output-dir/-O has no effect without --extract/-x\n");
 
+    if (g_dump && g_batch)
+        fprintf(stderr, "Warning: Option --dump/-D has no effect with --batch/-b\n");
+
+    if ((g_jitter || g_stall) && !g_virtual_audio)
+        fprintf(stderr, "Warning: Options --jitter and --stall have no effect without --virtual-audio\n");
+
+    if (g_jitter < 0 || g_stall < 0)
+    {
+        fprintf(stderr, "Error: Negative --jitter or --stall\n");
+        illegal_options = true;
+    }
+
+    if (g_buffer != 3000 && !g_play)
+        fprintf(stderr, "Warning: Option --buffer has no effect without --play/-p\n");
+
+    if (g_buffer < 20 || g_buffer > 60000)
+    {
+        fprintf(stderr, "Error: --buffer must be from 20 to 60000 ms\n");
+        illegal_options = true;
+    }
+
+    if (g_rate < 2*SWITCH_RATE || g_rate > ENCODER_MAX_RATE)
+    {
+        fprintf(stderr, "Error: --rate must be from %d to %d Hz\n",
+                2*SWITCH_RATE, ENCODER_MAX_RATE);
+        illegal_options = true;
+    }
+
     DecoderOptions options;
     options.filename = filename0;
     options.dump = g_dump;
@@ -761,6 +892,13 @@ int main(int argc, char **argv)
     options.fast = g_fast;
     options.slow = g_slow;
     options.dual = g_dual;
+    options.skip = !g_no_skip;
+    options.survey = !g_no_survey;
+    options.decimate = !g_no_decimate;
+    options.threads = !g_no_threads;
+    options.split_channels = g_split_channels;
+    options.beam = g_beam;
+    options.beam_audit = g_beam_audit;
     options.band = g_low_band  ? BAND_LOW :
                    g_high_band ? BAND_HIGH :
                    BAND_DUAL;
@@ -786,6 +924,9 @@ int main(int argc, char **argv)
     if (g_version)
         return version();
 
+    if (g_batch)
+        return batch(options);
+
     if (g_list)
         return list(options);
 
@@ -798,11 +939,26 @@ int main(int argc, char **argv)
     if (g_encode)
         return encode(filename0, filename1);
 
-    if (g_play)
-        return play(filename0);
+    if (g_virtual_audio)
+    {
+        const char *path = g_virtual_audio;
+        bool null_device = strcmp(path, "null") == 0;
+        VirtualDeviceConfig config;
+        config.play_path = null_device ? 0 : path;
+        config.record_path = null_device ? 0 : path;
+        config.jitter = g_jitter*1e-6;
+        config.stall_time = g_stall*1e-3;
+        config.stall_rate = g_stall ? 1 : 0;
+        VirtualDevice::Select(&config);
+    }
 
-    if (g_record)
-        return record(filename0);
+    if (g_play || g_record)
+    {
+        int status = g_play ? play(filename0) : record(filename0);
+        if (g_virtual_audio)
+            print_virtual_stats();
+        return status;
+    }
 
     return 1; // should not come here
 }